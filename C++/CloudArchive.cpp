@@ -0,0 +1,592 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudArchive.cpp
+//
+// Synopsis:  Implements the compressed cloud archive.
+//
+//            Each block holds the delta of the quantized coordinates of its
+//            points in Morton order, mapped to unsigned values by zigzag coding
+//            and split in byte planes. Each byte plane is a stream compressed
+//            with a static order-0 rANS coder, or stored when it does not
+//            compress.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "CloudArchive.h"
+#include "Morton.h"
+#include "ParallelFor.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static const char       ARCHIVE_MAGIC[4]  = { 'S', '3', 'D', 'Z' };
+static const MIL_UINT32 ARCHIVE_VERSION   = 1;
+static const MIL_INT    ARCHIVE_ALIGNMENT = 8;
+
+// Number of points of a block.
+static const MIL_UINT32 ARCHIVE_BLOCK_SIZE = 65536;
+
+// Largest quantized coordinate.
+static const MIL_DOUBLE ARCHIVE_MAX_QUANTIZED = 4294967295.0;
+
+// Encoding of a stream.
+enum
+   {
+   eStreamStored = 0,
+   eStreamRans   = 1
+   };
+
+// rANS coder parameters: the frequencies sum to 2^RANS_PROB_BITS and the
+// state is renormalized by bytes in [RANS_LOWER_BOUND, 256 * RANS_LOWER_BOUND).
+static const MIL_UINT32 RANS_PROB_BITS   = 12;
+static const MIL_UINT32 RANS_PROB_SCALE  = 1 << RANS_PROB_BITS;
+static const MIL_UINT32 RANS_LOWER_BOUND = 1 << 23;
+
+//--------------------------------------------------------------------------
+// Maps a signed delta to an unsigned value, small magnitudes first.
+//--------------------------------------------------------------------------
+static inline MIL_UINT32 ZigZagEncode(MIL_UINT32 Delta)
+   {
+   return (Delta << 1) ^ (MIL_UINT32)((MIL_INT32)Delta >> 31);
+   }
+
+static inline MIL_UINT32 ZigZagDecode(MIL_UINT32 Value)
+   {
+   return (Value >> 1) ^ (0 - (Value & 1));
+   }
+
+//--------------------------------------------------------------------------
+// Appends a value to a byte vector.
+//--------------------------------------------------------------------------
+template <class T>
+static void AppendValue(std::vector<MIL_UINT8>* pBuffer, T Value)
+   {
+   const MIL_UINT8* pValue = (const MIL_UINT8*)&Value;
+   pBuffer->insert(pBuffer->end(), pValue, pValue + sizeof(T));
+   }
+
+//--------------------------------------------------------------------------
+// Scales the symbol counts to frequencies summing to RANS_PROB_SCALE, each
+// present symbol keeping a frequency of at least 1.
+//--------------------------------------------------------------------------
+static void NormalizeFrequencies(const MIL_UINT32* pCounts, MIL_INT NbSymbols, MIL_UINT32* pFrequencies)
+   {
+   MIL_INT Sum = 0;
+   MIL_INT MostFrequent = 0;
+   for(MIL_INT s = 0; s < 256; s++)
+      {
+      pFrequencies[s] = 0;
+      if(pCounts[s] == 0)
+         continue;
+      pFrequencies[s] = (MIL_UINT32)(((MIL_UINT64)pCounts[s] * RANS_PROB_SCALE) / (MIL_UINT64)NbSymbols);
+      if(pFrequencies[s] == 0)
+         pFrequencies[s] = 1;
+      Sum += pFrequencies[s];
+      if(pCounts[s] > pCounts[MostFrequent])
+         MostFrequent = s;
+      }
+
+   // Give the rounding error to the most frequent symbol, or take it from the
+   // largest frequencies.
+   if(Sum < (MIL_INT)RANS_PROB_SCALE)
+      pFrequencies[MostFrequent] += (MIL_UINT32)((MIL_INT)RANS_PROB_SCALE - Sum);
+   while(Sum > (MIL_INT)RANS_PROB_SCALE)
+      {
+      MIL_INT Largest = 0;
+      for(MIL_INT s = 1; s < 256; s++)
+         {
+         if(pFrequencies[s] > pFrequencies[Largest])
+            Largest = s;
+         }
+      pFrequencies[Largest]--;
+      Sum--;
+      }
+   }
+
+//--------------------------------------------------------------------------
+// Appends a byte stream, compressed with rANS when it is smaller.
+//--------------------------------------------------------------------------
+static void EncodeStream(const MIL_UINT8* pSymbols, MIL_INT NbSymbols, std::vector<MIL_UINT8>* pBuffer)
+   {
+   MIL_UINT32 Counts[256] = { 0 };
+   for(MIL_INT i = 0; i < NbSymbols; i++)
+      Counts[pSymbols[i]]++;
+
+   MIL_UINT32 Frequencies[256];
+   MIL_UINT32 Starts[256];
+   NormalizeFrequencies(Counts, NbSymbols, Frequencies);
+   MIL_UINT32 Start = 0;
+   for(MIL_INT s = 0; s < 256; s++)
+      {
+      Starts[s] = Start;
+      Start += Frequencies[s];
+      }
+
+   // Table: the presence bit of each symbol followed by the frequencies of the present symbols.
+   std::vector<MIL_UINT8> Encoded(32, 0);
+   for(MIL_INT s = 0; s < 256; s++)
+      {
+      if(Frequencies[s])
+         {
+         Encoded[(size_t)(s / 8)] |= (MIL_UINT8)(1 << (s % 8));
+         AppendValue(&Encoded, (MIL_UINT16)Frequencies[s]);
+         }
+      }
+
+   // Encode the symbols backward so that the decoder reads them forward. A symbol
+   // produces at most two bytes.
+   std::vector<MIL_UINT8> Code((size_t)(2 * NbSymbols + 4));
+   MIL_UINT8* pCode = &Code[0] + Code.size();
+   MIL_UINT32 State = RANS_LOWER_BOUND;
+   for(MIL_INT i = NbSymbols - 1; i >= 0; i--)
+      {
+      const MIL_UINT32 Frequency = Frequencies[pSymbols[i]];
+      const MIL_UINT32 StateMax  = ((RANS_LOWER_BOUND >> RANS_PROB_BITS) << 8) * Frequency;
+      while(State >= StateMax)
+         {
+         *--pCode = (MIL_UINT8)(State & 0xFF);
+         State >>= 8;
+         }
+      State = ((State / Frequency) << RANS_PROB_BITS) + (State % Frequency) + Starts[pSymbols[i]];
+      }
+   pCode -= 4;
+   memcpy(pCode, &State, sizeof(State));
+   Encoded.insert(Encoded.end(), pCode, &Code[0] + Code.size());
+
+   if((MIL_INT)Encoded.size() < NbSymbols)
+      {
+      pBuffer->push_back((MIL_UINT8)eStreamRans);
+      AppendValue(pBuffer, (MIL_UINT32)Encoded.size());
+      pBuffer->insert(pBuffer->end(), Encoded.begin(), Encoded.end());
+      }
+   else
+      {
+      pBuffer->push_back((MIL_UINT8)eStreamStored);
+      AppendValue(pBuffer, (MIL_UINT32)NbSymbols);
+      pBuffer->insert(pBuffer->end(), pSymbols, pSymbols + NbSymbols);
+      }
+   }
+
+//--------------------------------------------------------------------------
+// Decodes a byte stream. Returns the end of the stream, or M_NULL if it is
+// malformed.
+//--------------------------------------------------------------------------
+static const MIL_UINT8* DecodeStream(const MIL_UINT8* pStream, const MIL_UINT8* pEnd,
+                                     MIL_UINT8* pSymbols, MIL_INT NbSymbols)
+   {
+   if(pEnd - pStream < 5)
+      return M_NULL;
+   const MIL_UINT8 Mode = pStream[0];
+   MIL_UINT32 Size;
+   memcpy(&Size, pStream + 1, sizeof(Size));
+   pStream += 5;
+   if((MIL_INT)Size > pEnd - pStream)
+      return M_NULL;
+   const MIL_UINT8* pStreamEnd = pStream + Size;
+
+   if(Mode == eStreamStored)
+      {
+      if((MIL_INT)Size != NbSymbols)
+         return M_NULL;
+      memcpy(pSymbols, pStream, (size_t)NbSymbols);
+      return pStreamEnd;
+      }
+   if(Mode != eStreamRans || Size < 32)
+      return M_NULL;
+
+   // Read the frequency table and build the slot to symbol table.
+   MIL_UINT32 Frequencies[256];
+   MIL_UINT32 Starts[256];
+   MIL_UINT8  SlotSymbols[RANS_PROB_SCALE];
+   const MIL_UINT8* pPresence = pStream;
+   pStream += 32;
+   MIL_UINT32 Start = 0;
+   for(MIL_INT s = 0; s < 256; s++)
+      {
+      Frequencies[s] = 0;
+      if(pPresence[s / 8] & (1 << (s % 8)))
+         {
+         MIL_UINT16 Frequency;
+         if(pStreamEnd - pStream < (MIL_INT)sizeof(Frequency))
+            return M_NULL;
+         memcpy(&Frequency, pStream, sizeof(Frequency));
+         pStream += sizeof(Frequency);
+         Frequencies[s] = Frequency;
+         }
+      Starts[s] = Start;
+      if(Start + Frequencies[s] > RANS_PROB_SCALE)
+         return M_NULL;
+      memset(SlotSymbols + Start, (int)s, Frequencies[s]);
+      Start += Frequencies[s];
+      }
+   if(Start != RANS_PROB_SCALE || pStreamEnd - pStream < 4)
+      return M_NULL;
+
+   // A stream of a single symbol, like the high byte planes of small deltas, holds no information.
+   if(Frequencies[SlotSymbols[0]] == RANS_PROB_SCALE)
+      {
+      memset(pSymbols, SlotSymbols[0], (size_t)NbSymbols);
+      return pStreamEnd;
+      }
+
+   MIL_UINT32 State;
+   memcpy(&State, pStream, sizeof(State));
+   pStream += sizeof(State);
+   for(MIL_INT i = 0; i < NbSymbols; i++)
+      {
+      const MIL_UINT32 Slot   = State & (RANS_PROB_SCALE - 1);
+      const MIL_UINT8  Symbol = SlotSymbols[Slot];
+      pSymbols[i] = Symbol;
+      State = Frequencies[Symbol] * (State >> RANS_PROB_BITS) + Slot - Starts[Symbol];
+      while(State < RANS_LOWER_BOUND && pStream < pStreamEnd)
+         State = (State << 8) | *pStream++;
+      }
+   return pStreamEnd;
+   }
+
+//--------------------------------------------------------------------------
+// Appends the byte planes of values.
+//--------------------------------------------------------------------------
+static void EncodePlanes(const std::vector<MIL_UINT32>& Values, MIL_INT NbPlanes,
+                         std::vector<MIL_UINT8>* pPlane, std::vector<MIL_UINT8>* pBuffer)
+   {
+   for(MIL_INT p = 0; p < NbPlanes; p++)
+      {
+      for(size_t i = 0; i < Values.size(); i++)
+         (*pPlane)[i] = (MIL_UINT8)(Values[i] >> (8 * p));
+      EncodeStream(&(*pPlane)[0], (MIL_INT)Values.size(), pBuffer);
+      }
+   }
+
+//--------------------------------------------------------------------------
+// Decodes the byte planes of values. Returns the end of the planes, or
+// M_NULL if they are malformed.
+//--------------------------------------------------------------------------
+static const MIL_UINT8* DecodePlanes(const MIL_UINT8* pStream, const MIL_UINT8* pEnd, MIL_INT NbPlanes,
+                                     std::vector<MIL_UINT8>* pPlane, std::vector<MIL_UINT32>* pValues)
+   {
+   std::fill(pValues->begin(), pValues->end(), 0);
+   for(MIL_INT p = 0; p < NbPlanes && pStream; p++)
+      {
+      pStream = DecodeStream(pStream, pEnd, &(*pPlane)[0], (MIL_INT)pValues->size());
+      if(pStream)
+         {
+         for(size_t i = 0; i < pValues->size(); i++)
+            (*pValues)[i] |= (MIL_UINT32)(*pPlane)[i] << (8 * p);
+         }
+      }
+   return pStream;
+   }
+
+//--------------------------------------------------------------------------
+CCloudArchiveReader::CCloudArchiveReader()
+   : m_pBlocks(M_NULL)
+   {
+   memset(&m_Header, 0, sizeof(m_Header));
+   }
+
+//--------------------------------------------------------------------------
+bool CCloudArchiveReader::Open(MIL_CONST_TEXT_PTR FileName)
+   {
+   m_pBlocks = M_NULL;
+   if(!m_File.Open(FileName) || m_File.Size() < (MIL_INT)sizeof(SCloudArchiveHeader))
+      return false;
+
+   memcpy(&m_Header, m_File.Data(), sizeof(m_Header));
+   if(memcmp(m_Header.Magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 ||
+      m_Header.Version   != ARCHIVE_VERSION ||
+      m_Header.BlockSize == 0 ||
+      m_Header.NbPoints  <= 0 ||
+      m_Header.NbBlocks  != (m_Header.NbPoints + m_Header.BlockSize - 1) / m_Header.BlockSize ||
+      m_Header.IndexOffset % ARCHIVE_ALIGNMENT != 0 ||
+      m_Header.IndexOffset < (MIL_INT64)sizeof(m_Header) ||
+      m_Header.IndexOffset + m_Header.NbBlocks * (MIL_INT64)sizeof(SCloudArchiveBlock) > m_File.Size())
+      return false;
+
+   m_pBlocks = (const SCloudArchiveBlock*)(m_File.Data() + m_Header.IndexOffset);
+   for(MIL_INT b = 0; b < NbBlocks(); b++)
+      {
+      if(m_pBlocks[b].Offset < (MIL_INT64)sizeof(m_Header) ||
+         m_pBlocks[b].Size < 0 ||
+         m_pBlocks[b].Offset + m_pBlocks[b].Size > m_Header.IndexOffset)
+         {
+         m_pBlocks = M_NULL;
+         return false;
+         }
+      }
+   return true;
+   }
+
+//--------------------------------------------------------------------------
+MIL_INT CCloudArchiveReader::BlockFirstPoint(MIL_INT BlockIndex) const
+   {
+   return BlockIndex * (MIL_INT)m_Header.BlockSize;
+   }
+
+//--------------------------------------------------------------------------
+MIL_INT CCloudArchiveReader::BlockNbPoints(MIL_INT BlockIndex) const
+   {
+   const MIL_INT Remaining = (MIL_INT)m_Header.NbPoints - BlockFirstPoint(BlockIndex);
+   return Remaining < (MIL_INT)m_Header.BlockSize ? Remaining : (MIL_INT)m_Header.BlockSize;
+   }
+
+//--------------------------------------------------------------------------
+bool CCloudArchiveReader::DecodeBlock(MIL_INT BlockIndex, const SCloudView& View) const
+   {
+   const MIL_INT    FirstPoint = BlockFirstPoint(BlockIndex);
+   const MIL_INT    NbPoints   = BlockNbPoints(BlockIndex);
+   const MIL_UINT8* pStream    = m_File.Data() + m_pBlocks[BlockIndex].Offset;
+   const MIL_UINT8* pEnd       = pStream + m_pBlocks[BlockIndex].Size;
+
+   std::vector<MIL_UINT32> Values((size_t)NbPoints);
+   std::vector<MIL_UINT8>  Plane((size_t)NbPoints);
+
+   // Coordinates.
+   MIL_FLOAT* const pCoordinates[3] = { View.X, View.Y, View.Z };
+   for(MIL_INT a = 0; a < 3 && pStream; a++)
+      {
+      pStream = DecodePlanes(pStream, pEnd, 4, &Plane, &Values);
+      if(!pStream)
+         break;
+
+      MIL_FLOAT*       pCoordinate = pCoordinates[a] + FirstPoint;
+      const MIL_DOUBLE Origin      = m_Header.Min[a];
+      MIL_UINT32       Quantized   = 0;
+      for(MIL_INT i = 0; i < NbPoints; i++)
+         {
+         Quantized += ZigZagDecode(Values[(size_t)i]);
+         pCoordinate[i] = (MIL_FLOAT)(Origin + Quantized * m_Header.Precision);
+         }
+      }
+
+   // Reflectance.
+   if(pStream && (m_Header.Flags & eArchiveIntensity))
+      {
+      pStream = DecodePlanes(pStream, pEnd, 2, &Plane, &Values);
+      if(pStream && View.Intensity)
+         {
+         MIL_UINT16 Intensity = 0;
+         for(MIL_INT i = 0; i < NbPoints; i++)
+            {
+            Intensity = (MIL_UINT16)(Intensity + ZigZagDecode(Values[(size_t)i]));
+            View.Intensity[FirstPoint + i] = Intensity;
+            }
+         }
+      }
+   else if(pStream && (m_Header.Flags & eArchiveColor))
+      {
+      for(MIL_INT b = 0; b < 3 && pStream; b++)
+         {
+         pStream = DecodePlanes(pStream, pEnd, 1, &Plane, &Values);
+         if(pStream && View.Color[b])
+            {
+            MIL_UINT8 Color = 0;
+            for(MIL_INT i = 0; i < NbPoints; i++)
+               {
+               Color = (MIL_UINT8)(Color + ZigZagDecode(Values[(size_t)i]));
+               View.Color[b][FirstPoint + i] = Color;
+               }
+            }
+         }
+      }
+
+   return pStream != M_NULL;
+   }
+
+//--------------------------------------------------------------------------
+bool SaveCloudArchive(MIL_CONST_TEXT_PTR FileName, const SCloudView& View, const SCloudStats& Stats,
+                      MIL_DOUBLE Precision)
+   {
+   if(Stats.NbPoints <= 0 || !(Precision > 0.0))
+      return false;
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      if((Stats.Max[a] - Stats.Min[a]) / Precision >= ARCHIVE_MAX_QUANTIZED)
+         return false;
+      }
+
+   // Sort the valid points along the Morton curve.
+   std::vector<MIL_UINT32> Order;
+   ComputeMortonOrder(View, Stats, &Order);
+
+   SCloudArchiveHeader Header;
+   memcpy(Header.Magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+   Header.Version   = ARCHIVE_VERSION;
+   Header.Flags     = View.Color[0] ? eArchiveColor : (View.Intensity ? eArchiveIntensity : 0);
+   Header.BlockSize = ARCHIVE_BLOCK_SIZE;
+   Header.NbPoints  = (MIL_INT64)Order.size();
+   Header.NbBlocks  = (Header.NbPoints + ARCHIVE_BLOCK_SIZE - 1) / ARCHIVE_BLOCK_SIZE;
+   Header.Precision = Precision;
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      Header.Min[a]      = Stats.Min[a];
+      Header.Max[a]      = Stats.Max[a];
+      Header.Centroid[a] = Stats.Centroid[a];
+      }
+
+   // Encode the blocks in parallel.
+   const MIL_INT NbBlocks = (MIL_INT)Header.NbBlocks;
+   std::vector< std::vector<MIL_UINT8> > Blocks((size_t)NbBlocks);
+   std::vector<SCloudArchiveBlock>       Index((size_t)NbBlocks);
+   ParallelChunks(0, NbBlocks, GetNbChunks(NbBlocks, 1), [&](MIL_INT, MIL_INT BlockBegin, MIL_INT BlockEnd)
+      {
+      std::vector<MIL_UINT32> Values;
+      std::vector<MIL_UINT8>  Plane;
+      for(MIL_INT b = BlockBegin; b < BlockEnd; b++)
+         {
+         const MIL_INT     FirstPoint = b * ARCHIVE_BLOCK_SIZE;
+         const MIL_INT     NbPoints   = (MIL_INT)Order.size() - FirstPoint < (MIL_INT)ARCHIVE_BLOCK_SIZE ?
+                                        (MIL_INT)Order.size() - FirstPoint : (MIL_INT)ARCHIVE_BLOCK_SIZE;
+         const MIL_UINT32* pOrder     = &Order[(size_t)FirstPoint];
+         std::vector<MIL_UINT8>& Buffer = Blocks[(size_t)b];
+         Values.resize((size_t)NbPoints);
+         Plane.resize((size_t)NbPoints);
+
+         // Coordinates.
+         const MIL_FLOAT* const pCoordinates[3] = { View.X, View.Y, View.Z };
+         for(MIL_INT a = 0; a < 3; a++)
+            {
+            const MIL_FLOAT* pCoordinate = pCoordinates[a];
+            const MIL_DOUBLE InvPrecision = 1.0 / Precision;
+            MIL_UINT32 Previous = 0;
+            MIL_UINT32 Min      = 0xFFFFFFFF;
+            MIL_UINT32 Max      = 0;
+            for(MIL_INT i = 0; i < NbPoints; i++)
+               {
+               MIL_DOUBLE Value = (pCoordinate[pOrder[i]] - Stats.Min[a]) * InvPrecision + 0.5;
+               if(!(Value > 0.0))
+                  Value = 0.0;
+               else if(Value > ARCHIVE_MAX_QUANTIZED)
+                  Value = ARCHIVE_MAX_QUANTIZED;
+               const MIL_UINT32 Quantized = (MIL_UINT32)Value;
+               Values[(size_t)i] = ZigZagEncode(Quantized - Previous);
+               Previous = Quantized;
+               if(Quantized < Min) Min = Quantized;
+               if(Quantized > Max) Max = Quantized;
+               }
+            Index[(size_t)b].Min[a] = Stats.Min[a] + Min * Precision;
+            Index[(size_t)b].Max[a] = Stats.Min[a] + Max * Precision;
+            EncodePlanes(Values, 4, &Plane, &Buffer);
+            }
+
+         // Reflectance.
+         if(Header.Flags & eArchiveIntensity)
+            {
+            MIL_UINT16 Previous = 0;
+            for(MIL_INT i = 0; i < NbPoints; i++)
+               {
+               const MIL_UINT16 Intensity = View.Intensity[pOrder[i]];
+               Values[(size_t)i] = ZigZagEncode((MIL_UINT32)(MIL_INT32)(MIL_INT16)(MIL_UINT16)(Intensity - Previous)) & 0xFFFF;
+               Previous = Intensity;
+               }
+            EncodePlanes(Values, 2, &Plane, &Buffer);
+            }
+         else if(Header.Flags & eArchiveColor)
+            {
+            for(MIL_INT c = 0; c < 3; c++)
+               {
+               MIL_UINT8 Previous = 0;
+               for(MIL_INT i = 0; i < NbPoints; i++)
+                  {
+                  const MIL_UINT8 Color = View.Color[c][pOrder[i]];
+                  Values[(size_t)i] = ZigZagEncode((MIL_UINT32)(MIL_INT32)(MIL_INT8)(MIL_UINT8)(Color - Previous)) & 0xFF;
+                  Previous = Color;
+                  }
+               EncodePlanes(Values, 1, &Plane, &Buffer);
+               }
+            }
+         }
+      });
+
+   // Locate the blocks and the index in the file.
+   MIL_INT64 Offset = (MIL_INT64)sizeof(Header);
+   for(MIL_INT b = 0; b < NbBlocks; b++)
+      {
+      Index[(size_t)b].Offset = Offset;
+      Index[(size_t)b].Size   = (MIL_INT64)Blocks[(size_t)b].size();
+      Offset += Index[(size_t)b].Size;
+      }
+   const MIL_INT64 PaddingSize = (ARCHIVE_ALIGNMENT - Offset % ARCHIVE_ALIGNMENT) % ARCHIVE_ALIGNMENT;
+   Header.IndexOffset = Offset + PaddingSize;
+
+   FILE* pFile = MosFopen(FileName, MIL_TEXT("wb"));
+   if(!pFile)
+      return false;
+
+   static const char PADDING[ARCHIVE_ALIGNMENT] = { 0 };
+   bool Success = fwrite(&Header, sizeof(Header), 1, pFile) == 1;
+   for(MIL_INT b = 0; b < NbBlocks && Success; b++)
+      {
+      const std::vector<MIL_UINT8>& Block = Blocks[(size_t)b];
+      Success = fwrite(&Block[0], 1, Block.size(), pFile) == Block.size();
+      }
+   Success = Success && fwrite(PADDING, 1, (size_t)PaddingSize, pFile) == (size_t)PaddingSize;
+   Success = Success && fwrite(&Index[0], sizeof(SCloudArchiveBlock), Index.size(), pFile) == Index.size();
+   Success = (fclose(pFile) == 0) && Success;
+
+   if(!Success)
+      MappFileOperation(M_DEFAULT, FileName, M_NULL, M_NULL, M_FILE_DELETE, M_DEFAULT, M_NULL);
+   return Success;
+   }
+
+//--------------------------------------------------------------------------
+MIL_UNIQUE_BUF_ID LoadCloudArchive(MIL_ID MilSystem, MIL_CONST_TEXT_PTR FileName, MIL_INT Components,
+                                   SCloudStats* pStats, CMultiBoxCrop* pCrop)
+   {
+   CCloudArchiveReader Reader;
+   if(!Reader.Open(FileName))
+      return MIL_UNIQUE_BUF_ID();
+
+   const SCloudArchiveHeader& Header = Reader.Header();
+   MIL_INT LoadedComponents = eComponentRange;
+   if(Components & eComponentReflectance)
+      {
+      if(Header.Flags & eArchiveIntensity)
+         LoadedComponents |= eComponentReflectance;
+      else if(Header.Flags & eArchiveColor)
+         LoadedComponents |= eComponentColor;
+      }
+
+   SCloudView View;
+   MIL_UNIQUE_BUF_ID MilContainer = AllocPointCloudContainer(MilSystem, (MIL_INT)Header.NbPoints, LoadedComponents, &View);
+
+   // Decode the blocks in parallel, testing the points of a block against the
+   // crop boxes right after it is decoded.
+   const MIL_INT NbChunks = GetNbChunks(Reader.NbBlocks(), 1);
+   std::vector<MIL_UINT8> ChunkFailed((size_t)NbChunks, 0);
+   if(pCrop)
+      pCrop->Reset(NbChunks);
+   ParallelChunks(0, Reader.NbBlocks(), NbChunks, [&](MIL_INT Chunk, MIL_INT BlockBegin, MIL_INT BlockEnd)
+      {
+      for(MIL_INT b = BlockBegin; b < BlockEnd; b++)
+         {
+         if(!Reader.DecodeBlock(b, View))
+            {
+            ChunkFailed[(size_t)Chunk] = 1;
+            return;
+            }
+         if(pCrop)
+            {
+            const MIL_INT FirstPoint = Reader.BlockFirstPoint(b);
+            pCrop->AddPoints(Chunk, View.X + FirstPoint, View.Y + FirstPoint, View.Z + FirstPoint, M_NULL,
+                             Reader.BlockNbPoints(b));
+            }
+         }
+      });
+
+   for(MIL_INT c = 0; c < NbChunks; c++)
+      {
+      if(ChunkFailed[(size_t)c])
+         return MIL_UNIQUE_BUF_ID();
+      }
+
+   pStats->NbPoints = (MIL_INT)Header.NbPoints;
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      pStats->Min[a]      = Header.Min[a];
+      pStats->Max[a]      = Header.Max[a];
+      pStats->Centroid[a] = Header.Centroid[a];
+      }
+   return MilContainer;
+   }
@@ -0,0 +1,103 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudArchive.h
+//
+// Synopsis:  Declares the compressed cloud archive. The points are sorted along
+//            the Morton curve, quantized, delta coded and entropy coded in
+//            independent blocks that are encoded and decoded in parallel and
+//            located through a block index for random access.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include "MappedFile.h"
+#include "PointCloudData.h"
+#include "CloudCrop.h"
+
+// Optional content of an archive file.
+enum
+   {
+   eArchiveIntensity = 0x1,
+   eArchiveColor     = 0x2
+   };
+
+// Default quantization step of the archived coordinates, in mm.
+static const MIL_DOUBLE ARCHIVE_DEFAULT_PRECISION = 0.001;
+
+//-------------------------------------------------------------------------------
+// Header of an archive file. It is followed by the encoded blocks and by the
+// block index, an array of NbBlocks SCloudArchiveBlock at IndexOffset. The
+// coordinates are quantized with the step Precision from the origin Min.
+//-------------------------------------------------------------------------------
+struct SCloudArchiveHeader
+   {
+   char       Magic[4];
+   MIL_UINT32 Version;
+   MIL_UINT32 Flags;
+   MIL_UINT32 BlockSize;     // Points per block; the last block can be smaller.
+   MIL_INT64  NbPoints;
+   MIL_INT64  NbBlocks;
+   MIL_INT64  IndexOffset;
+   MIL_DOUBLE Precision;
+   MIL_DOUBLE Min[3];
+   MIL_DOUBLE Max[3];
+   MIL_DOUBLE Centroid[3];
+   };
+
+//-------------------------------------------------------------------------------
+// Entry of the block index: location of the block in the file and bounding
+// box of its points.
+//-------------------------------------------------------------------------------
+struct SCloudArchiveBlock
+   {
+   MIL_INT64  Offset;
+   MIL_INT64  Size;
+   MIL_DOUBLE Min[3];
+   MIL_DOUBLE Max[3];
+   };
+
+//-------------------------------------------------------------------------------
+// Read access to the blocks of an archive file.
+//-------------------------------------------------------------------------------
+class CCloudArchiveReader
+   {
+   public:
+      CCloudArchiveReader();
+
+      // Maps an archive file and validates its header and block index.
+      bool Open(MIL_CONST_TEXT_PTR FileName);
+
+      const SCloudArchiveHeader& Header() const { return m_Header; }
+      MIL_INT                    NbBlocks() const { return (MIL_INT)m_Header.NbBlocks; }
+      const SCloudArchiveBlock&  Block(MIL_INT BlockIndex) const { return m_pBlocks[BlockIndex]; }
+
+      // Returns the index of the first point of a block and its number of points.
+      MIL_INT BlockFirstPoint(MIL_INT BlockIndex) const;
+      MIL_INT BlockNbPoints(MIL_INT BlockIndex) const;
+
+      // Decodes the points of a block at their position in the view. The
+      // reflectance is decoded only if the view has the archived one.
+      bool DecodeBlock(MIL_INT BlockIndex, const SCloudView& View) const;
+
+   private:
+      CMappedFile               m_File;
+      SCloudArchiveHeader       m_Header;
+      const SCloudArchiveBlock* m_pBlocks;
+   };
+
+// Writes the valid points of a point cloud in an archive file, with the
+// 16-bit intensity or the 8-bit RGB reflectance. The coordinates are
+// quantized with the given step in the bounding box of the statistics.
+bool SaveCloudArchive(MIL_CONST_TEXT_PTR FileName, const SCloudView& View, const SCloudStats& Stats,
+                      MIL_DOUBLE Precision);
+
+// Restores a point cloud from an archive file, decoding the blocks in
+// parallel. The points are in Morton order. The reflectance is decoded when
+// Components holds eComponentReflectance. Returns an empty identifier if the
+// file is not a valid archive. When pCrop is not M_NULL, the points are also
+// tested against its boxes while the blocks are decoded.
+MIL_UNIQUE_BUF_ID LoadCloudArchive(MIL_ID MilSystem, MIL_CONST_TEXT_PTR FileName, MIL_INT Components,
+                                   SCloudStats* pStats, CMultiBoxCrop* pCrop);
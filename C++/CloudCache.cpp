@@ -0,0 +1,251 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudCache.cpp
+//
+// Synopsis:  Implements the binary cloud cache.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "CloudCache.h"
+#include "MappedFile.h"
+#include "ParallelFor.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static const char       CACHE_MAGIC[4]  = { 'S', '3', 'D', 'C' };
+static const MIL_UINT32 CACHE_VERSION   = 2;
+static const MIL_INT    CACHE_ALIGNMENT = 8;
+
+// Minimum number of points copied by a worker thread.
+static const MIL_INT CACHE_COPY_CHUNK_SIZE = 65536;
+
+//--------------------------------------------------------------------------
+// Returns the size of an array in the cache file, padding included.
+//--------------------------------------------------------------------------
+static MIL_INT PaddedSize(MIL_INT Size)
+   {
+   return (Size + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+   }
+
+//--------------------------------------------------------------------------
+// Writes an array of the valid points followed by its padding.
+//--------------------------------------------------------------------------
+template <class T>
+static bool WriteArray(FILE* pFile, const T* pArray, const std::vector<MIL_INT>& ValidIndices, MIL_INT NbPoints)
+   {
+   bool Success;
+   if(ValidIndices.empty())
+      Success = fwrite(pArray, sizeof(T), (size_t)NbPoints, pFile) == (size_t)NbPoints;
+   else
+      {
+      std::vector<T> Compacted(ValidIndices.size());
+      for(size_t i = 0; i < ValidIndices.size(); i++)
+         Compacted[i] = pArray[ValidIndices[i]];
+      NbPoints = (MIL_INT)Compacted.size();
+      Success = fwrite(&Compacted[0], sizeof(T), Compacted.size(), pFile) == Compacted.size();
+      }
+
+   static const char PADDING[CACHE_ALIGNMENT] = { 0 };
+   MIL_INT PaddingSize = PaddedSize(NbPoints * (MIL_INT)sizeof(T)) - NbPoints * (MIL_INT)sizeof(T);
+   return Success && fwrite(PADDING, 1, (size_t)PaddingSize, pFile) == (size_t)PaddingSize;
+   }
+
+//--------------------------------------------------------------------------
+// Copies the elements [Begin, End) of an array of the cache file.
+//--------------------------------------------------------------------------
+template <class T>
+static void CopyArray(const MIL_UINT8* pSource, T* pArray, MIL_INT Begin, MIL_INT End)
+   {
+   memcpy(pArray + Begin, pSource + Begin * sizeof(T), (size_t)(End - Begin) * sizeof(T));
+   }
+
+//--------------------------------------------------------------------------
+MIL_STRING GetCloudCacheFileName(MIL_CONST_TEXT_PTR FileName)
+   {
+   MIL_STRING CacheFileName = FileName;
+
+   size_t Separator = CacheFileName.find_last_of(MIL_TEXT("/\\"));
+   if(Separator != MIL_STRING::npos)
+      CacheFileName.erase(0, Separator + 1);
+
+   size_t Extension = CacheFileName.find_last_of(MIL_TEXT('.'));
+   if(Extension != MIL_STRING::npos)
+      CacheFileName.erase(Extension);
+
+   // The FNV-1a hash of the full name keeps apart the files of the same name in
+   // different folders.
+   MIL_UINT64 Hash = 0xCBF29CE484222325ULL;
+   for(MIL_CONST_TEXT_PTR pChar = FileName; *pChar; pChar++)
+      {
+      Hash ^= (MIL_UINT64)*pChar;
+      Hash *= 0x100000001B3ULL;
+      }
+   MIL_TEXT_CHAR HashText[32];
+   MosSprintf(HashText, 32, MIL_TEXT("_%08x%08x"), (unsigned int)(Hash >> 32), (unsigned int)Hash);
+
+   return CacheFileName + HashText + MIL_TEXT(".s3dc");
+   }
+
+//--------------------------------------------------------------------------
+bool SaveCloudCache(MIL_CONST_TEXT_PTR CacheFileName, const SCloudView& View, const SCloudStats& Stats,
+                    MIL_UINT32 Flags, MIL_INT NormalNeighbors, const MIL_DOUBLE* NormalOrientation,
+                    MIL_INT64 SourceSize, MIL_INT64 SourceTime)
+   {
+   // Only the valid points are written.
+   std::vector<MIL_INT> ValidIndices;
+   if(View.Confidence)
+      {
+      ValidIndices.reserve((size_t)Stats.NbPoints);
+      for(MIL_INT i = 0; i < View.NbPoints; i++)
+         {
+         if(View.Confidence[i] != 0)
+            ValidIndices.push_back(i);
+         }
+      if(ValidIndices.empty())
+         return false;
+      }
+
+   if(!View.Intensity)
+      Flags &= ~eCacheIntensity;
+   if(!View.NormalX)
+      Flags &= ~eCacheNormals;
+
+   SCloudCacheHeader Header;
+   memset(&Header, 0, sizeof(Header));
+   memcpy(Header.Magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+   Header.Version    = CACHE_VERSION;
+   Header.Flags      = Flags;
+   Header.NbPoints   = Stats.NbPoints;
+   Header.SourceSize = SourceSize;
+   Header.SourceTime = SourceTime;
+   Header.NormalNeighbors = (Flags & eCacheNormals) ? (MIL_UINT32)NormalNeighbors : 0;
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      Header.Min[a]      = Stats.Min[a];
+      Header.Max[a]      = Stats.Max[a];
+      Header.Centroid[a] = Stats.Centroid[a];
+      Header.NormalOrientation[a] = Header.NormalNeighbors > 0 ? NormalOrientation[a] : 0.0;
+      }
+
+   FILE* pFile = MosFopen(CacheFileName, MIL_TEXT("wb"));
+   if(!pFile)
+      return false;
+
+   bool Success = fwrite(&Header, sizeof(Header), 1, pFile) == 1 &&
+                  WriteArray(pFile, View.X, ValidIndices, View.NbPoints) &&
+                  WriteArray(pFile, View.Y, ValidIndices, View.NbPoints) &&
+                  WriteArray(pFile, View.Z, ValidIndices, View.NbPoints);
+   if(Success && (Flags & eCacheIntensity))
+      Success = WriteArray(pFile, View.Intensity, ValidIndices, View.NbPoints);
+   if(Success && (Flags & eCacheNormals))
+      Success = WriteArray(pFile, View.NormalX, ValidIndices, View.NbPoints) &&
+                WriteArray(pFile, View.NormalY, ValidIndices, View.NbPoints) &&
+                WriteArray(pFile, View.NormalZ, ValidIndices, View.NbPoints);
+
+   Success = (fclose(pFile) == 0) && Success;
+   if(!Success)
+      MappFileOperation(M_DEFAULT, CacheFileName, M_NULL, M_NULL, M_FILE_DELETE, M_DEFAULT, M_NULL);
+   return Success;
+   }
+
+//--------------------------------------------------------------------------
+MIL_UNIQUE_BUF_ID LoadCloudCache(MIL_ID MilSystem, MIL_CONST_TEXT_PTR CacheFileName,
+                                 MIL_INT64 SourceSize, MIL_INT64 SourceTime, MIL_INT Components,
+                                 MIL_INT NormalNeighbors, const MIL_DOUBLE NormalOrientation[3],
+                                 SCloudStats* pStats, MIL_UINT32* pFlags, CMultiBoxCrop* pCrop)
+   {
+   CMappedFile File;
+   if(!File.Open(CacheFileName) || File.Size() < (MIL_INT)sizeof(SCloudCacheHeader))
+      return MIL_UNIQUE_BUF_ID();
+
+   SCloudCacheHeader Header;
+   memcpy(&Header, File.Data(), sizeof(Header));
+   if(memcmp(Header.Magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+      Header.Version    != CACHE_VERSION ||
+      Header.SourceSize != SourceSize ||
+      Header.SourceTime != SourceTime ||
+      Header.NbPoints   <= 0)
+      return MIL_UNIQUE_BUF_ID();
+
+   // Validate the file size against the content announced by the header, bounding
+   // the number of points by the coordinates first so that the sizes do not overflow.
+   if(Header.NbPoints > (MIL_INT64)((File.Size() - (MIL_INT)sizeof(Header)) / (3 * (MIL_INT)sizeof(MIL_FLOAT))))
+      return MIL_UNIQUE_BUF_ID();
+   const MIL_INT NbPoints = (MIL_INT)Header.NbPoints;
+   MIL_INT ExpectedSize = (MIL_INT)sizeof(Header) + 3 * PaddedSize(NbPoints * (MIL_INT)sizeof(MIL_FLOAT));
+   if(Header.Flags & eCacheIntensity)
+      ExpectedSize += PaddedSize(NbPoints * (MIL_INT)sizeof(MIL_UINT16));
+   if(Header.Flags & eCacheNormals)
+      ExpectedSize += 3 * PaddedSize(NbPoints * (MIL_INT)sizeof(MIL_FLOAT));
+   if(File.Size() < ExpectedSize)
+      return MIL_UNIQUE_BUF_ID();
+
+   // The normals estimated differently are left out.
+   MIL_UINT32 Flags = Header.Flags;
+   if(NormalNeighbors > 0 && Header.NormalNeighbors > 0 &&
+      ((MIL_INT)Header.NormalNeighbors != NormalNeighbors ||
+       Header.NormalOrientation[0] != NormalOrientation[0] ||
+       Header.NormalOrientation[1] != NormalOrientation[1] ||
+       Header.NormalOrientation[2] != NormalOrientation[2]))
+      Flags &= ~eCacheNormals;
+
+   // Allocate the selected components held by the cache.
+   MIL_INT LoadedComponents = eComponentRange;
+   if((Header.Flags & eCacheIntensity) && (Components & eComponentReflectance))
+      LoadedComponents |= eComponentReflectance;
+   if((Flags & eCacheNormals) && (Components & eComponentNormals))
+      LoadedComponents |= eComponentNormals;
+
+   SCloudView View;
+   MIL_UNIQUE_BUF_ID MilContainer = AllocPointCloudContainer(MilSystem, NbPoints, LoadedComponents, &View);
+
+   // Locate the arrays in the file.
+   const MIL_INT    FloatArraySize   = PaddedSize(NbPoints * (MIL_INT)sizeof(MIL_FLOAT));
+   const MIL_UINT8* pSourceX         = File.Data() + sizeof(Header);
+   const MIL_UINT8* pSourceY         = pSourceX + FloatArraySize;
+   const MIL_UINT8* pSourceZ         = pSourceY + FloatArraySize;
+   const MIL_UINT8* pSourceIntensity = pSourceZ + FloatArraySize;
+   const MIL_UINT8* pSourceNormals   = pSourceIntensity;
+   if(Header.Flags & eCacheIntensity)
+      pSourceNormals += PaddedSize(NbPoints * (MIL_INT)sizeof(MIL_UINT16));
+
+   // Copy the arrays chunk by chunk in parallel, testing the coordinates block by block
+   // against the crop boxes while they are still in the cache.
+   const MIL_INT NbChunks = GetNbChunks(NbPoints, CACHE_COPY_CHUNK_SIZE);
+   if(pCrop)
+      pCrop->Reset(NbChunks);
+   ParallelChunks(0, NbPoints, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      for(MIL_INT BlockBegin = ChunkBegin; BlockBegin < ChunkEnd; BlockBegin += CROP_BLOCK_SIZE)
+         {
+         const MIL_INT BlockEnd = ChunkEnd - BlockBegin < CROP_BLOCK_SIZE ? ChunkEnd : BlockBegin + CROP_BLOCK_SIZE;
+         CopyArray(pSourceX, View.X, BlockBegin, BlockEnd);
+         CopyArray(pSourceY, View.Y, BlockBegin, BlockEnd);
+         CopyArray(pSourceZ, View.Z, BlockBegin, BlockEnd);
+         if(pCrop)
+            pCrop->AddPoints(Chunk, View.X + BlockBegin, View.Y + BlockBegin, View.Z + BlockBegin, M_NULL, BlockEnd - BlockBegin);
+         }
+      if(View.Intensity)
+         CopyArray(pSourceIntensity, View.Intensity, ChunkBegin, ChunkEnd);
+      if(View.NormalX)
+         {
+         CopyArray(pSourceNormals, View.NormalX, ChunkBegin, ChunkEnd);
+         CopyArray(pSourceNormals + FloatArraySize, View.NormalY, ChunkBegin, ChunkEnd);
+         CopyArray(pSourceNormals + 2 * FloatArraySize, View.NormalZ, ChunkBegin, ChunkEnd);
+         }
+      });
+
+   pStats->NbPoints = NbPoints;
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      pStats->Min[a]      = Header.Min[a];
+      pStats->Max[a]      = Header.Max[a];
+      pStats->Centroid[a] = Header.Centroid[a];
+      }
+   if(pFlags)
+      *pFlags = Flags;
+
+   return MilContainer;
+   }
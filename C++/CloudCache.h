@@ -0,0 +1,71 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudCache.h
+//
+// Synopsis:  Declares the binary cloud cache. A cache file holds the statistics
+//            of a point cloud followed by its planar components, so that a cloud
+//            already parsed once is restored without parsing nor statistics.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include "PointCloudData.h"
+#include "CloudCrop.h"
+
+// Optional content of a cache file.
+enum
+   {
+   eCacheIntensity     = 0x1,
+   eCacheNormals       = 0x2,
+   eCacheMortonOrdered = 0x4
+   };
+
+//-------------------------------------------------------------------------------
+// Header of a cache file. It is followed by the X, Y and Z arrays of 32-bit
+// floats, the 16-bit intensity array when eCacheIntensity is set and the
+// normal X, Y and Z arrays when eCacheNormals is set. Each array starts on
+// an 8-byte boundary.
+//-------------------------------------------------------------------------------
+struct SCloudCacheHeader
+   {
+   char       Magic[4];
+   MIL_UINT32 Version;
+   MIL_UINT32 Flags;
+   MIL_UINT32 NormalNeighbors;       // Neighbors of the estimated normals; 0 for the normals of the source file.
+   MIL_INT64  NbPoints;
+   MIL_INT64  SourceSize;    // Size of the source file when the cache was written.
+   MIL_INT64  SourceTime;    // Modification time of the source file.
+   MIL_DOUBLE Min[3];
+   MIL_DOUBLE Max[3];
+   MIL_DOUBLE Centroid[3];
+   MIL_DOUBLE NormalOrientation[3];  // Direction the estimated normals do not point away from.
+   };
+
+// Returns the name of the cache file of a point cloud file: its base name
+// followed by a hash of its full name, with the cache extension, in the
+// working directory.
+MIL_STRING GetCloudCacheFileName(MIL_CONST_TEXT_PTR FileName);
+
+// Writes the valid points of a point cloud in a cache file. The source file
+// signature is stored to detect a stale cache, and the estimation of the
+// normals to detect normals estimated differently. NormalNeighbors is 0 for
+// the normals of the source file; NormalOrientation can then be M_NULL.
+bool SaveCloudCache(MIL_CONST_TEXT_PTR CacheFileName, const SCloudView& View, const SCloudStats& Stats,
+                    MIL_UINT32 Flags, MIL_INT NormalNeighbors, const MIL_DOUBLE* NormalOrientation,
+                    MIL_INT64 SourceSize, MIL_INT64 SourceTime);
+
+// Restores a point cloud from a cache file. Returns an empty identifier if
+// the cache does not exist or does not match the source file signature.
+// Only the optional arrays selected in Components are read. When
+// NormalNeighbors is not 0, the normals estimated with other neighbors or
+// another orientation are not read and eCacheNormals is cleared from the
+// returned flags; the normals of the source file are always read. When pCrop
+// is not M_NULL, the points are also tested against its boxes while they are
+// copied.
+MIL_UNIQUE_BUF_ID LoadCloudCache(MIL_ID MilSystem, MIL_CONST_TEXT_PTR CacheFileName,
+                                 MIL_INT64 SourceSize, MIL_INT64 SourceTime, MIL_INT Components,
+                                 MIL_INT NormalNeighbors, const MIL_DOUBLE NormalOrientation[3],
+                                 SCloudStats* pStats, MIL_UINT32* pFlags, CMultiBoxCrop* pCrop);
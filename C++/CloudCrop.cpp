@@ -0,0 +1,213 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudCrop.cpp
+//
+// Synopsis:  Implements the axis-aligned box crop of the point clouds.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "CloudCrop.h"
+#include "ParallelFor.h"
+#include <math.h>
+#include <string.h>
+
+// Minimum number of points processed by a worker thread.
+static const MIL_INT CROP_CHUNK_SIZE = 65536;
+
+// Largest quantized coordinate.
+static const MIL_DOUBLE QUANTIZED_MAX_VALUE = 65535.0;
+
+//--------------------------------------------------------------------------
+SCloudBox MakeCenteredBox(MIL_DOUBLE SizeX, MIL_DOUBLE SizeY, MIL_DOUBLE SizeZ)
+   {
+   const MIL_DOUBLE Size[3] = { fabs(SizeX), fabs(SizeY), fabs(SizeZ) };
+
+   SCloudBox Box;
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      Box.Min[a] = -0.5 * Size[a];
+      Box.Max[a] =  0.5 * Size[a];
+      }
+   return Box;
+   }
+
+//--------------------------------------------------------------------------
+CMultiBoxCrop::CMultiBoxCrop(const SCloudBox* pBoxes, MIL_INT NbBoxes)
+   : m_Boxes(pBoxes, pBoxes + NbBoxes),
+     m_pKernel(GetBoxCropKernel(GetBestBoxCropKernel())),
+     m_NbChunks(0),
+     m_HasNormals(false)
+   {
+   for(MIL_INT b = 0; b < NbBoxes; b++)
+      m_FloatBoxes.push_back(MakeFloatBox(pBoxes[b].Min, pBoxes[b].Max));
+   }
+
+//--------------------------------------------------------------------------
+void CMultiBoxCrop::Reset(MIL_INT NbChunks)
+   {
+   m_Chunks.clear();
+   m_Chunks.resize((size_t)(NbChunks * NbBoxes()));
+   m_NbChunks = NbChunks;
+   m_HasNormals = false;
+   }
+
+//--------------------------------------------------------------------------
+void CMultiBoxCrop::AddPoints(MIL_INT Chunk, const MIL_FLOAT* pX, const MIL_FLOAT* pY, const MIL_FLOAT* pZ,
+                              const MIL_UINT8* pConfidence, MIL_INT NbPoints)
+   {
+   // The kernel compacts the points kept in a block on the stack that is then
+   // appended to the points of the chunk.
+   MIL_FLOAT Kept[3][CROP_BLOCK_SIZE];
+   for(MIL_INT BlockBegin = 0; BlockBegin < NbPoints; BlockBegin += CROP_BLOCK_SIZE)
+      {
+      const MIL_INT BlockSize = NbPoints - BlockBegin < CROP_BLOCK_SIZE ? NbPoints - BlockBegin : CROP_BLOCK_SIZE;
+      for(MIL_INT b = 0; b < NbBoxes(); b++)
+         {
+         const MIL_INT NbKept = m_pKernel(pX + BlockBegin, pY + BlockBegin, pZ + BlockBegin,
+                                          pConfidence ? pConfidence + BlockBegin : M_NULL, BlockSize,
+                                          m_FloatBoxes[(size_t)b], Kept[0], Kept[1], Kept[2]);
+         if(NbKept == 0)
+            continue;
+
+         SChunkPoints& Points = m_Chunks[(size_t)(Chunk * NbBoxes() + b)];
+         Points.X.insert(Points.X.end(), Kept[0], Kept[0] + NbKept);
+         Points.Y.insert(Points.Y.end(), Kept[1], Kept[1] + NbKept);
+         Points.Z.insert(Points.Z.end(), Kept[2], Kept[2] + NbKept);
+         }
+      }
+   }
+
+//--------------------------------------------------------------------------
+void CMultiBoxCrop::Crop(const SCloudView& View)
+   {
+   const MIL_INT NbChunks = GetNbChunks(View.NbPoints, CROP_CHUNK_SIZE);
+   Reset(NbChunks);
+   if(!View.NormalX)
+      {
+      ParallelChunks(0, View.NbPoints, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+         {
+         AddPoints(Chunk, View.X + ChunkBegin, View.Y + ChunkBegin, View.Z + ChunkBegin,
+                   View.Confidence ? View.Confidence + ChunkBegin : M_NULL, ChunkEnd - ChunkBegin);
+         });
+      return;
+      }
+
+   // The kernels do not return the indices of the points kept, so the points
+   // with normals are tested one by one.
+   m_HasNormals = true;
+   const MIL_INT NbBox = NbBoxes();
+   ParallelChunks(0, View.NbPoints, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      for(MIL_INT i = ChunkBegin; i < ChunkEnd; i++)
+         {
+         if(View.Confidence && View.Confidence[i] == 0)
+            continue;
+
+         for(MIL_INT b = 0; b < NbBox; b++)
+            {
+            if(!m_Boxes[(size_t)b].Contains(View.X[i], View.Y[i], View.Z[i]))
+               continue;
+
+            SChunkPoints& Points = m_Chunks[(size_t)(Chunk * NbBox + b)];
+            Points.X.push_back(View.X[i]);
+            Points.Y.push_back(View.Y[i]);
+            Points.Z.push_back(View.Z[i]);
+            Points.NormalX.push_back(View.NormalX[i]);
+            Points.NormalY.push_back(View.NormalY[i]);
+            Points.NormalZ.push_back(View.NormalZ[i]);
+            }
+         }
+      });
+   }
+
+//--------------------------------------------------------------------------
+void CMultiBoxCrop::CropQuantized(const SQuantizedCloudView& View)
+   {
+   // Get the quantized bounds of the boxes; a box outside the quantized range is empty.
+   const MIL_INT NbBox = NbBoxes();
+   std::vector<MIL_INT> QuantizedMin((size_t)(3 * NbBox));
+   std::vector<MIL_INT> QuantizedMax((size_t)(3 * NbBox));
+   for(MIL_INT b = 0; b < NbBox; b++)
+      {
+      for(MIL_INT a = 0; a < 3; a++)
+         {
+         const MIL_DOUBLE Min = ceil((m_Boxes[(size_t)b].Min[a] - View.Offset[a]) / View.Scale[a]);
+         const MIL_DOUBLE Max = floor((m_Boxes[(size_t)b].Max[a] - View.Offset[a]) / View.Scale[a]);
+         QuantizedMin[(size_t)(3 * b + a)] = Min < 0.0 ? 0 : (MIL_INT)Min;
+         QuantizedMax[(size_t)(3 * b + a)] = Max > QUANTIZED_MAX_VALUE ? (MIL_INT)QUANTIZED_MAX_VALUE : (MIL_INT)Max;
+         }
+      }
+
+   const MIL_INT NbPoints = View.Attributes.NbPoints;
+   const MIL_INT NbChunks = GetNbChunks(NbPoints, CROP_CHUNK_SIZE);
+   Reset(NbChunks);
+   ParallelChunks(0, NbPoints, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      for(MIL_INT i = ChunkBegin; i < ChunkEnd; i++)
+         {
+         if(View.Attributes.Confidence && View.Attributes.Confidence[i] == 0)
+            continue;
+
+         const MIL_INT Point[3] = { View.X[i], View.Y[i], View.Z[i] };
+         for(MIL_INT b = 0; b < NbBox; b++)
+            {
+            const MIL_INT* pMin = &QuantizedMin[(size_t)(3 * b)];
+            const MIL_INT* pMax = &QuantizedMax[(size_t)(3 * b)];
+            if(Point[0] < pMin[0] || Point[0] > pMax[0] ||
+               Point[1] < pMin[1] || Point[1] > pMax[1] ||
+               Point[2] < pMin[2] || Point[2] > pMax[2])
+               continue;
+
+            SChunkPoints& Points = m_Chunks[(size_t)(Chunk * NbBox + b)];
+            Points.X.push_back((MIL_FLOAT)(View.Offset[0] + View.Scale[0] * Point[0]));
+            Points.Y.push_back((MIL_FLOAT)(View.Offset[1] + View.Scale[1] * Point[1]));
+            Points.Z.push_back((MIL_FLOAT)(View.Offset[2] + View.Scale[2] * Point[2]));
+            }
+         }
+      });
+   }
+
+//--------------------------------------------------------------------------
+MIL_INT CMultiBoxCrop::Count(MIL_INT Box) const
+   {
+   MIL_INT NbPoints = 0;
+   for(MIL_INT c = 0; c < m_NbChunks; c++)
+      NbPoints += (MIL_INT)m_Chunks[(size_t)(c * NbBoxes() + Box)].X.size();
+   return NbPoints;
+   }
+
+//--------------------------------------------------------------------------
+MIL_UNIQUE_BUF_ID CMultiBoxCrop::AllocContainer(MIL_ID MilSystem, MIL_INT Box) const
+   {
+   // Get the position of each chunk in the cropped cloud.
+   std::vector<MIL_INT> ChunkOffsets((size_t)m_NbChunks + 1, 0);
+   for(MIL_INT c = 0; c < m_NbChunks; c++)
+      ChunkOffsets[(size_t)c + 1] = ChunkOffsets[(size_t)c] + (MIL_INT)m_Chunks[(size_t)(c * NbBoxes() + Box)].X.size();
+
+   SCloudView View;
+   const MIL_INT Components = eComponentRange | (m_HasNormals ? eComponentNormals : 0);
+   MIL_UNIQUE_BUF_ID MilContainer = AllocPointCloudContainer(MilSystem, ChunkOffsets.back(), Components, &View);
+
+   ParallelChunks(0, m_NbChunks, m_NbChunks, [&](MIL_INT, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      for(MIL_INT c = ChunkBegin; c < ChunkEnd; c++)
+         {
+         const SChunkPoints& Points = m_Chunks[(size_t)(c * NbBoxes() + Box)];
+         if(Points.X.empty())
+            continue;
+         const size_t Size = Points.X.size() * sizeof(MIL_FLOAT);
+         memcpy(View.X + ChunkOffsets[(size_t)c], &Points.X[0], Size);
+         memcpy(View.Y + ChunkOffsets[(size_t)c], &Points.Y[0], Size);
+         memcpy(View.Z + ChunkOffsets[(size_t)c], &Points.Z[0], Size);
+         if(m_HasNormals)
+            {
+            memcpy(View.NormalX + ChunkOffsets[(size_t)c], &Points.NormalX[0], Size);
+            memcpy(View.NormalY + ChunkOffsets[(size_t)c], &Points.NormalY[0], Size);
+            memcpy(View.NormalZ + ChunkOffsets[(size_t)c], &Points.NormalZ[0], Size);
+            }
+         }
+      });
+
+   return MilContainer;
+   }
@@ -0,0 +1,113 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudCrop.h
+//
+// Synopsis:  Declares the axis-aligned box crop of the point clouds. The points
+//            are tested against several boxes at once, chunk by chunk, while the
+//            loaders decode them.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include <vector>
+#include "PointCloudData.h"
+#include "CloudCropKernel.h"
+
+// Number of points decoded by the loaders before they are tested against the
+// crop boxes, so that the points are still in the cache when they are tested.
+static const MIL_INT CROP_BLOCK_SIZE = 4096;
+
+//-------------------------------------------------------------------------------
+// Axis-aligned box, bounds included.
+//-------------------------------------------------------------------------------
+struct SCloudBox
+   {
+   MIL_DOUBLE Min[3];
+   MIL_DOUBLE Max[3];
+
+   bool Contains(MIL_FLOAT X, MIL_FLOAT Y, MIL_FLOAT Z) const
+      {
+      return X >= Min[0] && X <= Max[0] &&
+             Y >= Min[1] && Y <= Max[1] &&
+             Z >= Min[2] && Z <= Max[2];
+      }
+   };
+
+// Returns the box centered on the origin with the given dimensions, which
+// can be negative like those of M3dgeoBox.
+SCloudBox MakeCenteredBox(MIL_DOUBLE SizeX, MIL_DOUBLE SizeY, MIL_DOUBLE SizeZ);
+
+//-------------------------------------------------------------------------------
+// Gathers the points inside each of several boxes. The points are added
+// chunk by chunk, each chunk being filled by a single thread, and the
+// subsets are built by concatenating the chunks in order. The points of an
+// array are tested by the fastest box crop kernel of the processor.
+//-------------------------------------------------------------------------------
+class CMultiBoxCrop
+   {
+   public:
+      CMultiBoxCrop(const SCloudBox* pBoxes, MIL_INT NbBoxes);
+
+      // Discards the gathered points and prepares NbChunks empty chunks.
+      void Reset(MIL_INT NbChunks);
+
+      // Tests a point against all the boxes.
+      void Add(MIL_INT Chunk, MIL_FLOAT X, MIL_FLOAT Y, MIL_FLOAT Z)
+         {
+         for(MIL_INT b = 0; b < (MIL_INT)m_Boxes.size(); b++)
+            {
+            if(m_Boxes[b].Contains(X, Y, Z))
+               {
+               SChunkPoints& Points = m_Chunks[(size_t)(Chunk * m_Boxes.size() + b)];
+               Points.X.push_back(X);
+               Points.Y.push_back(Y);
+               Points.Z.push_back(Z);
+               }
+            }
+         }
+
+      // Tests an array of points against all the boxes. The points whose
+      // confidence is 0 are skipped when pConfidence is not M_NULL.
+      void AddPoints(MIL_INT Chunk, const MIL_FLOAT* pX, const MIL_FLOAT* pY, const MIL_FLOAT* pZ,
+                     const MIL_UINT8* pConfidence, MIL_INT NbPoints);
+
+      // Gathers the valid points of a cloud inside all the boxes in a single
+      // parallel traversal. The normals of the points are also gathered when
+      // the cloud has normals.
+      void Crop(const SCloudView& View);
+
+      // Gathers the valid points of a quantized cloud inside the boxes. The
+      // boxes are converted to quantized coordinates so that only the points
+      // kept are dequantized.
+      void CropQuantized(const SQuantizedCloudView& View);
+
+      MIL_INT NbBoxes() const { return (MIL_INT)m_Boxes.size(); }
+
+      // Returns the number of points inside a box.
+      MIL_INT Count(MIL_INT Box) const;
+
+      // Allocates a container holding the points inside a box, and their
+      // normals when they were gathered.
+      MIL_UNIQUE_BUF_ID AllocContainer(MIL_ID MilSystem, MIL_INT Box) const;
+
+   private:
+      struct SChunkPoints
+         {
+         std::vector<MIL_FLOAT> X;
+         std::vector<MIL_FLOAT> Y;
+         std::vector<MIL_FLOAT> Z;
+         std::vector<MIL_FLOAT> NormalX;   // Empty unless m_HasNormals.
+         std::vector<MIL_FLOAT> NormalY;
+         std::vector<MIL_FLOAT> NormalZ;
+         };
+
+      std::vector<SCloudBox>    m_Boxes;
+      std::vector<SFloatBox>    m_FloatBoxes;
+      TBoxCropKernel            m_pKernel;
+      std::vector<SChunkPoints> m_Chunks;   // Indexed by Chunk * NbBoxes + Box.
+      MIL_INT                   m_NbChunks;
+      bool                      m_HasNormals;
+   };
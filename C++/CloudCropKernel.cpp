@@ -0,0 +1,334 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudCropKernel.cpp
+//
+// Synopsis:  Implements the box crop kernels and their run-time selection.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "CloudCropKernel.h"
+#include <string.h>
+
+// The vector kernels are built for the x86 processors only. The compilers other than
+// Visual C++ build them with a function target attribute, so that the example does not
+// require the whole program to be built for these instruction sets. Visual C++ builds
+// the AVX-512 kernel from VC++ 2017 15.3; the other compilers always build it.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+   #define BOX_CROP_USE_AVX2 1
+   #if !defined(_MSC_VER) || _MSC_VER >= 1911
+      #define BOX_CROP_USE_AVX512 1
+   #endif
+   #include <immintrin.h>
+   #if defined(_MSC_VER)
+      #include <intrin.h>
+      #define BOX_CROP_TARGET_AVX2
+      #define BOX_CROP_TARGET_AVX512
+   #else
+      #define BOX_CROP_TARGET_AVX2   __attribute__((target("avx2")))
+      #define BOX_CROP_TARGET_AVX512 __attribute__((target("avx512f")))
+   #endif
+#endif
+
+//--------------------------------------------------------------------------
+// Returns the smallest float not less than a value.
+//--------------------------------------------------------------------------
+static MIL_FLOAT FloatNotLess(MIL_DOUBLE Value)
+   {
+   MIL_FLOAT Result = (MIL_FLOAT)Value;
+   if(!(Result < Value))
+      return Result;
+
+   MIL_UINT32 Bits;
+   memcpy(&Bits, &Result, sizeof(Bits));
+   if(Result == 0.0f)
+      Bits = 0x00000001;
+   else if(Result > 0.0f)
+      Bits++;
+   else
+      Bits--;
+   memcpy(&Result, &Bits, sizeof(Bits));
+   return Result;
+   }
+
+//--------------------------------------------------------------------------
+// Returns the largest float not greater than a value.
+//--------------------------------------------------------------------------
+static MIL_FLOAT FloatNotGreater(MIL_DOUBLE Value)
+   {
+   MIL_FLOAT Result = (MIL_FLOAT)Value;
+   if(!(Result > Value))
+      return Result;
+
+   MIL_UINT32 Bits;
+   memcpy(&Bits, &Result, sizeof(Bits));
+   if(Result == 0.0f)
+      Bits = 0x80000001;
+   else if(Result > 0.0f)
+      Bits--;
+   else
+      Bits++;
+   memcpy(&Result, &Bits, sizeof(Bits));
+   return Result;
+   }
+
+//--------------------------------------------------------------------------
+SFloatBox MakeFloatBox(const MIL_DOUBLE Min[3], const MIL_DOUBLE Max[3])
+   {
+   SFloatBox Box;
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      Box.Min[a] = FloatNotLess(Min[a]);
+      Box.Max[a] = FloatNotGreater(Max[a]);
+      }
+   return Box;
+   }
+
+//--------------------------------------------------------------------------
+// Returns the number of bits set in a mask.
+//--------------------------------------------------------------------------
+static inline MIL_INT CountBits(MIL_UINT32 Mask)
+   {
+   Mask = Mask - ((Mask >> 1) & 0x55555555);
+   Mask = (Mask & 0x33333333) + ((Mask >> 2) & 0x33333333);
+   Mask = (Mask + (Mask >> 4)) & 0x0F0F0F0F;
+   return (MIL_INT)((Mask * 0x01010101) >> 24);
+   }
+
+//--------------------------------------------------------------------------
+static MIL_INT BoxCropScalar(const MIL_FLOAT* pX, const MIL_FLOAT* pY, const MIL_FLOAT* pZ,
+                             const MIL_UINT8* pConfidence, MIL_INT NbPoints, const SFloatBox& Box,
+                             MIL_FLOAT* pOutX, MIL_FLOAT* pOutY, MIL_FLOAT* pOutZ)
+   {
+   MIL_INT NbInside = 0;
+   for(MIL_INT i = 0; i < NbPoints; i++)
+      {
+      if(pConfidence && pConfidence[i] == 0)
+         continue;
+      if(pX[i] >= Box.Min[0] && pX[i] <= Box.Max[0] &&
+         pY[i] >= Box.Min[1] && pY[i] <= Box.Max[1] &&
+         pZ[i] >= Box.Min[2] && pZ[i] <= Box.Max[2])
+         {
+         pOutX[NbInside] = pX[i];
+         pOutY[NbInside] = pY[i];
+         pOutZ[NbInside] = pZ[i];
+         NbInside++;
+         }
+      }
+   return NbInside;
+   }
+
+#if BOX_CROP_USE_AVX2
+// Lane permutations that move the lanes selected by an 8-bit mask to the first
+// lanes, in order. The lane index of the k-th selected lane is in the k-th nibble.
+static const MIL_UINT32 COMPRESS_PERMUTATIONS[256] =
+   {
+   0x00000000, 0x00000000, 0x00000001, 0x00000010, 0x00000002, 0x00000020, 0x00000021, 0x00000210,
+   0x00000003, 0x00000030, 0x00000031, 0x00000310, 0x00000032, 0x00000320, 0x00000321, 0x00003210,
+   0x00000004, 0x00000040, 0x00000041, 0x00000410, 0x00000042, 0x00000420, 0x00000421, 0x00004210,
+   0x00000043, 0x00000430, 0x00000431, 0x00004310, 0x00000432, 0x00004320, 0x00004321, 0x00043210,
+   0x00000005, 0x00000050, 0x00000051, 0x00000510, 0x00000052, 0x00000520, 0x00000521, 0x00005210,
+   0x00000053, 0x00000530, 0x00000531, 0x00005310, 0x00000532, 0x00005320, 0x00005321, 0x00053210,
+   0x00000054, 0x00000540, 0x00000541, 0x00005410, 0x00000542, 0x00005420, 0x00005421, 0x00054210,
+   0x00000543, 0x00005430, 0x00005431, 0x00054310, 0x00005432, 0x00054320, 0x00054321, 0x00543210,
+   0x00000006, 0x00000060, 0x00000061, 0x00000610, 0x00000062, 0x00000620, 0x00000621, 0x00006210,
+   0x00000063, 0x00000630, 0x00000631, 0x00006310, 0x00000632, 0x00006320, 0x00006321, 0x00063210,
+   0x00000064, 0x00000640, 0x00000641, 0x00006410, 0x00000642, 0x00006420, 0x00006421, 0x00064210,
+   0x00000643, 0x00006430, 0x00006431, 0x00064310, 0x00006432, 0x00064320, 0x00064321, 0x00643210,
+   0x00000065, 0x00000650, 0x00000651, 0x00006510, 0x00000652, 0x00006520, 0x00006521, 0x00065210,
+   0x00000653, 0x00006530, 0x00006531, 0x00065310, 0x00006532, 0x00065320, 0x00065321, 0x00653210,
+   0x00000654, 0x00006540, 0x00006541, 0x00065410, 0x00006542, 0x00065420, 0x00065421, 0x00654210,
+   0x00006543, 0x00065430, 0x00065431, 0x00654310, 0x00065432, 0x00654320, 0x00654321, 0x06543210,
+   0x00000007, 0x00000070, 0x00000071, 0x00000710, 0x00000072, 0x00000720, 0x00000721, 0x00007210,
+   0x00000073, 0x00000730, 0x00000731, 0x00007310, 0x00000732, 0x00007320, 0x00007321, 0x00073210,
+   0x00000074, 0x00000740, 0x00000741, 0x00007410, 0x00000742, 0x00007420, 0x00007421, 0x00074210,
+   0x00000743, 0x00007430, 0x00007431, 0x00074310, 0x00007432, 0x00074320, 0x00074321, 0x00743210,
+   0x00000075, 0x00000750, 0x00000751, 0x00007510, 0x00000752, 0x00007520, 0x00007521, 0x00075210,
+   0x00000753, 0x00007530, 0x00007531, 0x00075310, 0x00007532, 0x00075320, 0x00075321, 0x00753210,
+   0x00000754, 0x00007540, 0x00007541, 0x00075410, 0x00007542, 0x00075420, 0x00075421, 0x00754210,
+   0x00007543, 0x00075430, 0x00075431, 0x00754310, 0x00075432, 0x00754320, 0x00754321, 0x07543210,
+   0x00000076, 0x00000760, 0x00000761, 0x00007610, 0x00000762, 0x00007620, 0x00007621, 0x00076210,
+   0x00000763, 0x00007630, 0x00007631, 0x00076310, 0x00007632, 0x00076320, 0x00076321, 0x00763210,
+   0x00000764, 0x00007640, 0x00007641, 0x00076410, 0x00007642, 0x00076420, 0x00076421, 0x00764210,
+   0x00007643, 0x00076430, 0x00076431, 0x00764310, 0x00076432, 0x00764320, 0x00764321, 0x07643210,
+   0x00000765, 0x00007650, 0x00007651, 0x00076510, 0x00007652, 0x00076520, 0x00076521, 0x00765210,
+   0x00007653, 0x00076530, 0x00076531, 0x00765310, 0x00076532, 0x00765320, 0x00765321, 0x07653210,
+   0x00007654, 0x00076540, 0x00076541, 0x00765410, 0x00076542, 0x00765420, 0x00765421, 0x07654210,
+   0x00076543, 0x00765430, 0x00765431, 0x07654310, 0x00765432, 0x07654320, 0x07654321, 0x76543210,
+   };
+
+//--------------------------------------------------------------------------
+BOX_CROP_TARGET_AVX2
+static MIL_INT BoxCropAvx2(const MIL_FLOAT* pX, const MIL_FLOAT* pY, const MIL_FLOAT* pZ,
+                           const MIL_UINT8* pConfidence, MIL_INT NbPoints, const SFloatBox& Box,
+                           MIL_FLOAT* pOutX, MIL_FLOAT* pOutY, MIL_FLOAT* pOutZ)
+   {
+   const __m256  MinX       = _mm256_set1_ps(Box.Min[0]);
+   const __m256  MinY       = _mm256_set1_ps(Box.Min[1]);
+   const __m256  MinZ       = _mm256_set1_ps(Box.Min[2]);
+   const __m256  MaxX       = _mm256_set1_ps(Box.Max[0]);
+   const __m256  MaxY       = _mm256_set1_ps(Box.Max[1]);
+   const __m256  MaxZ       = _mm256_set1_ps(Box.Max[2]);
+   const __m256i Lanes      = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+   const __m256i Shifts     = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+   const __m256i NibbleMask = _mm256_set1_epi32(0xF);
+
+   MIL_INT NbInside = 0;
+   MIL_INT i = 0;
+   for(; i + 8 <= NbPoints; i += 8)
+      {
+      const __m256 X = _mm256_loadu_ps(pX + i);
+      const __m256 Y = _mm256_loadu_ps(pY + i);
+      const __m256 Z = _mm256_loadu_ps(pZ + i);
+      __m256 Inside = _mm256_and_ps(_mm256_cmp_ps(X, MinX, _CMP_GE_OQ), _mm256_cmp_ps(X, MaxX, _CMP_LE_OQ));
+      Inside = _mm256_and_ps(Inside, _mm256_and_ps(_mm256_cmp_ps(Y, MinY, _CMP_GE_OQ), _mm256_cmp_ps(Y, MaxY, _CMP_LE_OQ)));
+      Inside = _mm256_and_ps(Inside, _mm256_and_ps(_mm256_cmp_ps(Z, MinZ, _CMP_GE_OQ), _mm256_cmp_ps(Z, MaxZ, _CMP_LE_OQ)));
+      MIL_UINT32 Mask = (MIL_UINT32)_mm256_movemask_ps(Inside);
+      if(pConfidence)
+         {
+         const __m256i Confidence = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(pConfidence + i)));
+         const __m256i Invalid    = _mm256_cmpeq_epi32(Confidence, _mm256_setzero_si256());
+         Mask &= ~(MIL_UINT32)_mm256_movemask_ps(_mm256_castsi256_ps(Invalid));
+         }
+      if(Mask == 0)
+         continue;
+
+      if(Mask == 0xFF)
+         {
+         _mm256_storeu_ps(pOutX + NbInside, X);
+         _mm256_storeu_ps(pOutY + NbInside, Y);
+         _mm256_storeu_ps(pOutZ + NbInside, Z);
+         NbInside += 8;
+         continue;
+         }
+
+      // Move the points kept to the first lanes and store only those lanes.
+      const MIL_INT NbKept      = CountBits(Mask);
+      const __m256i Permutation = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32((int)COMPRESS_PERMUTATIONS[Mask]), Shifts), NibbleMask);
+      const __m256i StoreMask   = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)NbKept), Lanes);
+      _mm256_maskstore_ps(pOutX + NbInside, StoreMask, _mm256_permutevar8x32_ps(X, Permutation));
+      _mm256_maskstore_ps(pOutY + NbInside, StoreMask, _mm256_permutevar8x32_ps(Y, Permutation));
+      _mm256_maskstore_ps(pOutZ + NbInside, StoreMask, _mm256_permutevar8x32_ps(Z, Permutation));
+      NbInside += NbKept;
+      }
+
+   return NbInside + BoxCropScalar(pX + i, pY + i, pZ + i, pConfidence ? pConfidence + i : M_NULL, NbPoints - i, Box,
+                                   pOutX + NbInside, pOutY + NbInside, pOutZ + NbInside);
+   }
+#endif
+
+#if BOX_CROP_USE_AVX512
+//--------------------------------------------------------------------------
+BOX_CROP_TARGET_AVX512
+static MIL_INT BoxCropAvx512(const MIL_FLOAT* pX, const MIL_FLOAT* pY, const MIL_FLOAT* pZ,
+                             const MIL_UINT8* pConfidence, MIL_INT NbPoints, const SFloatBox& Box,
+                             MIL_FLOAT* pOutX, MIL_FLOAT* pOutY, MIL_FLOAT* pOutZ)
+   {
+   const __m512 MinX = _mm512_set1_ps(Box.Min[0]);
+   const __m512 MinY = _mm512_set1_ps(Box.Min[1]);
+   const __m512 MinZ = _mm512_set1_ps(Box.Min[2]);
+   const __m512 MaxX = _mm512_set1_ps(Box.Max[0]);
+   const __m512 MaxY = _mm512_set1_ps(Box.Max[1]);
+   const __m512 MaxZ = _mm512_set1_ps(Box.Max[2]);
+
+   MIL_INT NbInside = 0;
+   MIL_INT i = 0;
+   for(; i + 16 <= NbPoints; i += 16)
+      {
+      const __m512 X = _mm512_loadu_ps(pX + i);
+      const __m512 Y = _mm512_loadu_ps(pY + i);
+      const __m512 Z = _mm512_loadu_ps(pZ + i);
+      __mmask16 Mask = _mm512_cmp_ps_mask(X, MinX, _CMP_GE_OQ);
+      Mask = _mm512_mask_cmp_ps_mask(Mask, X, MaxX, _CMP_LE_OQ);
+      Mask = _mm512_mask_cmp_ps_mask(Mask, Y, MinY, _CMP_GE_OQ);
+      Mask = _mm512_mask_cmp_ps_mask(Mask, Y, MaxY, _CMP_LE_OQ);
+      Mask = _mm512_mask_cmp_ps_mask(Mask, Z, MinZ, _CMP_GE_OQ);
+      Mask = _mm512_mask_cmp_ps_mask(Mask, Z, MaxZ, _CMP_LE_OQ);
+      if(pConfidence)
+         {
+         // The zero source of the widening keeps GCC from warning about an undefined source.
+         const __m512i Confidence = _mm512_mask_cvtepu8_epi32(_mm512_setzero_si512(), (__mmask16)0xFFFF,
+                                                              _mm_loadu_si128((const __m128i*)(pConfidence + i)));
+         Mask = _mm512_mask_test_epi32_mask(Mask, Confidence, Confidence);
+         }
+      if(Mask == 0)
+         continue;
+
+      // Store the points kept contiguously.
+      _mm512_mask_compressstoreu_ps(pOutX + NbInside, Mask, X);
+      _mm512_mask_compressstoreu_ps(pOutY + NbInside, Mask, Y);
+      _mm512_mask_compressstoreu_ps(pOutZ + NbInside, Mask, Z);
+      NbInside += CountBits((MIL_UINT32)Mask);
+      }
+
+   return NbInside + BoxCropScalar(pX + i, pY + i, pZ + i, pConfidence ? pConfidence + i : M_NULL, NbPoints - i, Box,
+                                   pOutX + NbInside, pOutY + NbInside, pOutZ + NbInside);
+   }
+#endif
+
+//--------------------------------------------------------------------------
+EBoxCropKernel GetBestBoxCropKernel()
+   {
+#if BOX_CROP_USE_AVX2
+#if defined(_MSC_VER)
+   // The AVX states must also be saved by the operating system.
+   int Info[4];
+   __cpuid(Info, 0);
+   if(Info[0] < 7)
+      return eBoxCropScalar;
+   __cpuid(Info, 1);
+   const bool OsSavesAvx = (Info[2] & (1 << 27)) && (Info[2] & (1 << 28));
+   if(!OsSavesAvx)
+      return eBoxCropScalar;
+   const unsigned __int64 EnabledStates = _xgetbv(0);
+   __cpuidex(Info, 7, 0);
+#if BOX_CROP_USE_AVX512
+   if((Info[1] & (1 << 16)) && (EnabledStates & 0xE6) == 0xE6)
+      return eBoxCropAvx512;
+#endif
+   if((Info[1] & (1 << 5)) && (EnabledStates & 0x6) == 0x6)
+      return eBoxCropAvx2;
+#else
+   __builtin_cpu_init();
+#if BOX_CROP_USE_AVX512
+   if(__builtin_cpu_supports("avx512f"))
+      return eBoxCropAvx512;
+#endif
+   if(__builtin_cpu_supports("avx2"))
+      return eBoxCropAvx2;
+#endif
+#endif
+   return eBoxCropScalar;
+   }
+
+//--------------------------------------------------------------------------
+TBoxCropKernel GetBoxCropKernel(EBoxCropKernel Kernel)
+   {
+   switch(Kernel)
+      {
+#if BOX_CROP_USE_AVX2
+      case eBoxCropAvx2:
+         return BoxCropAvx2;
+#endif
+#if BOX_CROP_USE_AVX512
+      case eBoxCropAvx512:
+         return BoxCropAvx512;
+#endif
+      default:
+         return BoxCropScalar;
+      }
+   }
+
+//--------------------------------------------------------------------------
+MIL_CONST_TEXT_PTR GetBoxCropKernelName(EBoxCropKernel Kernel)
+   {
+   switch(Kernel)
+      {
+      case eBoxCropAvx2:
+         return MIL_TEXT("AVX2");
+      case eBoxCropAvx512:
+         return MIL_TEXT("AVX-512");
+      default:
+         return MIL_TEXT("scalar");
+      }
+   }
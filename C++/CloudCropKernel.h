@@ -0,0 +1,52 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudCropKernel.h
+//
+// Synopsis:  Declares the kernels that copy the points of a cloud inside an
+//            axis-aligned box. The AVX2 and AVX-512 kernels test 8 and 16 points
+//            at a time and compact the points kept with masked stores; the
+//            fastest kernel supported by the processor is selected at run time.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+
+//-------------------------------------------------------------------------------
+// Axis-aligned box with float bounds, bounds included.
+//-------------------------------------------------------------------------------
+struct SFloatBox
+   {
+   MIL_FLOAT Min[3];
+   MIL_FLOAT Max[3];
+   };
+
+// Returns the float box holding exactly the float points of the box with
+// the given double bounds.
+SFloatBox MakeFloatBox(const MIL_DOUBLE Min[3], const MIL_DOUBLE Max[3]);
+
+// Box crop kernels.
+enum EBoxCropKernel
+   {
+   eBoxCropScalar = 0,
+   eBoxCropAvx2,
+   eBoxCropAvx512
+   };
+
+// Copies the points inside the box to pOutX, pOutY and pOutZ, in order, and
+// returns their number. The points whose confidence is 0 are skipped when
+// pConfidence is not M_NULL. The output arrays need room for NbPoints values.
+typedef MIL_INT (*TBoxCropKernel)(const MIL_FLOAT* pX, const MIL_FLOAT* pY, const MIL_FLOAT* pZ,
+                                  const MIL_UINT8* pConfidence, MIL_INT NbPoints, const SFloatBox& Box,
+                                  MIL_FLOAT* pOutX, MIL_FLOAT* pOutY, MIL_FLOAT* pOutZ);
+
+// Returns the fastest kernel supported by the processor and the operating system.
+EBoxCropKernel GetBestBoxCropKernel();
+
+// Returns a kernel, or the scalar kernel if it is not built.
+TBoxCropKernel GetBoxCropKernel(EBoxCropKernel Kernel);
+
+// Returns the name of a kernel.
+MIL_CONST_TEXT_PTR GetBoxCropKernelName(EBoxCropKernel Kernel);
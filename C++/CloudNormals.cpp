@@ -0,0 +1,171 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudNormals.cpp
+//
+// Synopsis:  Implements the estimation of the normals of the point clouds.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "CloudNormals.h"
+#include "Octree.h"
+#include "ParallelFor.h"
+#include <math.h>
+#include <float.h>
+
+// Largest number of neighbors of a point.
+static const MIL_INT NORMALS_MAX_NEIGHBORS = 64;
+
+// Minimum number of points processed by a worker thread.
+static const MIL_INT NORMALS_CHUNK_SIZE = 4096;
+
+// Maximum number of Jacobi sweeps of the eigen decomposition.
+static const MIL_INT NORMALS_MAX_SWEEPS = 16;
+
+//--------------------------------------------------------------------------
+// Gets the eigenvector of the smallest eigenvalue of a symmetric 3x3 matrix
+// with Jacobi rotations. The matrix is diagonalized in place.
+//--------------------------------------------------------------------------
+static void GetSmallestEigenvector(MIL_DOUBLE A[3][3], MIL_DOUBLE Vector[3])
+   {
+   MIL_DOUBLE V[3][3] = { { 1.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 0.0, 1.0 } };
+   static const MIL_INT PAIRS[3][2] = { { 0, 1 }, { 0, 2 }, { 1, 2 } };
+   for(MIL_INT Sweep = 0; Sweep < NORMALS_MAX_SWEEPS; Sweep++)
+      {
+      const MIL_DOUBLE OffDiagonal = A[0][1] * A[0][1] + A[0][2] * A[0][2] + A[1][2] * A[1][2];
+      const MIL_DOUBLE Diagonal    = A[0][0] * A[0][0] + A[1][1] * A[1][1] + A[2][2] * A[2][2];
+      if(OffDiagonal <= 1e-24 * Diagonal)
+         break;
+
+      for(MIL_INT r = 0; r < 3; r++)
+         {
+         const MIL_INT p = PAIRS[r][0];
+         const MIL_INT q = PAIRS[r][1];
+         if(A[p][q] == 0.0)
+            continue;
+
+         // Rotate the rows and columns p and q to cancel A[p][q].
+         const MIL_DOUBLE Theta = (A[q][q] - A[p][p]) / (2.0 * A[p][q]);
+         const MIL_DOUBLE T     = (Theta >= 0.0 ? 1.0 : -1.0) / (fabs(Theta) + sqrt(Theta * Theta + 1.0));
+         const MIL_DOUBLE C     = 1.0 / sqrt(T * T + 1.0);
+         const MIL_DOUBLE S     = T * C;
+         for(MIL_INT k = 0; k < 3; k++)
+            {
+            const MIL_DOUBLE Akp = A[k][p];
+            const MIL_DOUBLE Akq = A[k][q];
+            A[k][p] = C * Akp - S * Akq;
+            A[k][q] = S * Akp + C * Akq;
+            }
+         for(MIL_INT k = 0; k < 3; k++)
+            {
+            const MIL_DOUBLE Apk = A[p][k];
+            const MIL_DOUBLE Aqk = A[q][k];
+            A[p][k] = C * Apk - S * Aqk;
+            A[q][k] = S * Apk + C * Aqk;
+            }
+         for(MIL_INT k = 0; k < 3; k++)
+            {
+            const MIL_DOUBLE Vkp = V[k][p];
+            const MIL_DOUBLE Vkq = V[k][q];
+            V[k][p] = C * Vkp - S * Vkq;
+            V[k][q] = S * Vkp + C * Vkq;
+            }
+         }
+      }
+
+   MIL_INT Smallest = 0;
+   for(MIL_INT a = 1; a < 3; a++)
+      {
+      if(A[a][a] < A[Smallest][Smallest])
+         Smallest = a;
+      }
+   for(MIL_INT a = 0; a < 3; a++)
+      Vector[a] = V[a][Smallest];
+   }
+
+//--------------------------------------------------------------------------
+void EstimateNormals(const SCloudView& View, MIL_INT NbNeighbors, const MIL_DOUBLE Orientation[3])
+   {
+   if(!View.NormalX)
+      return;
+   NbNeighbors = NbNeighbors < 3 ? 3 : (NbNeighbors > NORMALS_MAX_NEIGHBORS ? NORMALS_MAX_NEIGHBORS : NbNeighbors);
+
+   // The invalid points are not in the octree.
+   if(View.Confidence)
+      {
+      ParallelFor(0, View.NbPoints, NORMALS_CHUNK_SIZE, [&](MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+         {
+         for(MIL_INT i = ChunkBegin; i < ChunkEnd; i++)
+            {
+            if(View.Confidence[i] == 0)
+               View.NormalX[i] = View.NormalY[i] = View.NormalZ[i] = 0.0f;
+            }
+         });
+      }
+
+   COctree Octree;
+   Octree.Build(View, 1);
+   ParallelFor(0, Octree.NbPoints(), NORMALS_CHUNK_SIZE, [&](MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      MIL_INT   Neighbors[NORMALS_MAX_NEIGHBORS];
+      MIL_FLOAT Distances2[NORMALS_MAX_NEIGHBORS];
+      for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+         {
+         const MIL_INT NbFound = Octree.FindKNearest(Octree.Point(k), NbNeighbors, FLT_MAX, Neighbors, Distances2);
+
+         // Covariance of the neighbors about their centroid.
+         MIL_DOUBLE Centroid[3] = { 0.0, 0.0, 0.0 };
+         for(MIL_INT n = 0; n < NbFound; n++)
+            {
+            const MIL_FLOAT* pNeighbor = Octree.Point(Neighbors[n]);
+            for(MIL_INT a = 0; a < 3; a++)
+               Centroid[a] += pNeighbor[a];
+            }
+         for(MIL_INT a = 0; a < 3; a++)
+            Centroid[a] /= (MIL_DOUBLE)(NbFound > 0 ? NbFound : 1);
+
+         MIL_DOUBLE Covariance[3][3] = { { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0 } };
+         for(MIL_INT n = 0; n < NbFound; n++)
+            {
+            const MIL_FLOAT* pNeighbor = Octree.Point(Neighbors[n]);
+            const MIL_DOUBLE Offset[3] = { pNeighbor[0] - Centroid[0], pNeighbor[1] - Centroid[1], pNeighbor[2] - Centroid[2] };
+            for(MIL_INT r = 0; r < 3; r++)
+               {
+               for(MIL_INT c = r; c < 3; c++)
+                  Covariance[r][c] += Offset[r] * Offset[c];
+               }
+            }
+         for(MIL_INT r = 0; r < 3; r++)
+            {
+            for(MIL_INT c = 0; c < r; c++)
+               Covariance[r][c] = Covariance[c][r];
+            }
+
+         MIL_DOUBLE Normal[3] = { 0.0, 0.0, 0.0 };
+         if(NbFound >= 3 && Covariance[0][0] + Covariance[1][1] + Covariance[2][2] > 0.0)
+            {
+            GetSmallestEigenvector(Covariance, Normal);
+            if(Normal[0] * Orientation[0] + Normal[1] * Orientation[1] + Normal[2] * Orientation[2] < 0.0)
+               {
+               for(MIL_INT a = 0; a < 3; a++)
+                  Normal[a] = -Normal[a];
+               }
+            }
+
+         const MIL_INT i = Octree.CloudIndex(k);
+         View.NormalX[i] = (MIL_FLOAT)Normal[0];
+         View.NormalY[i] = (MIL_FLOAT)Normal[1];
+         View.NormalZ[i] = (MIL_FLOAT)Normal[2];
+         }
+      });
+   }
+
+//--------------------------------------------------------------------------
+bool AddEstimatedNormals(MIL_ID MilContainer, MIL_INT NbNeighbors, const MIL_DOUBLE Orientation[3])
+   {
+   SCloudView View;
+   if(!AllocNormalsComponent(MilContainer, &View))
+      return false;
+   EstimateNormals(View, NbNeighbors, Orientation);
+   return true;
+   }
@@ -0,0 +1,29 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudNormals.h
+//
+// Synopsis:  Declares the estimation of the normals of the point clouds. The normal
+//            of a point is the direction of least variance of its nearest
+//            neighbors, found in an octree of the cloud.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include "PointCloudData.h"
+
+// Estimates the normals of the valid points of a cloud from their NbNeighbors
+// nearest neighbors, the point included, and writes them in the normals of
+// the view. The points are processed in parallel in the Morton order of the
+// octree, so that the neighbors of consecutive points are close in memory.
+// The normals are oriented so that they do not point away from Orientation;
+// the normals of the invalid points and of the points whose neighbors do not
+// span a plane are 0.
+void EstimateNormals(const SCloudView& View, MIL_INT NbNeighbors, const MIL_DOUBLE Orientation[3]);
+
+// Adds a normals component holding the normals estimated by EstimateNormals
+// to a point cloud container that has none. Returns false if the range of
+// the cloud is not an accessible float range.
+bool AddEstimatedNormals(MIL_ID MilContainer, MIL_INT NbNeighbors, const MIL_DOUBLE Orientation[3]);
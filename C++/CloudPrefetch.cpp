@@ -0,0 +1,64 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudPrefetch.cpp
+//
+// Synopsis:  Implements the background restoration of the point clouds.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "CloudPrefetch.h"
+#include <utility>
+
+//--------------------------------------------------------------------------
+CCloudPrefetcher::CCloudPrefetcher()
+   : m_NbFiles(0)
+   {
+   }
+
+//--------------------------------------------------------------------------
+CCloudPrefetcher::~CCloudPrefetcher()
+   {
+   // The restoration writes in the clouds; it must end before they are freed.
+   if(m_Thread.joinable())
+      m_Thread.join();
+   }
+
+//--------------------------------------------------------------------------
+void CCloudPrefetcher::Start(MIL_ID MilSystem, const MIL_CONST_TEXT_PTR* FileNames, MIL_INT NbFiles,
+                             const SCloudLoadOptions& Options)
+   {
+   if(m_Thread.joinable())
+      m_Thread.join();
+
+   m_NbFiles = NbFiles;
+   m_FileNames.assign(FileNames, FileNames + NbFiles);
+   m_Options = Options;
+   m_pClouds.reset(new SLoadedCloud[(size_t)NbFiles]);
+
+   m_Thread = std::thread([this, MilSystem]()
+      {
+      std::vector<MIL_CONST_TEXT_PTR> FileNamePtrs;
+      for(size_t f = 0; f < m_FileNames.size(); f++)
+         FileNamePtrs.push_back(m_FileNames[f].c_str());
+      RestorePointClouds(MilSystem, FileNamePtrs.data(), m_NbFiles, m_Options, m_pClouds.get());
+      });
+   }
+
+//--------------------------------------------------------------------------
+MIL_INT CCloudPrefetcher::Wait(SLoadedCloud* pClouds)
+   {
+   if(!m_Thread.joinable())
+      return 0;
+   m_Thread.join();
+
+   for(MIL_INT f = 0; f < m_NbFiles; f++)
+      {
+      pClouds[f].Container = std::move(m_pClouds[f].Container);
+      pClouds[f].Stats     = m_pClouds[f].Stats;
+      pClouds[f].Cropped.swap(m_pClouds[f].Cropped);
+      pClouds[f].CroppedNbPoints.swap(m_pClouds[f].CroppedNbPoints);
+      }
+   m_pClouds.reset();
+   return m_NbFiles;
+   }
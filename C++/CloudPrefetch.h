@@ -0,0 +1,54 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudPrefetch.h
+//
+// Synopsis:  Declares the prefetcher that restores the point clouds of the next
+//            scan pair on a background thread while the current pair is
+//            registered and stitched.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "PointCloudIO.h"
+
+//-------------------------------------------------------------------------------
+// Restores a set of point cloud files in the background with
+// RestorePointClouds. The clouds are decoded and cropped in the crop boxes of
+// the options on the background thread and handed over by Wait.
+//-------------------------------------------------------------------------------
+class CCloudPrefetcher
+   {
+   public:
+      CCloudPrefetcher();
+      ~CCloudPrefetcher();
+
+      // Starts restoring the files. The file names and the options are copied.
+      // A pending prefetch is waited for and its clouds are discarded.
+      void Start(MIL_ID MilSystem, const MIL_CONST_TEXT_PTR* FileNames, MIL_INT NbFiles,
+                 const SCloudLoadOptions& Options);
+
+      // Returns true if clouds were started and not handed over yet.
+      bool IsPending() const { return m_Thread.joinable(); }
+
+      // Waits until the files are restored and moves the clouds in pClouds,
+      // which must hold one cloud per file. Returns the number of clouds,
+      // 0 if no prefetch is pending.
+      MIL_INT Wait(SLoadedCloud* pClouds);
+
+   private:
+      // Disallow copy.
+      CCloudPrefetcher(const CCloudPrefetcher&);
+      CCloudPrefetcher& operator=(const CCloudPrefetcher&);
+
+      std::thread                     m_Thread;
+      MIL_INT                         m_NbFiles;
+      std::vector<MIL_STRING>         m_FileNames;
+      SCloudLoadOptions               m_Options;
+      std::unique_ptr<SLoadedCloud[]> m_pClouds;
+   };
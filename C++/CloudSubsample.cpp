@@ -0,0 +1,286 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudSubsample.cpp
+//
+// Synopsis:  Implements the voxel grid subsampling of the point clouds.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "CloudSubsample.h"
+#include "ParallelFor.h"
+#include <float.h>
+#include <math.h>
+#include <utility>
+#include <vector>
+
+// Minimum number of points processed by a worker thread.
+static const MIL_INT SUBSAMPLE_CHUNK_SIZE = 65536;
+
+// Number of bits of a cell coordinate in a cell key.
+static const MIL_INT CELL_BITS_PER_AXIS = 21;
+static const MIL_UINT64 CELL_COORDINATE_MASK = (1 << CELL_BITS_PER_AXIS) - 1;
+
+// Initial number of slots of a hash table.
+static const MIL_UINT64 INITIAL_TABLE_SIZE = 1024;
+
+// Key of the invalid points and of the empty slots of the hash tables; the
+// keys of the cells use 63 bits.
+static const MIL_UINT64 NO_CELL_KEY = ~(MIL_UINT64)0;
+
+// Points of an occupied cell.
+struct SVoxelCell
+   {
+   MIL_UINT64 Key;
+   MIL_INT    NbPoints;
+   MIL_DOUBLE Sum[3];
+   MIL_DOUBLE NormalSum[3];       // Of the centroid, when the cloud has normals.
+   MIL_INT    Nearest;            // Index of the point nearest to the center; the first point for the centroid.
+   MIL_DOUBLE NearestDistance;    // Its squared distance to the center.
+   };
+
+//--------------------------------------------------------------------------
+// Mixes the bits of a cell key so that neighboring cells are spread over the
+// partitions and the slots of the hash tables.
+//--------------------------------------------------------------------------
+static inline MIL_UINT64 HashCellKey(MIL_UINT64 Key)
+   {
+   Key ^= Key >> 33;
+   Key *= 0xFF51AFD7ED558CCDULL;
+   Key ^= Key >> 33;
+   Key *= 0xC4CEB9FE1A85EC53ULL;
+   Key ^= Key >> 33;
+   return Key;
+   }
+
+//--------------------------------------------------------------------------
+MIL_UNIQUE_BUF_ID VoxelGridSubsample(MIL_ID MilSystem, const SCloudView& View, MIL_DOUBLE CellSize,
+                                     EVoxelPoint Point)
+   {
+   SCloudStats Stats;
+   ComputeCloudStats(View, &Stats);
+
+   const MIL_DOUBLE InvCellSize = 1.0 / CellSize;
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      if(Stats.NbPoints > 0 && !((Stats.Max[a] - Stats.Min[a]) * InvCellSize < (MIL_DOUBLE)CELL_COORDINATE_MASK))
+         return MIL_UNIQUE_BUF_ID();
+      }
+
+   // Get the cell of each point and count the points of each chunk in each partition.
+   const MIL_INT NbChunks     = GetNbChunks(View.NbPoints, SUBSAMPLE_CHUNK_SIZE);
+   const MIL_INT NbPartitions = NbChunks;
+   std::vector<MIL_UINT64> Keys((size_t)View.NbPoints);
+   std::vector<MIL_INT>    Offsets((size_t)(NbChunks * NbPartitions), 0);
+   ParallelChunks(0, View.NbPoints, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      MIL_INT* pCounts = &Offsets[(size_t)(Chunk * NbPartitions)];
+      for(MIL_INT i = ChunkBegin; i < ChunkEnd; i++)
+         {
+         if(View.Confidence && View.Confidence[i] == 0)
+            {
+            Keys[(size_t)i] = NO_CELL_KEY;
+            continue;
+            }
+
+         const MIL_UINT64 CellX = (MIL_UINT64)((View.X[i] - Stats.Min[0]) * InvCellSize);
+         const MIL_UINT64 CellY = (MIL_UINT64)((View.Y[i] - Stats.Min[1]) * InvCellSize);
+         const MIL_UINT64 CellZ = (MIL_UINT64)((View.Z[i] - Stats.Min[2]) * InvCellSize);
+         const MIL_UINT64 Key   = CellX | (CellY << CELL_BITS_PER_AXIS) | (CellZ << (2 * CELL_BITS_PER_AXIS));
+         Keys[(size_t)i] = Key;
+         pCounts[HashCellKey(Key) % (MIL_UINT64)NbPartitions]++;
+         }
+      });
+
+   // Get the position of the points of each chunk in each partition.
+   std::vector<MIL_INT> PartitionBegin((size_t)NbPartitions + 1, 0);
+   MIL_INT Position = 0;
+   for(MIL_INT p = 0; p < NbPartitions; p++)
+      {
+      PartitionBegin[(size_t)p] = Position;
+      for(MIL_INT c = 0; c < NbChunks; c++)
+         {
+         const MIL_INT Count = Offsets[(size_t)(c * NbPartitions + p)];
+         Offsets[(size_t)(c * NbPartitions + p)] = Position;
+         Position += Count;
+         }
+      }
+   PartitionBegin[(size_t)NbPartitions] = Position;
+
+   // Sort the point indices by partition, keeping their order.
+   std::vector<MIL_UINT32> Order((size_t)Position);
+   ParallelChunks(0, View.NbPoints, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      MIL_INT* pOffsets = &Offsets[(size_t)(Chunk * NbPartitions)];
+      for(MIL_INT i = ChunkBegin; i < ChunkEnd; i++)
+         {
+         const MIL_UINT64 Key = Keys[(size_t)i];
+         if(Key != NO_CELL_KEY)
+            Order[(size_t)(pOffsets[HashCellKey(Key) % (MIL_UINT64)NbPartitions]++)] = (MIL_UINT32)i;
+         }
+      });
+
+   // Gather the cells of each partition in its own open addressing hash table.
+   std::vector< std::vector<SVoxelCell> > Cells((size_t)NbPartitions);
+   ParallelChunks(0, NbPartitions, NbPartitions, [&](MIL_INT, MIL_INT PartitionFirst, MIL_INT PartitionEnd)
+      {
+      for(MIL_INT p = PartitionFirst; p < PartitionEnd; p++)
+         {
+         const MIL_INT Begin = PartitionBegin[(size_t)p];
+         const MIL_INT End   = PartitionBegin[(size_t)p + 1];
+
+         // The table is grown as the cells are found, keeping it at most half full.
+         MIL_UINT64 TableSize = INITIAL_TABLE_SIZE;
+         std::vector<MIL_UINT64> TableKeys((size_t)TableSize, NO_CELL_KEY);
+         std::vector<MIL_UINT32> TableCells((size_t)TableSize);
+         std::vector<SVoxelCell>& PartitionCells = Cells[(size_t)p];
+
+         for(MIL_INT o = Begin; o < End; o++)
+            {
+            const MIL_UINT32 i   = Order[(size_t)o];
+            const MIL_UINT64 Key = Keys[i];
+
+            // The partition is chosen from the low bits of the hash; probe from the high bits.
+            MIL_UINT64 Slot = (HashCellKey(Key) >> 32) & (TableSize - 1);
+            while(TableKeys[(size_t)Slot] != NO_CELL_KEY && TableKeys[(size_t)Slot] != Key)
+               Slot = (Slot + 1) & (TableSize - 1);
+            if(TableKeys[(size_t)Slot] == NO_CELL_KEY)
+               {
+               if(2 * (PartitionCells.size() + 1) > TableSize)
+                  {
+                  TableSize *= 2;
+                  TableKeys.assign((size_t)TableSize, NO_CELL_KEY);
+                  TableCells.resize((size_t)TableSize);
+                  for(size_t c = 0; c < PartitionCells.size(); c++)
+                     {
+                     MIL_UINT64 CellSlot = (HashCellKey(PartitionCells[c].Key) >> 32) & (TableSize - 1);
+                     while(TableKeys[(size_t)CellSlot] != NO_CELL_KEY)
+                        CellSlot = (CellSlot + 1) & (TableSize - 1);
+                     TableKeys[(size_t)CellSlot]  = PartitionCells[c].Key;
+                     TableCells[(size_t)CellSlot] = (MIL_UINT32)c;
+                     }
+                  Slot = (HashCellKey(Key) >> 32) & (TableSize - 1);
+                  while(TableKeys[(size_t)Slot] != NO_CELL_KEY)
+                     Slot = (Slot + 1) & (TableSize - 1);
+                  }
+
+               SVoxelCell Cell;
+               Cell.Key             = Key;
+               Cell.NbPoints        = 0;
+               Cell.Sum[0]          = Cell.Sum[1] = Cell.Sum[2] = 0.0;
+               Cell.NormalSum[0]    = Cell.NormalSum[1] = Cell.NormalSum[2] = 0.0;
+               Cell.Nearest         = i;
+               Cell.NearestDistance = DBL_MAX;
+               TableKeys[(size_t)Slot]  = Key;
+               TableCells[(size_t)Slot] = (MIL_UINT32)PartitionCells.size();
+               PartitionCells.push_back(Cell);
+               }
+
+            SVoxelCell& Cell = PartitionCells[TableCells[(size_t)Slot]];
+            Cell.NbPoints++;
+            if(Point == eVoxelCentroid)
+               {
+               Cell.Sum[0] += View.X[i];
+               Cell.Sum[1] += View.Y[i];
+               Cell.Sum[2] += View.Z[i];
+               if(View.NormalX)
+                  {
+                  Cell.NormalSum[0] += View.NormalX[i];
+                  Cell.NormalSum[1] += View.NormalY[i];
+                  Cell.NormalSum[2] += View.NormalZ[i];
+                  }
+               }
+            else
+               {
+               const MIL_DOUBLE CenterX = Stats.Min[0] + ((MIL_DOUBLE)( Key                                   & CELL_COORDINATE_MASK) + 0.5) * CellSize;
+               const MIL_DOUBLE CenterY = Stats.Min[1] + ((MIL_DOUBLE)((Key >> CELL_BITS_PER_AXIS)       & CELL_COORDINATE_MASK) + 0.5) * CellSize;
+               const MIL_DOUBLE CenterZ = Stats.Min[2] + ((MIL_DOUBLE)((Key >> (2 * CELL_BITS_PER_AXIS)) & CELL_COORDINATE_MASK) + 0.5) * CellSize;
+               const MIL_DOUBLE Distance = (View.X[i] - CenterX) * (View.X[i] - CenterX) +
+                                           (View.Y[i] - CenterY) * (View.Y[i] - CenterY) +
+                                           (View.Z[i] - CenterZ) * (View.Z[i] - CenterZ);
+               if(Distance < Cell.NearestDistance)
+                  {
+                  Cell.Nearest         = i;
+                  Cell.NearestDistance = Distance;
+                  }
+               }
+            }
+         }
+      });
+
+   // Write one point per cell, the partitions one after the other.
+   std::vector<MIL_INT> CellOffsets((size_t)NbPartitions + 1, 0);
+   for(MIL_INT p = 0; p < NbPartitions; p++)
+      CellOffsets[(size_t)p + 1] = CellOffsets[(size_t)p] + (MIL_INT)Cells[(size_t)p].size();
+
+   // The normals are kept, averaged over the cell for the centroid.
+   SCloudView Subsampled;
+   MIL_UNIQUE_BUF_ID MilSubsampled = AllocPointCloudContainer(MilSystem, CellOffsets.back(),
+                                                              eComponentRange | (View.NormalX ? eComponentNormals : 0),
+                                                              &Subsampled);
+   ParallelChunks(0, NbPartitions, NbPartitions, [&](MIL_INT, MIL_INT PartitionFirst, MIL_INT PartitionEnd)
+      {
+      for(MIL_INT p = PartitionFirst; p < PartitionEnd; p++)
+         {
+         const std::vector<SVoxelCell>& PartitionCells = Cells[(size_t)p];
+         MIL_INT Out = CellOffsets[(size_t)p];
+         for(size_t c = 0; c < PartitionCells.size(); c++, Out++)
+            {
+            const SVoxelCell& Cell = PartitionCells[c];
+            if(Point == eVoxelCentroid)
+               {
+               Subsampled.X[Out] = (MIL_FLOAT)(Cell.Sum[0] / Cell.NbPoints);
+               Subsampled.Y[Out] = (MIL_FLOAT)(Cell.Sum[1] / Cell.NbPoints);
+               Subsampled.Z[Out] = (MIL_FLOAT)(Cell.Sum[2] / Cell.NbPoints);
+               }
+            else
+               {
+               Subsampled.X[Out] = View.X[Cell.Nearest];
+               Subsampled.Y[Out] = View.Y[Cell.Nearest];
+               Subsampled.Z[Out] = View.Z[Cell.Nearest];
+               }
+
+            if(!View.NormalX)
+               continue;
+            const MIL_DOUBLE Norm = sqrt(Cell.NormalSum[0] * Cell.NormalSum[0] +
+                                         Cell.NormalSum[1] * Cell.NormalSum[1] +
+                                         Cell.NormalSum[2] * Cell.NormalSum[2]);
+            if(Point == eVoxelCentroid && Norm > 1e-6 * Cell.NbPoints)
+               {
+               Subsampled.NormalX[Out] = (MIL_FLOAT)(Cell.NormalSum[0] / Norm);
+               Subsampled.NormalY[Out] = (MIL_FLOAT)(Cell.NormalSum[1] / Norm);
+               Subsampled.NormalZ[Out] = (MIL_FLOAT)(Cell.NormalSum[2] / Norm);
+               }
+            else
+               {
+               // The nearest point, or a cell whose normals cancel out, keeps the normal of its point.
+               Subsampled.NormalX[Out] = View.NormalX[Cell.Nearest];
+               Subsampled.NormalY[Out] = View.NormalY[Cell.Nearest];
+               Subsampled.NormalZ[Out] = View.NormalZ[Cell.Nearest];
+               }
+            }
+         }
+      });
+
+   return MilSubsampled;
+   }
+
+//--------------------------------------------------------------------------
+bool BuildVoxelPyramid(MIL_ID MilSystem, const SCloudView& View, MIL_DOUBLE FinestCellSize, MIL_INT NbLevels,
+                       EVoxelPoint Point, std::vector<MIL_UNIQUE_BUF_ID>* pLevels)
+   {
+   pLevels->clear();
+   SCloudView LevelView = View;
+   MIL_DOUBLE CellSize  = FinestCellSize;
+   for(MIL_INT l = 0; l < NbLevels; l++, CellSize *= 2.0)
+      {
+      MIL_UNIQUE_BUF_ID MilLevel = VoxelGridSubsample(MilSystem, LevelView, CellSize, Point);
+      if(MilLevel == M_NULL || !GetCloudView(MilLevel, &LevelView))
+         {
+         pLevels->clear();
+         return false;
+         }
+      pLevels->push_back(std::move(MilLevel));
+      }
+   return true;
+   }
@@ -0,0 +1,40 @@
+﻿//***************************************************************************************/
+//
+// File name: CloudSubsample.h
+//
+// Synopsis:  Declares the voxel grid subsampling of the point clouds. The points
+//            are spread over cubic cells of a metric grid and each occupied cell
+//            is replaced by a single point, which bounds the number of points by
+//            the extent of the surface rather than by the density of the scan.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include "PointCloudData.h"
+#include <vector>
+
+// Point kept for each occupied cell.
+enum EVoxelPoint
+   {
+   eVoxelCentroid = 0,   // Centroid of the points of the cell.
+   eVoxelNearest         // Point of the cell nearest to its center.
+   };
+
+// Subsamples the valid points of a point cloud on a grid of cubic cells of
+// the given size aligned on the minimum of its bounding box. The cells are
+// gathered in hash tables filled in parallel, each worker owning the cells
+// whose hash falls in its partition. Returns a container holding the range
+// of one point per occupied cell, with its normal averaged over the cell for
+// the centroid when the cloud has normals, or an empty identifier if the grid
+// would have more than 2^21 cells along an axis.
+MIL_UNIQUE_BUF_ID VoxelGridSubsample(MIL_ID MilSystem, const SCloudView& View, MIL_DOUBLE CellSize,
+                                     EVoxelPoint Point);
+
+// Subsamples a point cloud on NbLevels voxel grids whose cells double in size
+// from FinestCellSize, each level being subsampled from the finer one. Level 0
+// is the finest. Returns false and no levels if a level cannot be subsampled.
+bool BuildVoxelPyramid(MIL_ID MilSystem, const SCloudView& View, MIL_DOUBLE FinestCellSize, MIL_INT NbLevels,
+                       EVoxelPoint Point, std::vector<MIL_UNIQUE_BUF_ID>* pLevels);
@@ -0,0 +1,462 @@
+﻿//***************************************************************************************/
+//
+// File name: GlobalRegistration.cpp
+//
+// Synopsis:  Implements the global registration of the point clouds from FPFH
+//            descriptors and a RANSAC.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "GlobalRegistration.h"
+#include "CloudNormals.h"
+#include "CloudSubsample.h"
+#include "IcpRegistration.h"
+#include "Octree.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <vector>
+
+// Number of bins of each of the 3 angular features of a histogram.
+static const MIL_INT FPFH_NB_BINS = 11;
+static const MIL_INT FPFH_SIZE    = 3 * FPFH_NB_BINS;
+
+// Minimum number of keypoints described by a worker thread.
+static const MIL_INT GLOBAL_CHUNK_SIZE = 256;
+
+// Minimum number of hypotheses evaluated by a worker thread.
+static const MIL_INT GLOBAL_HYPOTHESIS_CHUNK_SIZE = 1024;
+
+// Smallest ratio of the lengths of the matching edges of the 3 pairs of a hypothesis.
+static const MIL_DOUBLE GLOBAL_EDGE_LENGTH_RATIO = 0.9;
+
+// Minimum number of inliers of the transformation found.
+static const MIL_INT GLOBAL_MIN_INLIERS = 10;
+
+static const MIL_DOUBLE GLOBAL_PI = 3.14159265358979323846;
+
+// Keypoints of a cloud: the points of its voxel grid subsampling, indexed by an
+// octree, with their normals and descriptors in the order of the octree.
+struct SKeypoints
+   {
+   MIL_UNIQUE_BUF_ID      MilCloud;
+   COctree                Octree;
+   std::vector<MIL_FLOAT> Normals;        // 3 per keypoint, 0 if it could not be estimated.
+   std::vector<MIL_FLOAT> Descriptors;    // FPFH_SIZE per keypoint, 0 if it has no neighbors.
+   };
+
+// Pair of a moving keypoint and a reference keypoint.
+struct SGlobalPair
+   {
+   MIL_DOUBLE Moving[3];
+   MIL_DOUBLE Reference[3];
+   };
+
+// Best hypothesis of a worker thread.
+struct SHypothesis
+   {
+   MIL_INT Number;
+   MIL_INT NbInliers;
+   };
+
+//--------------------------------------------------------------------------
+// Mixes the bits of a 64-bit value (SplitMix64 finalizer).
+//--------------------------------------------------------------------------
+static inline MIL_UINT64 MixBits(MIL_UINT64 Value)
+   {
+   Value += 0x9E3779B97F4A7C15ULL;
+   Value = (Value ^ (Value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   Value = (Value ^ (Value >> 27)) * 0x94D049BB133111EBULL;
+   return Value ^ (Value >> 31);
+   }
+
+//--------------------------------------------------------------------------
+// Adds the features of the pair of a point and its neighbor, both with a
+// normal, to a histogram. The features are the angles of the normal of one
+// point in the Darboux frame of the other, chosen so that they do not depend
+// on the order of the points.
+//--------------------------------------------------------------------------
+static void AddPairFeatures(const MIL_FLOAT* pPoint, const MIL_FLOAT* pNormal,
+                            const MIL_FLOAT* pNeighbor, const MIL_FLOAT* pNeighborNormal,
+                            MIL_DOUBLE Weight, MIL_DOUBLE* pHistogram)
+   {
+   MIL_DOUBLE d[3] = { (MIL_DOUBLE)pNeighbor[0] - pPoint[0],
+                       (MIL_DOUBLE)pNeighbor[1] - pPoint[1],
+                       (MIL_DOUBLE)pNeighbor[2] - pPoint[2] };
+   const MIL_DOUBLE Length = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+   if(Length == 0.0)
+      return;
+
+   const MIL_FLOAT* u = pNormal;
+   const MIL_FLOAT* n = pNeighborNormal;
+   const MIL_DOUBLE Angle1 = (u[0] * d[0] + u[1] * d[1] + u[2] * d[2]) / Length;
+   const MIL_DOUBLE Angle2 = (n[0] * d[0] + n[1] * d[1] + n[2] * d[2]) / Length;
+   MIL_DOUBLE Feature3 = Angle1;
+   if(acos(fabs(Angle1)) > acos(fabs(Angle2)))
+      {
+      std::swap(u, n);
+      for(MIL_INT a = 0; a < 3; a++)
+         d[a] = -d[a];
+      Feature3 = -Angle2;
+      }
+
+   // Darboux frame (u, v, w) of the first point.
+   MIL_DOUBLE v[3] = { d[1] * u[2] - d[2] * u[1], d[2] * u[0] - d[0] * u[2], d[0] * u[1] - d[1] * u[0] };
+   const MIL_DOUBLE NormV = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+   if(NormV == 0.0)
+      return;
+   for(MIL_INT a = 0; a < 3; a++)
+      v[a] /= NormV;
+   const MIL_DOUBLE w[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+
+   const MIL_DOUBLE Feature1 = atan2(w[0] * n[0] + w[1] * n[1] + w[2] * n[2], u[0] * n[0] + u[1] * n[1] + u[2] * n[2]);
+   const MIL_DOUBLE Feature2 = v[0] * n[0] + v[1] * n[1] + v[2] * n[2];
+
+   const MIL_DOUBLE Ratios[3] = { (Feature1 + GLOBAL_PI) / (2.0 * GLOBAL_PI), (Feature2 + 1.0) * 0.5, (Feature3 + 1.0) * 0.5 };
+   for(MIL_INT f = 0; f < 3; f++)
+      {
+      MIL_INT Bin = (MIL_INT)floor(Ratios[f] * FPFH_NB_BINS);
+      Bin = Bin < 0 ? 0 : (Bin >= FPFH_NB_BINS ? FPFH_NB_BINS - 1 : Bin);
+      pHistogram[f * FPFH_NB_BINS + Bin] += Weight;
+      }
+   }
+
+//--------------------------------------------------------------------------
+// Subsamples a cloud on the voxel grid, estimates the normals of its points
+// and computes their FPFH descriptors: the simplified histogram of the pairs
+// of each point with its neighbors, to which the simplified histograms of
+// the neighbors are added with the inverse of their distance as weight.
+// Returns false if the cloud cannot be subsampled.
+//--------------------------------------------------------------------------
+static bool ComputeKeypoints(MIL_ID MilSystem, const SCloudView& View, const SGlobalRegistrationSettings& Settings,
+                             SKeypoints* pKeypoints)
+   {
+   SCloudView KeypointView;
+   pKeypoints->MilCloud = VoxelGridSubsample(MilSystem, View, Settings.VoxelSize, eVoxelCentroid);
+   if(pKeypoints->MilCloud == M_NULL || !AllocNormalsComponent(pKeypoints->MilCloud, &KeypointView))
+      return false;
+   EstimateNormals(KeypointView, Settings.NormalNeighbors, Settings.NormalOrientation);
+
+   const COctree& Octree = pKeypoints->Octree;
+   pKeypoints->Octree.Build(KeypointView, 1);
+   const MIL_INT NbKeypoints = Octree.NbPoints();
+   pKeypoints->Normals.resize((size_t)(3 * NbKeypoints));
+   for(MIL_INT k = 0; k < NbKeypoints; k++)
+      {
+      const MIL_INT i = Octree.CloudIndex(k);
+      pKeypoints->Normals[(size_t)(3 * k)]     = KeypointView.NormalX[i];
+      pKeypoints->Normals[(size_t)(3 * k + 1)] = KeypointView.NormalY[i];
+      pKeypoints->Normals[(size_t)(3 * k + 2)] = KeypointView.NormalZ[i];
+      }
+
+   // The neighbors of a keypoint include itself.
+   const MIL_FLOAT Radius2 = (MIL_FLOAT)(Settings.FeatureRadius * Settings.FeatureRadius);
+   const MIL_INT   MaxK    = Settings.MaxFeatureNeighbors + 1;
+   const MIL_FLOAT* Normals = &pKeypoints->Normals[0];
+   auto HasNormal = [Normals](MIL_INT k)
+      {
+      return Normals[3 * k] != 0.0f || Normals[3 * k + 1] != 0.0f || Normals[3 * k + 2] != 0.0f;
+      };
+
+   // Simplified histograms, normalized so that each feature sums to 100.
+   std::vector<MIL_DOUBLE> Simplified((size_t)(FPFH_SIZE * NbKeypoints), 0.0);
+   ParallelFor(0, NbKeypoints, GLOBAL_CHUNK_SIZE, [&](MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      std::vector<MIL_INT>   Neighbors((size_t)MaxK);
+      std::vector<MIL_FLOAT> Distances2((size_t)MaxK);
+      for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+         {
+         if(!HasNormal(k))
+            continue;
+         MIL_DOUBLE*     pHistogram = &Simplified[(size_t)(FPFH_SIZE * k)];
+         const MIL_INT   NbFound    = Octree.FindKNearest(Octree.Point(k), MaxK, Radius2, &Neighbors[0], &Distances2[0]);
+         MIL_INT         NbPairs    = 0;
+         for(MIL_INT j = 0; j < NbFound; j++)
+            {
+            const MIL_INT Neighbor = Neighbors[(size_t)j];
+            if(Neighbor == k || !HasNormal(Neighbor))
+               continue;
+            AddPairFeatures(Octree.Point(k), &Normals[3 * k], Octree.Point(Neighbor), &Normals[3 * Neighbor], 1.0, pHistogram);
+            NbPairs++;
+            }
+         for(MIL_INT b = 0; NbPairs > 0 && b < FPFH_SIZE; b++)
+            pHistogram[b] *= 100.0 / NbPairs;
+         }
+      });
+
+   // Add the weighted histograms of the neighbors.
+   pKeypoints->Descriptors.assign((size_t)(FPFH_SIZE * NbKeypoints), 0.0f);
+   ParallelFor(0, NbKeypoints, GLOBAL_CHUNK_SIZE, [&](MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      std::vector<MIL_INT>   Neighbors((size_t)MaxK);
+      std::vector<MIL_FLOAT> Distances2((size_t)MaxK);
+      MIL_DOUBLE Weighted[FPFH_SIZE];
+      for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+         {
+         if(!HasNormal(k))
+            continue;
+         for(MIL_INT b = 0; b < FPFH_SIZE; b++)
+            Weighted[b] = 0.0;
+         const MIL_INT NbFound = Octree.FindKNearest(Octree.Point(k), MaxK, Radius2, &Neighbors[0], &Distances2[0]);
+         for(MIL_INT j = 0; j < NbFound; j++)
+            {
+            const MIL_INT Neighbor = Neighbors[(size_t)j];
+            if(Neighbor == k || Distances2[(size_t)j] <= 0.0f)
+               continue;
+            const MIL_DOUBLE  Weight = 1.0 / sqrt((MIL_DOUBLE)Distances2[(size_t)j]);
+            const MIL_DOUBLE* pNeighborHistogram = &Simplified[(size_t)(FPFH_SIZE * Neighbor)];
+            for(MIL_INT b = 0; b < FPFH_SIZE; b++)
+               Weighted[b] += Weight * pNeighborHistogram[b];
+            }
+
+         const MIL_DOUBLE* pHistogram  = &Simplified[(size_t)(FPFH_SIZE * k)];
+         MIL_FLOAT*        pDescriptor = &pKeypoints->Descriptors[(size_t)(FPFH_SIZE * k)];
+         for(MIL_INT f = 0; f < 3; f++)
+            {
+            MIL_DOUBLE Sum = 0.0;
+            for(MIL_INT b = f * FPFH_NB_BINS; b < (f + 1) * FPFH_NB_BINS; b++)
+               Sum += Weighted[b];
+            const MIL_DOUBLE Scale = Sum > 0.0 ? 100.0 / Sum : 0.0;
+            for(MIL_INT b = f * FPFH_NB_BINS; b < (f + 1) * FPFH_NB_BINS; b++)
+               pDescriptor[b] = (MIL_FLOAT)(pHistogram[b] + Scale * Weighted[b]);
+            }
+         }
+      });
+   return true;
+   }
+
+//--------------------------------------------------------------------------
+// Finds, for each keypoint of a set, the keypoint of another set with the
+// nearest descriptor, by an exhaustive search in parallel. The keypoints
+// without descriptor are not paired; their nearest keypoint is -1.
+//--------------------------------------------------------------------------
+static void FindNearestDescriptors(const SKeypoints& From, const SKeypoints& To, std::vector<MIL_INT32>* pNearest)
+   {
+   const MIL_INT NbFrom = From.Octree.NbPoints();
+   const MIL_INT NbTo   = To.Octree.NbPoints();
+   auto IsDescribed = [](const MIL_FLOAT* pDescriptor)
+      {
+      for(MIL_INT b = 0; b < FPFH_SIZE; b++)
+         if(pDescriptor[b] != 0.0f)
+            return true;
+      return false;
+      };
+
+   pNearest->assign((size_t)NbFrom, -1);
+   ParallelFor(0, NbFrom, GLOBAL_CHUNK_SIZE, [&](MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+         {
+         const MIL_FLOAT* pDescriptor = &From.Descriptors[(size_t)(FPFH_SIZE * k)];
+         if(!IsDescribed(pDescriptor))
+            continue;
+         MIL_FLOAT BestDistance2 = FLT_MAX;
+         for(MIL_INT j = 0; j < NbTo; j++)
+            {
+            const MIL_FLOAT* pOther = &To.Descriptors[(size_t)(FPFH_SIZE * j)];
+            MIL_FLOAT Distance2 = 0.0f;
+            for(MIL_INT b = 0; b < FPFH_SIZE && Distance2 < BestDistance2; b++)
+               Distance2 += (pDescriptor[b] - pOther[b]) * (pDescriptor[b] - pOther[b]);
+            if(Distance2 < BestDistance2 && IsDescribed(pOther))
+               {
+               BestDistance2 = Distance2;
+               (*pNearest)[(size_t)k] = (MIL_INT32)j;
+               }
+            }
+         }
+      });
+   }
+
+//--------------------------------------------------------------------------
+// Solves the rigid transformation minimizing the squared distances of the
+// moving points of some pairs to their reference points.
+//--------------------------------------------------------------------------
+static void SolveRigidTransformation(const std::vector<SGlobalPair>& Pairs, const MIL_INT* Indices, MIL_INT NbIndices,
+                                     MIL_DOUBLE Matrix[16])
+   {
+   MIL_DOUBLE MovingCenter[3]    = { 0.0, 0.0, 0.0 };
+   MIL_DOUBLE ReferenceCenter[3] = { 0.0, 0.0, 0.0 };
+   for(MIL_INT k = 0; k < NbIndices; k++)
+      for(MIL_INT r = 0; r < 3; r++)
+         {
+         MovingCenter[r]    += Pairs[(size_t)Indices[k]].Moving[r] / NbIndices;
+         ReferenceCenter[r] += Pairs[(size_t)Indices[k]].Reference[r] / NbIndices;
+         }
+
+   MIL_DOUBLE H[3][3] = { { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0 } };
+   for(MIL_INT k = 0; k < NbIndices; k++)
+      for(MIL_INT r = 0; r < 3; r++)
+         for(MIL_INT c = 0; c < 3; c++)
+            H[r][c] += (Pairs[(size_t)Indices[k]].Moving[r] - MovingCenter[r]) *
+                       (Pairs[(size_t)Indices[k]].Reference[c] - ReferenceCenter[c]);
+
+   MIL_DOUBLE Rotation[3][3];
+   SolveRotation(H, Rotation);
+   for(MIL_INT r = 0; r < 3; r++)
+      {
+      for(MIL_INT c = 0; c < 3; c++)
+         Matrix[4 * r + c] = Rotation[r][c];
+      Matrix[4 * r + 3] = ReferenceCenter[r] - (Rotation[r][0] * MovingCenter[0] +
+                                                Rotation[r][1] * MovingCenter[1] +
+                                                Rotation[r][2] * MovingCenter[2]);
+      }
+   Matrix[12] = Matrix[13] = Matrix[14] = 0.0;
+   Matrix[15] = 1.0;
+   }
+
+//--------------------------------------------------------------------------
+// Returns the number of pairs whose transformed moving point is within the
+// inlier distance of its reference point, and gathers them if pInliers is
+// not M_NULL.
+//--------------------------------------------------------------------------
+static MIL_INT CountInliers(const std::vector<SGlobalPair>& Pairs, const MIL_DOUBLE Matrix[16], MIL_DOUBLE InlierDistance2,
+                            std::vector<MIL_INT>* pInliers)
+   {
+   MIL_INT NbInliers = 0;
+   for(size_t p = 0; p < Pairs.size(); p++)
+      {
+      MIL_DOUBLE Distance2 = 0.0;
+      for(MIL_INT r = 0; r < 3; r++)
+         {
+         const MIL_DOUBLE Coordinate = Matrix[4 * r] * Pairs[p].Moving[0] + Matrix[4 * r + 1] * Pairs[p].Moving[1] +
+                                       Matrix[4 * r + 2] * Pairs[p].Moving[2] + Matrix[4 * r + 3];
+         Distance2 += (Coordinate - Pairs[p].Reference[r]) * (Coordinate - Pairs[p].Reference[r]);
+         }
+      if(Distance2 < InlierDistance2)
+         {
+         NbInliers++;
+         if(pInliers)
+            pInliers->push_back((MIL_INT)p);
+         }
+      }
+   return NbInliers;
+   }
+
+//--------------------------------------------------------------------------
+// Draws the 3 distinct pairs of a hypothesis from the seed and its number,
+// and returns false if their edges do not have similar lengths.
+//--------------------------------------------------------------------------
+static bool DrawHypothesis(const std::vector<SGlobalPair>& Pairs, MIL_UINT64 Seed, MIL_INT Number,
+                           MIL_DOUBLE MinEdgeLength, MIL_INT Sample[3])
+   {
+   const MIL_UINT64 NbPairs = (MIL_UINT64)Pairs.size();
+   MIL_UINT64 State = MixBits(Seed ^ MixBits((MIL_UINT64)Number));
+   for(MIL_INT s = 0; s < 3; s++)
+      {
+      State = MixBits(State);
+      Sample[s] = (MIL_INT)(State % NbPairs);
+      }
+   if(Sample[0] == Sample[1] || Sample[0] == Sample[2] || Sample[1] == Sample[2])
+      return false;
+
+   for(MIL_INT s = 0; s < 3; s++)
+      {
+      const SGlobalPair& First  = Pairs[(size_t)Sample[s]];
+      const SGlobalPair& Second = Pairs[(size_t)Sample[(s + 1) % 3]];
+      MIL_DOUBLE MovingLength2 = 0.0, ReferenceLength2 = 0.0;
+      for(MIL_INT a = 0; a < 3; a++)
+         {
+         MovingLength2    += (First.Moving[a] - Second.Moving[a]) * (First.Moving[a] - Second.Moving[a]);
+         ReferenceLength2 += (First.Reference[a] - Second.Reference[a]) * (First.Reference[a] - Second.Reference[a]);
+         }
+      const MIL_DOUBLE MovingLength    = sqrt(MovingLength2);
+      const MIL_DOUBLE ReferenceLength = sqrt(ReferenceLength2);
+      if(MovingLength < MinEdgeLength || ReferenceLength < MinEdgeLength ||
+         std::min(MovingLength, ReferenceLength) < GLOBAL_EDGE_LENGTH_RATIO * std::max(MovingLength, ReferenceLength))
+         return false;
+      }
+   return true;
+   }
+
+//--------------------------------------------------------------------------
+void RegisterGlobal(MIL_ID MilSystem, const SCloudView& Reference, const SCloudView& Moving,
+                    const SGlobalRegistrationSettings& Settings, SGlobalRegistrationResult* pResult)
+   {
+   for(MIL_INT i = 0; i < 16; i++)
+      pResult->Matrix[i] = (i % 5 == 0) ? 1.0 : 0.0;
+   pResult->NbPairs   = 0;
+   pResult->NbInliers = 0;
+   pResult->Found     = false;
+
+   SKeypoints ReferenceKeypoints;
+   SKeypoints MovingKeypoints;
+   if(!ComputeKeypoints(MilSystem, Reference, Settings, &ReferenceKeypoints) ||
+      !ComputeKeypoints(MilSystem, Moving, Settings, &MovingKeypoints))
+      return;
+
+   // Pair the keypoints whose descriptors are mutually nearest.
+   std::vector<MIL_INT32> MovingNearest;
+   std::vector<MIL_INT32> ReferenceNearest;
+   FindNearestDescriptors(MovingKeypoints, ReferenceKeypoints, &MovingNearest);
+   FindNearestDescriptors(ReferenceKeypoints, MovingKeypoints, &ReferenceNearest);
+   std::vector<SGlobalPair> Pairs;
+   for(size_t k = 0; k < MovingNearest.size(); k++)
+      {
+      const MIL_INT32 j = MovingNearest[k];
+      if(j < 0 || ReferenceNearest[(size_t)j] != (MIL_INT32)k)
+         continue;
+      SGlobalPair Pair;
+      const MIL_FLOAT* pMoving    = MovingKeypoints.Octree.Point((MIL_INT)k);
+      const MIL_FLOAT* pReference = ReferenceKeypoints.Octree.Point(j);
+      for(MIL_INT a = 0; a < 3; a++)
+         {
+         Pair.Moving[a]    = pMoving[a];
+         Pair.Reference[a] = pReference[a];
+         }
+      Pairs.push_back(Pair);
+      }
+   pResult->NbPairs = (MIL_INT)Pairs.size();
+   if(pResult->NbPairs < GLOBAL_MIN_INLIERS)
+      return;
+
+   // Evaluate the hypotheses in parallel; each worker keeps its best one, the
+   // first one in case of a tie.
+   const MIL_DOUBLE InlierDistance2 = Settings.InlierDistance * Settings.InlierDistance;
+   const MIL_DOUBLE MinEdgeLength   = 2.0 * Settings.VoxelSize;
+   const MIL_INT    NbChunks        = GetNbChunks(Settings.NbHypotheses, GLOBAL_HYPOTHESIS_CHUNK_SIZE);
+   std::vector<SHypothesis> ChunkBest((size_t)NbChunks);
+   ParallelChunks(0, Settings.NbHypotheses, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      SHypothesis Best = { -1, 0 };
+      for(MIL_INT h = ChunkBegin; h < ChunkEnd; h++)
+         {
+         MIL_INT    Sample[3];
+         MIL_DOUBLE Matrix[16];
+         if(!DrawHypothesis(Pairs, Settings.Seed, h, MinEdgeLength, Sample))
+            continue;
+         SolveRigidTransformation(Pairs, Sample, 3, Matrix);
+         const MIL_INT NbInliers = CountInliers(Pairs, Matrix, InlierDistance2, M_NULL);
+         if(NbInliers > Best.NbInliers)
+            {
+            Best.Number    = h;
+            Best.NbInliers = NbInliers;
+            }
+         }
+      ChunkBest[(size_t)Chunk] = Best;
+      });
+   SHypothesis Best = { -1, 0 };
+   for(MIL_INT c = 0; c < NbChunks; c++)
+      if(ChunkBest[(size_t)c].NbInliers > Best.NbInliers)
+         Best = ChunkBest[(size_t)c];
+   if(Best.NbInliers < GLOBAL_MIN_INLIERS)
+      return;
+
+   // Refine the best hypothesis on its inliers.
+   MIL_INT    Sample[3];
+   MIL_DOUBLE Matrix[16];
+   DrawHypothesis(Pairs, Settings.Seed, Best.Number, MinEdgeLength, Sample);
+   SolveRigidTransformation(Pairs, Sample, 3, Matrix);
+   std::vector<MIL_INT> Inliers;
+   CountInliers(Pairs, Matrix, InlierDistance2, &Inliers);
+   MIL_DOUBLE Refined[16];
+   SolveRigidTransformation(Pairs, &Inliers[0], (MIL_INT)Inliers.size(), Refined);
+   const MIL_INT NbRefinedInliers = CountInliers(Pairs, Refined, InlierDistance2, M_NULL);
+   const bool    UseRefined = NbRefinedInliers >= (MIL_INT)Inliers.size();
+
+   for(MIL_INT i = 0; i < 16; i++)
+      pResult->Matrix[i] = UseRefined ? Refined[i] : Matrix[i];
+   pResult->NbInliers = UseRefined ? NbRefinedInliers : (MIL_INT)Inliers.size();
+   pResult->Found     = true;
+   }
@@ -0,0 +1,56 @@
+﻿//***************************************************************************************/
+//
+// File name: GlobalRegistration.h
+//
+// Synopsis:  Declares the global registration of a point cloud on a reference
+//            point cloud from geometric features, which needs no prior on the
+//            location of the moving cloud. The clouds are subsampled on a voxel
+//            grid, their points are described by fast point feature histograms
+//            (FPFH) and the transformation is found by a RANSAC on the pairs of
+//            points with similar descriptors.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include "PointCloudData.h"
+
+//-------------------------------------------------------------------------------
+// Controls of a global registration.
+//-------------------------------------------------------------------------------
+struct SGlobalRegistrationSettings
+   {
+   MIL_DOUBLE VoxelSize;             // Cell size of the voxel grid subsampling of the clouds.
+   MIL_INT    NormalNeighbors;       // Neighbors of the normals estimated on the subsampled clouds.
+   MIL_DOUBLE NormalOrientation[3];  // Direction the estimated normals do not point away from.
+   MIL_DOUBLE FeatureRadius;         // Radius of the neighborhoods described by the histograms.
+   MIL_INT    MaxFeatureNeighbors;   // Largest number of neighbors of a histogram.
+   MIL_INT    NbHypotheses;          // Number of RANSAC hypotheses.
+   MIL_DOUBLE InlierDistance;        // Distance below which a pair agrees with a hypothesis.
+   MIL_UINT64 Seed;                  // Seed of the samples of the hypotheses.
+   };
+
+//-------------------------------------------------------------------------------
+// Result of a global registration.
+//-------------------------------------------------------------------------------
+struct SGlobalRegistrationResult
+   {
+   MIL_DOUBLE Matrix[16];     // Row-major transformation of the moving cloud onto the reference.
+   MIL_INT    NbPairs;        // Pairs of points with mutually nearest descriptors.
+   MIL_INT    NbInliers;      // Pairs that agree with the transformation.
+   bool       Found;          // False if no hypothesis has enough inliers; Matrix then is the identity.
+   };
+
+// Registers the valid points of a moving point cloud on a reference point
+// cloud without initial transformation. The subsampled points are the
+// keypoints: their normals are estimated, their FPFH descriptors are computed
+// in parallel and each moving keypoint is paired with the reference keypoint
+// of nearest descriptor when they are mutually nearest. The hypotheses are
+// solved from 3 pairs whose edges have similar lengths, evaluated in parallel
+// and the one with the most inliers is refined on its inliers. The samples of
+// each hypothesis are derived from the seed and its number, so that the result
+// does not depend on the number of threads.
+void RegisterGlobal(MIL_ID MilSystem, const SCloudView& Reference, const SCloudView& Moving,
+                    const SGlobalRegistrationSettings& Settings, SGlobalRegistrationResult* pResult);
@@ -0,0 +1,270 @@
+﻿//***************************************************************************************/
+//
+// File name: HashGrid.cpp
+//
+// Synopsis:  Implements the uniform hash grid of the reference point clouds.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "HashGrid.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <utility>
+
+// Number of bits of a cell coordinate in a cell key.
+static const MIL_INT    GRID_BITS_PER_AXIS = 21;
+static const MIL_INT64  GRID_MAX_NB_CELLS  = (MIL_INT64)1 << GRID_BITS_PER_AXIS;
+
+// Key of the empty slots of the hash table; the keys of the cells use 63 bits.
+static const MIL_UINT64 NO_GRID_CELL_KEY = ~(MIL_UINT64)0;
+
+//--------------------------------------------------------------------------
+// Returns the key of a cell from its coordinates.
+//--------------------------------------------------------------------------
+static inline MIL_UINT64 GridCellKey(MIL_INT64 X, MIL_INT64 Y, MIL_INT64 Z)
+   {
+   return (MIL_UINT64)X | ((MIL_UINT64)Y << GRID_BITS_PER_AXIS) | ((MIL_UINT64)Z << (2 * GRID_BITS_PER_AXIS));
+   }
+
+//--------------------------------------------------------------------------
+// Mixes the bits of a cell key so that neighboring cells are spread over the
+// slots of the hash table.
+//--------------------------------------------------------------------------
+static inline MIL_UINT64 HashGridCellKey(MIL_UINT64 Key)
+   {
+   Key ^= Key >> 33;
+   Key *= 0xFF51AFD7ED558CCDULL;
+   Key ^= Key >> 33;
+   Key *= 0xC4CEB9FE1A85EC53ULL;
+   Key ^= Key >> 33;
+   return Key;
+   }
+
+//--------------------------------------------------------------------------
+// Returns the distance along an axis from a position, in cell units, to a
+// cell at the given offset from the cell of the position.
+//--------------------------------------------------------------------------
+static inline MIL_DOUBLE CellGap(MIL_DOUBLE Position, MIL_INT64 Cell, MIL_INT64 Offset, MIL_DOUBLE CellSize)
+   {
+   if(Offset > 0)
+      return (Cell - Position) * CellSize;
+   if(Offset < 0)
+      return (Position - Cell - 1) * CellSize;
+   return 0.0;
+   }
+
+//--------------------------------------------------------------------------
+CHashGrid::CHashGrid()
+   : m_CellSize(1.0)
+   {
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      m_Min[a]     = 0.0;
+      m_NbCells[a] = 0;
+      }
+   }
+
+//--------------------------------------------------------------------------
+bool CHashGrid::Build(const SCloudView& View, MIL_INT Step, MIL_DOUBLE CellSize)
+   {
+   // Copy the valid points.
+   Step = std::max<MIL_INT>(Step, 1);
+   std::vector<SPoint> Points;
+   Points.reserve((size_t)(View.NbPoints / Step + 1));
+   MIL_DOUBLE Min[3] = {  DBL_MAX,  DBL_MAX,  DBL_MAX };
+   MIL_DOUBLE Max[3] = { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+   for(MIL_INT i = 0; i < View.NbPoints; i += Step)
+      {
+      if(View.Confidence && View.Confidence[i] == 0)
+         continue;
+
+      SPoint Point;
+      Point.Coordinates[0] = View.X[i];
+      Point.Coordinates[1] = View.Y[i];
+      Point.Coordinates[2] = View.Z[i];
+      Point.Index          = (MIL_UINT32)i;
+      for(MIL_INT a = 0; a < 3; a++)
+         {
+         Min[a] = std::min(Min[a], (MIL_DOUBLE)Point.Coordinates[a]);
+         Max[a] = std::max(Max[a], (MIL_DOUBLE)Point.Coordinates[a]);
+         }
+      Points.push_back(Point);
+      }
+
+   m_Points.clear();
+   m_Cells.clear();
+   m_CellSize = CellSize;
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      m_Min[a]     = Points.empty() ? 0.0 : Min[a];
+      m_NbCells[a] = Points.empty() ? 0 : (MIL_INT64)((Max[a] - Min[a]) / CellSize) + 1;
+      if(m_NbCells[a] >= GRID_MAX_NB_CELLS)
+         return false;
+      }
+
+   // Sort the points by cell.
+   std::vector< std::pair<MIL_UINT64, MIL_UINT32> > Keys(Points.size());
+   for(size_t p = 0; p < Points.size(); p++)
+      {
+      const MIL_FLOAT* pPoint = Points[p].Coordinates;
+      Keys[p].first  = GridCellKey((MIL_INT64)((pPoint[0] - m_Min[0]) / CellSize),
+                                   (MIL_INT64)((pPoint[1] - m_Min[1]) / CellSize),
+                                   (MIL_INT64)((pPoint[2] - m_Min[2]) / CellSize));
+      Keys[p].second = (MIL_UINT32)p;
+      }
+   std::sort(Keys.begin(), Keys.end());
+
+   m_Points.resize(Points.size());
+   MIL_INT NbOccupiedCells = 0;
+   for(size_t p = 0; p < Keys.size(); p++)
+      {
+      m_Points[p] = Points[Keys[p].second];
+      if(p == 0 || Keys[p].first != Keys[p - 1].first)
+         NbOccupiedCells++;
+      }
+
+   // Map the cells to their points in a table at most half full.
+   size_t TableSize = 16;
+   while(TableSize < (size_t)(2 * NbOccupiedCells))
+      TableSize *= 2;
+   SCell EmptyCell = { NO_GRID_CELL_KEY, 0, 0 };
+   m_Cells.assign(TableSize, EmptyCell);
+   for(size_t Begin = 0; Begin < Keys.size(); )
+      {
+      size_t End = Begin + 1;
+      while(End < Keys.size() && Keys[End].first == Keys[Begin].first)
+         End++;
+
+      size_t Slot = (size_t)(HashGridCellKey(Keys[Begin].first) & (TableSize - 1));
+      while(m_Cells[Slot].Key != NO_GRID_CELL_KEY)
+         Slot = (Slot + 1) & (TableSize - 1);
+      m_Cells[Slot].Key   = Keys[Begin].first;
+      m_Cells[Slot].Begin = (MIL_UINT32)Begin;
+      m_Cells[Slot].End   = (MIL_UINT32)End;
+      Begin = End;
+      }
+   return true;
+   }
+
+//--------------------------------------------------------------------------
+const CHashGrid::SCell* CHashGrid::FindCell(MIL_UINT64 Key) const
+   {
+   const size_t Mask = m_Cells.size() - 1;
+   size_t Slot = (size_t)(HashGridCellKey(Key) & Mask);
+   while(m_Cells[Slot].Key != Key)
+      {
+      if(m_Cells[Slot].Key == NO_GRID_CELL_KEY)
+         return M_NULL;
+      Slot = (Slot + 1) & Mask;
+      }
+   return &m_Cells[Slot];
+   }
+
+//--------------------------------------------------------------------------
+bool CHashGrid::FindNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2,
+                            MIL_INT* pGridIndex, MIL_FLOAT* pDistance2) const
+   {
+   return CHashGrid::FindApproximateNearest(Query, MaxDistance2, 0.0f, pGridIndex, pDistance2);
+   }
+
+//--------------------------------------------------------------------------
+bool CHashGrid::FindApproximateNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2, MIL_FLOAT Error,
+                                       MIL_INT* pGridIndex, MIL_FLOAT* pDistance2) const
+   {
+   // The rings and the cells are skipped when they are not nearer than the
+   // nearest point found shrunk by the error.
+   const MIL_FLOAT Shrink = 1.0f / ((1.0f + Error) * (1.0f + Error));
+   MIL_INT   BestIndex     = -1;
+   MIL_FLOAT BestDistance2 = MaxDistance2;
+   MIL_FLOAT Bound2        = MaxDistance2;
+   if(m_Points.empty())
+      {
+      *pGridIndex = -1;
+      return false;
+      }
+
+   // Position of the query in cell units, its cell and its distance to the faces of its cell.
+   MIL_DOUBLE Position[3];
+   MIL_INT64  Cell[3];
+   MIL_DOUBLE FaceDistance = m_CellSize;
+   MIL_INT64  NbRings = 0;
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      Position[a] = (Query[a] - m_Min[a]) / m_CellSize;
+      Cell[a]     = (MIL_INT64)floor(Position[a]);
+      FaceDistance = std::min(FaceDistance, std::min(Position[a] - Cell[a], Cell[a] + 1 - Position[a]) * m_CellSize);
+
+      // The rings past the grid have no points.
+      NbRings = std::max(NbRings, std::max(Cell[a] + 1, m_NbCells[a] - Cell[a]));
+      }
+   // Nor do the rings past the maximum distance.
+   const MIL_DOUBLE MaxRings = sqrt((MIL_DOUBLE)MaxDistance2) / m_CellSize + 1.0;
+   if(MaxRings < (MIL_DOUBLE)NbRings)
+      NbRings = (MIL_INT64)MaxRings;
+
+   for(MIL_INT64 Ring = 0; Ring <= NbRings; Ring++)
+      {
+      // The points of the ring are at least this far.
+      if(Ring > 0)
+         {
+         const MIL_DOUBLE RingDistance = (Ring - 1) * m_CellSize + FaceDistance;
+         if(RingDistance * RingDistance >= Bound2)
+            break;
+         }
+
+      // Visit the cells of the ring closer than the nearest point found, skipping
+      // the slices and the rows of the ring that are too far.
+      for(MIL_INT64 DZ = -Ring; DZ <= Ring; DZ++)
+         {
+         const MIL_INT64  Z    = Cell[2] + DZ;
+         const MIL_DOUBLE GapZ = CellGap(Position[2], Z, DZ, m_CellSize);
+         if(Z < 0 || Z >= m_NbCells[2] || GapZ * GapZ >= Bound2)
+            continue;
+
+         for(MIL_INT64 DY = -Ring; DY <= Ring; DY++)
+            {
+            const MIL_INT64  Y     = Cell[1] + DY;
+            const MIL_DOUBLE GapY  = CellGap(Position[1], Y, DY, m_CellSize);
+            const MIL_DOUBLE GapYZ = GapZ * GapZ + GapY * GapY;
+            if(Y < 0 || Y >= m_NbCells[1] || GapYZ >= Bound2)
+               continue;
+
+            // Inside the faces of the ring, only its two cells along X.
+            const bool OnFace = DZ == -Ring || DZ == Ring || DY == -Ring || DY == Ring;
+            for(MIL_INT64 DX = -Ring; DX <= Ring; DX += OnFace ? 1 : 2 * Ring)
+               {
+               const MIL_INT64  X    = Cell[0] + DX;
+               const MIL_DOUBLE GapX = CellGap(Position[0], X, DX, m_CellSize);
+               if(X < 0 || X >= m_NbCells[0] || GapYZ + GapX * GapX >= Bound2)
+                  continue;
+
+               const SCell* pCell = FindCell(GridCellKey(X, Y, Z));
+               if(pCell == M_NULL)
+                  continue;
+
+               for(MIL_UINT32 i = pCell->Begin; i < pCell->End; i++)
+                  {
+                  const MIL_FLOAT* pPoint = m_Points[i].Coordinates;
+                  const MIL_FLOAT  DiffX = pPoint[0] - Query[0];
+                  const MIL_FLOAT  DiffY = pPoint[1] - Query[1];
+                  const MIL_FLOAT  DiffZ = pPoint[2] - Query[2];
+                  const MIL_FLOAT  Distance2 = DiffX * DiffX + DiffY * DiffY + DiffZ * DiffZ;
+                  if(Distance2 < BestDistance2)
+                     {
+                     BestDistance2 = Distance2;
+                     BestIndex     = (MIL_INT)i;
+                     Bound2        = Distance2 * Shrink;
+                     }
+                  }
+               }
+            }
+         }
+      }
+
+   *pGridIndex = BestIndex;
+   if(pDistance2)
+      *pDistance2 = BestDistance2;
+   return BestIndex >= 0;
+   }
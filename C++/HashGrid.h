@@ -0,0 +1,68 @@
+﻿//***************************************************************************************/
+//
+// File name: HashGrid.h
+//
+// Synopsis:  Declares the uniform hash grid used to find the nearest neighbors of
+//            points in a reference point cloud within a bounded distance. For the
+//            dense and evenly sampled clouds of a scanner, a query only visits the
+//            few cells around the query point.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include <vector>
+#include "PointCloudData.h"
+#include "NearestNeighborIndex.h"
+
+//-------------------------------------------------------------------------------
+// Grid of cubic cells over the valid points of a cloud. The points are copied
+// sorted by cell and an open addressing hash table maps each occupied cell to
+// its points. A query visits the cells in rings of increasing distance around
+// the cell of the query point and stops at the first ring farther than the
+// nearest point found, so that the queries are fastest when the cells are
+// about the size of the distance to the nearest points.
+//-------------------------------------------------------------------------------
+class CHashGrid : public CNearestNeighborIndex
+   {
+   public:
+      CHashGrid();
+
+      // Builds the grid over the valid points of a cloud taken with a step.
+      // Returns false if the grid would have more than 2^21 cells along an axis.
+      bool Build(const SCloudView& View, MIL_INT Step, MIL_DOUBLE CellSize);
+
+      // CNearestNeighborIndex.
+      virtual MIL_INT          NbPoints() const { return (MIL_INT)m_Points.size(); }
+      virtual const MIL_FLOAT* Point(MIL_INT GridIndex) const { return m_Points[(size_t)GridIndex].Coordinates; }
+      virtual MIL_INT          CloudIndex(MIL_INT GridIndex) const { return (MIL_INT)m_Points[(size_t)GridIndex].Index; }
+      virtual bool             FindNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2,
+                                           MIL_INT* pGridIndex, MIL_FLOAT* pDistance2) const;
+      virtual bool             FindApproximateNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2, MIL_FLOAT Error,
+                                                      MIL_INT* pGridIndex, MIL_FLOAT* pDistance2) const;
+
+   private:
+      struct SPoint
+         {
+         MIL_FLOAT  Coordinates[3];
+         MIL_UINT32 Index;
+         };
+
+      // Slot of the hash table; the points of the cell are [Begin, End).
+      struct SCell
+         {
+         MIL_UINT64 Key;
+         MIL_UINT32 Begin;
+         MIL_UINT32 End;
+         };
+
+      const SCell* FindCell(MIL_UINT64 Key) const;
+
+      std::vector<SPoint> m_Points;
+      std::vector<SCell>  m_Cells;
+      MIL_DOUBLE          m_CellSize;
+      MIL_DOUBLE          m_Min[3];       // Corner of the first cell.
+      MIL_INT64           m_NbCells[3];   // Number of cells along each axis.
+   };
@@ -0,0 +1,827 @@
+﻿//***************************************************************************************/
+//
+// File name: IcpRegistration.cpp
+//
+// Synopsis:  Implements the point-to-point, point-to-plane, plane-to-plane
+//            and generalized ICP registrations.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "IcpRegistration.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+// Minimum number of moving points paired by a chunk, and maximum number of
+// chunks. The chunks, and thus the rounding of their sums, do not depend on
+// the number of threads.
+static const MIL_INT ICP_CHUNK_SIZE = 4096;
+static const MIL_INT ICP_NB_CHUNKS  = 64;
+
+// Minimum number of pairs needed to solve a rigid transformation.
+static const MIL_INT ICP_MIN_NB_PAIRS = 3;
+
+// Ratio of the relative decrease of the RMS error to its threshold below which
+// the nearest reference points are searched exactly.
+static const MIL_DOUBLE ICP_EXACT_SEARCH_RATIO = 2.0;
+
+// Number of bits of the digits of the radix selection of the closest pairs.
+static const MIL_INT ICP_SELECT_RADIX_BITS = 11;
+static const MIL_INT ICP_SELECT_RADIX_SIZE = (MIL_INT)1 << ICP_SELECT_RADIX_BITS;
+
+// Number of bins of the histogram of the distances of the pairs from which the
+// trimmed ICP estimates the overlap, and exponent of the overlap fraction that
+// divides the RMS distance of the pairs kept.
+static const MIL_INT    ICP_TRIM_NB_BINS = 1024;
+static const MIL_DOUBLE ICP_TRIM_EXPONENT = 3.0;
+
+// Ratio of the distance of the pairs of the trimmed ICP to the RMS error of the
+// previous iteration.
+static const MIL_DOUBLE ICP_TRIM_DISTANCE_RATIO = 2.5;
+
+// Variance along its normal of a point of the generalized ICP, relative to the
+// variance in its tangent plane.
+static const MIL_DOUBLE ICP_GENERALIZED_EPSILON = 0.001;
+
+// Pair of a moving point and its nearest reference point.
+struct SIcpPair
+   {
+   MIL_FLOAT Distance2;
+   MIL_INT32 Moving;      // Index in the moving cloud.
+   MIL_INT32 Reference;   // Index in the spatial index, -1 if the point is not paired.
+   };
+
+// Sums over the pairs kept of the squared distances, of the moving and
+// reference points and of their products, and with the other metrics of the
+// normal equations of the linearized distances to the planes or of the
+// linearized weighted distances.
+struct SIcpSums
+   {
+   SIcpSums()
+      : Distance2(0.0)
+      {
+      for(MIL_INT r = 0; r < 3; r++)
+         {
+         Moving[r] = Reference[r] = 0.0;
+         for(MIL_INT c = 0; c < 3; c++)
+            Products[r][c] = 0.0;
+         }
+      for(MIL_INT r = 0; r < 6; r++)
+         {
+         PlaneVector[r] = 0.0;
+         for(MIL_INT c = 0; c < 6; c++)
+            PlaneMatrix[r][c] = 0.0;
+         }
+      }
+
+   void Add(const SIcpSums& Other)
+      {
+      Distance2 += Other.Distance2;
+      for(MIL_INT r = 0; r < 3; r++)
+         {
+         Moving[r]    += Other.Moving[r];
+         Reference[r] += Other.Reference[r];
+         for(MIL_INT c = 0; c < 3; c++)
+            Products[r][c] += Other.Products[r][c];
+         }
+      for(MIL_INT r = 0; r < 6; r++)
+         {
+         PlaneVector[r] += Other.PlaneVector[r];
+         for(MIL_INT c = 0; c < 6; c++)
+            PlaneMatrix[r][c] += Other.PlaneMatrix[r][c];
+         }
+      }
+
+   MIL_DOUBLE Distance2;
+   MIL_DOUBLE Moving[3];
+   MIL_DOUBLE Reference[3];
+   MIL_DOUBLE Products[3][3];      // Of the moving point coordinate r and of the reference point coordinate c.
+   MIL_DOUBLE PlaneMatrix[6][6];   // Of the products of the derivatives of the distances.
+   MIL_DOUBLE PlaneVector[6];      // Of the derivatives times the distances.
+   };
+
+//--------------------------------------------------------------------------
+// Adds a pair of the generalized ICP to the normal equations. The covariance
+// of each point is I - (1 - e) n n^T, flat along its normal n, and the
+// distance d = p - q of the pair is weighted by the inverse of the sum of the
+// covariances of both points. d changes by w x p + t for a small rotation w
+// and a translation t of the moving point p. The points without normal have
+// an isotropic covariance.
+//--------------------------------------------------------------------------
+static void AddGeneralizedPair(const MIL_DOUBLE Point[3], const MIL_FLOAT* pReferencePoint,
+                               const MIL_DOUBLE ReferenceNormal[3], const MIL_DOUBLE MovingNormal[3],
+                               SIcpSums* pSums)
+   {
+   MIL_DOUBLE C[3][3];
+   for(MIL_INT r = 0; r < 3; r++)
+      for(MIL_INT c = 0; c < 3; c++)
+         C[r][c] = (r == c ? 2.0 : 0.0) - (1.0 - ICP_GENERALIZED_EPSILON) *
+                   (ReferenceNormal[r] * ReferenceNormal[c] + MovingNormal[r] * MovingNormal[c]);
+
+   // Invert the sum of the covariances by its cofactors.
+   MIL_DOUBLE Weight[3][3];
+   Weight[0][0] = C[1][1] * C[2][2] - C[1][2] * C[2][1];
+   Weight[0][1] = C[0][2] * C[2][1] - C[0][1] * C[2][2];
+   Weight[0][2] = C[0][1] * C[1][2] - C[0][2] * C[1][1];
+   Weight[1][0] = C[1][2] * C[2][0] - C[1][0] * C[2][2];
+   Weight[1][1] = C[0][0] * C[2][2] - C[0][2] * C[2][0];
+   Weight[1][2] = C[0][2] * C[1][0] - C[0][0] * C[1][2];
+   Weight[2][0] = C[1][0] * C[2][1] - C[1][1] * C[2][0];
+   Weight[2][1] = C[0][1] * C[2][0] - C[0][0] * C[2][1];
+   Weight[2][2] = C[0][0] * C[1][1] - C[0][1] * C[1][0];
+   const MIL_DOUBLE Determinant = C[0][0] * Weight[0][0] + C[0][1] * Weight[1][0] + C[0][2] * Weight[2][0];
+   if(!(Determinant > 0.0))
+      return;
+   for(MIL_INT r = 0; r < 3; r++)
+      for(MIL_INT c = 0; c < 3; c++)
+         Weight[r][c] /= Determinant;
+
+   const MIL_DOUBLE Jacobian[3][6] = { {  0.0,      Point[2], -Point[1], 1.0, 0.0, 0.0 },
+                                       { -Point[2], 0.0,       Point[0], 0.0, 1.0, 0.0 },
+                                       {  Point[1], -Point[0], 0.0,      0.0, 0.0, 1.0 } };
+   const MIL_DOUBLE Distance[3] = { Point[0] - pReferencePoint[0],
+                                    Point[1] - pReferencePoint[1],
+                                    Point[2] - pReferencePoint[2] };
+   MIL_DOUBLE WeightedJacobian[3][6];
+   MIL_DOUBLE WeightedDistance[3];
+   for(MIL_INT r = 0; r < 3; r++)
+      {
+      WeightedDistance[r] = Weight[r][0] * Distance[0] + Weight[r][1] * Distance[1] + Weight[r][2] * Distance[2];
+      for(MIL_INT c = 0; c < 6; c++)
+         WeightedJacobian[r][c] = Weight[r][0] * Jacobian[0][c] + Weight[r][1] * Jacobian[1][c] + Weight[r][2] * Jacobian[2][c];
+      }
+   for(MIL_INT a = 0; a < 6; a++)
+      {
+      pSums->PlaneVector[a] += Jacobian[0][a] * WeightedDistance[0] + Jacobian[1][a] * WeightedDistance[1] +
+                               Jacobian[2][a] * WeightedDistance[2];
+      for(MIL_INT b = 0; b < 6; b++)
+         pSums->PlaneMatrix[a][b] += Jacobian[0][a] * WeightedJacobian[0][b] + Jacobian[1][a] * WeightedJacobian[1][b] +
+                                     Jacobian[2][a] * WeightedJacobian[2][b];
+      }
+   }
+
+//--------------------------------------------------------------------------
+// Returns the bits of a squared distance, which are ordered like the
+// distances since the distances are positive.
+//--------------------------------------------------------------------------
+static inline MIL_UINT32 DistanceBits(MIL_FLOAT Distance2)
+   {
+   MIL_UINT32 Bits;
+   memcpy(&Bits, &Distance2, sizeof(Bits));
+   return Bits;
+   }
+
+//--------------------------------------------------------------------------
+// Applies a row-major rigid transformation to a point.
+//--------------------------------------------------------------------------
+static inline void TransformPoint(const MIL_DOUBLE Matrix[16], MIL_FLOAT X, MIL_FLOAT Y, MIL_FLOAT Z,
+                                  MIL_DOUBLE Out[3])
+   {
+   for(MIL_INT r = 0; r < 3; r++)
+      Out[r] = Matrix[4 * r] * X + Matrix[4 * r + 1] * Y + Matrix[4 * r + 2] * Z + Matrix[4 * r + 3];
+   }
+
+//--------------------------------------------------------------------------
+// H = U S Vt is decomposed with one-sided Jacobi rotations and R = V Ut, with
+// the sign of the smallest singular direction chosen so that R is not a
+// reflection.
+//--------------------------------------------------------------------------
+void SolveRotation(const MIL_DOUBLE H[3][3], MIL_DOUBLE R[3][3])
+   {
+   MIL_DOUBLE A[3][3];
+   MIL_DOUBLE V[3][3] = { { 1.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 0.0, 1.0 } };
+   for(MIL_INT r = 0; r < 3; r++)
+      for(MIL_INT c = 0; c < 3; c++)
+         A[r][c] = H[r][c];
+
+   // Orthogonalize the columns of A = H V.
+   for(MIL_INT Sweep = 0; Sweep < 32; Sweep++)
+      {
+      bool Rotated = false;
+      for(MIL_INT p = 0; p < 2; p++)
+         {
+         for(MIL_INT q = p + 1; q < 3; q++)
+            {
+            MIL_DOUBLE Alpha = 0.0, Beta = 0.0, Gamma = 0.0;
+            for(MIL_INT r = 0; r < 3; r++)
+               {
+               Alpha += A[r][p] * A[r][p];
+               Beta  += A[r][q] * A[r][q];
+               Gamma += A[r][p] * A[r][q];
+               }
+            if(fabs(Gamma) <= 1e-15 * sqrt(Alpha * Beta))
+               continue;
+
+            Rotated = true;
+            const MIL_DOUBLE Zeta = (Beta - Alpha) / (2.0 * Gamma);
+            const MIL_DOUBLE T    = (Zeta >= 0.0 ? 1.0 : -1.0) / (fabs(Zeta) + sqrt(1.0 + Zeta * Zeta));
+            const MIL_DOUBLE C    = 1.0 / sqrt(1.0 + T * T);
+            const MIL_DOUBLE S    = C * T;
+            for(MIL_INT r = 0; r < 3; r++)
+               {
+               const MIL_DOUBLE Ap = A[r][p], Aq = A[r][q];
+               A[r][p] = C * Ap - S * Aq;
+               A[r][q] = S * Ap + C * Aq;
+               const MIL_DOUBLE Vp = V[r][p], Vq = V[r][q];
+               V[r][p] = C * Vp - S * Vq;
+               V[r][q] = S * Vp + C * Vq;
+               }
+            }
+         }
+      if(!Rotated)
+         break;
+      }
+
+   // The singular values are the norms of the columns, sorted in decreasing order.
+   MIL_DOUBLE Sigma[3];
+   for(MIL_INT c = 0; c < 3; c++)
+      Sigma[c] = sqrt(A[0][c] * A[0][c] + A[1][c] * A[1][c] + A[2][c] * A[2][c]);
+   MIL_INT Order[3] = { 0, 1, 2 };
+   std::sort(Order, Order + 3, [&Sigma](MIL_INT First, MIL_INT Second) { return Sigma[First] > Sigma[Second]; });
+
+   // The rotation is undetermined when the points are on a line.
+   for(MIL_INT r = 0; r < 3; r++)
+      for(MIL_INT c = 0; c < 3; c++)
+         R[r][c] = r == c ? 1.0 : 0.0;
+   if(!(Sigma[Order[1]] > 1e-12 * Sigma[Order[0]]))
+      return;
+
+   MIL_DOUBLE U[3][3];
+   for(MIL_INT k = 0; k < 2; k++)
+      for(MIL_INT r = 0; r < 3; r++)
+         U[r][Order[k]] = A[r][Order[k]] / Sigma[Order[k]];
+   const MIL_INT Last = Order[2];
+   const MIL_INT U0 = Order[0], U1 = Order[1];
+   U[0][Last] = U[1][U0] * U[2][U1] - U[2][U0] * U[1][U1];
+   U[1][Last] = U[2][U0] * U[0][U1] - U[0][U0] * U[2][U1];
+   U[2][Last] = U[0][U0] * U[1][U1] - U[1][U0] * U[0][U1];
+   if(Sigma[Last] > 1e-12 * Sigma[U0])
+      {
+      // Keep the direction of the smallest singular vector found by the rotations.
+      const MIL_DOUBLE Dot = U[0][Last] * A[0][Last] + U[1][Last] * A[1][Last] + U[2][Last] * A[2][Last];
+      if(Dot < 0.0)
+         for(MIL_INT r = 0; r < 3; r++)
+            U[r][Last] = -U[r][Last];
+      }
+
+   // Avoid a reflection.
+   const MIL_DOUBLE DetU = U[0][0] * (U[1][1] * U[2][2] - U[1][2] * U[2][1]) -
+                           U[0][1] * (U[1][0] * U[2][2] - U[1][2] * U[2][0]) +
+                           U[0][2] * (U[1][0] * U[2][1] - U[1][1] * U[2][0]);
+   const MIL_DOUBLE DetV = V[0][0] * (V[1][1] * V[2][2] - V[1][2] * V[2][1]) -
+                           V[0][1] * (V[1][0] * V[2][2] - V[1][2] * V[2][0]) +
+                           V[0][2] * (V[1][0] * V[2][1] - V[1][1] * V[2][0]);
+   if(DetU * DetV < 0.0)
+      for(MIL_INT r = 0; r < 3; r++)
+         V[r][Last] = -V[r][Last];
+
+   for(MIL_INT r = 0; r < 3; r++)
+      for(MIL_INT c = 0; c < 3; c++)
+         R[r][c] = V[r][0] * U[c][0] + V[r][1] * U[c][1] + V[r][2] * U[c][2];
+   }
+
+//--------------------------------------------------------------------------
+// Solves the 6x6 linear system A x = b by a Gaussian elimination with partial
+// pivoting. Returns false if the system is singular.
+//--------------------------------------------------------------------------
+static bool SolveLinearSystem6(const MIL_DOUBLE A[6][6], const MIL_DOUBLE b[6], MIL_DOUBLE x[6])
+   {
+   MIL_DOUBLE M[6][7];
+   MIL_DOUBLE MaxDiagonal = 0.0;
+   for(MIL_INT r = 0; r < 6; r++)
+      {
+      for(MIL_INT c = 0; c < 6; c++)
+         M[r][c] = A[r][c];
+      M[r][6] = b[r];
+      MaxDiagonal = std::max(MaxDiagonal, fabs(A[r][r]));
+      }
+
+   for(MIL_INT c = 0; c < 6; c++)
+      {
+      MIL_INT Pivot = c;
+      for(MIL_INT r = c + 1; r < 6; r++)
+         if(fabs(M[r][c]) > fabs(M[Pivot][c]))
+            Pivot = r;
+      if(!(fabs(M[Pivot][c]) > 1e-12 * MaxDiagonal))
+         return false;
+      if(Pivot != c)
+         for(MIL_INT k = c; k < 7; k++)
+            std::swap(M[c][k], M[Pivot][k]);
+      for(MIL_INT r = c + 1; r < 6; r++)
+         {
+         const MIL_DOUBLE Factor = M[r][c] / M[c][c];
+         for(MIL_INT k = c; k < 7; k++)
+            M[r][k] -= Factor * M[c][k];
+         }
+      }
+   for(MIL_INT r = 5; r >= 0; r--)
+      {
+      MIL_DOUBLE Sum = M[r][6];
+      for(MIL_INT c = r + 1; c < 6; c++)
+         Sum -= M[r][c] * x[c];
+      x[r] = Sum / M[r][r];
+      }
+   return true;
+   }
+
+//--------------------------------------------------------------------------
+// Returns the rotation of angle |w| around the axis w.
+//--------------------------------------------------------------------------
+static void RotationFromVector(const MIL_DOUBLE w[3], MIL_DOUBLE R[3][3])
+   {
+   const MIL_DOUBLE Angle = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+   const MIL_DOUBLE Axis[3] = { Angle > 0.0 ? w[0] / Angle : 1.0, Angle > 0.0 ? w[1] / Angle : 0.0,
+                                Angle > 0.0 ? w[2] / Angle : 0.0 };
+   const MIL_DOUBLE C = cos(Angle);
+   const MIL_DOUBLE S = sin(Angle);
+   for(MIL_INT r = 0; r < 3; r++)
+      for(MIL_INT c = 0; c < 3; c++)
+         R[r][c] = (1.0 - C) * Axis[r] * Axis[c] + (r == c ? C : 0.0);
+   R[0][1] -= S * Axis[2];
+   R[0][2] += S * Axis[1];
+   R[1][0] += S * Axis[2];
+   R[1][2] -= S * Axis[0];
+   R[2][0] -= S * Axis[1];
+   R[2][1] += S * Axis[0];
+   }
+
+//--------------------------------------------------------------------------
+// Selects the NbKept pairs of smallest distance by a parallel radix selection
+// on the bits of the distances, with the chunks of the pairing. Returns the
+// bits of the largest distance kept. The pairs kept are the pairs below it
+// and, in each chunk, the first pTieQuotas[Chunk] pairs at it, so that the
+// selection does not depend on the number of threads.
+//--------------------------------------------------------------------------
+static MIL_UINT32 SelectClosestPairs(const std::vector<SIcpPair>& Pairs, MIL_INT NbKept, MIL_INT NbChunks,
+                                     std::vector<MIL_INT>* pTieQuotas)
+   {
+   const MIL_INT NbPairs = (MIL_INT)Pairs.size();
+   std::vector<MIL_UINT32> Histograms((size_t)(NbChunks * ICP_SELECT_RADIX_SIZE));
+   MIL_UINT64 Prefix  = 0;
+   MIL_INT    NbBelow = 0;
+   MIL_INT    Digit   = 0;
+
+   // Find the digits of the largest distance kept from the highest, counting
+   // the pairs of each digit among the pairs with the digits already found.
+   for(MIL_INT Shift = 2 * ICP_SELECT_RADIX_BITS; Shift >= 0; Shift -= ICP_SELECT_RADIX_BITS)
+      {
+      std::fill(Histograms.begin(), Histograms.end(), 0);
+      ParallelChunks(0, NbPairs, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+         {
+         MIL_UINT32* pHistogram = &Histograms[(size_t)(Chunk * ICP_SELECT_RADIX_SIZE)];
+         for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+            {
+            const MIL_UINT64 Bits = DistanceBits(Pairs[(size_t)k].Distance2);
+            if((Bits >> (Shift + ICP_SELECT_RADIX_BITS)) == Prefix)
+               pHistogram[(Bits >> Shift) & (ICP_SELECT_RADIX_SIZE - 1)]++;
+            }
+         });
+
+      MIL_INT Count = 0;
+      for(Digit = 0; Digit < ICP_SELECT_RADIX_SIZE; Digit++)
+         {
+         Count = 0;
+         for(MIL_INT c = 0; c < NbChunks; c++)
+            Count += Histograms[(size_t)(c * ICP_SELECT_RADIX_SIZE + Digit)];
+         if(NbBelow + Count >= NbKept)
+            break;
+         NbBelow += Count;
+         }
+      Prefix = (Prefix << ICP_SELECT_RADIX_BITS) | (MIL_UINT64)Digit;
+      }
+
+   // Share the pairs at the largest distance kept among the chunks in order.
+   MIL_INT NbTies = NbKept - NbBelow;
+   pTieQuotas->resize((size_t)NbChunks);
+   for(MIL_INT c = 0; c < NbChunks; c++)
+      {
+      const MIL_INT ChunkTies = Histograms[(size_t)(c * ICP_SELECT_RADIX_SIZE + Digit)];
+      (*pTieQuotas)[(size_t)c] = std::min(ChunkTies, NbTies);
+      NbTies -= (*pTieQuotas)[(size_t)c];
+      }
+   return (MIL_UINT32)Prefix;
+   }
+
+//--------------------------------------------------------------------------
+// Returns the RMS distance of the NbKept closest pairs, selected like the pairs
+// kept and summed in the order of the chunks.
+//--------------------------------------------------------------------------
+static MIL_DOUBLE GetClosestRmsDistance(const std::vector<SIcpPair>& Pairs, MIL_INT NbKept, MIL_INT NbChunks,
+                                        std::vector<MIL_INT>* pTieQuotas)
+   {
+   const MIL_UINT32 KeptBits = SelectClosestPairs(Pairs, NbKept, NbChunks, pTieQuotas);
+   std::vector<MIL_DOUBLE> ChunkDistance2((size_t)NbChunks, 0.0);
+   ParallelChunks(0, (MIL_INT)Pairs.size(), NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      MIL_DOUBLE Distance2 = 0.0;
+      MIL_INT    NbTies    = (*pTieQuotas)[(size_t)Chunk];
+      for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+         {
+         const MIL_UINT32 Bits = DistanceBits(Pairs[(size_t)k].Distance2);
+         if(Bits > KeptBits || (Bits == KeptBits && NbTies-- == 0))
+            continue;
+         Distance2 += Pairs[(size_t)k].Distance2;
+         }
+      ChunkDistance2[(size_t)Chunk] = Distance2;
+      });
+
+   MIL_DOUBLE Distance2 = 0.0;
+   for(MIL_INT c = 0; c < NbChunks; c++)
+      Distance2 += ChunkDistance2[(size_t)c];
+   return sqrt(Distance2 / NbKept);
+   }
+
+//--------------------------------------------------------------------------
+// Estimates the number of closest pairs kept by the trimmed ICP: the number k
+// of at least MinNbKept pairs minimizing the RMS distance of the k closest
+// pairs divided by (k / NbUsed)^3. The distances are counted in a histogram
+// filled in parallel with the chunks of the pairing, and the k candidates are
+// the pairs below each bin, so that the estimate does not depend on the number
+// of threads.
+//--------------------------------------------------------------------------
+static MIL_INT EstimateNbKept(const std::vector<SIcpPair>& Pairs, MIL_INT NbUsed, MIL_INT NbPaired,
+                              MIL_FLOAT MaxPairedDistance2, MIL_INT MinNbKept, MIL_INT NbChunks,
+                              std::vector<MIL_INT>* pHistograms)
+   {
+   if(NbPaired <= MinNbKept || !(MaxPairedDistance2 > 0.0f))
+      return NbPaired;
+
+   const MIL_DOUBLE BinSize = sqrt((MIL_DOUBLE)MaxPairedDistance2) / ICP_TRIM_NB_BINS;
+   std::vector<MIL_INT>& Histograms = *pHistograms;
+   Histograms.assign((size_t)(NbChunks * ICP_TRIM_NB_BINS), 0);
+   ParallelChunks(0, (MIL_INT)Pairs.size(), NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      MIL_INT* pHistogram = &Histograms[(size_t)(Chunk * ICP_TRIM_NB_BINS)];
+      for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+         {
+         if(Pairs[(size_t)k].Reference < 0)
+            continue;
+         const MIL_INT Bin = (MIL_INT)(sqrt((MIL_DOUBLE)Pairs[(size_t)k].Distance2) / BinSize);
+         pHistogram[Bin < ICP_TRIM_NB_BINS ? Bin : ICP_TRIM_NB_BINS - 1]++;
+         }
+      });
+
+   // The pairs of a bin are taken at its center.
+   MIL_INT    NbKept   = NbPaired;
+   MIL_DOUBLE BestCost = DBL_MAX;
+   MIL_INT    NbBelow  = 0;
+   MIL_DOUBLE SumBelow = 0.0;
+   for(MIL_INT b = 0; b < ICP_TRIM_NB_BINS; b++)
+      {
+      MIL_INT NbInBin = 0;
+      for(MIL_INT c = 0; c < NbChunks; c++)
+         NbInBin += Histograms[(size_t)(c * ICP_TRIM_NB_BINS + b)];
+      if(NbInBin == 0)
+         continue;
+      const MIL_DOUBLE Center = (b + 0.5) * BinSize;
+      NbBelow  += NbInBin;
+      SumBelow += NbInBin * Center * Center;
+      if(NbBelow < MinNbKept)
+         continue;
+      const MIL_DOUBLE Cost = sqrt(SumBelow / NbBelow) / pow((MIL_DOUBLE)NbBelow / NbUsed, ICP_TRIM_EXPONENT);
+      if(Cost < BestCost)
+         {
+         BestCost = Cost;
+         NbKept   = NbBelow;
+         }
+      }
+   return NbKept;
+   }
+
+//--------------------------------------------------------------------------
+void RegisterIcp(const CNearestNeighborIndex& Reference, const SCloudView& Moving, const SIcpSettings& Settings,
+                 const MIL_DOUBLE InitialMatrix[16], SIcpResult* pResult)
+   {
+   for(MIL_INT i = 0; i < 16; i++)
+      pResult->Matrix[i] = InitialMatrix[i];
+   pResult->RmsError                = 0.0;
+   pResult->Overlap                 = 0.0;
+   pResult->NbIterations            = 0;
+   pResult->NbApproximateIterations = 0;
+   pResult->Status                  = eIcpNotEnoughPairs;
+
+   // Fall back to the metrics whose normals are available.
+   EIcpMetric Metric = Settings.Metric;
+   if((Metric == eIcpPlaneToPlane || Metric == eIcpGeneralized) && Moving.NormalX == M_NULL)
+      Metric = eIcpPointToPlane;
+   if(Metric != eIcpPointToPoint && !Reference.HasNormals())
+      Metric = eIcpPointToPoint;
+   pResult->Metric = Metric;
+
+   // Gather the moving points used.
+   std::vector<MIL_INT32> Used;
+   Used.reserve((size_t)(Moving.NbPoints / std::max<MIL_INT>(Settings.DecimationStep, 1) + 1));
+   for(MIL_INT i = 0; i < Moving.NbPoints; i += std::max<MIL_INT>(Settings.DecimationStep, 1))
+      {
+      if(Moving.Confidence == M_NULL || Moving.Confidence[i] != 0)
+         Used.push_back((MIL_INT32)i);
+      }
+   const MIL_INT NbUsed  = (MIL_INT)Used.size();
+   const MIL_INT NbChunks = std::min(std::max<MIL_INT>(NbUsed / ICP_CHUNK_SIZE, 1), ICP_NB_CHUNKS);
+
+   // The nearest reference point of the previous iteration bounds the search of
+   // the nearest reference point, which moves little between iterations.
+   std::vector<MIL_INT32> Nearest((size_t)NbUsed, -1);
+   std::vector<SIcpPair>  Pairs((size_t)NbUsed);
+   std::vector<MIL_INT>   ChunkNbPaired((size_t)NbChunks);
+   std::vector<MIL_FLOAT> ChunkMaxDistance2((size_t)NbChunks);
+   std::vector<MIL_INT>   Histograms;
+   std::vector<MIL_INT>   TieQuotas;
+   std::vector<SIcpSums>  ChunkSums((size_t)NbChunks);
+   const MIL_FLOAT MaxPairDistance2 = (MIL_FLOAT)std::min(Settings.MaxPairDistance * Settings.MaxPairDistance, (MIL_DOUBLE)FLT_MAX);
+   MIL_FLOAT       MaxDistance2     = MaxPairDistance2;
+   MIL_DOUBLE PreviousRmsError = -1.0;
+   MIL_INT    PreviousNbKept   = 0;
+   bool       Exact = !(Settings.NeighborError > 0.0);
+   for(;;)
+      {
+      // Pair each moving point with its nearest reference point.
+      const MIL_DOUBLE* Matrix = pResult->Matrix;
+      const MIL_FLOAT   Error  = Exact ? 0.0f : (MIL_FLOAT)Settings.NeighborError;
+      ParallelChunks(0, NbUsed, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+         {
+         MIL_INT   NbChunkPaired = 0;
+         MIL_FLOAT MaxChunkDistance2 = 0.0f;
+         for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+            {
+            const MIL_INT32 i = Used[(size_t)k];
+            MIL_DOUBLE Point[3];
+            TransformPoint(Matrix, Moving.X[i], Moving.Y[i], Moving.Z[i], Point);
+            const MIL_FLOAT Query[3] = { (MIL_FLOAT)Point[0], (MIL_FLOAT)Point[1], (MIL_FLOAT)Point[2] };
+
+            MIL_INT32& Previous = Nearest[(size_t)k];
+            MIL_FLOAT Distance2 = MaxDistance2;
+            if(Previous >= 0)
+               {
+               const MIL_FLOAT* pPrevious = Reference.Point(Previous);
+               Distance2 = (pPrevious[0] - Query[0]) * (pPrevious[0] - Query[0]) +
+                           (pPrevious[1] - Query[1]) * (pPrevious[1] - Query[1]) +
+                           (pPrevious[2] - Query[2]) * (pPrevious[2] - Query[2]);
+               if(!(Distance2 < MaxDistance2))
+                  {
+                  Previous  = -1;
+                  Distance2 = MaxDistance2;
+                  }
+               }
+
+            MIL_INT   IndexPoint;
+            MIL_FLOAT NearestDistance2;
+            if(Reference.FindApproximateNearest(Query, Distance2, Error, &IndexPoint, &NearestDistance2))
+               {
+               Previous  = (MIL_INT32)IndexPoint;
+               Distance2 = NearestDistance2;
+               }
+
+            SIcpPair& Pair = Pairs[(size_t)k];
+            Pair.Moving    = i;
+            Pair.Reference = Previous;
+            Pair.Distance2 = Previous >= 0 ? Distance2 : FLT_MAX;
+            NbChunkPaired += Previous >= 0 ? 1 : 0;
+            if(Previous >= 0)
+               MaxChunkDistance2 = std::max(MaxChunkDistance2, Distance2);
+            }
+         ChunkNbPaired[(size_t)Chunk]     = NbChunkPaired;
+         ChunkMaxDistance2[(size_t)Chunk] = MaxChunkDistance2;
+         });
+
+      // Keep the closest pairs, as many as the overlap or as estimated by the trimmed
+      // ICP. The unpaired points are farther than all the pairs.
+      MIL_INT   NbPaired = 0;
+      MIL_FLOAT MaxPairedDistance2 = 0.0f;
+      for(MIL_INT c = 0; c < NbChunks; c++)
+         {
+         NbPaired += ChunkNbPaired[(size_t)c];
+         MaxPairedDistance2 = std::max(MaxPairedDistance2, ChunkMaxDistance2[(size_t)c]);
+         }
+      MIL_INT NbKept = Settings.Overlap > 0.0 ?
+                       std::min((MIL_INT)(NbUsed * Settings.Overlap / 100.0 + 0.5), NbPaired) :
+                       EstimateNbKept(Pairs, NbUsed, NbPaired, MaxPairedDistance2,
+                                      (MIL_INT)(NbUsed * Settings.MinOverlap / 100.0 + 0.5), NbChunks, &Histograms);
+      if(NbKept < ICP_MIN_NB_PAIRS)
+         {
+         pResult->Status = eIcpNotEnoughPairs;
+         return;
+         }
+      const MIL_UINT32 KeptBits = SelectClosestPairs(Pairs, NbKept, NbChunks, &TieQuotas);
+
+      // Sum the distances, the points and their products, or the normal equations
+      // of the other metrics, over the pairs kept, in parallel, adding the sums of
+      // the chunks in order.
+      ParallelChunks(0, NbUsed, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+         {
+         SIcpSums Sums;
+         MIL_INT  NbTies = TieQuotas[(size_t)Chunk];
+         for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+            {
+            const SIcpPair&  Pair = Pairs[(size_t)k];
+            const MIL_UINT32 Bits = DistanceBits(Pair.Distance2);
+            if(Bits > KeptBits)
+               continue;
+            if(Bits == KeptBits)
+               {
+               if(NbTies == 0)
+                  continue;
+               NbTies--;
+               }
+
+            const MIL_FLOAT* pReferencePoint = Reference.Point(Pair.Reference);
+            MIL_DOUBLE Point[3];
+            TransformPoint(Matrix, Moving.X[Pair.Moving], Moving.Y[Pair.Moving], Moving.Z[Pair.Moving], Point);
+            Sums.Distance2 += Pair.Distance2;
+            if(Metric == eIcpPointToPoint)
+               {
+               for(MIL_INT r = 0; r < 3; r++)
+                  {
+                  Sums.Moving[r]    += Point[r];
+                  Sums.Reference[r] += pReferencePoint[r];
+                  for(MIL_INT c = 0; c < 3; c++)
+                     Sums.Products[r][c] += Point[r] * pReferencePoint[c];
+                  }
+               continue;
+               }
+
+            // The distance to the plane of the pair along n changes by (p x n).w + n.t
+            // for a small rotation w and a translation t of the moving point p. The
+            // plane-to-plane metric uses the sum of the normals of both points, and the
+            // generalized metric weights the distance of the pair by their covariances.
+            const MIL_FLOAT* pReferenceNormal = Reference.Normal(Pair.Reference);
+            MIL_DOUBLE Normal[3] = { pReferenceNormal[0], pReferenceNormal[1], pReferenceNormal[2] };
+            MIL_DOUBLE MovingNormal[3] = { 0.0, 0.0, 0.0 };
+            if(Metric == eIcpPlaneToPlane || Metric == eIcpGeneralized)
+               {
+               const MIL_DOUBLE Rotated[16] = { Matrix[0], Matrix[1], Matrix[2],  0.0,
+                                                Matrix[4], Matrix[5], Matrix[6],  0.0,
+                                                Matrix[8], Matrix[9], Matrix[10], 0.0,
+                                                0.0,       0.0,       0.0,        1.0 };
+               TransformPoint(Rotated, Moving.NormalX[Pair.Moving], Moving.NormalY[Pair.Moving],
+                              Moving.NormalZ[Pair.Moving], MovingNormal);
+               }
+            if(Metric == eIcpGeneralized)
+               {
+               AddGeneralizedPair(Point, pReferencePoint, Normal, MovingNormal, &Sums);
+               continue;
+               }
+            if(Metric == eIcpPlaneToPlane)
+               {
+               const MIL_DOUBLE Sign = Normal[0] * MovingNormal[0] + Normal[1] * MovingNormal[1] +
+                                       Normal[2] * MovingNormal[2] < 0.0 ? -1.0 : 1.0;
+               for(MIL_INT r = 0; r < 3; r++)
+                  Normal[r] += Sign * MovingNormal[r];
+               }
+            const MIL_DOUBLE Derivatives[6] = { Point[1] * Normal[2] - Point[2] * Normal[1],
+                                                Point[2] * Normal[0] - Point[0] * Normal[2],
+                                                Point[0] * Normal[1] - Point[1] * Normal[0],
+                                                Normal[0], Normal[1], Normal[2] };
+            const MIL_DOUBLE PlaneDistance = (Point[0] - pReferencePoint[0]) * Normal[0] +
+                                             (Point[1] - pReferencePoint[1]) * Normal[1] +
+                                             (Point[2] - pReferencePoint[2]) * Normal[2];
+            for(MIL_INT r = 0; r < 6; r++)
+               {
+               Sums.PlaneVector[r] += Derivatives[r] * PlaneDistance;
+               for(MIL_INT c = 0; c < 6; c++)
+                  Sums.PlaneMatrix[r][c] += Derivatives[r] * Derivatives[c];
+               }
+            }
+         ChunkSums[(size_t)Chunk] = Sums;
+         });
+      SIcpSums Sums;
+      for(MIL_INT c = 0; c < NbChunks; c++)
+         Sums.Add(ChunkSums[(size_t)c]);
+      const MIL_DOUBLE RmsError = sqrt(Sums.Distance2 / NbKept);
+      pResult->RmsError = RmsError;
+      pResult->Overlap  = 100.0 * NbKept / NbUsed;
+
+      // Stop when the RMS error no longer decreases enough, and search the
+      // following pairs exactly when it nearly does. The trimmed ICP compares the
+      // RMS distances of as many closest pairs as at the previous iteration, since
+      // the RMS error of fewer pairs is smaller whether or not the pairs improve.
+      const bool HasPrevious   = PreviousRmsError >= 0.0;
+      MIL_DOUBLE ComparedError = RmsError;
+      if(HasPrevious && NbKept != PreviousNbKept)
+         ComparedError = GetClosestRmsDistance(Pairs, std::min(PreviousNbKept, NbPaired), NbChunks, &TieQuotas);
+      const MIL_DOUBLE Decrease  = PreviousRmsError - ComparedError;
+      const MIL_DOUBLE Threshold = PreviousRmsError * Settings.RmsErrorRelativeThreshold / 100.0;
+      if(HasPrevious && Exact && Decrease <= Threshold)
+         {
+         pResult->Status = eIcpRmsErrorRelativeThresholdReached;
+         return;
+         }
+      if(pResult->NbIterations >= Settings.MaxIterations)
+         {
+         pResult->Status = eIcpMaxIterationsReached;
+         return;
+         }
+      PreviousRmsError = RmsError;
+      PreviousNbKept   = NbKept;
+
+      // The trimmed ICP pairs the points within a distance scaled to the RMS error,
+      // so that the pairs outside the overlap do not hold the estimated overlap up.
+      if(!(Settings.Overlap > 0.0))
+         {
+         const MIL_DOUBLE Distance = ICP_TRIM_DISTANCE_RATIO * RmsError;
+         MaxDistance2 = std::min(MaxPairDistance2, (MIL_FLOAT)(Distance * Distance));
+         }
+      if(!Exact)
+         {
+         pResult->NbApproximateIterations++;
+         Exact = HasPrevious && Decrease <= ICP_EXACT_SEARCH_RATIO * Threshold;
+         }
+
+      // Solve the rigid transformation of the moving points onto their pairs.
+      MIL_DOUBLE Rotation[3][3];
+      MIL_DOUBLE Translation[3];
+      if(Metric == eIcpPointToPoint)
+         {
+         MIL_DOUBLE MovingCenter[3];
+         MIL_DOUBLE ReferenceCenter[3];
+         MIL_DOUBLE H[3][3];
+         for(MIL_INT r = 0; r < 3; r++)
+            {
+            MovingCenter[r]    = Sums.Moving[r] / NbKept;
+            ReferenceCenter[r] = Sums.Reference[r] / NbKept;
+            }
+         for(MIL_INT r = 0; r < 3; r++)
+            for(MIL_INT c = 0; c < 3; c++)
+               H[r][c] = Sums.Products[r][c] - NbKept * MovingCenter[r] * ReferenceCenter[c];
+
+         SolveRotation(H, Rotation);
+         for(MIL_INT r = 0; r < 3; r++)
+            Translation[r] = ReferenceCenter[r] - (Rotation[r][0] * MovingCenter[0] +
+                                                   Rotation[r][1] * MovingCenter[1] +
+                                                   Rotation[r][2] * MovingCenter[2]);
+         }
+      else
+         {
+         // Minimize the linearized distances to the planes or weighted distances; the
+         // transformation is not updated when they do not constrain all its parameters.
+         MIL_DOUBLE Opposite[6];
+         MIL_DOUBLE Update[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+         for(MIL_INT r = 0; r < 6; r++)
+            Opposite[r] = -Sums.PlaneVector[r];
+         if(!SolveLinearSystem6(Sums.PlaneMatrix, Opposite, Update))
+            for(MIL_INT r = 0; r < 6; r++)
+               Update[r] = 0.0;
+         RotationFromVector(Update, Rotation);
+         for(MIL_INT r = 0; r < 3; r++)
+            Translation[r] = Update[3 + r];
+         }
+
+      // Compose the update with the current transformation.
+      MIL_DOUBLE Updated[16];
+      for(MIL_INT r = 0; r < 3; r++)
+         {
+         for(MIL_INT c = 0; c < 4; c++)
+            Updated[4 * r + c] = Rotation[r][0] * Matrix[c] + Rotation[r][1] * Matrix[4 + c] + Rotation[r][2] * Matrix[8 + c];
+         Updated[4 * r + 3] += Translation[r];
+         }
+      for(MIL_INT c = 0; c < 4; c++)
+         Updated[12 + c] = Matrix[12 + c];
+      for(MIL_INT i = 0; i < 16; i++)
+         pResult->Matrix[i] = Updated[i];
+      pResult->NbIterations++;
+      }
+   }
+
+//--------------------------------------------------------------------------
+void RegisterIcpTwoStages(const CNearestNeighborIndex& Reference, const SCloudView& CoarseMoving,
+                          const SCloudView& FineMoving, const SIcpSettings& Settings, MIL_DOUBLE FineOverlap,
+                          const MIL_DOUBLE InitialMatrix[16], SIcpResult* pPreregistration,
+                          SIcpResult* pRegistration)
+   {
+   RegisterIcp(Reference, CoarseMoving, Settings, InitialMatrix, pPreregistration);
+   if(pPreregistration->Status == eIcpNotEnoughPairs)
+      {
+      *pRegistration = *pPreregistration;
+      return;
+      }
+
+   SIcpSettings FineSettings = Settings;
+   FineSettings.Overlap = FineOverlap;
+   RegisterIcp(Reference, FineMoving, FineSettings, pPreregistration->Matrix, pRegistration);
+   }
+
+//--------------------------------------------------------------------------
+void RegisterIcpPyramid(const CNearestNeighborIndex* const* References, const SCloudView* Moving, MIL_INT NbLevels,
+                        const SIcpSettings& Settings, const MIL_DOUBLE InitialMatrix[16], SIcpResult* pLevelResults)
+   {
+   const MIL_DOUBLE* Matrix = InitialMatrix;
+   for(MIL_INT l = NbLevels - 1; l >= 0; l--)
+      {
+      RegisterIcp(*References[l], Moving[l], Settings, Matrix, &pLevelResults[l]);
+      if(pLevelResults[l].Status == eIcpNotEnoughPairs)
+         {
+         for(MIL_INT Finer = l - 1; Finer >= 0; Finer--)
+            {
+            pLevelResults[Finer] = pLevelResults[l];
+            pLevelResults[Finer].NbIterations            = 0;
+            pLevelResults[Finer].NbApproximateIterations = 0;
+            }
+         return;
+         }
+      Matrix = pLevelResults[l].Matrix;
+      }
+   }
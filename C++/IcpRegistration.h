@@ -0,0 +1,105 @@
+﻿//***************************************************************************************/
+//
+// File name: IcpRegistration.h
+//
+// Synopsis:  Declares the point-to-point, point-to-plane and plane-to-plane ICP
+//            registrations of a point cloud on a reference point cloud indexed by
+//            a spatial index. The index is built
+//            by the caller, so that it can be shared by several registrations on
+//            the same reference.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include "PointCloudData.h"
+#include "NearestNeighborIndex.h"
+
+// Status of an ICP registration.
+enum EIcpStatus
+   {
+   eIcpNotEnoughPairs = 0,             // Fewer than 3 point pairs were found.
+   eIcpMaxIterationsReached,
+   eIcpRmsErrorRelativeThresholdReached
+   };
+
+// Error minimized by an ICP registration. The point-to-plane metric minimizes
+// the distances of the moving points to the tangent planes of their pairs, and
+// the plane-to-plane metric their distances along the sum of the normals of
+// both points, which usually converge in fewer iterations on smooth surfaces.
+enum EIcpMetric
+   {
+   eIcpPointToPoint = 0,
+   eIcpPointToPlane,    // Needs the normals of the reference index.
+   eIcpPlaneToPlane,    // Needs the normals of the reference index and of the moving cloud.
+   eIcpGeneralized      // Generalized ICP; needs the normals of the reference index and of the moving cloud.
+   };
+
+//-------------------------------------------------------------------------------
+// Controls of an ICP registration.
+//-------------------------------------------------------------------------------
+struct SIcpSettings
+   {
+   MIL_INT    MaxIterations;
+   MIL_DOUBLE RmsErrorRelativeThreshold;   // %, of the RMS error of the previous iteration.
+   MIL_DOUBLE Overlap;                     // %, of the moving points paired at each iteration; 0 to
+                                           // estimate it at each iteration.
+   MIL_DOUBLE MinOverlap;                  // %, smallest estimated overlap.
+   MIL_DOUBLE MaxPairDistance;             // Distance beyond which the moving points are not paired.
+   MIL_INT    DecimationStep;              // Step between the moving points used.
+   MIL_DOUBLE NeighborError;               // Relative distance error of the nearest reference points while
+                                           // the RMS error still decreases fast; 0 for an exact search.
+   EIcpMetric Metric;
+   };
+
+//-------------------------------------------------------------------------------
+// Result of an ICP registration.
+//-------------------------------------------------------------------------------
+struct SIcpResult
+   {
+   MIL_DOUBLE Matrix[16];     // Row-major transformation of the moving cloud onto the reference.
+   MIL_DOUBLE RmsError;       // RMS distance of the pairs kept at the last iteration.
+   MIL_DOUBLE Overlap;        // %, of the moving points kept at the last iteration.
+   MIL_INT    NbIterations;
+   MIL_INT    NbApproximateIterations;   // Iterations paired with approximate nearest reference points.
+   EIcpMetric Metric;                    // Metric used, with the normals available.
+   EIcpStatus Status;
+   };
+
+// Returns the rotation R maximizing the trace of R H, H being the covariance
+// of the moving and reference points of the pairs, centered on their
+// centroids: H[r][c] sums the products of the moving coordinate r and of the
+// reference coordinate c.
+void SolveRotation(const MIL_DOUBLE H[3][3], MIL_DOUBLE R[3][3]);
+
+// Registers the valid points of a moving point cloud on the reference point
+// cloud of a spatial index, starting from the initial row-major
+// transformation. The result holds the last transformation, even when the
+// registration stops on too few pairs or on the maximum number of iterations.
+// A metric whose normals are missing falls back to point-to-plane or
+// point-to-point. The result does not depend on the number of threads.
+void RegisterIcp(const CNearestNeighborIndex& Reference, const SCloudView& Moving, const SIcpSettings& Settings,
+                 const MIL_DOUBLE InitialMatrix[16], SIcpResult* pResult);
+
+// Registers a moving point cloud in two stages, like the pairwise registration
+// of the example: a pre-registration of the coarse moving points from the
+// initial transformation with the overlap of the settings, then a registration
+// of the fine moving points from the pre-registration with FineOverlap, 0 to
+// estimate it. The second stage is skipped when the first one finds too few
+// pairs; pRegistration then holds the pre-registration.
+void RegisterIcpTwoStages(const CNearestNeighborIndex& Reference, const SCloudView& CoarseMoving,
+                          const SCloudView& FineMoving, const SIcpSettings& Settings, MIL_DOUBLE FineOverlap,
+                          const MIL_DOUBLE InitialMatrix[16], SIcpResult* pPreregistration,
+                          SIcpResult* pRegistration);
+
+// Registers a moving point cloud through a resolution pyramid, from its
+// coarsest level NbLevels - 1 to its finest level 0: the moving points of each
+// level are registered on the reference index of the same level from the
+// transformation of the coarser level, so that most iterations run on the
+// few points of the coarse levels. pLevelResults receives the result of each
+// level. When a level finds too few pairs, the finer levels are skipped and
+// their results hold its transformation without iterations.
+void RegisterIcpPyramid(const CNearestNeighborIndex* const* References, const SCloudView* Moving, MIL_INT NbLevels,
+                        const SIcpSettings& Settings, const MIL_DOUBLE InitialMatrix[16], SIcpResult* pLevelResults);
@@ -0,0 +1,250 @@
+﻿//***************************************************************************************/
+//
+// File name: KdTree.cpp
+//
+// Synopsis:  Implements the kd-tree of the reference point clouds.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "KdTree.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <float.h>
+
+// Maximum number of points in a leaf.
+static const MIL_INT KD_TREE_LEAF_SIZE = 8;
+
+//--------------------------------------------------------------------------
+CKdTree::CKdTree()
+   : m_Depth(0)
+   {
+   }
+
+//--------------------------------------------------------------------------
+void CKdTree::Build(const SCloudView& View, MIL_INT Step)
+   {
+   // Copy the valid points.
+   Step = std::max<MIL_INT>(Step, 1);
+   m_Points.clear();
+   m_Points.reserve((size_t)(View.NbPoints / Step + 1));
+   MIL_FLOAT Min[3] = {  FLT_MAX,  FLT_MAX,  FLT_MAX };
+   MIL_FLOAT Max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+   for(MIL_INT i = 0; i < View.NbPoints; i += Step)
+      {
+      if(View.Confidence && View.Confidence[i] == 0)
+         continue;
+
+      SPoint Point;
+      Point.Coordinates[0] = View.X[i];
+      Point.Coordinates[1] = View.Y[i];
+      Point.Coordinates[2] = View.Z[i];
+      Point.Index          = (MIL_UINT32)i;
+      for(MIL_INT a = 0; a < 3; a++)
+         {
+         Min[a] = std::min(Min[a], Point.Coordinates[a]);
+         Max[a] = std::max(Max[a], Point.Coordinates[a]);
+         }
+      m_Points.push_back(Point);
+      }
+
+   // Halve the points down to the leaf size.
+   const MIL_INT NbTreePoints = NbPoints();
+   m_Depth = 0;
+   while((NbTreePoints >> m_Depth) > KD_TREE_LEAF_SIZE)
+      m_Depth++;
+   m_Nodes.assign(((size_t)1 << m_Depth) - 1, SNode());
+
+   // Split the first levels one level at a time, the nodes of a level in parallel,
+   // until there is a subtree per worker, then build the subtrees in parallel.
+   struct STask
+      {
+      MIL_INT   Node;
+      MIL_INT   Begin;
+      MIL_INT   End;
+      MIL_FLOAT Min[3];
+      MIL_FLOAT Max[3];
+      };
+   std::vector<STask> Level(1);
+   Level[0].Node  = 0;
+   Level[0].Begin = 0;
+   Level[0].End   = NbTreePoints;
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      Level[0].Min[a] = Min[a];
+      Level[0].Max[a] = Max[a];
+      }
+
+   MIL_INT Depth = 0;
+   for(; Depth < m_Depth && (MIL_INT)Level.size() < GetNbWorkers(); Depth++)
+      {
+      std::vector<STask> NextLevel(2 * Level.size());
+      ParallelChunks(0, (MIL_INT)Level.size(), (MIL_INT)Level.size(), [&](MIL_INT, MIL_INT TaskBegin, MIL_INT TaskEnd)
+         {
+         for(MIL_INT t = TaskBegin; t < TaskEnd; t++)
+            {
+            const STask& Task = Level[(size_t)t];
+            BuildNode(Task.Node, Task.Begin, Task.End, m_Depth - 1, Task.Min, Task.Max);
+
+            // The children bounds are those of the node cut by the split plane.
+            const SNode& Node = m_Nodes[(size_t)Task.Node];
+            const MIL_INT Mid = (Task.Begin + Task.End) / 2;
+            STask& Left  = NextLevel[(size_t)(2 * t)];
+            STask& Right = NextLevel[(size_t)(2 * t + 1)];
+            Left  = Task;
+            Right = Task;
+            Left.Node  = 2 * Task.Node + 1;
+            Left.End   = Mid;
+            Right.Node = 2 * Task.Node + 2;
+            Right.Begin = Mid;
+            Left.Max[Node.Axis]  = Node.Split;
+            Right.Min[Node.Axis] = Node.Split;
+            }
+         });
+      Level.swap(NextLevel);
+      }
+
+   ParallelChunks(0, (MIL_INT)Level.size(), (MIL_INT)Level.size(), [&](MIL_INT, MIL_INT TaskBegin, MIL_INT TaskEnd)
+      {
+      for(MIL_INT t = TaskBegin; t < TaskEnd; t++)
+         {
+         const STask& Task = Level[(size_t)t];
+         BuildNode(Task.Node, Task.Begin, Task.End, Depth, Task.Min, Task.Max);
+         }
+      });
+   }
+
+//--------------------------------------------------------------------------
+// Splits the points of a node and builds its subtree. The subtree is built
+// down to the leaves when Depth is the depth of the node; the node alone is
+// split when Depth is m_Depth - 1.
+//--------------------------------------------------------------------------
+void CKdTree::BuildNode(MIL_INT Node, MIL_INT Begin, MIL_INT End, MIL_INT Depth,
+                        const MIL_FLOAT Min[3], const MIL_FLOAT Max[3])
+   {
+   if(Depth >= m_Depth)
+      return;
+
+   MIL_INT Axis = 0;
+   for(MIL_INT a = 1; a < 3; a++)
+      {
+      if(Max[a] - Min[a] > Max[Axis] - Min[Axis])
+         Axis = a;
+      }
+
+   const MIL_INT Mid = (Begin + End) / 2;
+   SNode& Split = m_Nodes[(size_t)Node];
+   Split.Axis = (MIL_INT32)Axis;
+   if(Begin < End)
+      {
+      std::nth_element(m_Points.begin() + Begin, m_Points.begin() + Mid, m_Points.begin() + End,
+                       [Axis](const SPoint& First, const SPoint& Second)
+                          { return First.Coordinates[Axis] < Second.Coordinates[Axis]; });
+      Split.Split = Mid < End ? m_Points[(size_t)Mid].Coordinates[Axis] : Max[Axis];
+      }
+   else
+      Split.Split = Min[Axis];
+
+   if(Depth == m_Depth - 1)
+      return;
+
+   MIL_FLOAT ChildMin[3] = { Min[0], Min[1], Min[2] };
+   MIL_FLOAT ChildMax[3] = { Max[0], Max[1], Max[2] };
+   ChildMax[Axis] = Split.Split;
+   BuildNode(2 * Node + 1, Begin, Mid, Depth + 1, Min, ChildMax);
+   ChildMin[Axis] = Split.Split;
+   BuildNode(2 * Node + 2, Mid, End, Depth + 1, ChildMin, Max);
+   }
+
+//--------------------------------------------------------------------------
+bool CKdTree::FindNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2,
+                          MIL_INT* pTreeIndex, MIL_FLOAT* pDistance2) const
+   {
+   return CKdTree::FindApproximateNearest(Query, MaxDistance2, 0.0f, pTreeIndex, pDistance2);
+   }
+
+//--------------------------------------------------------------------------
+bool CKdTree::FindApproximateNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2, MIL_FLOAT Error,
+                                     MIL_INT* pTreeIndex, MIL_FLOAT* pDistance2) const
+   {
+   // Subtrees still to visit with the offsets of the query from their cell
+   // along each axis, whose squared sum bounds the distance of their points.
+   // A subtree is pushed only above the subtrees that are less deep.
+   struct SEntry
+      {
+      MIL_INT   Node;
+      MIL_INT   Begin;
+      MIL_INT   End;
+      MIL_INT   Depth;
+      MIL_FLOAT Offset[3];
+      MIL_FLOAT Distance2;
+      };
+   SEntry  Stack[64];
+   MIL_INT NbEntries = 0;
+
+   // The subtrees are skipped when they are not nearer than the nearest point
+   // found shrunk by the error.
+   const MIL_FLOAT Shrink = 1.0f / ((1.0f + Error) * (1.0f + Error));
+   MIL_INT   BestIndex     = -1;
+   MIL_FLOAT BestDistance2 = MaxDistance2;
+   MIL_FLOAT Bound2        = MaxDistance2;
+
+   SEntry Root = { 0, 0, NbPoints(), 0, { 0.0f, 0.0f, 0.0f }, 0.0f };
+   Stack[NbEntries++] = Root;
+   while(NbEntries > 0)
+      {
+      SEntry Entry = Stack[--NbEntries];
+      if(Entry.Distance2 >= Bound2)
+         continue;
+
+      // Descend to the leaf on the side of the query, keeping the other sides.
+      while(Entry.Depth < m_Depth)
+         {
+         const SNode&    Node = m_Nodes[(size_t)Entry.Node];
+         const MIL_INT   Mid  = (Entry.Begin + Entry.End) / 2;
+         const MIL_FLOAT Diff = Query[Node.Axis] - Node.Split;
+
+         SEntry Far = Entry;
+         Far.Depth++;
+         Far.Distance2 += Diff * Diff - Entry.Offset[Node.Axis] * Entry.Offset[Node.Axis];
+         Far.Offset[Node.Axis] = Diff;
+         if(Diff < 0.0f)
+            {
+            Far.Node  = 2 * Entry.Node + 2;
+            Far.Begin = Mid;
+            Entry.Node = 2 * Entry.Node + 1;
+            Entry.End  = Mid;
+            }
+         else
+            {
+            Far.Node  = 2 * Entry.Node + 1;
+            Far.End   = Mid;
+            Entry.Node  = 2 * Entry.Node + 2;
+            Entry.Begin = Mid;
+            }
+         Entry.Depth++;
+         if(Far.Distance2 < Bound2)
+            Stack[NbEntries++] = Far;
+         }
+
+      for(MIL_INT i = Entry.Begin; i < Entry.End; i++)
+         {
+         const MIL_FLOAT* pPoint = m_Points[(size_t)i].Coordinates;
+         const MIL_FLOAT  DX = pPoint[0] - Query[0];
+         const MIL_FLOAT  DY = pPoint[1] - Query[1];
+         const MIL_FLOAT  DZ = pPoint[2] - Query[2];
+         const MIL_FLOAT  Distance2 = DX * DX + DY * DY + DZ * DZ;
+         if(Distance2 < BestDistance2)
+            {
+            BestDistance2 = Distance2;
+            BestIndex     = i;
+            Bound2        = Distance2 * Shrink;
+            }
+         }
+      }
+
+   *pTreeIndex = BestIndex;
+   if(pDistance2)
+      *pDistance2 = BestDistance2;
+   return BestIndex >= 0;
+   }
@@ -0,0 +1,63 @@
+﻿//***************************************************************************************/
+//
+// File name: KdTree.h
+//
+// Synopsis:  Declares the kd-tree used to find the nearest neighbors of points in
+//            a reference point cloud at any distance.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include <vector>
+#include "PointCloudData.h"
+#include "NearestNeighborIndex.h"
+
+//-------------------------------------------------------------------------------
+// Balanced kd-tree over the valid points of a cloud. The points are copied in
+// the order of the leaves, so that the tree does not depend on the container
+// of the cloud. A node splits its points at their median along the axis of
+// largest extent of its bounding box; the children of node k are 2k+1 and
+// 2k+2 and the leaves hold at most KD_TREE_LEAF_SIZE points.
+//-------------------------------------------------------------------------------
+class CKdTree : public CNearestNeighborIndex
+   {
+   public:
+      CKdTree();
+
+      // Builds the tree over the valid points of a cloud taken with a step, so
+      // that the tree can index a decimated cloud. The levels of the tree are
+      // built in parallel.
+      void Build(const SCloudView& View, MIL_INT Step);
+
+      // CNearestNeighborIndex.
+      virtual MIL_INT          NbPoints() const { return (MIL_INT)m_Points.size(); }
+      virtual const MIL_FLOAT* Point(MIL_INT TreeIndex) const { return m_Points[(size_t)TreeIndex].Coordinates; }
+      virtual MIL_INT          CloudIndex(MIL_INT TreeIndex) const { return (MIL_INT)m_Points[(size_t)TreeIndex].Index; }
+      virtual bool             FindNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2,
+                                           MIL_INT* pTreeIndex, MIL_FLOAT* pDistance2) const;
+      virtual bool             FindApproximateNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2, MIL_FLOAT Error,
+                                                      MIL_INT* pTreeIndex, MIL_FLOAT* pDistance2) const;
+
+   private:
+      struct SPoint
+         {
+         MIL_FLOAT  Coordinates[3];
+         MIL_UINT32 Index;
+         };
+
+      struct SNode
+         {
+         MIL_FLOAT Split;
+         MIL_INT32 Axis;
+         };
+
+      void BuildNode(MIL_INT Node, MIL_INT Begin, MIL_INT End, MIL_INT Depth,
+                     const MIL_FLOAT Min[3], const MIL_FLOAT Max[3]);
+
+      std::vector<SPoint> m_Points;
+      std::vector<SNode>  m_Nodes;
+      MIL_INT             m_Depth;   // Depth of the leaves.
+   };
@@ -0,0 +1,148 @@
+﻿//***************************************************************************************/
+//
+// File name: MappedFile.cpp
+//
+// Synopsis:  Implements the read-only memory-mapped file and the file information helpers.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "MappedFile.h"
+
+#if M_MIL_USE_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//--------------------------------------------------------------------------
+CMappedFile::CMappedFile()
+   : m_pData(M_NULL),
+     m_Size(0)
+#if M_MIL_USE_WINDOWS
+   , m_FileHandle(INVALID_HANDLE_VALUE),
+     m_MappingHandle(M_NULL)
+#else
+   , m_FileDescriptor(-1)
+#endif
+   {
+   }
+
+//--------------------------------------------------------------------------
+CMappedFile::~CMappedFile()
+   {
+   Close();
+   }
+
+//--------------------------------------------------------------------------
+// Maps the whole file in read-only mode. Returns false if the file cannot
+// be opened or mapped, or if it is empty.
+//--------------------------------------------------------------------------
+bool CMappedFile::Open(MIL_CONST_TEXT_PTR FileName)
+   {
+   Close();
+
+#if M_MIL_USE_WINDOWS
+   m_FileHandle = CreateFile(FileName, GENERIC_READ, FILE_SHARE_READ, M_NULL, OPEN_EXISTING,
+                             FILE_FLAG_SEQUENTIAL_SCAN, M_NULL);
+   if(m_FileHandle == INVALID_HANDLE_VALUE)
+      return false;
+
+   LARGE_INTEGER FileSize;
+   if(!GetFileSizeEx(m_FileHandle, &FileSize) || FileSize.QuadPart == 0)
+      {
+      Close();
+      return false;
+      }
+
+   m_MappingHandle = CreateFileMapping(m_FileHandle, M_NULL, PAGE_READONLY, 0, 0, M_NULL);
+   if(!m_MappingHandle)
+      {
+      Close();
+      return false;
+      }
+
+   m_pData = (const MIL_UINT8*)MapViewOfFile(m_MappingHandle, FILE_MAP_READ, 0, 0, 0);
+   if(!m_pData)
+      {
+      Close();
+      return false;
+      }
+   m_Size = (MIL_INT)FileSize.QuadPart;
+#else
+   m_FileDescriptor = open(FileName, O_RDONLY);
+   if(m_FileDescriptor < 0)
+      return false;
+
+   struct stat FileStatus;
+   if(fstat(m_FileDescriptor, &FileStatus) != 0 || FileStatus.st_size == 0)
+      {
+      Close();
+      return false;
+      }
+
+   void* pMapping = mmap(M_NULL, (size_t)FileStatus.st_size, PROT_READ, MAP_PRIVATE, m_FileDescriptor, 0);
+   if(pMapping == MAP_FAILED)
+      {
+      Close();
+      return false;
+      }
+
+   // The loaders read the file front to back.
+   madvise(pMapping, (size_t)FileStatus.st_size, MADV_SEQUENTIAL);
+
+   m_pData = (const MIL_UINT8*)pMapping;
+   m_Size  = (MIL_INT)FileStatus.st_size;
+#endif
+
+   return true;
+   }
+
+//--------------------------------------------------------------------------
+// Unmaps the file and releases the handles.
+//--------------------------------------------------------------------------
+void CMappedFile::Close()
+   {
+#if M_MIL_USE_WINDOWS
+   if(m_pData)
+      UnmapViewOfFile(m_pData);
+   if(m_MappingHandle)
+      CloseHandle(m_MappingHandle);
+   if(m_FileHandle != INVALID_HANDLE_VALUE)
+      CloseHandle(m_FileHandle);
+   m_MappingHandle = M_NULL;
+   m_FileHandle    = INVALID_HANDLE_VALUE;
+#else
+   if(m_pData)
+      munmap((void*)m_pData, (size_t)m_Size);
+   if(m_FileDescriptor >= 0)
+      close(m_FileDescriptor);
+   m_FileDescriptor = -1;
+#endif
+
+   m_pData = M_NULL;
+   m_Size  = 0;
+   }
+
+//--------------------------------------------------------------------------
+bool GetFileSignature(MIL_CONST_TEXT_PTR FileName, MIL_INT64* pSize, MIL_INT64* pModificationTime)
+   {
+#if M_MIL_USE_WINDOWS
+   WIN32_FILE_ATTRIBUTE_DATA Attributes;
+   if(!GetFileAttributesEx(FileName, GetFileExInfoStandard, &Attributes))
+      return false;
+   *pSize             = ((MIL_INT64)Attributes.nFileSizeHigh << 32) | Attributes.nFileSizeLow;
+   *pModificationTime = ((MIL_INT64)Attributes.ftLastWriteTime.dwHighDateTime << 32) |
+                        Attributes.ftLastWriteTime.dwLowDateTime;
+#else
+   struct stat FileStatus;
+   if(stat(FileName, &FileStatus) != 0)
+      return false;
+   *pSize             = (MIL_INT64)FileStatus.st_size;
+   *pModificationTime = (MIL_INT64)FileStatus.st_mtime;
+#endif
+   return true;
+   }
@@ -0,0 +1,50 @@
+﻿//***************************************************************************************/
+//
+// File name: MappedFile.h
+//
+// Synopsis:  Declares a read-only memory-mapped file used by the point cloud loaders
+//            to access the file content without copying it in user memory, and
+//            the file information helpers used to validate the cached clouds.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+
+//-------------------------------------------------------------------------------
+// Read-only view of a whole file mapped in the process address space.
+//-------------------------------------------------------------------------------
+class CMappedFile
+   {
+   public:
+      CMappedFile();
+      ~CMappedFile();
+
+      bool Open(MIL_CONST_TEXT_PTR FileName);
+      void Close();
+
+      bool             IsOpen() const { return m_pData != M_NULL; }
+      const MIL_UINT8* Data()   const { return m_pData; }
+      MIL_INT          Size()   const { return m_Size; }
+
+   private:
+      // Not copyable.
+      CMappedFile(const CMappedFile&);
+      CMappedFile& operator=(const CMappedFile&);
+
+      const MIL_UINT8* m_pData;
+      MIL_INT          m_Size;
+
+#if M_MIL_USE_WINDOWS
+      void* m_FileHandle;
+      void* m_MappingHandle;
+#else
+      int   m_FileDescriptor;
+#endif
+   };
+
+// Gets the size and the last modification time of a file. Returns false
+// if the file does not exist.
+bool GetFileSignature(MIL_CONST_TEXT_PTR FileName, MIL_INT64* pSize, MIL_INT64* pModificationTime);
@@ -0,0 +1,199 @@
+﻿//***************************************************************************************/
+//
+// File name: Morton.cpp
+//
+// Synopsis:  Implements the Morton ordering of the point clouds.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "Morton.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <string.h>
+
+// Minimum number of points sorted by a worker thread.
+static const MIL_INT MORTON_SORT_CHUNK_SIZE = 65536;
+
+// Number of bits of the digit of the Morton codes that distributes the keys in buckets.
+static const MIL_INT    MORTON_RADIX_BITS = 14;
+static const MIL_INT    MORTON_RADIX_SIZE = (MIL_INT)1 << MORTON_RADIX_BITS;
+static const MIL_UINT64 MORTON_RADIX_MASK = (MIL_UINT64)(MORTON_RADIX_SIZE - 1);
+
+// Minimum number of points copied by a worker thread when a cloud is reordered.
+static const MIL_INT MORTON_GATHER_CHUNK_SIZE = 65536;
+
+// Morton code of a point and its index in the cloud.
+struct SMortonKey
+   {
+   MIL_UINT64 Code;
+   MIL_UINT32 Index;
+
+   bool operator<(const SMortonKey& Other) const
+      {
+      return Code < Other.Code || (Code == Other.Code && Index < Other.Index);
+      }
+   };
+
+//--------------------------------------------------------------------------
+void ComputeMortonOrder(const SCloudView& View, const SCloudStats& Stats, std::vector<MIL_UINT32>* pOrder)
+   {
+   const SMortonGrid Grid(Stats);
+
+   // Count the valid points of each chunk to place their keys.
+   const MIL_INT NbChunks = GetNbChunks(View.NbPoints, MORTON_SORT_CHUNK_SIZE);
+   std::vector<MIL_INT> KeyBegin((size_t)NbChunks + 1, 0);
+   ParallelChunks(0, View.NbPoints, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      MIL_INT NbValid = ChunkEnd - ChunkBegin;
+      if(View.Confidence)
+         {
+         for(MIL_INT i = ChunkBegin; i < ChunkEnd; i++)
+            NbValid -= (View.Confidence[i] == 0);
+         }
+      KeyBegin[(size_t)Chunk + 1] = NbValid;
+      });
+   for(MIL_INT c = 0; c < NbChunks; c++)
+      KeyBegin[(size_t)c + 1] += KeyBegin[(size_t)c];
+   const MIL_INT NbKeys = KeyBegin[(size_t)NbChunks];
+
+   // Compute the keys, in the order of the points, and the bits that differ
+   // between them.
+   std::vector<SMortonKey> Keys((size_t)NbKeys);
+   std::vector<MIL_UINT64> ChunkOr((size_t)NbChunks, 0);
+   std::vector<MIL_UINT64> ChunkAnd((size_t)NbChunks, ~(MIL_UINT64)0);
+   ParallelChunks(0, View.NbPoints, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      SMortonKey* pKey = Keys.empty() ? M_NULL : &Keys[(size_t)KeyBegin[(size_t)Chunk]];
+      MIL_UINT64  Or   = 0;
+      MIL_UINT64  And  = ~(MIL_UINT64)0;
+      for(MIL_INT i = ChunkBegin; i < ChunkEnd; i++)
+         {
+         if(View.Confidence && View.Confidence[i] == 0)
+            continue;
+
+         pKey->Code  = Grid.Encode(View.X[i], View.Y[i], View.Z[i]);
+         pKey->Index = (MIL_UINT32)i;
+         Or  |= pKey->Code;
+         And &= pKey->Code;
+         pKey++;
+         }
+      ChunkOr[(size_t)Chunk]  = Or;
+      ChunkAnd[(size_t)Chunk] = And;
+      });
+   MIL_UINT64 Or  = 0;
+   MIL_UINT64 And = ~(MIL_UINT64)0;
+   for(MIL_INT c = 0; c < NbChunks; c++)
+      {
+      Or  |= ChunkOr[(size_t)c];
+      And &= ChunkAnd[(size_t)c];
+      }
+   const MIL_UINT64 Varying = NbKeys > 0 ? Or ^ And : 0;
+
+   // Distribute the keys in buckets by the highest digit that differs between
+   // them. The chunks count their digits, then each chunk scatters its keys
+   // from the offset of its digits after those of the previous chunks.
+   MIL_INT Shift = 0;
+   while(Shift + MORTON_RADIX_BITS < 64 && (Varying >> (Shift + MORTON_RADIX_BITS)) != 0)
+      Shift++;
+   const MIL_INT NbSortChunks = GetNbChunks(NbKeys, MORTON_SORT_CHUNK_SIZE);
+   std::vector<MIL_INT> Offsets((size_t)(NbSortChunks * MORTON_RADIX_SIZE));
+   ParallelChunks(0, NbKeys, NbSortChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      MIL_INT* pCounts = &Offsets[(size_t)(Chunk * MORTON_RADIX_SIZE)];
+      memset(pCounts, 0, (size_t)MORTON_RADIX_SIZE * sizeof(MIL_INT));
+      for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+         pCounts[(Keys[(size_t)k].Code >> Shift) & MORTON_RADIX_MASK]++;
+      });
+
+   std::vector<MIL_INT> BucketBegin((size_t)MORTON_RADIX_SIZE + 1, 0);
+   MIL_INT Position = 0;
+   for(MIL_INT d = 0; d < MORTON_RADIX_SIZE; d++)
+      {
+      BucketBegin[(size_t)d] = Position;
+      for(MIL_INT c = 0; c < NbSortChunks; c++)
+         {
+         const MIL_INT Count = Offsets[(size_t)(c * MORTON_RADIX_SIZE + d)];
+         Offsets[(size_t)(c * MORTON_RADIX_SIZE + d)] = Position;
+         Position += Count;
+         }
+      }
+   BucketBegin[(size_t)MORTON_RADIX_SIZE] = Position;
+
+   std::vector<SMortonKey> Buckets((size_t)NbKeys);
+   ParallelChunks(0, NbKeys, NbSortChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      MIL_INT* pOffsets = &Offsets[(size_t)(Chunk * MORTON_RADIX_SIZE)];
+      for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+         {
+         const SMortonKey& Key = Keys[(size_t)k];
+         Buckets[(size_t)pOffsets[(Key.Code >> Shift) & MORTON_RADIX_MASK]++] = Key;
+         }
+      });
+
+   // Sort the buckets, which are small enough to be sorted in the cache. Each
+   // chunk of keys sorts the buckets that start in it.
+   ParallelChunks(0, NbKeys, NbSortChunks, [&](MIL_INT, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      MIL_INT d = std::lower_bound(BucketBegin.begin(), BucketBegin.end() - 1, ChunkBegin) - BucketBegin.begin();
+      for(; d < MORTON_RADIX_SIZE && BucketBegin[(size_t)d] < ChunkEnd; d++)
+         std::sort(Buckets.begin() + BucketBegin[(size_t)d], Buckets.begin() + BucketBegin[(size_t)d + 1]);
+      });
+   Keys.swap(Buckets);
+
+   pOrder->resize(Keys.size());
+   ParallelChunks(0, NbKeys, NbSortChunks, [&](MIL_INT, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+         (*pOrder)[(size_t)k] = Keys[(size_t)k].Index;
+      });
+   }
+
+//--------------------------------------------------------------------------
+// Copies the values of an array in the order of the points.
+//--------------------------------------------------------------------------
+template <class T>
+static void GatherValues(const T* pSrc, const MIL_UINT32* pOrder, MIL_INT Begin, MIL_INT End, T* pDst)
+   {
+   if(!pSrc || !pDst)
+      return;
+   for(MIL_INT i = Begin; i < End; i++)
+      pDst[i] = pSrc[pOrder[i]];
+   }
+
+//--------------------------------------------------------------------------
+MIL_UNIQUE_BUF_ID ReorderPointCloud(MIL_ID MilSystem, const SCloudView& View, const SCloudStats& Stats)
+   {
+   std::vector<MIL_UINT32> Order;
+   ComputeMortonOrder(View, Stats, &Order);
+
+   MIL_INT Components = eComponentRange;
+   if(View.Intensity)
+      Components |= eComponentReflectance;
+   else if(View.Color[0])
+      Components |= eComponentColor;
+   if(View.NormalX)
+      Components |= eComponentNormals;
+
+   SCloudView Sorted;
+   const MIL_INT NbPoints = (MIL_INT)Order.size();
+   MIL_UNIQUE_BUF_ID MilSorted = AllocPointCloudContainer(MilSystem, NbPoints, Components, &Sorted);
+   if(NbPoints == 0)
+      return MilSorted;
+
+   const MIL_UINT32* pOrder = &Order[0];
+   ParallelFor(0, NbPoints, MORTON_GATHER_CHUNK_SIZE, [&](MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      GatherValues(View.X, pOrder, ChunkBegin, ChunkEnd, Sorted.X);
+      GatherValues(View.Y, pOrder, ChunkBegin, ChunkEnd, Sorted.Y);
+      GatherValues(View.Z, pOrder, ChunkBegin, ChunkEnd, Sorted.Z);
+      GatherValues(View.Intensity, pOrder, ChunkBegin, ChunkEnd, Sorted.Intensity);
+      for(MIL_INT b = 0; b < 3; b++)
+         GatherValues(View.Color[b], pOrder, ChunkBegin, ChunkEnd, Sorted.Color[b]);
+      GatherValues(View.NormalX, pOrder, ChunkBegin, ChunkEnd, Sorted.NormalX);
+      GatherValues(View.NormalY, pOrder, ChunkBegin, ChunkEnd, Sorted.NormalY);
+      GatherValues(View.NormalZ, pOrder, ChunkBegin, ChunkEnd, Sorted.NormalZ);
+      });
+
+   return MilSorted;
+   }
@@ -0,0 +1,94 @@
+﻿//***************************************************************************************/
+//
+// File name: Morton.h
+//
+// Synopsis:  Declares the Morton (Z-order) codes used to sort the points of a
+//            cloud along a space-filling curve, so that points close in space
+//            are also close in memory.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include <vector>
+#include "PointCloudData.h"
+
+// Number of bits of each grid coordinate in a Morton code.
+static const MIL_INT MORTON_BITS_PER_AXIS = 21;
+
+//-------------------------------------------------------------------------------
+// Spreads the 21 low bits of a value so that two zero bits separate them.
+//-------------------------------------------------------------------------------
+inline MIL_UINT64 SpreadMortonBits(MIL_UINT32 Value)
+   {
+   MIL_UINT64 Bits = Value & 0x1FFFFF;
+   Bits = (Bits | (Bits << 32)) & 0x001F00000000FFFFULL;
+   Bits = (Bits | (Bits << 16)) & 0x001F0000FF0000FFULL;
+   Bits = (Bits | (Bits <<  8)) & 0x100F00F00F00F00FULL;
+   Bits = (Bits | (Bits <<  4)) & 0x10C30C30C30C30C3ULL;
+   Bits = (Bits | (Bits <<  2)) & 0x1249249249249249ULL;
+   return Bits;
+   }
+
+//-------------------------------------------------------------------------------
+// Interleaves the bits of three 21-bit grid coordinates, X in the lowest bit.
+//-------------------------------------------------------------------------------
+inline MIL_UINT64 MortonEncode(MIL_UINT32 X, MIL_UINT32 Y, MIL_UINT32 Z)
+   {
+   return SpreadMortonBits(X) | (SpreadMortonBits(Y) << 1) | (SpreadMortonBits(Z) << 2);
+   }
+
+//-------------------------------------------------------------------------------
+// Cubic grid of 2^21 cells per axis spanning the bounding box of a cloud, with
+// the same cell size on all axes so that the Morton curve is isotropic.
+//-------------------------------------------------------------------------------
+struct SMortonGrid
+   {
+   MIL_DOUBLE Min[3];
+   MIL_DOUBLE InvCellSize;
+
+   explicit SMortonGrid(const SCloudStats& Stats)
+      {
+      MIL_DOUBLE Extent = 0.0;
+      for(MIL_INT a = 0; a < 3; a++)
+         {
+         Min[a] = Stats.Min[a];
+         if(Stats.Max[a] - Stats.Min[a] > Extent)
+            Extent = Stats.Max[a] - Stats.Min[a];
+         }
+      InvCellSize = Extent > 0.0 ? MaxCoordinate() / Extent : 0.0;
+      }
+
+   static MIL_DOUBLE MaxCoordinate() { return (MIL_DOUBLE)((1 << MORTON_BITS_PER_AXIS) - 1); }
+
+   // Returns the Morton code of the cell of a point, clamped to the grid.
+   MIL_UINT64 Encode(MIL_FLOAT X, MIL_FLOAT Y, MIL_FLOAT Z) const
+      {
+      MIL_UINT32 Grid[3];
+      const MIL_FLOAT Point[3] = { X, Y, Z };
+      for(MIL_INT a = 0; a < 3; a++)
+         {
+         MIL_DOUBLE Coordinate = (Point[a] - Min[a]) * InvCellSize + 0.5;
+         if(!(Coordinate > 0.0))
+            Coordinate = 0.0;
+         else if(Coordinate > MaxCoordinate())
+            Coordinate = MaxCoordinate();
+         Grid[a] = (MIL_UINT32)Coordinate;
+         }
+      return MortonEncode(Grid[0], Grid[1], Grid[2]);
+      }
+   };
+
+// Computes the order of the valid points of a cloud along the Morton curve of
+// the grid spanning its bounding box. pOrder receives the indices of the
+// valid points sorted by Morton code, points with the same code keeping their
+// relative order. A parallel radix pass distributes the codes in buckets by
+// their highest differing digit, then the buckets are sorted in parallel.
+void ComputeMortonOrder(const SCloudView& View, const SCloudStats& Stats, std::vector<MIL_UINT32>* pOrder);
+
+// Copies the valid points of a cloud in a new container, in Morton order,
+// with their reflectance and normals. The statistics of the cloud are those
+// of the new container.
+MIL_UNIQUE_BUF_ID ReorderPointCloud(MIL_ID MilSystem, const SCloudView& View, const SCloudStats& Stats);
@@ -0,0 +1,70 @@
+﻿//***************************************************************************************/
+//
+// File name: NearestNeighborIndex.h
+//
+// Synopsis:  Declares the interface of the spatial indexes used to find the
+//            nearest neighbors of points in a reference point cloud.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include <vector>
+#include "PointCloudData.h"
+
+//-------------------------------------------------------------------------------
+// Spatial index over a copy of the valid points of a cloud. An index is built
+// once and can then be queried concurrently by any number of threads.
+//-------------------------------------------------------------------------------
+class CNearestNeighborIndex
+   {
+   public:
+      virtual ~CNearestNeighborIndex() {}
+
+      virtual MIL_INT NbPoints() const = 0;
+
+      // Returns a point of the index and its index in the cloud it was built from.
+      virtual const MIL_FLOAT* Point(MIL_INT IndexPoint) const = 0;
+      virtual MIL_INT          CloudIndex(MIL_INT IndexPoint) const = 0;
+
+      // Finds the point nearest to a query point whose squared distance is below
+      // MaxDistance2. Returns false if there is none; pIndexPoint then is -1.
+      virtual bool FindNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2,
+                               MIL_INT* pIndexPoint, MIL_FLOAT* pDistance2) const = 0;
+
+      // Finds a point whose distance to a query point is at most 1 + Error times
+      // the distance of the nearest point. The parts of the index that cannot
+      // hold a point that much nearer than the nearest point found are skipped,
+      // which is faster for larger errors. An error of 0 gives the nearest point.
+      virtual bool FindApproximateNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2, MIL_FLOAT Error,
+                                          MIL_INT* pIndexPoint, MIL_FLOAT* pDistance2) const = 0;
+
+      // Copies the normals of the points from the cloud the index was built from,
+      // so that the index holds them after the cloud is freed. Returns false and
+      // keeps no normals if the cloud has none.
+      bool AttachNormals(const SCloudView& View)
+         {
+         m_Normals.clear();
+         if(View.NormalX == M_NULL)
+            return false;
+         m_Normals.resize((size_t)(3 * NbPoints()));
+         for(MIL_INT i = 0; i < NbPoints(); i++)
+            {
+            const MIL_INT CloudPoint = CloudIndex(i);
+            m_Normals[(size_t)(3 * i)]     = View.NormalX[CloudPoint];
+            m_Normals[(size_t)(3 * i + 1)] = View.NormalY[CloudPoint];
+            m_Normals[(size_t)(3 * i + 2)] = View.NormalZ[CloudPoint];
+            }
+         return true;
+         }
+
+      // Returns whether normals are attached, and the normal of a point of the index
+      // when they are.
+      bool             HasNormals() const { return !m_Normals.empty(); }
+      const MIL_FLOAT* Normal(MIL_INT IndexPoint) const { return &m_Normals[(size_t)(3 * IndexPoint)]; }
+
+   private:
+      std::vector<MIL_FLOAT> m_Normals;
+   };
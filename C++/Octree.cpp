@@ -0,0 +1,453 @@
+﻿//***************************************************************************************/
+//
+// File name: Octree.cpp
+//
+// Synopsis:  Implements the octree of the point clouds.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "Octree.h"
+#include "Morton.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <float.h>
+
+// Maximum number of points in a leaf.
+static const MIL_INT OCTREE_LEAF_SIZE = 16;
+
+// Minimum number of points or nodes processed by a worker thread.
+static const MIL_INT OCTREE_CHUNK_SIZE = 65536;
+
+// Number of nodes still to visit by a search; a node is replaced by at most
+// 8 children at each of the MORTON_BITS_PER_AXIS levels.
+static const MIL_INT OCTREE_STACK_SIZE = 8 * (MORTON_BITS_PER_AXIS + 1);
+
+//--------------------------------------------------------------------------
+// Returns the squared distance from a point to a box, 0 inside the box.
+//--------------------------------------------------------------------------
+static inline MIL_FLOAT BoxDistance2(const MIL_FLOAT Min[3], const MIL_FLOAT Max[3], const MIL_FLOAT Query[3])
+   {
+   MIL_FLOAT Distance2 = 0.0f;
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      const MIL_FLOAT Offset = Query[a] < Min[a] ? Min[a] - Query[a] : (Query[a] > Max[a] ? Query[a] - Max[a] : 0.0f);
+      Distance2 += Offset * Offset;
+      }
+   return Distance2;
+   }
+
+//--------------------------------------------------------------------------
+COctree::COctree()
+   : m_NbLevels(0)
+   {
+   }
+
+//--------------------------------------------------------------------------
+void COctree::Build(const SCloudView& View, MIL_INT Step)
+   {
+   // Copy the valid points.
+   Step = std::max<MIL_INT>(Step, 1);
+   std::vector<MIL_FLOAT>  Coordinates[3];
+   std::vector<MIL_UINT32> Indices;
+   for(MIL_INT a = 0; a < 3; a++)
+      Coordinates[a].reserve((size_t)(View.NbPoints / Step + 1));
+   Indices.reserve((size_t)(View.NbPoints / Step + 1));
+   for(MIL_INT i = 0; i < View.NbPoints; i += Step)
+      {
+      if(View.Confidence && View.Confidence[i] == 0)
+         continue;
+
+      Coordinates[0].push_back(View.X[i]);
+      Coordinates[1].push_back(View.Y[i]);
+      Coordinates[2].push_back(View.Z[i]);
+      Indices.push_back((MIL_UINT32)i);
+      }
+
+   m_Points.clear();
+   m_Nodes.clear();
+   m_NbLevels = 0;
+   const MIL_INT NbTreePoints = (MIL_INT)Indices.size();
+   if(NbTreePoints == 0)
+      return;
+
+   // Sort the points along the Morton curve.
+   SCloudView Points = SCloudView();
+   Points.X        = &Coordinates[0][0];
+   Points.Y        = &Coordinates[1][0];
+   Points.Z        = &Coordinates[2][0];
+   Points.NbPoints = NbTreePoints;
+   SCloudStats Stats;
+   ComputeCloudStats(Points, &Stats);
+   std::vector<MIL_UINT32> Order;
+   ComputeMortonOrder(Points, Stats, &Order);
+
+   const SMortonGrid       Grid(Stats);
+   std::vector<MIL_UINT64> Codes((size_t)NbTreePoints);
+   m_Points.resize((size_t)NbTreePoints);
+   ParallelFor(0, NbTreePoints, OCTREE_CHUNK_SIZE, [&](MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+         {
+         const MIL_UINT32 i = Order[(size_t)k];
+         SPoint& Point = m_Points[(size_t)k];
+         for(MIL_INT a = 0; a < 3; a++)
+            Point.Coordinates[a] = Coordinates[a][i];
+         Point.Index = Indices[i];
+         Codes[(size_t)k] = Grid.Encode(Point.Coordinates[0], Point.Coordinates[1], Point.Coordinates[2]);
+         }
+      });
+
+   // Split the nodes one level at a time. The points of an octant of a node
+   // share the digit of their codes at the level of the node, so the children
+   // are the runs of the digit in the range of the node.
+   SNode Root = SNode();
+   Root.End = (MIL_UINT32)NbTreePoints;
+   m_Nodes.push_back(Root);
+   MIL_INT LevelBegin = 0;
+   for(MIL_INT Level = 0; LevelBegin < (MIL_INT)m_Nodes.size(); Level++)
+      {
+      const MIL_INT LevelEnd = (MIL_INT)m_Nodes.size();
+      const MIL_INT Shift    = 3 * (MORTON_BITS_PER_AXIS - 1 - Level);
+      m_NbLevels = Level + 1;
+      for(MIL_INT n = LevelBegin; n < LevelEnd; n++)
+         {
+         const MIL_UINT32 Begin = m_Nodes[(size_t)n].Begin;
+         const MIL_UINT32 End   = m_Nodes[(size_t)n].End;
+         if(End - Begin <= (MIL_UINT32)OCTREE_LEAF_SIZE || Shift < 0)
+            continue;
+
+         m_Nodes[(size_t)n].FirstChild = (MIL_UINT32)m_Nodes.size();
+         for(MIL_UINT32 ChildBegin = Begin; ChildBegin < End; )
+            {
+            const MIL_UINT64 Prefix = Codes[ChildBegin] >> Shift;
+            const MIL_UINT32 ChildEnd = (MIL_UINT32)(std::upper_bound(Codes.begin() + ChildBegin, Codes.begin() + End, Prefix,
+                                                                      [Shift](MIL_UINT64 Value, MIL_UINT64 Code)
+                                                                         { return Value < (Code >> Shift); }) - Codes.begin());
+            SNode Child = SNode();
+            Child.Begin = ChildBegin;
+            Child.End   = ChildEnd;
+            m_Nodes.push_back(Child);
+            ChildBegin = ChildEnd;
+            }
+         m_Nodes[(size_t)n].NbChildren = (MIL_UINT32)m_Nodes.size() - m_Nodes[(size_t)n].FirstChild;
+         }
+      LevelBegin = LevelEnd;
+      }
+
+   // Bound the points of the leaves in parallel, then the nodes from their
+   // children, which follow them.
+   const MIL_INT NbNodes = (MIL_INT)m_Nodes.size();
+   ParallelFor(0, NbNodes, OCTREE_CHUNK_SIZE / OCTREE_LEAF_SIZE, [&](MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      for(MIL_INT n = ChunkBegin; n < ChunkEnd; n++)
+         {
+         SNode& Node = m_Nodes[(size_t)n];
+         if(Node.NbChildren > 0)
+            continue;
+         for(MIL_INT a = 0; a < 3; a++)
+            {
+            Node.Min[a] =  FLT_MAX;
+            Node.Max[a] = -FLT_MAX;
+            }
+         for(MIL_UINT32 i = Node.Begin; i < Node.End; i++)
+            {
+            for(MIL_INT a = 0; a < 3; a++)
+               {
+               Node.Min[a] = std::min(Node.Min[a], m_Points[i].Coordinates[a]);
+               Node.Max[a] = std::max(Node.Max[a], m_Points[i].Coordinates[a]);
+               }
+            }
+         }
+      });
+   for(MIL_INT n = NbNodes - 1; n >= 0; n--)
+      {
+      SNode& Node = m_Nodes[(size_t)n];
+      if(Node.NbChildren == 0)
+         continue;
+      for(MIL_INT a = 0; a < 3; a++)
+         {
+         Node.Min[a] =  FLT_MAX;
+         Node.Max[a] = -FLT_MAX;
+         }
+      for(MIL_UINT32 c = Node.FirstChild; c < Node.FirstChild + Node.NbChildren; c++)
+         {
+         for(MIL_INT a = 0; a < 3; a++)
+            {
+            Node.Min[a] = std::min(Node.Min[a], m_Nodes[c].Min[a]);
+            Node.Max[a] = std::max(Node.Max[a], m_Nodes[c].Max[a]);
+            }
+         }
+      }
+   }
+
+//--------------------------------------------------------------------------
+void COctree::GetLevelOfDetail(MIL_INT Depth, MIL_INT NbPointsPerNode, std::vector<MIL_UINT32>* pTreeIndices) const
+   {
+   pTreeIndices->clear();
+   if(m_Nodes.empty() || NbPointsPerNode <= 0)
+      return;
+
+   // Visit the nodes depth first, the children in Morton order.
+   struct SEntry
+      {
+      MIL_UINT32 Node;
+      MIL_INT    Depth;
+      };
+   SEntry  Stack[OCTREE_STACK_SIZE];
+   MIL_INT NbEntries = 0;
+   SEntry  Root = { 0, 0 };
+   Stack[NbEntries++] = Root;
+   while(NbEntries > 0)
+      {
+      const SEntry Entry = Stack[--NbEntries];
+      const SNode& Node  = m_Nodes[Entry.Node];
+      if(Entry.Depth < Depth && Node.NbChildren > 0)
+         {
+         for(MIL_UINT32 c = Node.NbChildren; c > 0; c--)
+            {
+            SEntry Child = { Node.FirstChild + c - 1, Entry.Depth + 1 };
+            Stack[NbEntries++] = Child;
+            }
+         continue;
+         }
+
+      // Take the middle points of equal parts of the range, which are spread
+      // over the cell along the curve.
+      const MIL_INT NbNodePoints = (MIL_INT)(Node.End - Node.Begin);
+      if(NbNodePoints <= NbPointsPerNode)
+         {
+         for(MIL_UINT32 i = Node.Begin; i < Node.End; i++)
+            pTreeIndices->push_back(i);
+         }
+      else
+         {
+         for(MIL_INT k = 0; k < NbPointsPerNode; k++)
+            pTreeIndices->push_back(Node.Begin + (MIL_UINT32)(((2 * k + 1) * NbNodePoints) / (2 * NbPointsPerNode)));
+         }
+      }
+   }
+
+//--------------------------------------------------------------------------
+void COctree::FindInBox(const SFloatBox& Box, std::vector<MIL_UINT32>* pTreeIndices) const
+   {
+   pTreeIndices->clear();
+   if(m_Nodes.empty())
+      return;
+
+   MIL_UINT32 Stack[OCTREE_STACK_SIZE];
+   MIL_INT    NbEntries = 0;
+   Stack[NbEntries++] = 0;
+   while(NbEntries > 0)
+      {
+      const SNode& Node = m_Nodes[Stack[--NbEntries]];
+      bool Inside   = true;
+      bool Disjoint = false;
+      for(MIL_INT a = 0; a < 3; a++)
+         {
+         Inside   = Inside && Node.Min[a] >= Box.Min[a] && Node.Max[a] <= Box.Max[a];
+         Disjoint = Disjoint || Node.Max[a] < Box.Min[a] || Node.Min[a] > Box.Max[a];
+         }
+      if(Disjoint)
+         continue;
+
+      if(Inside)
+         {
+         for(MIL_UINT32 i = Node.Begin; i < Node.End; i++)
+            pTreeIndices->push_back(i);
+         }
+      else if(Node.NbChildren > 0)
+         {
+         for(MIL_UINT32 c = Node.NbChildren; c > 0; c--)
+            Stack[NbEntries++] = Node.FirstChild + c - 1;
+         }
+      else
+         {
+         for(MIL_UINT32 i = Node.Begin; i < Node.End; i++)
+            {
+            const MIL_FLOAT* pPoint = m_Points[i].Coordinates;
+            if(pPoint[0] >= Box.Min[0] && pPoint[0] <= Box.Max[0] &&
+               pPoint[1] >= Box.Min[1] && pPoint[1] <= Box.Max[1] &&
+               pPoint[2] >= Box.Min[2] && pPoint[2] <= Box.Max[2])
+               pTreeIndices->push_back(i);
+            }
+         }
+      }
+   }
+
+//--------------------------------------------------------------------------
+MIL_INT COctree::FindKNearest(const MIL_FLOAT Query[3], MIL_INT K, MIL_FLOAT MaxDistance2,
+                              MIL_INT* pTreeIndices, MIL_FLOAT* pDistances2) const
+   {
+   // Same traversal as FindNearest; the bound is the distance of the K-th
+   // point once K points are found.
+   struct SEntry
+      {
+      MIL_UINT32 Node;
+      MIL_FLOAT  Distance2;
+      };
+   SEntry  Stack[OCTREE_STACK_SIZE];
+   MIL_INT NbEntries = 0;
+
+   MIL_INT   NbFound = 0;
+   MIL_FLOAT Bound2  = MaxDistance2;
+
+   if(!m_Nodes.empty() && K > 0)
+      {
+      SEntry Root = { 0, BoxDistance2(m_Nodes[0].Min, m_Nodes[0].Max, Query) };
+      Stack[NbEntries++] = Root;
+      }
+   while(NbEntries > 0)
+      {
+      const SEntry Entry = Stack[--NbEntries];
+      if(Entry.Distance2 >= Bound2)
+         continue;
+
+      const SNode& Node = m_Nodes[Entry.Node];
+      if(Node.NbChildren == 0)
+         {
+         for(MIL_UINT32 i = Node.Begin; i < Node.End; i++)
+            {
+            const MIL_FLOAT* pPoint = m_Points[i].Coordinates;
+            const MIL_FLOAT  DX = pPoint[0] - Query[0];
+            const MIL_FLOAT  DY = pPoint[1] - Query[1];
+            const MIL_FLOAT  DZ = pPoint[2] - Query[2];
+            const MIL_FLOAT  Distance2 = DX * DX + DY * DY + DZ * DZ;
+            if(Distance2 >= Bound2)
+               continue;
+
+            // Insert the point in the sorted list, dropping the farthest one when it is full.
+            MIL_INT Position = NbFound < K ? NbFound++ : K - 1;
+            for(; Position > 0 && pDistances2[Position - 1] > Distance2; Position--)
+               {
+               pDistances2[Position]  = pDistances2[Position - 1];
+               pTreeIndices[Position] = pTreeIndices[Position - 1];
+               }
+            pDistances2[Position]  = Distance2;
+            pTreeIndices[Position] = (MIL_INT)i;
+            if(NbFound == K)
+               Bound2 = pDistances2[K - 1];
+            }
+         continue;
+         }
+
+      SEntry  Children[8];
+      MIL_INT NbChildren = 0;
+      for(MIL_UINT32 c = Node.FirstChild; c < Node.FirstChild + Node.NbChildren; c++)
+         {
+         SEntry Child = { c, BoxDistance2(m_Nodes[c].Min, m_Nodes[c].Max, Query) };
+         if(Child.Distance2 >= Bound2)
+            continue;
+         MIL_INT Position = NbChildren++;
+         for(; Position > 0 && Children[Position - 1].Distance2 < Child.Distance2; Position--)
+            Children[Position] = Children[Position - 1];
+         Children[Position] = Child;
+         }
+      for(MIL_INT c = 0; c < NbChildren; c++)
+         Stack[NbEntries++] = Children[c];
+      }
+
+   return NbFound;
+   }
+
+//--------------------------------------------------------------------------
+MIL_UNIQUE_BUF_ID COctree::AllocPointCloud(MIL_ID MilSystem, const std::vector<MIL_UINT32>& TreeIndices) const
+   {
+   const MIL_INT NbCopied = (MIL_INT)TreeIndices.size();
+   SCloudView View;
+   MIL_UNIQUE_BUF_ID MilContainer = AllocPointCloudContainer(MilSystem, NbCopied, eComponentRange, &View);
+   ParallelFor(0, NbCopied, OCTREE_CHUNK_SIZE, [&](MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      for(MIL_INT k = ChunkBegin; k < ChunkEnd; k++)
+         {
+         const MIL_FLOAT* pPoint = m_Points[TreeIndices[(size_t)k]].Coordinates;
+         View.X[k] = pPoint[0];
+         View.Y[k] = pPoint[1];
+         View.Z[k] = pPoint[2];
+         }
+      });
+   return MilContainer;
+   }
+
+//--------------------------------------------------------------------------
+bool COctree::FindNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2,
+                          MIL_INT* pTreeIndex, MIL_FLOAT* pDistance2) const
+   {
+   return COctree::FindApproximateNearest(Query, MaxDistance2, 0.0f, pTreeIndex, pDistance2);
+   }
+
+//--------------------------------------------------------------------------
+bool COctree::FindApproximateNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2, MIL_FLOAT Error,
+                                     MIL_INT* pTreeIndex, MIL_FLOAT* pDistance2) const
+   {
+   // Nodes still to visit with the distance of the query to their box. The
+   // children of a node are pushed from the farthest, so that the nearest is
+   // visited first.
+   struct SEntry
+      {
+      MIL_UINT32 Node;
+      MIL_FLOAT  Distance2;
+      };
+   SEntry  Stack[OCTREE_STACK_SIZE];
+   MIL_INT NbEntries = 0;
+
+   // The nodes are skipped when they are not nearer than the nearest point
+   // found shrunk by the error.
+   const MIL_FLOAT Shrink = 1.0f / ((1.0f + Error) * (1.0f + Error));
+   MIL_INT   BestIndex     = -1;
+   MIL_FLOAT BestDistance2 = MaxDistance2;
+   MIL_FLOAT Bound2        = MaxDistance2;
+
+   if(!m_Nodes.empty())
+      {
+      SEntry Root = { 0, BoxDistance2(m_Nodes[0].Min, m_Nodes[0].Max, Query) };
+      Stack[NbEntries++] = Root;
+      }
+   while(NbEntries > 0)
+      {
+      const SEntry Entry = Stack[--NbEntries];
+      if(Entry.Distance2 >= Bound2)
+         continue;
+
+      const SNode& Node = m_Nodes[Entry.Node];
+      if(Node.NbChildren == 0)
+         {
+         for(MIL_UINT32 i = Node.Begin; i < Node.End; i++)
+            {
+            const MIL_FLOAT* pPoint = m_Points[i].Coordinates;
+            const MIL_FLOAT  DX = pPoint[0] - Query[0];
+            const MIL_FLOAT  DY = pPoint[1] - Query[1];
+            const MIL_FLOAT  DZ = pPoint[2] - Query[2];
+            const MIL_FLOAT  Distance2 = DX * DX + DY * DY + DZ * DZ;
+            if(Distance2 < BestDistance2)
+               {
+               BestDistance2 = Distance2;
+               BestIndex     = (MIL_INT)i;
+               Bound2        = Distance2 * Shrink;
+               }
+            }
+         continue;
+         }
+
+      // Sort the children that may hold a nearer point by decreasing distance.
+      SEntry  Children[8];
+      MIL_INT NbChildren = 0;
+      for(MIL_UINT32 c = Node.FirstChild; c < Node.FirstChild + Node.NbChildren; c++)
+         {
+         SEntry Child = { c, BoxDistance2(m_Nodes[c].Min, m_Nodes[c].Max, Query) };
+         if(Child.Distance2 >= Bound2)
+            continue;
+         MIL_INT Position = NbChildren++;
+         for(; Position > 0 && Children[Position - 1].Distance2 < Child.Distance2; Position--)
+            Children[Position] = Children[Position - 1];
+         Children[Position] = Child;
+         }
+      for(MIL_INT c = 0; c < NbChildren; c++)
+         Stack[NbEntries++] = Children[c];
+      }
+
+   *pTreeIndex = BestIndex;
+   if(pDistance2)
+      *pDistance2 = BestDistance2;
+   return BestIndex >= 0;
+   }
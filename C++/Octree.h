@@ -0,0 +1,90 @@
+﻿//***************************************************************************************/
+//
+// File name: Octree.h
+//
+// Synopsis:  Declares the octree of the point clouds. The points are sorted along
+//            the Morton curve so that each node holds a contiguous range of them,
+//            which gives levels of detail, box queries and nearest-neighbor
+//            searches from a single index of the cloud.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include <vector>
+#include "PointCloudData.h"
+#include "CloudCropKernel.h"
+#include "NearestNeighborIndex.h"
+
+//-------------------------------------------------------------------------------
+// Octree over the valid points of a cloud. The points are copied in Morton
+// order on the grid of their bounding box; the children of a node are the
+// occupied octants of its cell, stored consecutively, and a node is split
+// while it holds more than OCTREE_LEAF_SIZE points. Each node keeps the
+// bounding box of its points.
+//-------------------------------------------------------------------------------
+class COctree : public CNearestNeighborIndex
+   {
+   public:
+      COctree();
+
+      // Builds the octree over the valid points of a cloud taken with a step,
+      // so that the octree can index a decimated cloud. The points are sorted
+      // and the bounding boxes of the leaves are computed in parallel.
+      void Build(const SCloudView& View, MIL_INT Step);
+
+      // Number of levels of the octree, the root being at depth 0.
+      MIL_INT NbLevels() const { return m_NbLevels; }
+
+      // Gets a level of detail of the cloud: at most NbPointsPerNode points
+      // spread over each node of the given depth and over each leaf above it.
+      // pTreeIndices receives their tree indices, in Morton order.
+      void GetLevelOfDetail(MIL_INT Depth, MIL_INT NbPointsPerNode, std::vector<MIL_UINT32>* pTreeIndices) const;
+
+      // Gets the points inside a box, bounds included. The nodes inside the box
+      // are taken whole and the points of the leaves crossing it are tested.
+      // pTreeIndices receives their tree indices, in Morton order.
+      void FindInBox(const SFloatBox& Box, std::vector<MIL_UINT32>* pTreeIndices) const;
+
+      // Finds the at most K nearest points of the octree strictly closer than
+      // the square root of MaxDistance2. pTreeIndices and pDistances2 receive
+      // their tree indices and squared distances by increasing distance and
+      // need room for K values. Returns the number of points found.
+      MIL_INT FindKNearest(const MIL_FLOAT Query[3], MIL_INT K, MIL_FLOAT MaxDistance2,
+                           MIL_INT* pTreeIndices, MIL_FLOAT* pDistances2) const;
+
+      // Copies points of the octree in a new container holding their range.
+      MIL_UNIQUE_BUF_ID AllocPointCloud(MIL_ID MilSystem, const std::vector<MIL_UINT32>& TreeIndices) const;
+
+      // CNearestNeighborIndex.
+      virtual MIL_INT          NbPoints() const { return (MIL_INT)m_Points.size(); }
+      virtual const MIL_FLOAT* Point(MIL_INT TreeIndex) const { return m_Points[(size_t)TreeIndex].Coordinates; }
+      virtual MIL_INT          CloudIndex(MIL_INT TreeIndex) const { return (MIL_INT)m_Points[(size_t)TreeIndex].Index; }
+      virtual bool             FindNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2,
+                                           MIL_INT* pTreeIndex, MIL_FLOAT* pDistance2) const;
+      virtual bool             FindApproximateNearest(const MIL_FLOAT Query[3], MIL_FLOAT MaxDistance2, MIL_FLOAT Error,
+                                                      MIL_INT* pTreeIndex, MIL_FLOAT* pDistance2) const;
+
+   private:
+      struct SPoint
+         {
+         MIL_FLOAT  Coordinates[3];
+         MIL_UINT32 Index;
+         };
+
+      struct SNode
+         {
+         MIL_FLOAT  Min[3];       // Bounding box of the points of the node.
+         MIL_FLOAT  Max[3];
+         MIL_UINT32 Begin;        // Range of the points of the node.
+         MIL_UINT32 End;
+         MIL_UINT32 FirstChild;   // Index of the first child.
+         MIL_UINT32 NbChildren;   // 0 for a leaf.
+         };
+
+      std::vector<SPoint> m_Points;
+      std::vector<SNode>  m_Nodes;      // In breadth-first order, the root first.
+      MIL_INT             m_NbLevels;
+   };
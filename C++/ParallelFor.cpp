@@ -0,0 +1,124 @@
+﻿//***************************************************************************************/
+//
+// File name: ParallelFor.cpp
+//
+// Synopsis:  Implements the pool of persistent worker threads that executes
+//            the chunks of the point cloud processing.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "ParallelFor.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+//-------------------------------------------------------------------------------
+// Pool of GetNbWorkers() - 1 worker threads, started on the first parallel call
+// and stopped at exit. The tasks of a call are taken one by one, under the lock,
+// by the workers and by the calling thread.
+//-------------------------------------------------------------------------------
+class CWorkerPool
+   {
+   public:
+      CWorkerPool() : m_Stop(false) {}
+      ~CWorkerPool();
+
+      void Run(MIL_INT NbTasks, const std::function<void(MIL_INT)>& Task);
+
+   private:
+      struct SJob
+         {
+         const std::function<void(MIL_INT)>* pTask;
+         MIL_INT                             NbTasks;
+         MIL_INT                             NextTask;
+         MIL_INT                             NbDone;
+         };
+
+      void WorkerLoop();
+
+      std::mutex               m_Mutex;
+      std::condition_variable  m_WorkAvailable;
+      std::condition_variable  m_JobDone;
+      std::deque<SJob*>        m_Jobs;        // Jobs with tasks not yet taken.
+      std::vector<std::thread> m_Workers;
+      bool                     m_Stop;
+   };
+
+static CWorkerPool s_WorkerPool;
+
+//--------------------------------------------------------------------------
+CWorkerPool::~CWorkerPool()
+   {
+      {
+      std::lock_guard<std::mutex> Lock(m_Mutex);
+      m_Stop = true;
+      }
+   m_WorkAvailable.notify_all();
+   for(size_t w = 0; w < m_Workers.size(); w++)
+      m_Workers[w].join();
+   }
+
+//--------------------------------------------------------------------------
+void CWorkerPool::Run(MIL_INT NbTasks, const std::function<void(MIL_INT)>& Task)
+   {
+   SJob Job = { &Task, NbTasks, 0, 0 };
+      {
+      std::lock_guard<std::mutex> Lock(m_Mutex);
+      if(m_Workers.empty())
+         {
+         for(MIL_INT w = 1; w < GetNbWorkers(); w++)
+            m_Workers.push_back(std::thread([this]() { WorkerLoop(); }));
+         }
+      m_Jobs.push_back(&Job);
+      }
+   m_WorkAvailable.notify_all();
+
+   // Run the tasks that the workers have not taken, then wait for the others.
+   std::unique_lock<std::mutex> Lock(m_Mutex);
+   while(Job.NextTask < NbTasks)
+      {
+      const MIL_INT t = Job.NextTask++;
+      if(Job.NextTask == NbTasks)
+         m_Jobs.erase(std::find(m_Jobs.begin(), m_Jobs.end(), &Job));
+      Lock.unlock();
+      Task(t);
+      Lock.lock();
+      Job.NbDone++;
+      }
+   m_JobDone.wait(Lock, [&Job]() { return Job.NbDone == Job.NbTasks; });
+   }
+
+//--------------------------------------------------------------------------
+void CWorkerPool::WorkerLoop()
+   {
+   std::unique_lock<std::mutex> Lock(m_Mutex);
+   for(;;)
+      {
+      m_WorkAvailable.wait(Lock, [this]() { return m_Stop || !m_Jobs.empty(); });
+      if(m_Jobs.empty())
+         return;
+
+      SJob* pJob = m_Jobs.front();
+      const MIL_INT t = pJob->NextTask++;
+      if(pJob->NextTask == pJob->NbTasks)
+         m_Jobs.pop_front();
+      Lock.unlock();
+      (*pJob->pTask)(t);
+      Lock.lock();
+
+      // The job is on the stack of its caller, which returns once it is done.
+      if(++pJob->NbDone == pJob->NbTasks)
+         m_JobDone.notify_all();
+      }
+   }
+
+//--------------------------------------------------------------------------
+void RunParallelTasks(MIL_INT NbTasks, const std::function<void(MIL_INT)>& Task)
+   {
+   if(NbTasks == 1)
+      Task(0);
+   else if(NbTasks > 1)
+      s_WorkerPool.Run(NbTasks, Task);
+   }
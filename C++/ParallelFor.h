@@ -0,0 +1,77 @@
+﻿//***************************************************************************************/
+//
+// File name: ParallelFor.h
+//
+// Synopsis:  Declares the helpers used to split the point cloud processing
+//            in chunks executed by a pool of persistent worker threads.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include <functional>
+#include <thread>
+#include <vector>
+
+//-------------------------------------------------------------------------------
+// Returns the number of worker threads available for the parallel stages.
+//-------------------------------------------------------------------------------
+inline MIL_INT GetNbWorkers()
+   {
+   MIL_INT NbWorkers = (MIL_INT)std::thread::hardware_concurrency();
+   return NbWorkers > 0 ? NbWorkers : 1;
+   }
+
+//-------------------------------------------------------------------------------
+// Returns the number of chunks of at least MinChunkSize elements used to
+// process Size elements.
+//-------------------------------------------------------------------------------
+inline MIL_INT GetNbChunks(MIL_INT Size, MIL_INT MinChunkSize)
+   {
+   MIL_INT NbChunks = MinChunkSize > 0 ? Size / MinChunkSize : Size;
+   if(NbChunks > GetNbWorkers())
+      NbChunks = GetNbWorkers();
+   return NbChunks > 1 ? NbChunks : 1;
+   }
+
+//-------------------------------------------------------------------------------
+// Calls Task(t) for t in [0, NbTasks) on the persistent worker threads and on
+// the calling thread, and returns once all the tasks are done. The calling
+// thread also runs the tasks not yet taken by a worker, so that the calls
+// from several threads and from the tasks themselves always complete.
+//-------------------------------------------------------------------------------
+void RunParallelTasks(MIL_INT NbTasks, const std::function<void(MIL_INT)>& Task);
+
+//-------------------------------------------------------------------------------
+// Calls Func(Chunk, ChunkBegin, ChunkEnd) for NbChunks contiguous chunks of
+// [Begin, End), in parallel on the worker threads, and returns once all the
+// chunks are done.
+//-------------------------------------------------------------------------------
+template <class TFunc>
+void ParallelChunks(MIL_INT Begin, MIL_INT End, MIL_INT NbChunks, TFunc Func)
+   {
+   const MIL_INT Size = End - Begin;
+   if(NbChunks <= 1 || Size <= 1)
+      {
+      Func((MIL_INT)0, Begin, End);
+      return;
+      }
+
+   RunParallelTasks(NbChunks, [&](MIL_INT c)
+      {
+      Func(c, Begin + (Size * c) / NbChunks, Begin + (Size * (c + 1)) / NbChunks);
+      });
+   }
+
+//-------------------------------------------------------------------------------
+// Calls Func(ChunkBegin, ChunkEnd) on chunks of at least MinChunkSize
+// elements of [Begin, End), in parallel.
+//-------------------------------------------------------------------------------
+template <class TFunc>
+void ParallelFor(MIL_INT Begin, MIL_INT End, MIL_INT MinChunkSize, TFunc Func)
+   {
+   ParallelChunks(Begin, End, GetNbChunks(End - Begin, MinChunkSize),
+                  [&Func](MIL_INT, MIL_INT ChunkBegin, MIL_INT ChunkEnd) { Func(ChunkBegin, ChunkEnd); });
+   }
@@ -0,0 +1,370 @@
+﻿//***************************************************************************************/
+//
+// File name: PointCloudData.cpp
+//
+// Synopsis:  Implements the direct access to the point cloud containers.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "PointCloudData.h"
+#include "ParallelFor.h"
+#include <float.h>
+
+// Bands of the 3-band components.
+static const MIL_INT COMPONENT_BANDS[3] = { M_RED, M_GREEN, M_BLUE };
+
+// Minimum number of points processed by a worker thread.
+static const MIL_INT STATS_CHUNK_SIZE    = 65536;
+static const MIL_INT QUANTIZE_CHUNK_SIZE = 65536;
+
+// Largest quantized coordinate.
+static const MIL_DOUBLE QUANTIZED_MAX_VALUE = 65535.0;
+
+// Components copied along with the quantized range.
+static const MIL_INT64 QUANTIZED_COPIED_COMPONENTS[] =
+   { M_COMPONENT_REFLECTANCE, M_COMPONENT_CONFIDENCE, M_COMPONENT_NORMALS_MIL };
+
+//--------------------------------------------------------------------------
+// Returns the host address of a band of a buffer.
+//--------------------------------------------------------------------------
+static void* GetBandHostAddress(MIL_ID MilBuffer, MIL_INT Band)
+   {
+   void* pHostAddress = M_NULL;
+   MIL_UNIQUE_BUF_ID MilBand = MbufChildColor(MilBuffer, Band, M_UNIQUE_ID);
+   MbufInquire(MilBand, M_HOST_ADDRESS, &pHostAddress);
+   return pHostAddress;
+   }
+
+//--------------------------------------------------------------------------
+// Returns true if the rows of the buffer are stored back to back.
+//--------------------------------------------------------------------------
+static bool IsContiguous(MIL_ID MilBuffer)
+   {
+   MIL_INT SizeY = MbufInquire(MilBuffer, M_SIZE_Y, M_NULL);
+   return SizeY == 1 || MbufInquire(MilBuffer, M_PITCH, M_NULL) == MbufInquire(MilBuffer, M_SIZE_X, M_NULL);
+   }
+
+//--------------------------------------------------------------------------
+// Gets the host addresses of the components other than the range. Returns
+// false if the confidence component cannot be accessed directly.
+//--------------------------------------------------------------------------
+static bool GetAttributeViews(MIL_ID MilContainer, SCloudView* pView)
+   {
+   pView->Intensity = M_NULL;
+   pView->Color[0] = pView->Color[1] = pView->Color[2] = M_NULL;
+   MIL_ID MilReflectance = MbufInquireContainer(MilContainer, M_COMPONENT_REFLECTANCE, M_COMPONENT_ID, M_NULL);
+   if(MilReflectance != M_NULL && IsContiguous(MilReflectance))
+      {
+      MIL_INT NbBands = MbufInquire(MilReflectance, M_SIZE_BAND, M_NULL);
+      MIL_INT Type    = MbufInquire(MilReflectance, M_TYPE, M_NULL);
+      if(NbBands == 1 && Type == M_UNSIGNED + 16)
+         MbufInquire(MilReflectance, M_HOST_ADDRESS, &pView->Intensity);
+      else if(NbBands == 3 && Type == M_UNSIGNED + 8)
+         {
+         for(MIL_INT b = 0; b < 3; b++)
+            pView->Color[b] = (MIL_UINT8*)GetBandHostAddress(MilReflectance, COMPONENT_BANDS[b]);
+         }
+      }
+
+   pView->Confidence = M_NULL;
+   MIL_ID MilConfidence = MbufInquireContainer(MilContainer, M_COMPONENT_CONFIDENCE, M_COMPONENT_ID, M_NULL);
+   if(MilConfidence != M_NULL)
+      {
+      if(MbufInquire(MilConfidence, M_TYPE, M_NULL) != 8 + M_UNSIGNED || !IsContiguous(MilConfidence))
+         return false;
+      MbufInquire(MilConfidence, M_HOST_ADDRESS, &pView->Confidence);
+      }
+
+   pView->NormalX = pView->NormalY = pView->NormalZ = M_NULL;
+   MIL_ID MilNormals = MbufInquireContainer(MilContainer, M_COMPONENT_NORMALS_MIL, M_COMPONENT_ID, M_NULL);
+   if(MilNormals != M_NULL &&
+      MbufInquire(MilNormals, M_SIZE_BAND, M_NULL) == 3 &&
+      MbufInquire(MilNormals, M_TYPE, M_NULL) == 32 + M_FLOAT &&
+      IsContiguous(MilNormals))
+      {
+      pView->NormalX = (MIL_FLOAT*)GetBandHostAddress(MilNormals, COMPONENT_BANDS[0]);
+      pView->NormalY = (MIL_FLOAT*)GetBandHostAddress(MilNormals, COMPONENT_BANDS[1]);
+      pView->NormalZ = (MIL_FLOAT*)GetBandHostAddress(MilNormals, COMPONENT_BANDS[2]);
+      }
+
+   return true;
+   }
+
+//--------------------------------------------------------------------------
+MIL_UNIQUE_BUF_ID AllocPointCloudContainer(MIL_ID MilSystem, MIL_INT NbPoints,
+                                           MIL_INT Components, SCloudView* pView)
+   {
+   MIL_UNIQUE_BUF_ID MilContainer = MbufAllocContainer(MilSystem, M_PROC + M_DISP, M_DEFAULT, M_UNIQUE_ID);
+
+   pView->X = pView->Y = pView->Z = M_NULL;
+   pView->Intensity  = M_NULL;
+   pView->Color[0] = pView->Color[1] = pView->Color[2] = M_NULL;
+   pView->Confidence = M_NULL;
+   pView->NormalX = pView->NormalY = pView->NormalZ = M_NULL;
+   pView->NbPoints   = NbPoints;
+
+   // An empty point cloud has no components.
+   if(NbPoints <= 0)
+      return MilContainer;
+
+   if(Components & eComponentRange)
+      {
+      MIL_ID MilRange = MbufAllocComponent(MilContainer, 3, NbPoints, 1, 32 + M_FLOAT, M_IMAGE + M_PROC,
+                                           M_COMPONENT_RANGE, M_NULL);
+      MbufControl(MilRange, M_3D_REPRESENTATION, M_CALIBRATED_XYZ_UNORGANIZED);
+      pView->X = (MIL_FLOAT*)GetBandHostAddress(MilRange, COMPONENT_BANDS[0]);
+      pView->Y = (MIL_FLOAT*)GetBandHostAddress(MilRange, COMPONENT_BANDS[1]);
+      pView->Z = (MIL_FLOAT*)GetBandHostAddress(MilRange, COMPONENT_BANDS[2]);
+      }
+
+   if(Components & eComponentReflectance)
+      {
+      MIL_ID MilReflectance = MbufAllocComponent(MilContainer, 1, NbPoints, 1, M_UNSIGNED + 16, M_IMAGE + M_PROC + M_DISP,
+                                                 M_COMPONENT_REFLECTANCE, M_NULL);
+      MbufInquire(MilReflectance, M_HOST_ADDRESS, &pView->Intensity);
+      }
+   else if(Components & eComponentColor)
+      {
+      MIL_ID MilReflectance = MbufAllocComponent(MilContainer, 3, NbPoints, 1, M_UNSIGNED + 8, M_IMAGE + M_PROC + M_DISP,
+                                                 M_COMPONENT_REFLECTANCE, M_NULL);
+      for(MIL_INT b = 0; b < 3; b++)
+         pView->Color[b] = (MIL_UINT8*)GetBandHostAddress(MilReflectance, COMPONENT_BANDS[b]);
+      }
+
+   if(Components & eComponentNormals)
+      {
+      MIL_ID MilNormals = MbufAllocComponent(MilContainer, 3, NbPoints, 1, 32 + M_FLOAT, M_IMAGE + M_PROC,
+                                             M_COMPONENT_NORMALS_MIL, M_NULL);
+      pView->NormalX = (MIL_FLOAT*)GetBandHostAddress(MilNormals, COMPONENT_BANDS[0]);
+      pView->NormalY = (MIL_FLOAT*)GetBandHostAddress(MilNormals, COMPONENT_BANDS[1]);
+      pView->NormalZ = (MIL_FLOAT*)GetBandHostAddress(MilNormals, COMPONENT_BANDS[2]);
+      }
+
+   return MilContainer;
+   }
+
+//--------------------------------------------------------------------------
+bool GetCloudView(MIL_ID MilContainer, SCloudView* pView)
+   {
+   MIL_ID MilRange = MbufInquireContainer(MilContainer, M_COMPONENT_RANGE, M_COMPONENT_ID, M_NULL);
+   if(MilRange == M_NULL ||
+      MbufInquire(MilRange, M_SIZE_BAND, M_NULL) != 3 ||
+      MbufInquire(MilRange, M_TYPE, M_NULL) != 32 + M_FLOAT ||
+      !IsContiguous(MilRange))
+      return false;
+
+   pView->NbPoints = MbufInquire(MilRange, M_SIZE_X, M_NULL) * MbufInquire(MilRange, M_SIZE_Y, M_NULL);
+   pView->X = (MIL_FLOAT*)GetBandHostAddress(MilRange, COMPONENT_BANDS[0]);
+   pView->Y = (MIL_FLOAT*)GetBandHostAddress(MilRange, COMPONENT_BANDS[1]);
+   pView->Z = (MIL_FLOAT*)GetBandHostAddress(MilRange, COMPONENT_BANDS[2]);
+   if(!pView->X || !pView->Y || !pView->Z)
+      return false;
+
+   return GetAttributeViews(MilContainer, pView);
+   }
+
+//--------------------------------------------------------------------------
+bool AllocNormalsComponent(MIL_ID MilContainer, SCloudView* pView)
+   {
+   if(!GetCloudView(MilContainer, pView))
+      return false;
+
+   MIL_ID MilRange = MbufInquireContainer(MilContainer, M_COMPONENT_RANGE, M_COMPONENT_ID, M_NULL);
+   MIL_INT SizeX = MbufInquire(MilRange, M_SIZE_X, M_NULL);
+   MIL_INT SizeY = MbufInquire(MilRange, M_SIZE_Y, M_NULL);
+   MIL_ID MilNormals = MbufAllocComponent(MilContainer, 3, SizeX, SizeY, 32 + M_FLOAT, M_IMAGE + M_PROC,
+                                          M_COMPONENT_NORMALS_MIL, M_NULL);
+   pView->NormalX = (MIL_FLOAT*)GetBandHostAddress(MilNormals, COMPONENT_BANDS[0]);
+   pView->NormalY = (MIL_FLOAT*)GetBandHostAddress(MilNormals, COMPONENT_BANDS[1]);
+   pView->NormalZ = (MIL_FLOAT*)GetBandHostAddress(MilNormals, COMPONENT_BANDS[2]);
+   return true;
+   }
+
+//--------------------------------------------------------------------------
+bool GetQuantizedCloudView(MIL_ID MilContainer, SQuantizedCloudView* pView)
+   {
+   MIL_ID MilRange = MbufInquireContainer(MilContainer, M_COMPONENT_RANGE, M_COMPONENT_ID, M_NULL);
+   if(MilRange == M_NULL ||
+      MbufInquire(MilRange, M_SIZE_BAND, M_NULL) != 3 ||
+      MbufInquire(MilRange, M_TYPE, M_NULL) != 16 + M_UNSIGNED ||
+      !IsContiguous(MilRange))
+      return false;
+
+   pView->X = (MIL_UINT16*)GetBandHostAddress(MilRange, COMPONENT_BANDS[0]);
+   pView->Y = (MIL_UINT16*)GetBandHostAddress(MilRange, COMPONENT_BANDS[1]);
+   pView->Z = (MIL_UINT16*)GetBandHostAddress(MilRange, COMPONENT_BANDS[2]);
+   if(!pView->X || !pView->Y || !pView->Z)
+      return false;
+
+   MbufInquire(MilRange, M_3D_SCALE_X,  &pView->Scale[0]);
+   MbufInquire(MilRange, M_3D_SCALE_Y,  &pView->Scale[1]);
+   MbufInquire(MilRange, M_3D_SCALE_Z,  &pView->Scale[2]);
+   MbufInquire(MilRange, M_3D_OFFSET_X, &pView->Offset[0]);
+   MbufInquire(MilRange, M_3D_OFFSET_Y, &pView->Offset[1]);
+   MbufInquire(MilRange, M_3D_OFFSET_Z, &pView->Offset[2]);
+
+   SCloudView& Attributes = pView->Attributes;
+   Attributes.X = Attributes.Y = Attributes.Z = M_NULL;
+   Attributes.NbPoints = MbufInquire(MilRange, M_SIZE_X, M_NULL) * MbufInquire(MilRange, M_SIZE_Y, M_NULL);
+   return GetAttributeViews(MilContainer, &Attributes);
+   }
+
+//--------------------------------------------------------------------------
+MIL_UNIQUE_BUF_ID QuantizePointCloud(MIL_ID MilSystem, MIL_ID MilContainer,
+                                     const SCloudStats* pStats, MIL_DOUBLE MaxError)
+   {
+   SCloudView View;
+   if(!GetCloudView(MilContainer, &View) || View.NbPoints == 0)
+      return MIL_UNIQUE_BUF_ID();
+
+   SCloudStats Stats;
+   if(pStats)
+      Stats = *pStats;
+   else
+      ComputeCloudStats(View, &Stats);
+   if(Stats.NbPoints == 0)
+      return MIL_UNIQUE_BUF_ID();
+
+   // Spread the bounding box over the quantized range of each axis.
+   MIL_DOUBLE Scale[3];
+   MIL_DOUBLE Offset[3];
+   for(MIL_INT a = 0; a < 3; a++)
+      {
+      const MIL_DOUBLE Extent = Stats.Max[a] - Stats.Min[a];
+      Scale[a]  = Extent > 0.0 ? Extent / QUANTIZED_MAX_VALUE : 1.0;
+      Offset[a] = Stats.Min[a];
+      if(0.5 * Scale[a] > MaxError)
+         return MIL_UNIQUE_BUF_ID();
+      }
+
+   MIL_UNIQUE_BUF_ID MilQuantized = MbufAllocContainer(MilSystem, M_PROC + M_DISP, M_DEFAULT, M_UNIQUE_ID);
+   MIL_ID MilRange = MbufAllocComponent(MilQuantized, 3, View.NbPoints, 1, 16 + M_UNSIGNED, M_IMAGE + M_PROC,
+                                        M_COMPONENT_RANGE, M_NULL);
+   MbufControl(MilRange, M_3D_REPRESENTATION, M_CALIBRATED_XYZ_UNORGANIZED);
+   MbufControl(MilRange, M_3D_SCALE_X,  Scale[0]);
+   MbufControl(MilRange, M_3D_SCALE_Y,  Scale[1]);
+   MbufControl(MilRange, M_3D_SCALE_Z,  Scale[2]);
+   MbufControl(MilRange, M_3D_OFFSET_X, Offset[0]);
+   MbufControl(MilRange, M_3D_OFFSET_Y, Offset[1]);
+   MbufControl(MilRange, M_3D_OFFSET_Z, Offset[2]);
+
+   const MIL_FLOAT* const pCoordinates[3] = { View.X, View.Y, View.Z };
+   MIL_UINT16* pQuantized[3];
+   for(MIL_INT a = 0; a < 3; a++)
+      pQuantized[a] = (MIL_UINT16*)GetBandHostAddress(MilRange, COMPONENT_BANDS[a]);
+
+   // Quantize the coordinates; the invalid points are set to 0.
+   ParallelFor(0, View.NbPoints, QUANTIZE_CHUNK_SIZE, [&](MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      for(MIL_INT a = 0; a < 3; a++)
+         {
+         const MIL_FLOAT* pSrc     = pCoordinates[a];
+         MIL_UINT16*      pDst     = pQuantized[a];
+         const MIL_DOUBLE InvScale = 1.0 / Scale[a];
+         for(MIL_INT i = ChunkBegin; i < ChunkEnd; i++)
+            {
+            MIL_DOUBLE Value = (View.Confidence && View.Confidence[i] == 0) ? 0.0 : (pSrc[i] - Offset[a]) * InvScale + 0.5;
+            if(!(Value > 0.0))
+               Value = 0.0;
+            else if(Value > QUANTIZED_MAX_VALUE)
+               Value = QUANTIZED_MAX_VALUE;
+            pDst[i] = (MIL_UINT16)Value;
+            }
+         }
+      });
+
+   // Copy the other components.
+   for(MIL_INT c = 0; c < (MIL_INT)(sizeof(QUANTIZED_COPIED_COMPONENTS) / sizeof(QUANTIZED_COPIED_COMPONENTS[0])); c++)
+      {
+      if(MbufInquireContainer(MilContainer, QUANTIZED_COPIED_COMPONENTS[c], M_COMPONENT_ID, M_NULL) != M_NULL)
+         MbufCopyComponent(MilContainer, MilQuantized, QUANTIZED_COPIED_COMPONENTS[c], M_APPEND, M_DEFAULT);
+      }
+
+   return MilQuantized;
+   }
+
+//--------------------------------------------------------------------------
+MIL_UNIQUE_BUF_ID DequantizePointCloud(MIL_ID MilSystem, MIL_ID MilContainer, SCloudView* pView)
+   {
+   SQuantizedCloudView Quantized;
+   if(!GetQuantizedCloudView(MilContainer, &Quantized))
+      return MIL_UNIQUE_BUF_ID();
+
+   SCloudView Range;
+   MIL_UNIQUE_BUF_ID MilDequantized = AllocPointCloudContainer(MilSystem, Quantized.Attributes.NbPoints, eComponentRange, &Range);
+   for(MIL_INT c = 0; c < (MIL_INT)(sizeof(QUANTIZED_COPIED_COMPONENTS) / sizeof(QUANTIZED_COPIED_COMPONENTS[0])); c++)
+      {
+      if(MbufInquireContainer(MilContainer, QUANTIZED_COPIED_COMPONENTS[c], M_COMPONENT_ID, M_NULL) != M_NULL)
+         MbufCopyComponent(MilContainer, MilDequantized, QUANTIZED_COPIED_COMPONENTS[c], M_APPEND, M_DEFAULT);
+      }
+   const MIL_UINT16* const pQuantized[3] = { Quantized.X, Quantized.Y, Quantized.Z };
+   MIL_FLOAT* const pCoordinates[3] = { Range.X, Range.Y, Range.Z };
+
+   // Restore the coordinates; the invalid points keep their confidence.
+   ParallelFor(0, Range.NbPoints, QUANTIZE_CHUNK_SIZE, [&](MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      for(MIL_INT a = 0; a < 3; a++)
+         {
+         const MIL_UINT16* pSrc   = pQuantized[a];
+         MIL_FLOAT*        pDst   = pCoordinates[a];
+         const MIL_DOUBLE  Scale  = Quantized.Scale[a];
+         const MIL_DOUBLE  Offset = Quantized.Offset[a];
+         for(MIL_INT i = ChunkBegin; i < ChunkEnd; i++)
+            pDst[i] = (MIL_FLOAT)(Offset + Scale * pSrc[i]);
+         }
+      });
+
+   GetCloudView(MilDequantized, pView);
+   return MilDequantized;
+   }
+
+//--------------------------------------------------------------------------
+void ComputeCloudStats(const SCloudView& View, SCloudStats* pStats)
+   {
+   const MIL_INT NbChunks = GetNbChunks(View.NbPoints, STATS_CHUNK_SIZE);
+   std::vector<SCloudStats> ChunkStats((size_t)NbChunks);
+
+   // Accumulate the statistics of each chunk; the centroid holds the sums.
+   ParallelChunks(0, View.NbPoints, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      SCloudStats& Stats = ChunkStats[(size_t)Chunk];
+      Stats.NbPoints = 0;
+      for(MIL_INT a = 0; a < 3; a++)
+         {
+         Stats.Min[a]      =  DBL_MAX;
+         Stats.Max[a]      = -DBL_MAX;
+         Stats.Centroid[a] =  0.0;
+         }
+
+      for(MIL_INT i = ChunkBegin; i < ChunkEnd; i++)
+         {
+         if(View.Confidence && View.Confidence[i] == 0)
+            continue;
+         const MIL_DOUBLE Point[3] = { View.X[i], View.Y[i], View.Z[i] };
+         for(MIL_INT a = 0; a < 3; a++)
+            {
+            if(Point[a] < Stats.Min[a]) Stats.Min[a] = Point[a];
+            if(Point[a] > Stats.Max[a]) Stats.Max[a] = Point[a];
+            Stats.Centroid[a] += Point[a];
+            }
+         Stats.NbPoints++;
+         }
+      });
+
+   // Combine the chunks.
+   *pStats = ChunkStats[0];
+   for(MIL_INT c = 1; c < NbChunks; c++)
+      {
+      const SCloudStats& Stats = ChunkStats[(size_t)c];
+      pStats->NbPoints += Stats.NbPoints;
+      for(MIL_INT a = 0; a < 3; a++)
+         {
+         if(Stats.Min[a] < pStats->Min[a]) pStats->Min[a] = Stats.Min[a];
+         if(Stats.Max[a] > pStats->Max[a]) pStats->Max[a] = Stats.Max[a];
+         pStats->Centroid[a] += Stats.Centroid[a];
+         }
+      }
+   for(MIL_INT a = 0; a < 3; a++)
+      pStats->Centroid[a] = pStats->NbPoints > 0 ? pStats->Centroid[a] / pStats->NbPoints : 0.0;
+   }
@@ -0,0 +1,102 @@
+﻿//***************************************************************************************/
+//
+// File name: PointCloudData.h
+//
+// Synopsis:  Declares the direct access to the host memory of the point cloud
+//            containers used by the loaders and by the in-tree processing.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+
+//-------------------------------------------------------------------------------
+// Direct access to the planar components of an unorganized point cloud.
+// The pointers refer to memory owned by the container; optional components
+// are M_NULL when absent.
+//-------------------------------------------------------------------------------
+struct SCloudView
+   {
+   MIL_FLOAT*  X;
+   MIL_FLOAT*  Y;
+   MIL_FLOAT*  Z;
+   MIL_UINT16* Intensity;   // 16-bit reflectance.
+   MIL_UINT8*  Color[3];    // 8-bit RGB reflectance.
+   MIL_UINT8*  Confidence;  // 0 for invalid points.
+   MIL_FLOAT*  NormalX;
+   MIL_FLOAT*  NormalY;
+   MIL_FLOAT*  NormalZ;
+   MIL_INT     NbPoints;
+   };
+
+//-------------------------------------------------------------------------------
+// Direct access to an unorganized point cloud whose range component holds
+// 16-bit quantized coordinates. The coordinate of a point on an axis is
+// Offset + Scale * Value.
+//-------------------------------------------------------------------------------
+struct SQuantizedCloudView
+   {
+   MIL_UINT16* X;
+   MIL_UINT16* Y;
+   MIL_UINT16* Z;
+   MIL_DOUBLE  Scale[3];
+   MIL_DOUBLE  Offset[3];
+   SCloudView  Attributes;   // Other components; its X, Y and Z are M_NULL.
+   };
+
+// Statistics of the valid points of a point cloud.
+struct SCloudStats
+   {
+   MIL_INT    NbPoints;
+   MIL_DOUBLE Min[3];
+   MIL_DOUBLE Max[3];
+   MIL_DOUBLE Centroid[3];
+   };
+
+// Components to allocate in a point cloud container.
+enum
+   {
+   eComponentRange       = 0x1,
+   eComponentReflectance = 0x2,
+   eComponentNormals     = 0x4,
+   eComponentColor       = 0x8    // 8-bit RGB reflectance instead of the 16-bit one.
+   };
+
+// Allocates an unorganized point cloud container of NbPoints and returns
+// the host addresses of its components.
+MIL_UNIQUE_BUF_ID AllocPointCloudContainer(MIL_ID MilSystem, MIL_INT NbPoints,
+                                           MIL_INT Components, SCloudView* pView);
+
+// Gets the host addresses of the components of an unorganized point cloud
+// container. Returns false if the range is not a 3-band 32-bit float
+// component with contiguous bands.
+bool GetCloudView(MIL_ID MilContainer, SCloudView* pView);
+
+// Adds a normals component of the size of the range to a point cloud
+// container that has none, and gets the host addresses of its components.
+// Returns false if the range is not an accessible float range.
+bool AllocNormalsComponent(MIL_ID MilContainer, SCloudView* pView);
+
+// Gets the host addresses of the components of an unorganized point cloud
+// container with a quantized range. Returns false if the range is not a
+// 3-band 16-bit unsigned component with contiguous bands.
+bool GetQuantizedCloudView(MIL_ID MilContainer, SQuantizedCloudView* pView);
+
+// Copies a point cloud in a new container whose range is quantized on 16 bits
+// with a scale and an offset per axis derived from the bounding box of the
+// valid points; the other components are copied as is. Returns an empty
+// identifier if the range cannot be accessed directly or if the quantization
+// error would exceed MaxError on an axis. pStats can be M_NULL.
+MIL_UNIQUE_BUF_ID QuantizePointCloud(MIL_ID MilSystem, MIL_ID MilContainer,
+                                     const SCloudStats* pStats, MIL_DOUBLE MaxError);
+
+// Copies a point cloud with a quantized range in a new container with a float
+// range and the same other components, and gets its host addresses. Returns an
+// empty identifier if the range is not an accessible quantized range.
+MIL_UNIQUE_BUF_ID DequantizePointCloud(MIL_ID MilSystem, MIL_ID MilContainer, SCloudView* pView);
+
+// Computes the number of valid points, the bounding box and the centroid
+// of a point cloud.
+void ComputeCloudStats(const SCloudView& View, SCloudStats* pStats);
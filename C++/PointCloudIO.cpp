@@ -0,0 +1,528 @@
+﻿//***************************************************************************************/
+//
+// File name: PointCloudIO.cpp
+//
+// Synopsis:  Implements the point cloud file loaders and writers.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "PointCloudIO.h"
+#include "CloudArchive.h"
+#include "CloudCache.h"
+#include "CloudNormals.h"
+#include "MappedFile.h"
+#include "Morton.h"
+#include "PointCloudData.h"
+#include "PointCloudText.h"
+#include "ParallelFor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+
+// Name and size of the PLY scalar types, indexed by EPlyType.
+static const char* const PLY_TYPE_NAMES[]     = { "char", "uchar", "short", "ushort", "int", "uint", "float", "double" };
+static const char* const PLY_TYPE_ALT_NAMES[] = { "int8", "uint8", "int16", "uint16", "int32", "uint32", "float32", "float64" };
+static const MIL_INT     PLY_TYPE_SIZES[]     = { 1, 1, 2, 2, 4, 4, 4, 8 };
+static const MIL_INT     NB_PLY_TYPES         = sizeof(PLY_TYPE_SIZES) / sizeof(PLY_TYPE_SIZES[0]);
+
+// Minimum number of vertices decoded or encoded by a worker thread.
+static const MIL_INT PLY_DECODE_CHUNK_SIZE = 65536;
+static const MIL_INT PLY_ENCODE_CHUNK_SIZE = 65536;
+
+//--------------------------------------------------------------------------
+// Returns the PLY type of a type name, or -1 if unknown.
+//--------------------------------------------------------------------------
+static MIL_INT FindPlyType(const std::string& TypeName)
+   {
+   for(MIL_INT t = 0; t < NB_PLY_TYPES; t++)
+      {
+      if(TypeName == PLY_TYPE_NAMES[t] || TypeName == PLY_TYPE_ALT_NAMES[t])
+         return t;
+      }
+   return -1;
+   }
+
+//--------------------------------------------------------------------------
+static bool IsHostLittleEndian()
+   {
+   const MIL_UINT16 Probe = 1;
+   return *(const MIL_UINT8*)&Probe == 1;
+   }
+
+//--------------------------------------------------------------------------
+MIL_INT SPlyHeader::FindProperty(const char* Name) const
+   {
+   for(MIL_INT p = 0; p < (MIL_INT)VertexProperties.size(); p++)
+      {
+      if(VertexProperties[p].Name == Name)
+         return p;
+      }
+   return -1;
+   }
+
+//--------------------------------------------------------------------------
+bool ParsePlyHeader(const MIL_UINT8* pData, MIL_INT DataSize, SPlyHeader* pHeader)
+   {
+   static const char END_HEADER[] = "end_header";
+
+   pHeader->NbVertices   = 0;
+   pHeader->VertexStride = 0;
+   pHeader->DataOffset   = 0;
+   pHeader->VertexProperties.clear();
+
+   if(DataSize < 4 || memcmp(pData, "ply", 3) != 0)
+      return false;
+
+   bool    HasFormat = false;
+   bool    HasVertex = false;
+   bool    InVertex  = false;
+   MIL_INT LineStart = 0;
+   while(LineStart < DataSize)
+      {
+      // Find the end of the line.
+      MIL_INT LineEnd = LineStart;
+      while(LineEnd < DataSize && pData[LineEnd] != '\n')
+         LineEnd++;
+      if(LineEnd == DataSize)
+         return false;
+
+      std::string Line((const char*)pData + LineStart, (size_t)(LineEnd - LineStart));
+      if(!Line.empty() && Line[Line.size() - 1] == '\r')
+         Line.erase(Line.size() - 1);
+      LineStart = LineEnd + 1;
+
+      std::istringstream Tokens(Line);
+      std::string Keyword;
+      Tokens >> Keyword;
+
+      if(Keyword == "format")
+         {
+         std::string Format;
+         Tokens >> Format;
+         if(Format == "ascii")
+            pHeader->Format = ePlyAscii;
+         else if(Format == "binary_little_endian")
+            pHeader->Format = ePlyBinaryLittleEndian;
+         else if(Format == "binary_big_endian")
+            pHeader->Format = ePlyBinaryBigEndian;
+         else
+            return false;
+         HasFormat = true;
+         }
+      else if(Keyword == "element")
+         {
+         std::string ElementName;
+         Tokens >> ElementName;
+         InVertex = (ElementName == "vertex");
+         if(InVertex)
+            {
+            // The vertex data must be the first data block of the file.
+            if(HasVertex)
+               return false;
+            Tokens >> pHeader->NbVertices;
+            HasVertex = true;
+            }
+         else if(!HasVertex)
+            return false;
+         }
+      else if(Keyword == "property" && InVertex)
+         {
+         std::string TypeName, PropertyName;
+         Tokens >> TypeName >> PropertyName;
+         MIL_INT Type = FindPlyType(TypeName);
+
+         // List properties make the vertex records of variable size.
+         if(Type < 0 || PropertyName.empty())
+            return false;
+
+         SPlyProperty Property;
+         Property.Name   = PropertyName;
+         Property.Type   = (EPlyType)Type;
+         Property.Offset = pHeader->VertexStride;
+         pHeader->VertexProperties.push_back(Property);
+         pHeader->VertexStride += PLY_TYPE_SIZES[Type];
+         }
+      else if(Keyword == END_HEADER)
+         {
+         pHeader->DataOffset = LineStart;
+         return HasFormat && HasVertex && pHeader->NbVertices > 0;
+         }
+      }
+
+   return false;
+   }
+
+//--------------------------------------------------------------------------
+MIL_UNIQUE_BUF_ID LoadPlyPointCloud(MIL_ID MilSystem, MIL_CONST_TEXT_PTR FileName,
+                                    MIL_INT Components, CMultiBoxCrop* pCrop)
+   {
+   CMappedFile File;
+   SPlyHeader  Header;
+   if(!IsHostLittleEndian() ||
+      !File.Open(FileName) ||
+      !ParsePlyHeader(File.Data(), File.Size(), &Header) ||
+      Header.Format != ePlyBinaryLittleEndian)
+      return MIL_UNIQUE_BUF_ID();
+
+   // Validate the vertex layout.
+   MIL_INT PropertyX         = Header.FindProperty("x");
+   MIL_INT PropertyY         = Header.FindProperty("y");
+   MIL_INT PropertyZ         = Header.FindProperty("z");
+   MIL_INT PropertyIntensity = (Components & eComponentReflectance) ? Header.FindProperty("intensity") : -1;
+   if(PropertyX < 0 || PropertyY < 0 || PropertyZ < 0 ||
+      Header.VertexProperties[PropertyX].Type != ePlyFloat32 ||
+      Header.VertexProperties[PropertyY].Type != ePlyFloat32 ||
+      Header.VertexProperties[PropertyZ].Type != ePlyFloat32 ||
+      (PropertyIntensity >= 0 && Header.VertexProperties[PropertyIntensity].Type != ePlyUInt16))
+      return MIL_UNIQUE_BUF_ID();
+
+   // Validate the size of the vertex block without overflowing.
+   const MIL_INT Stride = Header.VertexStride;
+   if(Stride <= 0 || Header.DataOffset > File.Size() ||
+      Header.NbVertices > (File.Size() - Header.DataOffset) / Stride)
+      return MIL_UNIQUE_BUF_ID();
+
+   // Allocate the container and decode the vertex block directly in its components.
+   SCloudView View;
+   MIL_UNIQUE_BUF_ID MilContainer =
+      AllocPointCloudContainer(MilSystem, Header.NbVertices,
+                               eComponentRange | (PropertyIntensity >= 0 ? eComponentReflectance : 0),
+                               &View);
+
+   // Decode the vertex block in chunks processed in parallel, extracting the
+   // points inside the crop boxes on the fly.
+   const MIL_UINT8* pVertexBlock    = File.Data() + Header.DataOffset;
+   const MIL_INT    OffsetX         = Header.VertexProperties[PropertyX].Offset;
+   const MIL_INT    OffsetY         = Header.VertexProperties[PropertyY].Offset;
+   const MIL_INT    OffsetZ         = Header.VertexProperties[PropertyZ].Offset;
+   const MIL_INT    OffsetIntensity = View.Intensity ? Header.VertexProperties[PropertyIntensity].Offset : 0;
+   const MIL_INT    NbChunks        = GetNbChunks(Header.NbVertices, PLY_DECODE_CHUNK_SIZE);
+   if(pCrop)
+      pCrop->Reset(NbChunks);
+   ParallelChunks(0, Header.NbVertices, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      const MIL_UINT8* pVertex = pVertexBlock + ChunkBegin * Stride;
+      for(MIL_INT BlockBegin = ChunkBegin; BlockBegin < ChunkEnd; BlockBegin += CROP_BLOCK_SIZE)
+         {
+         const MIL_INT BlockEnd = ChunkEnd - BlockBegin < CROP_BLOCK_SIZE ? ChunkEnd : BlockBegin + CROP_BLOCK_SIZE;
+         for(MIL_INT i = BlockBegin; i < BlockEnd; i++, pVertex += Stride)
+            {
+            memcpy(&View.X[i], pVertex + OffsetX, sizeof(MIL_FLOAT));
+            memcpy(&View.Y[i], pVertex + OffsetY, sizeof(MIL_FLOAT));
+            memcpy(&View.Z[i], pVertex + OffsetZ, sizeof(MIL_FLOAT));
+            }
+         if(pCrop)
+            pCrop->AddPoints(Chunk, View.X + BlockBegin, View.Y + BlockBegin, View.Z + BlockBegin, M_NULL, BlockEnd - BlockBegin);
+         }
+
+      if(View.Intensity)
+         {
+         pVertex = pVertexBlock + ChunkBegin * Stride;
+         for(MIL_INT i = ChunkBegin; i < ChunkEnd; i++, pVertex += Stride)
+            memcpy(&View.Intensity[i], pVertex + OffsetIntensity, sizeof(MIL_UINT16));
+         }
+      });
+
+   return MilContainer;
+   }
+
+//--------------------------------------------------------------------------
+void RestorePointCloud(MIL_ID MilSystem, MIL_CONST_TEXT_PTR FileName,
+                       const SCloudLoadOptions& Options, SLoadedCloud* pCloud)
+   {
+   CMultiBoxCrop  Crop(Options.CropBoxes.empty() ? M_NULL : &Options.CropBoxes[0], (MIL_INT)Options.CropBoxes.size());
+   CMultiBoxCrop* pCrop = Options.CropBoxes.empty() ? M_NULL : &Crop;
+   bool           Cropped = false;
+   bool           Sorted  = false;
+
+   // The normals are kept when they are estimated.
+   const bool    Estimate   = Options.NormalNeighbors > 0;
+   const MIL_INT Components = Options.Components | (Estimate ? eComponentNormals : 0);
+
+   // The clouds to sort are cropped once sorted, and the clouds with normals
+   // are cropped once their normals are known.
+   CMultiBoxCrop* pArchiveCrop = Estimate ? M_NULL : pCrop;
+   CMultiBoxCrop* pDecodeCrop  = (Options.MortonOrder || Estimate) ? M_NULL : pCrop;
+
+   // An archive is decoded directly, already in Morton order, and is not cached.
+   pCloud->Container = LoadCloudArchive(MilSystem, FileName, Components, &pCloud->Stats, pArchiveCrop);
+   const bool Archived = (pCloud->Container != M_NULL);
+   Cropped = (Archived && pArchiveCrop != M_NULL);
+   Sorted  = Archived;
+
+   MIL_INT64  SourceSize = 0;
+   MIL_INT64  SourceTime = 0;
+   MIL_STRING CacheFileName;
+   bool       UseCache = !Archived && Options.UseCache && GetFileSignature(FileName, &SourceSize, &SourceTime);
+   if(UseCache)
+      {
+      MIL_UINT32 CacheFlags = 0;
+      CacheFileName = GetCloudCacheFileName(FileName);
+      pCloud->Container = LoadCloudCache(MilSystem, CacheFileName.c_str(), SourceSize, SourceTime,
+                                         Components, Options.NormalNeighbors, Options.NormalOrientation,
+                                         &pCloud->Stats, &CacheFlags, pDecodeCrop);
+
+      // A cache without the normals to estimate, or with normals estimated differently,
+      // or without the selected intensity is written again.
+      if(pCloud->Container != M_NULL &&
+         ((Estimate && !(CacheFlags & eCacheNormals)) ||
+          ((Components & eComponentReflectance) && !(CacheFlags & eCacheIntensity))))
+         pCloud->Container.reset();
+      Cropped = (pCloud->Container != M_NULL && pDecodeCrop != M_NULL);
+      Sorted  = (pCloud->Container != M_NULL && (CacheFlags & eCacheMortonOrdered));
+      }
+
+   if(pCloud->Container == M_NULL)
+      {
+      // The cache written after the parse also holds the normals of the file;
+      // the intensity is only decoded when it is selected.
+      const MIL_INT ParsedComponents = UseCache ? (MIL_INT)(Components | eComponentRange | eComponentNormals)
+                                                : Components;
+      pCloud->Container = LoadPlyPointCloud(MilSystem, FileName, ParsedComponents, pDecodeCrop);
+      if(pCloud->Container == M_NULL)
+         pCloud->Container = LoadTextPointCloud(MilSystem, FileName, ParsedComponents, pDecodeCrop);
+      Cropped = (pCloud->Container != M_NULL && pDecodeCrop != M_NULL);
+      if(pCloud->Container == M_NULL)
+         pCloud->Container = MbufRestore(FileName, MilSystem, M_UNIQUE_ID);
+
+      SCloudView View;
+      if(GetCloudView(pCloud->Container, &View))
+         {
+         ComputeCloudStats(View, &pCloud->Stats);
+
+         // Sort the cloud before the cache is written, so that it is restored sorted.
+         if(Options.MortonOrder && pCloud->Stats.NbPoints > 0)
+            {
+            pCloud->Container = ReorderPointCloud(MilSystem, View, pCloud->Stats);
+            GetCloudView(pCloud->Container, &View);
+            Sorted = true;
+            }
+
+         // Estimate the normals before the cache is written, so that they are restored with the cloud.
+         MIL_INT NormalNeighbors = 0;
+         if(Estimate && !View.NormalX && pCloud->Stats.NbPoints > 0 &&
+            AddEstimatedNormals(pCloud->Container, Options.NormalNeighbors, Options.NormalOrientation))
+            {
+            GetCloudView(pCloud->Container, &View);
+            NormalNeighbors = Options.NormalNeighbors;
+            }
+         if(UseCache)
+            SaveCloudCache(CacheFileName.c_str(), View, pCloud->Stats,
+                           eCacheIntensity | eCacheNormals | (Sorted ? eCacheMortonOrdered : 0),
+                           NormalNeighbors, Options.NormalOrientation, SourceSize, SourceTime);
+         }
+      else
+         {
+         // Only the number of points is available for other range component layouts.
+         SCloudStats& Stats = pCloud->Stats;
+         MIL_UNIQUE_3DIM_ID MilStatResult = M3dimAllocResult(MilSystem, M_STATISTICS_RESULT, M_DEFAULT, M_UNIQUE_ID);
+         M3dimStat(M_STAT_CONTEXT_NUMBER_OF_POINTS, pCloud->Container, MilStatResult, M_DEFAULT);
+         M3dimGetResult(MilStatResult, M_NUMBER_OF_POINTS_VALID, &Stats.NbPoints);
+         for(MIL_INT a = 0; a < 3; a++)
+            Stats.Min[a] = Stats.Max[a] = Stats.Centroid[a] = 0.0;
+
+         SQuantizedCloudView QuantizedView;
+         if(pCrop && GetQuantizedCloudView(pCloud->Container, &QuantizedView))
+            {
+            pCrop->CropQuantized(QuantizedView);
+            Cropped = true;
+            }
+         }
+
+      // Free the components that were not selected.
+      if(!(Components & eComponentReflectance) &&
+         MbufInquireContainer(pCloud->Container, M_COMPONENT_REFLECTANCE, M_COMPONENT_ID, M_NULL) != M_NULL)
+         MbufFreeComponent(pCloud->Container, M_COMPONENT_REFLECTANCE, M_DEFAULT);
+      if(!(Components & eComponentNormals) &&
+         MbufInquireContainer(pCloud->Container, M_COMPONENT_NORMALS_MIL, M_COMPONENT_ID, M_NULL) != M_NULL)
+         MbufFreeComponent(pCloud->Container, M_COMPONENT_NORMALS_MIL, M_DEFAULT);
+      }
+
+   // Sort the clouds restored from an unsorted cache, estimate the normals of the
+   // archives and of the clouds restored by MbufRestore, then crop the clouds
+   // restored by MbufRestore, the sorted clouds and the clouds with normals.
+   SCloudView View;
+   const bool Sort = Options.MortonOrder && !Sorted && pCloud->Stats.NbPoints > 0;
+   if((Sort || Estimate || (pCrop && !Cropped)) && GetCloudView(pCloud->Container, &View))
+      {
+      if(Sort)
+         {
+         pCloud->Container = ReorderPointCloud(MilSystem, View, pCloud->Stats);
+         GetCloudView(pCloud->Container, &View);
+         }
+      if(Estimate && !View.NormalX && pCloud->Stats.NbPoints > 0 &&
+         AddEstimatedNormals(pCloud->Container, Options.NormalNeighbors, Options.NormalOrientation))
+         GetCloudView(pCloud->Container, &View);
+      if(pCrop && !Cropped)
+         {
+         pCrop->Crop(View);
+         Cropped = true;
+         }
+      }
+
+   pCloud->Cropped.clear();
+   pCloud->CroppedNbPoints.clear();
+   if(pCrop && Cropped)
+      {
+      for(MIL_INT b = 0; b < pCrop->NbBoxes(); b++)
+         {
+         pCloud->Cropped.push_back(pCrop->AllocContainer(MilSystem, b));
+         pCloud->CroppedNbPoints.push_back(pCrop->Count(b));
+         }
+      }
+   }
+
+//--------------------------------------------------------------------------
+void RestorePointClouds(MIL_ID MilSystem, const MIL_CONST_TEXT_PTR* FileNames, MIL_INT NbFiles,
+                        const SCloudLoadOptions& Options, SLoadedCloud* pClouds)
+   {
+   // One worker per file; the calling thread restores the first file.
+   std::vector<std::thread> Workers;
+   for(MIL_INT f = 1; f < NbFiles; f++)
+      {
+      Workers.push_back(std::thread([=, &Options]()
+         {
+         RestorePointCloud(MilSystem, FileNames[f], Options, &pClouds[f]);
+         }));
+      }
+   if(NbFiles > 0)
+      RestorePointCloud(MilSystem, FileNames[0], Options, &pClouds[0]);
+
+   for(size_t w = 0; w < Workers.size(); w++)
+      Workers[w].join();
+   }
+
+//--------------------------------------------------------------------------
+// Appends a value to a vertex record.
+//--------------------------------------------------------------------------
+template <class T>
+static inline MIL_UINT8* PutValue(MIL_UINT8* pRecord, T Value)
+   {
+   memcpy(pRecord, &Value, sizeof(T));
+   return pRecord + sizeof(T);
+   }
+
+//--------------------------------------------------------------------------
+bool SavePlyPointCloud(MIL_CONST_TEXT_PTR FileName, MIL_ID MilContainer)
+   {
+   // Get the components; the quantized coordinates are dequantized while the records are serialized.
+   SCloudView          View;
+   SQuantizedCloudView QuantizedView;
+   bool Accessible = false;
+   bool Quantized  = false;
+   if(IsHostLittleEndian())
+      {
+      if(GetCloudView(MilContainer, &View))
+         Accessible = true;
+      else if(GetQuantizedCloudView(MilContainer, &QuantizedView))
+         {
+         View = QuantizedView.Attributes;
+         Accessible = Quantized = true;
+         }
+      }
+   if(!Accessible)
+      {
+      MbufExport(FileName, M_DEFAULT, MilContainer);
+      return MappGetError(M_DEFAULT, M_CURRENT + M_THREAD_CURRENT, M_NULL) == M_NULL_ERROR;
+      }
+
+   // Count the valid points of each chunk to get the position of the chunks in the file.
+   const MIL_INT NbChunks = GetNbChunks(View.NbPoints, PLY_ENCODE_CHUNK_SIZE);
+   std::vector<MIL_INT> ChunkOffsets((size_t)NbChunks + 1, 0);
+   ParallelChunks(0, View.NbPoints, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      MIL_INT NbValid = ChunkEnd - ChunkBegin;
+      if(View.Confidence)
+         {
+         NbValid = 0;
+         for(MIL_INT i = ChunkBegin; i < ChunkEnd; i++)
+            NbValid += (View.Confidence[i] != 0);
+         }
+      ChunkOffsets[(size_t)Chunk + 1] = NbValid;
+      });
+   for(MIL_INT c = 0; c < NbChunks; c++)
+      ChunkOffsets[(size_t)c + 1] += ChunkOffsets[(size_t)c];
+   const MIL_INT NbVertices = ChunkOffsets.back();
+
+   // Build the header.
+   std::ostringstream Header;
+   Header << "ply\n"
+          << "format binary_little_endian 1.0\n"
+          << "element vertex " << NbVertices << "\n"
+          << "property float x\n"
+          << "property float y\n"
+          << "property float z\n";
+   MIL_INT Stride = 3 * sizeof(MIL_FLOAT);
+   if(View.Color[0])
+      {
+      Header << "property uchar red\n"
+             << "property uchar green\n"
+             << "property uchar blue\n";
+      Stride += 3 * sizeof(MIL_UINT8);
+      }
+   if(View.Intensity)
+      {
+      Header << "property ushort intensity\n";
+      Stride += sizeof(MIL_UINT16);
+      }
+   if(View.NormalX)
+      {
+      Header << "property float nx\n"
+             << "property float ny\n"
+             << "property float nz\n";
+      Stride += 3 * sizeof(MIL_FLOAT);
+      }
+   Header << "end_header\n";
+   const std::string HeaderText = Header.str();
+
+   // Serialize the vertex records of each chunk at its position in the file buffer.
+   std::vector<MIL_UINT8> FileBuffer(HeaderText.size() + (size_t)(NbVertices * Stride));
+   memcpy(&FileBuffer[0], HeaderText.data(), HeaderText.size());
+   MIL_UINT8* pVertexBlock = &FileBuffer[0] + HeaderText.size();
+   ParallelChunks(0, View.NbPoints, NbChunks, [&](MIL_INT Chunk, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      MIL_UINT8* pRecord = pVertexBlock + ChunkOffsets[(size_t)Chunk] * Stride;
+      for(MIL_INT i = ChunkBegin; i < ChunkEnd; i++)
+         {
+         if(View.Confidence && View.Confidence[i] == 0)
+            continue;
+
+         if(Quantized)
+            {
+            pRecord = PutValue(pRecord, (MIL_FLOAT)(QuantizedView.Offset[0] + QuantizedView.Scale[0] * QuantizedView.X[i]));
+            pRecord = PutValue(pRecord, (MIL_FLOAT)(QuantizedView.Offset[1] + QuantizedView.Scale[1] * QuantizedView.Y[i]));
+            pRecord = PutValue(pRecord, (MIL_FLOAT)(QuantizedView.Offset[2] + QuantizedView.Scale[2] * QuantizedView.Z[i]));
+            }
+         else
+            {
+            pRecord = PutValue(pRecord, View.X[i]);
+            pRecord = PutValue(pRecord, View.Y[i]);
+            pRecord = PutValue(pRecord, View.Z[i]);
+            }
+         if(View.Color[0])
+            {
+            pRecord = PutValue(pRecord, View.Color[0][i]);
+            pRecord = PutValue(pRecord, View.Color[1][i]);
+            pRecord = PutValue(pRecord, View.Color[2][i]);
+            }
+         if(View.Intensity)
+            pRecord = PutValue(pRecord, View.Intensity[i]);
+         if(View.NormalX)
+            {
+            pRecord = PutValue(pRecord, View.NormalX[i]);
+            pRecord = PutValue(pRecord, View.NormalY[i]);
+            pRecord = PutValue(pRecord, View.NormalZ[i]);
+            }
+         }
+      });
+
+   // Write the whole file at once.
+   FILE* pFile = MosFopen(FileName, MIL_TEXT("wb"));
+   if(!pFile)
+      return false;
+   bool Success = fwrite(&FileBuffer[0], 1, FileBuffer.size(), pFile) == FileBuffer.size();
+   Success = (fclose(pFile) == 0) && Success;
+   return Success;
+   }
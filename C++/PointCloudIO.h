@@ -0,0 +1,127 @@
+﻿//***************************************************************************************/
+//
+// File name: PointCloudIO.h
+//
+// Synopsis:  Declares the point cloud file loaders and writers used by the example.
+//            Binary little endian PLY files are read through a memory mapping
+//            and decoded directly in the container components.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include <string>
+#include <vector>
+#include "PointCloudData.h"
+#include "CloudCrop.h"
+
+// PLY data formats.
+enum EPlyFormat
+   {
+   ePlyAscii = 0,
+   ePlyBinaryLittleEndian,
+   ePlyBinaryBigEndian
+   };
+
+// PLY scalar property types.
+enum EPlyType
+   {
+   ePlyInt8 = 0,
+   ePlyUInt8,
+   ePlyInt16,
+   ePlyUInt16,
+   ePlyInt32,
+   ePlyUInt32,
+   ePlyFloat32,
+   ePlyFloat64
+   };
+
+// Scalar property of the vertex element.
+struct SPlyProperty
+   {
+   std::string Name;
+   EPlyType    Type;
+   MIL_INT     Offset;   // Byte offset in a binary vertex record.
+   };
+
+// Header of a PLY file, restricted to the vertex element.
+struct SPlyHeader
+   {
+   EPlyFormat                Format;
+   MIL_INT                   NbVertices;
+   MIL_INT                   VertexStride;   // Bytes per binary vertex record.
+   MIL_INT                   DataOffset;     // File offset of the vertex data.
+   std::vector<SPlyProperty> VertexProperties;
+
+   // Returns the index of the property, or -1 if absent.
+   MIL_INT FindProperty(const char* Name) const;
+   };
+
+// Parses the header of a PLY file. Returns false if the header is malformed
+// or if the vertex element is not the first element of the file.
+bool ParsePlyHeader(const MIL_UINT8* pData, MIL_INT DataSize, SPlyHeader* pHeader);
+
+// Loads a binary little endian PLY file with float x, y, z and an optional
+// ushort intensity property. Returns an empty identifier if the file does
+// not have that layout. The intensity is decoded in the reflectance only
+// when Components holds eComponentReflectance. When pCrop is not M_NULL,
+// the points are also tested against its boxes while the vertex block is
+// decoded.
+MIL_UNIQUE_BUF_ID LoadPlyPointCloud(MIL_ID MilSystem, MIL_CONST_TEXT_PTR FileName,
+                                    MIL_INT Components, CMultiBoxCrop* pCrop);
+
+//-------------------------------------------------------------------------------
+// Options of the point cloud restoration.
+//-------------------------------------------------------------------------------
+struct SCloudLoadOptions
+   {
+   SCloudLoadOptions()
+      : UseCache(true),
+        MortonOrder(false),
+        NormalNeighbors(0),
+        Components(eComponentRange | eComponentReflectance | eComponentNormals)
+      {
+      NormalOrientation[0] = 0.0;
+      NormalOrientation[1] = 0.0;
+      NormalOrientation[2] = -1.0;
+      }
+
+   bool                   UseCache;             // Restore from the cloud cache when it is up to date, and write it otherwise.
+   bool                   MortonOrder;          // Sort the points along the Morton curve before the crop.
+   MIL_INT                NormalNeighbors;      // Neighbors of the normals estimated for the clouds without normals; 0 to not estimate them.
+   MIL_DOUBLE             NormalOrientation[3]; // Direction the estimated normals do not point away from.
+   MIL_INT                Components;           // Components restored when the file has them; the range is always restored.
+   std::vector<SCloudBox> CropBoxes;            // Boxes whose subsets are extracted while the cloud is loaded.
+   };
+
+//-------------------------------------------------------------------------------
+// Point cloud restored from a file.
+//-------------------------------------------------------------------------------
+struct SLoadedCloud
+   {
+   MIL_UNIQUE_BUF_ID              Container;
+   SCloudStats                    Stats;
+   std::vector<MIL_UNIQUE_BUF_ID> Cropped;           // Subset in each crop box of the options, range and estimated normals only.
+   std::vector<MIL_INT>           CroppedNbPoints;   // Number of points of each subset.
+   };
+
+// Restores a point cloud file with the components of the options, computes
+// its statistics and extracts its subsets in the crop boxes; Cropped is left
+// empty if the range of the restored cloud cannot be accessed.
+void RestorePointCloud(MIL_ID MilSystem, MIL_CONST_TEXT_PTR FileName,
+                       const SCloudLoadOptions& Options, SLoadedCloud* pCloud);
+
+// Restores the point cloud files concurrently, one worker per file, and
+// returns once all of them are restored.
+void RestorePointClouds(MIL_ID MilSystem, const MIL_CONST_TEXT_PTR* FileNames, MIL_INT NbFiles,
+                        const SCloudLoadOptions& Options, SLoadedCloud* pClouds);
+
+// Saves the valid points of a point cloud container in a binary little
+// endian PLY file. The vertex records are serialized in parallel in a
+// single buffer written with one sequential write; quantized coordinates are
+// written as floats. Containers whose range component cannot be accessed
+// directly are exported with MbufExport in the binary PLY format selected by
+// the extension. Returns false if the file cannot be written.
+bool SavePlyPointCloud(MIL_CONST_TEXT_PTR FileName, MIL_ID MilContainer);
@@ -0,0 +1,373 @@
+﻿//***************************************************************************************/
+//
+// File name: PointCloudText.cpp
+//
+// Synopsis:  Implements the loader of the ASCII PLY and XYZ point cloud files.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "PointCloudText.h"
+#include "PointCloudIO.h"
+#include "MappedFile.h"
+#include "ParallelFor.h"
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__has_include)
+   #if __has_include(<charconv>)
+      #include <charconv>
+   #endif
+#endif
+
+// The floats are parsed with std::from_chars when the standard library supports
+// it for the floating-point types, and with the local parser otherwise.
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+   #define USE_FROM_CHARS 1
+#else
+   #define USE_FROM_CHARS 0
+#endif
+
+// Minimum number of bytes of text parsed by a worker thread.
+static const MIL_INT TEXT_PARSE_CHUNK_SIZE = 1 << 20;
+
+// Columns of the values of a line; -1 for an absent value.
+struct SLineColumns
+   {
+   MIL_INT X;
+   MIL_INT Y;
+   MIL_INT Z;
+   MIL_INT Intensity;
+   MIL_INT Last;
+   };
+
+//--------------------------------------------------------------------------
+static inline bool IsBlank(char Char)
+   {
+   return Char == ' ' || Char == '\t' || Char == '\r';
+   }
+
+//--------------------------------------------------------------------------
+static inline bool IsDigit(char Char)
+   {
+   return Char >= '0' && Char <= '9';
+   }
+
+//--------------------------------------------------------------------------
+// Returns the start of the line following the one holding pText.
+//--------------------------------------------------------------------------
+static const char* NextLine(const char* pText, const char* pEnd)
+   {
+   const char* pNewLine = (const char*)memchr(pText, '\n', (size_t)(pEnd - pText));
+   return pNewLine ? pNewLine + 1 : pEnd;
+   }
+
+//--------------------------------------------------------------------------
+// Returns true if the line holds values, i.e. is neither blank nor a comment.
+//--------------------------------------------------------------------------
+static bool IsDataLine(const char* pLine, const char* pLineEnd)
+   {
+   while(pLine < pLineEnd && IsBlank(*pLine))
+      pLine++;
+   return pLine < pLineEnd && *pLine != '#' && *pLine != '\n';
+   }
+
+#if !USE_FROM_CHARS
+//--------------------------------------------------------------------------
+// Parses a decimal floating-point number. The mantissa is accumulated in an
+// integer and scaled once, which is exact for the usual number of digits.
+//--------------------------------------------------------------------------
+static const char* ParseFloatValue(const char* pText, const char* pEnd, MIL_FLOAT* pValue)
+   {
+   static const MIL_DOUBLE POWERS_OF_10[] =
+      { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+   static const MIL_INT    MAX_EXACT_POWER = 22;
+   static const MIL_UINT64 MANTISSA_LIMIT  = 100000000000000000ULL;
+
+   const bool Negative = (pText < pEnd && *pText == '-');
+   if(pText < pEnd && (*pText == '-' || *pText == '+'))
+      pText++;
+
+   MIL_UINT64 Mantissa = 0;
+   MIL_INT    Exponent = 0;
+   MIL_INT    NbDigits = 0;
+   for(; pText < pEnd && IsDigit(*pText); pText++, NbDigits++)
+      {
+      if(Mantissa < MANTISSA_LIMIT)
+         Mantissa = Mantissa * 10 + (MIL_UINT64)(*pText - '0');
+      else
+         Exponent++;
+      }
+   if(pText < pEnd && *pText == '.')
+      {
+      for(pText++; pText < pEnd && IsDigit(*pText); pText++, NbDigits++)
+         {
+         if(Mantissa < MANTISSA_LIMIT)
+            {
+            Mantissa = Mantissa * 10 + (MIL_UINT64)(*pText - '0');
+            Exponent--;
+            }
+         }
+      }
+   if(NbDigits == 0)
+      return M_NULL;
+
+   if(pText < pEnd && (*pText == 'e' || *pText == 'E'))
+      {
+      const char* pExponent = pText + 1;
+      const bool NegativeExponent = (pExponent < pEnd && *pExponent == '-');
+      if(pExponent < pEnd && (*pExponent == '-' || *pExponent == '+'))
+         pExponent++;
+      if(pExponent < pEnd && IsDigit(*pExponent))
+         {
+         MIL_INT ExplicitExponent = 0;
+         for(; pExponent < pEnd && IsDigit(*pExponent); pExponent++)
+            {
+            if(ExplicitExponent < 10000)
+               ExplicitExponent = ExplicitExponent * 10 + (*pExponent - '0');
+            }
+         Exponent += NegativeExponent ? -ExplicitExponent : ExplicitExponent;
+         pText = pExponent;
+         }
+      }
+
+   MIL_DOUBLE Value = (MIL_DOUBLE)Mantissa;
+   if(Exponent > 0)
+      Value *= Exponent <= MAX_EXACT_POWER ? POWERS_OF_10[Exponent] : pow(10.0, (MIL_DOUBLE)Exponent);
+   else if(Exponent < 0)
+      Value /= -Exponent <= MAX_EXACT_POWER ? POWERS_OF_10[-Exponent] : pow(10.0, (MIL_DOUBLE)-Exponent);
+
+   *pValue = (MIL_FLOAT)(Negative ? -Value : Value);
+   return pText;
+   }
+#endif
+
+//--------------------------------------------------------------------------
+// Parses a float value. Returns the end of the value, or M_NULL on error.
+//--------------------------------------------------------------------------
+static inline const char* ParseFloat(const char* pText, const char* pEnd, MIL_FLOAT* pValue)
+   {
+#if USE_FROM_CHARS
+   // from_chars does not accept an explicit positive sign.
+   if(pText < pEnd && *pText == '+')
+      pText++;
+   std::from_chars_result Result = std::from_chars(pText, pEnd, *pValue);
+   return Result.ec == std::errc() ? Result.ptr : M_NULL;
+#else
+   return ParseFloatValue(pText, pEnd, pValue);
+#endif
+   }
+
+//--------------------------------------------------------------------------
+// Parses an unsigned integer value saturated to 16 bits. Returns the end of
+// the value, or M_NULL on error.
+//--------------------------------------------------------------------------
+static inline const char* ParseUInt16(const char* pText, const char* pEnd, MIL_UINT16* pValue)
+   {
+   if(pText < pEnd && *pText == '+')
+      pText++;
+   if(pText == pEnd || !IsDigit(*pText))
+      return M_NULL;
+
+   MIL_UINT32 Value = 0;
+   for(; pText < pEnd && IsDigit(*pText); pText++)
+      {
+      Value = Value * 10 + (MIL_UINT32)(*pText - '0');
+      if(Value > 0xFFFF)
+         Value = 0xFFFF;
+      }
+   *pValue = (MIL_UINT16)Value;
+   return pText;
+   }
+
+//--------------------------------------------------------------------------
+// Returns true if a value is neither infinite nor NaN.
+//--------------------------------------------------------------------------
+static inline bool IsFinite(MIL_FLOAT Value)
+   {
+   return Value - Value == 0.0f;
+   }
+
+//--------------------------------------------------------------------------
+// Parses the values of a data line. Returns false if a value is missing or
+// malformed, or if a coordinate is not finite.
+//--------------------------------------------------------------------------
+static bool ParseLine(const char* pText, const char* pLineEnd, const SLineColumns& Columns,
+                      MIL_FLOAT* pX, MIL_FLOAT* pY, MIL_FLOAT* pZ, MIL_UINT16* pIntensity)
+   {
+   for(MIL_INT c = 0; c <= Columns.Last; c++)
+      {
+      while(pText < pLineEnd && IsBlank(*pText))
+         pText++;
+      if(pText == pLineEnd)
+         return false;
+
+      if(c == Columns.X)
+         pText = ParseFloat(pText, pLineEnd, pX);
+      else if(c == Columns.Y)
+         pText = ParseFloat(pText, pLineEnd, pY);
+      else if(c == Columns.Z)
+         pText = ParseFloat(pText, pLineEnd, pZ);
+      else if(c == Columns.Intensity && pIntensity)
+         pText = ParseUInt16(pText, pLineEnd, pIntensity);
+      else
+         {
+         while(pText < pLineEnd && !IsBlank(*pText))
+            pText++;
+         }
+
+      // A value ends at a separator.
+      if(!pText || (pText < pLineEnd && !IsBlank(*pText)))
+         return false;
+      }
+   return IsFinite(*pX) && IsFinite(*pY) && IsFinite(*pZ);
+   }
+
+//--------------------------------------------------------------------------
+// Returns true if the file name ends with the extension, ignoring the case.
+//--------------------------------------------------------------------------
+static bool HasExtension(MIL_CONST_TEXT_PTR FileName, MIL_CONST_TEXT_PTR Extension)
+   {
+   const MIL_STRING Name = FileName;
+   const MIL_STRING Suffix = Extension;
+   if(Name.size() < Suffix.size())
+      return false;
+
+   for(size_t i = 0; i < Suffix.size(); i++)
+      {
+      MIL_TEXT_CHAR Char = Name[Name.size() - Suffix.size() + i];
+      if(Char >= MIL_TEXT('A') && Char <= MIL_TEXT('Z'))
+         Char = (MIL_TEXT_CHAR)(Char - MIL_TEXT('A') + MIL_TEXT('a'));
+      if(Char != Suffix[i])
+         return false;
+      }
+   return true;
+   }
+
+//--------------------------------------------------------------------------
+MIL_UNIQUE_BUF_ID LoadTextPointCloud(MIL_ID MilSystem, MIL_CONST_TEXT_PTR FileName,
+                                     MIL_INT Components, CMultiBoxCrop* pCrop)
+   {
+   CMappedFile File;
+   if(!File.Open(FileName))
+      return MIL_UNIQUE_BUF_ID();
+
+   // Get the columns of the values and the text body holding the points.
+   SLineColumns Columns;
+   const char*  pBody    = (const char*)File.Data();
+   const char*  pEnd     = pBody + File.Size();
+   MIL_INT      NbPoints = -1;   // All the data lines for a XYZ file.
+   SPlyHeader   Header;
+   if(ParsePlyHeader(File.Data(), File.Size(), &Header))
+      {
+      if(Header.Format != ePlyAscii)
+         return MIL_UNIQUE_BUF_ID();
+
+      // The values of an ASCII PLY line are in the order of the properties.
+      Columns.X         = Header.FindProperty("x");
+      Columns.Y         = Header.FindProperty("y");
+      Columns.Z         = Header.FindProperty("z");
+      Columns.Intensity = (Components & eComponentReflectance) ? Header.FindProperty("intensity") : -1;
+      if(Columns.Intensity >= 0 && Header.VertexProperties[Columns.Intensity].Type > ePlyUInt32)
+         Columns.Intensity = -1;
+      pBody   += Header.DataOffset;
+      NbPoints = Header.NbVertices;
+      }
+   else if(HasExtension(FileName, MIL_TEXT(".xyz")))
+      {
+      Columns.X         = 0;
+      Columns.Y         = 1;
+      Columns.Z         = 2;
+      Columns.Intensity = -1;
+      }
+   else
+      return MIL_UNIQUE_BUF_ID();
+
+   if(Columns.X < 0 || Columns.Y < 0 || Columns.Z < 0)
+      return MIL_UNIQUE_BUF_ID();
+   Columns.Last = Columns.X;
+   if(Columns.Y > Columns.Last)         Columns.Last = Columns.Y;
+   if(Columns.Z > Columns.Last)         Columns.Last = Columns.Z;
+   if(Columns.Intensity > Columns.Last) Columns.Last = Columns.Intensity;
+
+   // Split the body in chunks starting at line boundaries.
+   const MIL_INT NbChunks = GetNbChunks((MIL_INT)(pEnd - pBody), TEXT_PARSE_CHUNK_SIZE);
+   std::vector<const char*> ChunkStarts((size_t)NbChunks + 1);
+   ChunkStarts[0] = pBody;
+   ChunkStarts[(size_t)NbChunks] = pEnd;
+   for(MIL_INT c = 1; c < NbChunks; c++)
+      ChunkStarts[(size_t)c] = NextLine(pBody + (pEnd - pBody) * c / NbChunks, pEnd);
+
+   // Count the data lines of each chunk to get the index of its first point.
+   std::vector<MIL_INT> ChunkOffsets((size_t)NbChunks + 1, 0);
+   ParallelChunks(0, NbChunks, NbChunks, [&](MIL_INT, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      for(MIL_INT c = ChunkBegin; c < ChunkEnd; c++)
+         {
+         MIL_INT NbLines = 0;
+         const char* pChunkEnd = ChunkStarts[(size_t)c + 1];
+         for(const char* pLine = ChunkStarts[(size_t)c]; pLine < pChunkEnd; )
+            {
+            const char* pNextLine = NextLine(pLine, pChunkEnd);
+            NbLines += IsDataLine(pLine, pNextLine) ? 1 : 0;
+            pLine = pNextLine;
+            }
+         ChunkOffsets[(size_t)c + 1] = NbLines;
+         }
+      });
+   for(MIL_INT c = 0; c < NbChunks; c++)
+      ChunkOffsets[(size_t)c + 1] += ChunkOffsets[(size_t)c];
+
+   // The vertex lines are followed by the lines of the other elements in a PLY file.
+   if(NbPoints < 0)
+      NbPoints = ChunkOffsets.back();
+   if(NbPoints == 0 || ChunkOffsets.back() < NbPoints)
+      return MIL_UNIQUE_BUF_ID();
+
+   SCloudView View;
+   MIL_UNIQUE_BUF_ID MilContainer =
+      AllocPointCloudContainer(MilSystem, NbPoints,
+                               eComponentRange | (Columns.Intensity >= 0 ? eComponentReflectance : 0),
+                               &View);
+
+   // Parse the lines of each chunk at the position of its points.
+   std::vector<MIL_UINT8> ChunkFailed((size_t)NbChunks, 0);
+   if(pCrop)
+      pCrop->Reset(NbChunks);
+   ParallelChunks(0, NbChunks, NbChunks, [&](MIL_INT, MIL_INT ChunkBegin, MIL_INT ChunkEnd)
+      {
+      for(MIL_INT c = ChunkBegin; c < ChunkEnd; c++)
+         {
+         MIL_INT Index = ChunkOffsets[(size_t)c];
+         const char* pChunkEnd = ChunkStarts[(size_t)c + 1];
+         for(const char* pLine = ChunkStarts[(size_t)c]; pLine < pChunkEnd && Index < NbPoints; )
+            {
+            const char* pNextLine = NextLine(pLine, pChunkEnd);
+            const char* pLineEnd  = (pNextLine > pLine && pNextLine[-1] == '\n') ? pNextLine - 1 : pNextLine;
+            if(IsDataLine(pLine, pLineEnd))
+               {
+               if(!ParseLine(pLine, pLineEnd, Columns, &View.X[Index], &View.Y[Index], &View.Z[Index],
+                             View.Intensity ? &View.Intensity[Index] : M_NULL))
+                  {
+                  ChunkFailed[(size_t)c] = 1;
+                  break;
+                  }
+               if(pCrop)
+                  pCrop->Add(c, View.X[Index], View.Y[Index], View.Z[Index]);
+               Index++;
+               }
+            pLine = pNextLine;
+            }
+         }
+      });
+
+   for(MIL_INT c = 0; c < NbChunks; c++)
+      {
+      if(ChunkFailed[(size_t)c])
+         return MIL_UNIQUE_BUF_ID();
+      }
+
+   return MilContainer;
+   }
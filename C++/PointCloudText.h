@@ -0,0 +1,27 @@
+﻿//***************************************************************************************/
+//
+// File name: PointCloudText.h
+//
+// Synopsis:  Declares the loader of the ASCII PLY and XYZ point cloud files. The
+//            text is split in chunks at line boundaries that are parsed in
+//            parallel directly in the container components.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include "PointCloudData.h"
+#include "CloudCrop.h"
+
+// Loads an ASCII PLY file, or a text file with the .xyz extension holding
+// one "x y z" point per line, in the same container layout as the binary
+// PLY loader. The intensity property of a PLY file is parsed in the
+// reflectance when Components holds eComponentReflectance; the extra
+// columns of a XYZ file are ignored, as are its blank and '#' comment lines.
+// Returns an empty identifier if the file is not such a text file or if a
+// line is malformed. When pCrop is not M_NULL, the points are also tested
+// against its boxes while they are parsed.
+MIL_UNIQUE_BUF_ID LoadTextPointCloud(MIL_ID MilSystem, MIL_CONST_TEXT_PTR FileName,
+                                     MIL_INT Components, CMultiBoxCrop* pCrop);
@@ -0,0 +1,57 @@
+﻿//***************************************************************************************/
+//
+// File name: ReferenceIndexCache.cpp
+//
+// Synopsis:  Implements the cache of the spatial indexes of the reference point clouds.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#include "ReferenceIndexCache.h"
+#include "MappedFile.h"
+
+//--------------------------------------------------------------------------
+MIL_STRING MakeReferenceIndexKey(MIL_CONST_TEXT_PTR FileName, const SCloudBox& Box,
+                                 MIL_CONST_TEXT_PTR IndexDescription)
+   {
+   MIL_INT64 Size = 0;
+   MIL_INT64 ModificationTime = 0;
+   if(!GetFileSignature(FileName, &Size, &ModificationTime))
+      return MIL_STRING();
+
+   MIL_TEXT_CHAR Signature[512];
+   MosSprintf(Signature, 512, MIL_TEXT("|%lld|%lld|%.9g|%.9g|%.9g|%.9g|%.9g|%.9g"),
+              (long long)Size, (long long)ModificationTime,
+              Box.Min[0], Box.Min[1], Box.Min[2], Box.Max[0], Box.Max[1], Box.Max[2]);
+   return MIL_STRING(FileName) + Signature + MIL_TEXT("|") + IndexDescription;
+   }
+
+//--------------------------------------------------------------------------
+CReferenceIndexCache::CReferenceIndexCache()
+   {
+   }
+
+//--------------------------------------------------------------------------
+std::shared_ptr<const CNearestNeighborIndex> CReferenceIndexCache::Find(const MIL_STRING& Key)
+   {
+   std::lock_guard<std::mutex> Lock(m_Mutex);
+   std::map< MIL_STRING, std::shared_ptr<const CNearestNeighborIndex> >::const_iterator It = m_Indexes.find(Key);
+   return It != m_Indexes.end() ? It->second : std::shared_ptr<const CNearestNeighborIndex>();
+   }
+
+//--------------------------------------------------------------------------
+void CReferenceIndexCache::Add(const MIL_STRING& Key, const std::shared_ptr<const CNearestNeighborIndex>& Index)
+   {
+   if(Key.empty())
+      return;
+
+   std::lock_guard<std::mutex> Lock(m_Mutex);
+   m_Indexes[Key] = Index;
+   }
+
+//--------------------------------------------------------------------------
+void CReferenceIndexCache::Clear()
+   {
+   std::lock_guard<std::mutex> Lock(m_Mutex);
+   m_Indexes.clear();
+   }
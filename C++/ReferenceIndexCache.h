@@ -0,0 +1,55 @@
+﻿//***************************************************************************************/
+//
+// File name: ReferenceIndexCache.h
+//
+// Synopsis:  Declares the cache of the spatial indexes built over the reference
+//            point clouds. A reference that does not change between the scan
+//            pairs, such as a golden part, has its index built once and shared by
+//            the registration passes of all the pairs.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+//***************************************************************************************/
+#pragma once
+
+#include <mil.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "NearestNeighborIndex.h"
+#include "CloudCrop.h"
+
+// Returns the key identifying the subset of a point cloud file inside a box,
+// made of the name, the size and the modification time of the file, the
+// bounds of the box and a description of the subsampling of the subset and
+// of the kind of index.
+// Returns an empty key if the file does not exist.
+MIL_STRING MakeReferenceIndexKey(MIL_CONST_TEXT_PTR FileName, const SCloudBox& Box,
+                                 MIL_CONST_TEXT_PTR IndexDescription);
+
+//-------------------------------------------------------------------------------
+// Spatial indexes of the reference clouds by key. The indexes are shared and
+// never modified once built, so they remain valid while a caller holds them
+// even if the cache is cleared.
+//-------------------------------------------------------------------------------
+class CReferenceIndexCache
+   {
+   public:
+      CReferenceIndexCache();
+
+      // Returns the index of a key, or an empty pointer if there is none.
+      std::shared_ptr<const CNearestNeighborIndex> Find(const MIL_STRING& Key);
+
+      // Keeps the index of a key. An index with an empty key is not kept.
+      void Add(const MIL_STRING& Key, const std::shared_ptr<const CNearestNeighborIndex>& Index);
+
+      void Clear();
+
+   private:
+      // Not copyable.
+      CReferenceIndexCache(const CReferenceIndexCache&);
+      CReferenceIndexCache& operator=(const CReferenceIndexCache&);
+
+      std::mutex                                                           m_Mutex;
+      std::map< MIL_STRING, std::shared_ptr<const CNearestNeighborIndex> > m_Indexes;
+   };
@@ -12,6 +12,19 @@
 //***************************************************************************************/             
 #include <mil.h>
 #include <math.h>
+#include <utility>
+#include "PointCloudIO.h"
+#include "CloudCache.h"
+#include "CloudArchive.h"
+#include "CloudPrefetch.h"
+#include "MappedFile.h"
+#include "CloudSubsample.h"
+#include "ReferenceIndexCache.h"
+#include "KdTree.h"
+#include "HashGrid.h"
+#include "Octree.h"
+#include "IcpRegistration.h"
+#include "GlobalRegistration.h"
 
 //-------------------------------------------------------------------------------
 // Example description.
@@ -29,19 +42,87 @@ void PrintHeader()
 
    MosPrintf(MIL_TEXT("[MODULES USED]\n"));
    MosPrintf(MIL_TEXT("Modules used: 3D Registration, Buffer, 3D Image Processing,\n")
-             MIL_TEXT("3D Display, 3D Graphics, 3D Geometry and 3D Metrology.\n\n"));
+             MIL_TEXT("3D Display, 3D Graphics and 3D Geometry.\n\n"));
    }
 
-// Utility functions.
-bool   CheckForRequiredMILFile      (MIL_CONST_TEXT_PTR FileName);
-MIL_ID Alloc3dDisplayId             (MIL_ID MilSystem);
-
 // Enumerators definitions.
 enum { eSource = 0, eTarget, eStitched};
+enum { eUsedOverlapBox = 0, eOverlapBox };
+enum { eSubsampleDecimation = 0, eSubsampleVoxelGrid, eSubsamplePyramid };
+enum { eEngineMil = 0, eEngineNative };
+enum { eSearchKdTree = 0, eSearchHashGrid, eSearchOctree };
+enum { eMetricPointToPoint = 0, eMetricPointToPlane, eMetricPlaneToPlane, eMetricGeneralized };
+enum { ePreregistrationBox = 0, ePreregistrationGlobal };
 
 // The number of point clouds.
 static const MIL_INT NB_POINT_CLOUD = 2;
 
+// The number of crop boxes.
+static const MIL_INT NB_CROP_BOX = 2;
+
+// Point clouds of a scan pair and their subsets in the crop boxes.
+struct SCloudPair
+   {
+   MIL_UNIQUE_BUF_ID PointCloud[NB_POINT_CLOUD];
+   MIL_UNIQUE_BUF_ID CroppedPointCloud[NB_CROP_BOX][NB_POINT_CLOUD];
+   MIL_INT           SourceTotalNbPoints;
+   MIL_INT           SourceOverlapNbPoints;   // Number of points of the source in the overlap box; -1 until counted.
+   MIL_STRING        SourceFileName;
+   SCloudBox         OverlapBox;
+   };
+
+// Outcome of the registration of a pair by either registration engine.
+struct SRegistrationOutcome
+   {
+   MIL_INT             Status;                   // Registration status of the target.
+   MIL_DOUBLE          RmsError;                 // mm
+   MIL_INT             NbIterations;             // Of both registration passes.
+   MIL_INT             NbApproximateIterations;  // Of both passes, with approximate nearest neighbors; native engine.
+   MIL_DOUBLE          Overlap;                  // %, of the target points kept at the last iteration; native engine.
+   MIL_INT             RequestedMetric;          // Error minimization metric selected.
+   MIL_INT             Metric;                   // Error minimization metric used, after the fall backs of the native engine.
+   MIL_DOUBLE          ComputationTime;          // s
+   MIL_DOUBLE          IndexBuildTime;           // s, spent building the index of the source; native engine.
+   bool                IndexReused;              // The index of the source was taken from the cache; native engine.
+   MIL_UNIQUE_3DGEO_ID MilMatrix;                // Transformation of the target onto the source; native engine.
+   };
+
+// Utility functions.
+bool              CheckForRequiredMILFile (MIL_CONST_TEXT_PTR FileName);
+MIL_ID            Alloc3dDisplayId        (MIL_ID MilSystem);
+SCloudLoadOptions GetLoadOptions          ();
+void              PreparePointClouds      (MIL_ID MilSystem, const MIL_CONST_TEXT_PTR* FileNames,
+                                           const SCloudLoadOptions& LoadOptions,
+                                           SLoadedCloud* pLoadedCloud, SCloudPair* pPair);
+void              SetRegistrationControls (MIL_ID MilRegistrationContext, MIL_INT Metric);
+MIL_DOUBLE        GetFullModelOverlap     (MIL_ID MilSystem, SCloudPair* pPair);
+void              RegisterPointClouds     (MIL_ID MilSystem, MIL_ID MilRegistrationContext,
+                                           MIL_ID MilRegistrationResult, CReferenceIndexCache* pIndexCache,
+                                           SCloudPair* pPair, SRegistrationOutcome* pOutcome);
+bool              FindGlobalPreregistration(MIL_ID MilSystem, const SCloudPair& Pair, MIL_DOUBLE Matrix[16]);
+void              RegisterPointCloudsMil  (MIL_ID MilSystem, MIL_ID MilRegistrationContext,
+                                           MIL_ID MilRegistrationResult,
+                                           SCloudPair* pPair, SRegistrationOutcome* pOutcome);
+std::shared_ptr<const CNearestNeighborIndex>
+                  GetSourceIndex          (MIL_ID MilSystem, MIL_INT NeighborSearch,
+                                           const SCloudView& SourceView, MIL_DOUBLE GridSize,
+                                           MIL_INT Step, CReferenceIndexCache* pIndexCache,
+                                           const SCloudPair& Pair, bool* pReused,
+                                           SRegistrationOutcome* pOutcome);
+void              RegisterPointCloudsNative(MIL_ID MilSystem, MIL_INT NeighborSearch, MIL_INT Metric,
+                                           CReferenceIndexCache* pIndexCache,
+                                           SCloudPair* pPair, SRegistrationOutcome* pOutcome);
+void              PrintRegistrationStatus (const SRegistrationOutcome& Outcome);
+MIL_UNIQUE_BUF_ID StitchPointClouds       (MIL_ID MilSystem, MIL_ID MilRegistrationResult,
+                                           const SRegistrationOutcome& Outcome, SCloudPair* pPair);
+void              SaveStitchedPointCloud  (MIL_ID MilPointCloud, MIL_CONST_TEXT_PTR BaseName);
+void              RunBatchStitching       (MIL_ID MilSystem);
+void              RunNeighborSearchBenchmark(MIL_ID MilSystem);
+void              RunMetricBenchmark      (MIL_ID MilSystem);
+void              GetOutcomeMatrix        (MIL_ID MilSystem, MIL_ID MilRegistrationResult,
+                                           const SRegistrationOutcome& Outcome, MIL_DOUBLE Matrix[16]);
+void              PrintPoseDifference     (const MIL_DOUBLE Matrix[16], const MIL_DOUBLE ReferenceMatrix[16]);
+
 // Extraction box definitions.
 static const MIL_DOUBLE EXTRACTION_BOX_SIZE_X = 170.0;
 static const MIL_DOUBLE EXTRACTION_BOX_SIZE_Y = 200.0;
@@ -51,13 +132,57 @@ static const MIL_DOUBLE EXTRACTION_BOX_SIZE_Z = -66;
 static const MIL_DOUBLE BOX_OVERLAP = 0.20;
 static const MIL_DOUBLE BOX_USED_OVERLAP = 0.9 * BOX_OVERLAP;
 
+// Point clouds loading controls definitions.
+static const bool       USE_CLOUD_CACHE      = true;
+static const bool       MORTON_ORDER_AT_LOAD = false;   // Sort the points along the Morton curve before the crop.
+static const MIL_INT    NORMAL_NEIGHBORS     = 0;       // Neighbors of the normals estimated at load and cached; 0 to not estimate them.
+
+// Point clouds storage controls definitions.
+static const bool       USE_QUANTIZED_STORAGE  = false;
+static const MIL_DOUBLE QUANTIZATION_MAX_ERROR = 0.005; // mm
+
 // Registration context controls definitions.
-static const MIL_DOUBLE GRID_SIZE = 1.0;
+// The clouds are subsampled by decimation, on a voxel grid, or on a pyramid of voxel grids.
+static const MIL_INT    SUBSAMPLE_MODE = eSubsampleDecimation;
+static const MIL_DOUBLE GRID_SIZE = 1.0;       // mm, cells of the finest voxel grid.
+static const MIL_INT    PYRAMID_NB_LEVELS = 3; // Voxel grids whose cells double in size.
 static const MIL_INT    DECIMATION_STEP = 8;
 static const MIL_DOUBLE OVERLAP = 95; // %
 static const MIL_INT    MAX_ITERATIONS = 100;
 static const MIL_DOUBLE RMS_ERROR_RELATIVE_THRESHOLD = 0.5;  // %
-static const MIL_INT    ERROR_MINIMIZATION_METRIC = M_POINT_TO_POINT;
+
+// Overlap estimation of the native engine, by a trimmed ICP instead of OVERLAP.
+static const bool       ESTIMATE_OVERLAP = false;
+static const MIL_DOUBLE MIN_OVERLAP = 10; // %
+
+// Pre-registration of the target, in the expected overlap box or from the features of the whole clouds.
+static const MIL_INT    PREREGISTRATION_MODE = ePreregistrationBox;
+static const MIL_DOUBLE GLOBAL_VOXEL_SIZE = 3.0;                           // mm
+static const MIL_INT    GLOBAL_NORMAL_NEIGHBORS = 16;
+static const MIL_DOUBLE GLOBAL_FEATURE_RADIUS = 5.0 * GLOBAL_VOXEL_SIZE;   // mm
+static const MIL_INT    GLOBAL_MAX_FEATURE_NEIGHBORS = 100;
+static const MIL_INT    GLOBAL_NB_HYPOTHESES = 20000;
+static const MIL_DOUBLE GLOBAL_INLIER_DISTANCE = 1.5 * GLOBAL_VOXEL_SIZE;  // mm
+static const MIL_UINT64 GLOBAL_SEED = 0x5EED;
+
+// Error minimization metric. The metrics other than point-to-point need the normals; the
+// MIL engine has only the point-to-point and point-to-plane metrics. With the relative RMS
+// threshold, the point-to-point metric can stop before the right pose.
+static const MIL_INT    ERROR_MINIMIZATION_METRIC = eMetricPointToPoint;
+static const MIL_INT    METRIC_NORMAL_NEIGHBORS = 16; // Used when NORMAL_NEIGHBORS is 0.
+static MIL_CONST_TEXT_PTR METRIC_NAMES[] = { MIL_TEXT("point-to-point"), MIL_TEXT("point-to-plane"), MIL_TEXT("plane-to-plane"),
+                                             MIL_TEXT("generalized") };
+
+// Registration engine: the MIL pairwise registration or the native ICP.
+static const MIL_INT    REGISTRATION_ENGINE = eEngineMil;
+
+// Nearest-neighbor search of the native engine.
+static const MIL_INT    NEIGHBOR_SEARCH = eSearchKdTree;
+static const MIL_DOUBLE NEIGHBOR_SEARCH_ERROR = 0.5;  // Relative distance error while the RMS error decreases fast.
+static const MIL_DOUBLE EXPECTED_RMS_ERROR = 0.5; // mm
+static const MIL_DOUBLE HASH_GRID_CELL_SIZE = GRID_SIZE > 4 * EXPECTED_RMS_ERROR ? GRID_SIZE : 4 * EXPECTED_RMS_ERROR;
+static const MIL_DOUBLE MAX_PAIR_DISTANCE = 10.0; // mm
+static MIL_CONST_TEXT_PTR NEIGHBOR_SEARCH_NAMES[] = { MIL_TEXT("kd-tree"), MIL_TEXT("hash grid"), MIL_TEXT("octree") };
 
 // Visualization variables definitions.
 static const MIL_INT    NUM_BOX_POINTS = 24; // A 3d cube box has 24 points.
@@ -68,6 +193,11 @@ static const MIL_DOUBLE DRAW_BOX_MAX_X =  EXTRACTION_BOX_SIZE_X / 2;
 static const MIL_DOUBLE DRAW_BOX_MAX_Y =  EXTRACTION_BOX_SIZE_Y / 2 * BOX_USED_OVERLAP;
 static const MIL_DOUBLE DRAW_BOX_MAX_Z = -EXTRACTION_BOX_SIZE_Z / 2;
 
+// Level of detail of the displayed partial point clouds, taken from an octree of each cloud.
+static const bool    DISPLAY_LEVEL_OF_DETAIL = false;
+static const MIL_INT DISPLAY_OCTREE_DEPTH    = 8;
+static const MIL_INT DISPLAY_POINTS_PER_NODE = 2;
+
 // Displays constants.
 static const MIL_INT WINDOWS_OFFSET_X = 15;
 static const MIL_INT WINDOWS_OFFSET_Y = 40;
@@ -90,6 +220,39 @@ static const MIL_TEXT_CHAR* const FILE_SOURCE_POINT_CLOUD[2] =
 static const MIL_INT DISP_3D_SIZE_X = 384;
 static const MIL_INT DISP_3D_SIZE_Y = 384;
 
+// Output data files, written in the working directory. The stitched point cloud is
+// saved as a PLY file, a cloud cache and a cloud archive with this base name.
+static const bool SAVE_STITCHED_POINT_CLOUD = true;
+static MIL_CONST_TEXT_PTR FILE_STITCHED_POINT_CLOUD = MIL_TEXT("StitchedPointCloud");
+
+// Compressed archives of the restored point clouds, written in the working directory.
+// The archives can be restored in place of the input data files.
+static const bool ARCHIVE_SOURCE_POINT_CLOUDS = false;
+static MIL_CONST_TEXT_PTR FILE_SOURCE_POINT_CLOUD_ARCHIVE[2] =
+   {
+   MIL_TEXT("StitchReference.s3dz"),
+   MIL_TEXT("StitchTarget.s3dz")
+   };
+
+// Batch stitching of scan pairs, without displays; the example pair stands in for the scan pairs.
+static const bool BATCH_STITCHING = false;
+static const MIL_INT NB_BATCH_PAIRS = 3;
+static MIL_CONST_TEXT_PTR BATCH_POINT_CLOUD_FILES[NB_BATCH_PAIRS][NB_POINT_CLOUD] =
+   {
+   { FILE_SOURCE_POINT_CLOUD[0], FILE_SOURCE_POINT_CLOUD[1] },
+   { FILE_SOURCE_POINT_CLOUD[0], FILE_SOURCE_POINT_CLOUD[1] },
+   { FILE_SOURCE_POINT_CLOUD[0], FILE_SOURCE_POINT_CLOUD[1] }
+   };
+
+// Benchmark of the registration of the example pair by the MIL engine and by the
+// native engine with each nearest-neighbor search, without displays. The poses are
+// compared with the pose found by the MIL engine with the point-to-plane metric.
+static const bool BENCHMARK_NEIGHBOR_SEARCH = false;
+
+// Benchmark of the registration of the example pair with each error minimization metric
+// by both engines, without displays. The poses are compared as above.
+static const bool BENCHMARK_METRICS = false;
+
 //-------------------------------------------------------------------------------
 // Main.
 //-------------------------------------------------------------------------------
@@ -107,24 +270,66 @@ int MosMain()
       }
    MIL_ID MilSystem = M_DEFAULT_HOST;
 
+   if(BATCH_STITCHING)
+      {
+      RunBatchStitching(MilSystem);
+      MosPrintf(MIL_TEXT("Press <Enter> to end.\n"));
+      MosGetch();
+      return 0;
+      }
+
+   if(BENCHMARK_NEIGHBOR_SEARCH)
+      {
+      RunNeighborSearchBenchmark(MilSystem);
+      MosPrintf(MIL_TEXT("Press <Enter> to end.\n"));
+      MosGetch();
+      return 0;
+      }
+
+   if(BENCHMARK_METRICS)
+      {
+      RunMetricBenchmark(MilSystem);
+      MosPrintf(MIL_TEXT("Press <Enter> to end.\n"));
+      MosGetch();
+      return 0;
+      }
+
    //-------------------------------------------------------------------------------------------
    // Create the point cloud containers.
 
-   // Allocate 3D point cloud containers.
-   MIL_UNIQUE_BUF_ID MilPointCloud[NB_POINT_CLOUD+1];
-   MIL_UNIQUE_BUF_ID MilCroppedPointCloud[NB_POINT_CLOUD];
+   // Restore the unorganized point clouds concurrently. The binary PLY files are decoded
+   // directly from a memory mapping of the file into the container components.
+   // A binary cache holding the clouds and their statistics is written in the working
+   // directory after the first parse and restored instead of the PLY files afterwards.
+   // The points inside the two overlap boxes used by the registration are extracted
+   // while the clouds are decoded.
+   MosPrintf(MIL_TEXT("The reference and target point clouds are being restored..."));
+   SCloudLoadOptions LoadOptions = GetLoadOptions();
 
-   MilPointCloud[eStitched] = MbufAllocContainer(MilSystem, M_PROC+M_DISP, M_DEFAULT, M_UNIQUE_ID);
+   SLoadedCloud LoadedCloud[NB_POINT_CLOUD];
+   RestorePointClouds(MilSystem, FILE_SOURCE_POINT_CLOUD, NB_POINT_CLOUD, LoadOptions, LoadedCloud);
 
-   for(MIL_INT i = 0; i < NB_POINT_CLOUD ; ++i)
-      MilCroppedPointCloud[i] = MbufAllocContainer(MilSystem, M_PROC + M_DISP, M_DEFAULT, M_UNIQUE_ID);
+   // Archive the restored point clouds.
+   if(ARCHIVE_SOURCE_POINT_CLOUDS)
+      {
+      for(MIL_INT i = 0; i < NB_POINT_CLOUD; ++i)
+         {
+         SCloudView View;
+         if(GetCloudView(LoadedCloud[i].Container, &View))
+            SaveCloudArchive(FILE_SOURCE_POINT_CLOUD_ARCHIVE[i], View, LoadedCloud[i].Stats, ARCHIVE_DEFAULT_PRECISION);
+         }
+      }
 
-   // Restore the unorganized point clouds.
-   MosPrintf(MIL_TEXT("The reference and target point clouds are being restored..."));
-   MilPointCloud[eSource] = MbufRestore(FILE_SOURCE_POINT_CLOUD[0], MilSystem, M_UNIQUE_ID );
-   MilPointCloud[eTarget] = MbufRestore(FILE_SOURCE_POINT_CLOUD[1], MilSystem, M_UNIQUE_ID);
+   SCloudPair Pair;
+   bool CroppedAtLoad = false;
+   for(MIL_INT i = 0; i < NB_POINT_CLOUD; ++i)
+      CroppedAtLoad = CroppedAtLoad || !LoadedCloud[i].Cropped.empty();
+   PreparePointClouds(MilSystem, FILE_SOURCE_POINT_CLOUD, LoadOptions, LoadedCloud, &Pair);
 
    MosPrintf(MIL_TEXT("done.\n\n"));
+   if(CroppedAtLoad)
+      MosPrintf(MIL_TEXT("The overlap boxes were extracted with the %s box crop kernel.\n\n"),
+                GetBoxCropKernelName(GetBestBoxCropKernel()));
 
    //-------------------------------------------------------------------------------
    // Initialize 3D displays that will show the two partial point clouds and the stitched cloud.
@@ -153,22 +358,30 @@ int MosMain()
    M3ddispControl(MilDisplay[eStitched], M_WINDOW_INITIAL_POSITION_Y, (MIL_INT)((WINDOWS_OFFSET_Y + DISP_3D_SIZE_Y)));
 
    MIL_ID MilGraphicList = M_NULL;
+   MIL_UNIQUE_BUF_ID MilDisplayedPointCloud[NB_POINT_CLOUD];
    for(MIL_INT p = 0; p < NB_POINT_CLOUD; p++)
       {
+      // Take the level of detail of the cloud from its octree.
+      MIL_ID     MilDisplayed = Pair.PointCloud[p];
+      SCloudView View;
+      if(DISPLAY_LEVEL_OF_DETAIL && GetCloudView(Pair.PointCloud[p], &View))
+         {
+         COctree Octree;
+         Octree.Build(View, 1);
+         std::vector<MIL_UINT32> Displayed;
+         Octree.GetLevelOfDetail(DISPLAY_OCTREE_DEPTH, DISPLAY_POINTS_PER_NODE, &Displayed);
+         MilDisplayedPointCloud[p] = Octree.AllocPointCloud(MilSystem, Displayed);
+         MilDisplayed = MilDisplayedPointCloud[p];
+         }
+
       // Display the container.
-      MIL_INT64 CloudLabel = M3ddispSelect(MilDisplay[p], MilPointCloud[p],M_SELECT,M_DEFAULT);
+      MIL_INT64 CloudLabel = M3ddispSelect(MilDisplay[p], MilDisplayed,M_SELECT,M_DEFAULT);
       M3ddispInquire(MilDisplay[p], M_3D_GRAPHIC_LIST_ID, &MilGraphicList);
       M3dgraControl(MilGraphicList, CloudLabel, M_COLOR_USE_LUT, M_TRUE);
       M3dgraControl(MilGraphicList, CloudLabel, M_COLOR_COMPONENT, M_COMPONENT_RANGE);
       M3dgraControl(MilGraphicList, CloudLabel, M_COLOR_COMPONENT_BAND, 2);
       }
 
-   // Get the total number of points of the reference point cloud.
-   MIL_UNIQUE_3DIM_ID ResultId = M3dimAllocResult(MilSystem, M_STATISTICS_RESULT, M_DEFAULT, M_UNIQUE_ID);
-   MIL_INT SourceTotalNbPoints;
-   M3dimStat(M_STAT_CONTEXT_NUMBER_OF_POINTS, MilPointCloud[eSource], ResultId, M_DEFAULT );
-   M3dimGetResult(ResultId, M_NUMBER_OF_POINTS_VALID, &SourceTotalNbPoints);
-
    // Define the overlap box.
    MIL_UNIQUE_3DGEO_ID MilBox = M3dgeoAlloc(MilSystem, M_GEOMETRY, M_DEFAULT, M_UNIQUE_ID);
    M3dgeoBox(MilBox, M_CENTER_AND_DIMENSION,
@@ -196,10 +409,411 @@ int MosMain()
 
    MosPrintf(MIL_TEXT("\tProcessing."));
 
-   // 3D pairwise registration context and result.
+   // 3D pairwise registration context and result, allocated for the MIL engine only so
+   // that the native engine does not need the 3D registration module.
+   MIL_ID MilRegistrationContext = M_NULL;
+   MIL_ID MilRegistrationResult  = M_NULL;
+   if(REGISTRATION_ENGINE == eEngineMil)
+      {
+      MilRegistrationContext = M3dregAlloc(MilSystem, M_PAIRWISE_REGISTRATION_CONTEXT, M_DEFAULT, M_NULL);
+      MilRegistrationResult  = M3dregAllocResult(MilSystem, M_PAIRWISE_REGISTRATION_RESULT, M_DEFAULT, M_NULL);
+      SetRegistrationControls(MilRegistrationContext, ERROR_MINIMIZATION_METRIC);
+      }
+   CReferenceIndexCache IndexCache;
+
+   // Registration.
+   SRegistrationOutcome Outcome;
+   RegisterPointClouds(MilSystem, MilRegistrationContext, MilRegistrationResult, &IndexCache, &Pair, &Outcome);
+   MosPrintf(MIL_TEXT("done\n\n"));
+
+   MosPrintf(MIL_TEXT("The 3D stitching between the two partial point clouds has been performed with \n")
+             MIL_TEXT("the help of the points within the expected common overlap regions.\n\n"));
+
+   PrintRegistrationStatus(Outcome);
+
+   //--------------------------------------------------------------------------
+   // Stitching
+
+   // Add color to the two clouds and merge them.
+   for(MIL_INT i = 0; i < NB_POINT_CLOUD; ++i)
+      M3ddispControl(MilDisplay[i], M_UPDATE, M_DISABLE);
+   MIL_UNIQUE_BUF_ID MilStitchedPointCloud = StitchPointClouds(MilSystem, MilRegistrationResult, Outcome, &Pair);
+   for(MIL_INT i = 0; i < NB_POINT_CLOUD; ++i)
+      M3ddispControl(MilDisplay[i], M_UPDATE, M_ENABLE);
+
+   // Display stitched point cloud.
+   M3ddispSelect(MilDisplay[eStitched], MilStitchedPointCloud, M_SELECT, M_DEFAULT);
+
+   // Draw a 3D box in the stitched point cloud to show the original overlap regions.
+   M3ddispInquire(MilDisplay[eStitched], M_3D_GRAPHIC_LIST_ID, &MilGraphicList);
+   MIL_INT64 MilBoxGraphics =
+      M3dgraBox(MilGraphicList,
+                M_ROOT_NODE, M_BOTH_CORNERS,
+                -0.5 * EXTRACTION_BOX_SIZE_X, -0.5 * EXTRACTION_BOX_SIZE_Y * BOX_USED_OVERLAP,  0.5 * EXTRACTION_BOX_SIZE_Z,
+                 0.5* EXTRACTION_BOX_SIZE_X ,  0.5 * EXTRACTION_BOX_SIZE_Y * BOX_USED_OVERLAP, -0.5 * EXTRACTION_BOX_SIZE_Z,
+               M_DEFAULT, M_DEFAULT);
+   M3dgraControl(MilGraphicList, MilBoxGraphics, M_COLOR, M_COLOR_WHITE);
+   M3dgraControl(MilGraphicList, MilBoxGraphics, M_APPEARANCE, M_WIREFRAME);
+
+   MosPrintf(MIL_TEXT("The two point clouds have been stitched into a single point cloud.\n")
+             MIL_TEXT("The resulting stitched point cloud is displayed.\n")
+             MIL_TEXT("A white rectangular box show the transformed overlap region.\n\n"));
+
+   // Save the stitched point cloud.
+   if(SAVE_STITCHED_POINT_CLOUD)
+      SaveStitchedPointCloud(MilStitchedPointCloud, FILE_STITCHED_POINT_CLOUD);
+
+   MosPrintf(MIL_TEXT("Press <Enter> to end.\n"));
+   MosGetch();
+
+   //--------------------------------------------------------------------------
+   // Free MIL objects.
+   if(MilRegistrationContext != M_NULL)
+      {
+      M3dregFree(MilRegistrationContext);
+      M3dregFree(MilRegistrationResult);
+      }
+
+   for(MIL_INT d = 0; d < NB_DISPLAY; d++)
+      {
+      if(MilDisplay[d])
+         { M3ddispFree(MilDisplay[d]); }
+      }
+   return 0;
+   }
+
+//--------------------------------------------------------------------------
+// Stitches the scan pairs of the batch. The point clouds of the next pair are
+// restored by the prefetcher while the current pair is registered and stitched,
+// so that the loading time is hidden behind the processing time.
+//--------------------------------------------------------------------------
+void RunBatchStitching(MIL_ID MilSystem)
+   {
+   MosPrintf(MIL_TEXT("Batch stitching of %d scan pairs.\n\n"), (int)NB_BATCH_PAIRS);
+
+   SCloudLoadOptions LoadOptions = GetLoadOptions();
+
+   MIL_ID MilRegistrationContext = M_NULL;
+   MIL_ID MilRegistrationResult  = M_NULL;
+   if(REGISTRATION_ENGINE == eEngineMil)
+      {
+      MilRegistrationContext = M3dregAlloc(MilSystem, M_PAIRWISE_REGISTRATION_CONTEXT, M_DEFAULT, M_NULL);
+      MilRegistrationResult  = M3dregAllocResult(MilSystem, M_PAIRWISE_REGISTRATION_RESULT, M_DEFAULT, M_NULL);
+      SetRegistrationControls(MilRegistrationContext, ERROR_MINIMIZATION_METRIC);
+      }
+
+   // The index of a source shared by the pairs is built for the first pair only.
+   CReferenceIndexCache IndexCache;
+
+   MIL_DOUBLE BatchStartTime = 0.0;
+   MappTimer(M_TIMER_READ, &BatchStartTime);
+   MIL_DOUBLE TotalWaitTime = 0.0;
+
+   CCloudPrefetcher Prefetcher;
+   Prefetcher.Start(MilSystem, BATCH_POINT_CLOUD_FILES[0], NB_POINT_CLOUD, LoadOptions);
+
+   for(MIL_INT p = 0; p < NB_BATCH_PAIRS; p++)
+      {
+      // Wait for the point clouds of the pair.
+      MIL_DOUBLE WaitStartTime = 0.0;
+      MIL_DOUBLE ProcessStartTime = 0.0;
+      MappTimer(M_TIMER_READ, &WaitStartTime);
+      SLoadedCloud LoadedCloud[NB_POINT_CLOUD];
+      Prefetcher.Wait(LoadedCloud);
+      MappTimer(M_TIMER_READ, &ProcessStartTime);
+      TotalWaitTime += ProcessStartTime - WaitStartTime;
+
+      SCloudPair Pair;
+      PreparePointClouds(MilSystem, BATCH_POINT_CLOUD_FILES[p], LoadOptions, LoadedCloud, &Pair);
+
+      // Restore the next pair while this one is processed.
+      if(p + 1 < NB_BATCH_PAIRS)
+         Prefetcher.Start(MilSystem, BATCH_POINT_CLOUD_FILES[p + 1], NB_POINT_CLOUD, LoadOptions);
+
+      MosPrintf(MIL_TEXT("Pair %d: processing."), (int)p);
+      SRegistrationOutcome Outcome;
+      RegisterPointClouds(MilSystem, MilRegistrationContext, MilRegistrationResult, &IndexCache, &Pair, &Outcome);
+      MosPrintf(MIL_TEXT("done\n"));
+      PrintRegistrationStatus(Outcome);
+
+      MIL_UNIQUE_BUF_ID MilStitchedPointCloud = StitchPointClouds(MilSystem, MilRegistrationResult, Outcome, &Pair);
+      if(SAVE_STITCHED_POINT_CLOUD)
+         {
+         MIL_TEXT_CHAR BaseName[256];
+         MosSprintf(BaseName, 256, MIL_TEXT("%s%d"), FILE_STITCHED_POINT_CLOUD, (int)p);
+         SaveStitchedPointCloud(MilStitchedPointCloud, BaseName);
+         }
+
+      MIL_DOUBLE ProcessEndTime = 0.0;
+      MappTimer(M_TIMER_READ, &ProcessEndTime);
+      MosPrintf(MIL_TEXT("Pair %d waited %.2f ms for its point clouds and was processed in %.2f ms.\n\n"),
+                (int)p, (ProcessStartTime - WaitStartTime) * 1000.0, (ProcessEndTime - ProcessStartTime) * 1000.0);
+      }
+
+   MIL_DOUBLE BatchEndTime = 0.0;
+   MappTimer(M_TIMER_READ, &BatchEndTime);
+   MosPrintf(MIL_TEXT("The batch has been stitched in %.2f ms, of which %.2f ms were spent\n")
+             MIL_TEXT("waiting for point clouds.\n\n"),
+             (BatchEndTime - BatchStartTime) * 1000.0, TotalWaitTime * 1000.0);
+
+   if(MilRegistrationContext != M_NULL)
+      {
+      M3dregFree(MilRegistrationContext);
+      M3dregFree(MilRegistrationResult);
+      }
+   }
+
+//--------------------------------------------------------------------------
+// Registers the example pair with the MIL engine and then with the native
+// engine using each nearest-neighbor search. Each search registers the pair
+// twice, first building the index of the source and then taking it from the
+// cache. Prints the times, the number of iterations, the RMS errors and the
+// difference of the poses with the reference pose.
+//--------------------------------------------------------------------------
+void RunNeighborSearchBenchmark(MIL_ID MilSystem)
+   {
+   MosPrintf(MIL_TEXT("Benchmark of the nearest-neighbor searches of the registration.\n\n"));
+
+   SCloudLoadOptions LoadOptions = GetLoadOptions();
+   SLoadedCloud LoadedCloud[NB_POINT_CLOUD];
+   RestorePointClouds(MilSystem, FILE_SOURCE_POINT_CLOUD, NB_POINT_CLOUD, LoadOptions, LoadedCloud);
+   SCloudPair Pair;
+   PreparePointClouds(MilSystem, FILE_SOURCE_POINT_CLOUD, LoadOptions, LoadedCloud, &Pair);
+
    MIL_ID MilRegistrationContext = M3dregAlloc(MilSystem, M_PAIRWISE_REGISTRATION_CONTEXT, M_DEFAULT, M_NULL);
    MIL_ID MilRegistrationResult  = M3dregAllocResult(MilSystem, M_PAIRWISE_REGISTRATION_RESULT, M_DEFAULT, M_NULL);
 
+   // The reference pose is found by the MIL engine with the point-to-plane metric.
+   SRegistrationOutcome Outcome;
+   MIL_DOUBLE ReferenceMatrix[16];
+   MIL_DOUBLE Matrix[16];
+   MosPrintf(MIL_TEXT("MIL engine, %s, reference pose"), METRIC_NAMES[eMetricPointToPlane]);
+   SetRegistrationControls(MilRegistrationContext, eMetricPointToPlane);
+   RegisterPointCloudsMil(MilSystem, MilRegistrationContext, MilRegistrationResult, &Pair, &Outcome);
+   GetOutcomeMatrix(MilSystem, MilRegistrationResult, Outcome, ReferenceMatrix);
+   MosPrintf(MIL_TEXT("\n\n"));
+
+   SetRegistrationControls(MilRegistrationContext, ERROR_MINIMIZATION_METRIC);
+   MosPrintf(MIL_TEXT("MIL engine"));
+   RegisterPointCloudsMil(MilSystem, MilRegistrationContext, MilRegistrationResult, &Pair, &Outcome);
+   MosPrintf(MIL_TEXT("\n   registration %8.2f ms, %3d iterations, RMS error %f mm\n"),
+             Outcome.ComputationTime * 1000.0, (int)Outcome.NbIterations, Outcome.RmsError);
+   GetOutcomeMatrix(MilSystem, MilRegistrationResult, Outcome, Matrix);
+   PrintPoseDifference(Matrix, ReferenceMatrix);
+
+   for(MIL_INT Search = eSearchKdTree; Search <= eSearchOctree; Search++)
+      {
+      CReferenceIndexCache IndexCache;
+      for(MIL_INT Run = 0; Run < 2; Run++)
+         {
+         MosPrintf(MIL_TEXT("Native engine, %s"), NEIGHBOR_SEARCH_NAMES[Search]);
+         RegisterPointCloudsNative(MilSystem, Search, ERROR_MINIMIZATION_METRIC, &IndexCache, &Pair, &Outcome);
+         MosPrintf(MIL_TEXT("\n   registration %8.2f ms, %3d iterations (%d approximate), RMS error %f mm"),
+                   (Outcome.ComputationTime - Outcome.IndexBuildTime) * 1000.0, (int)Outcome.NbIterations,
+                   (int)Outcome.NbApproximateIterations, Outcome.RmsError);
+         if(Outcome.IndexReused)
+            MosPrintf(MIL_TEXT(", index reused\n"));
+         else
+            MosPrintf(MIL_TEXT(", index built in %.2f ms\n"), Outcome.IndexBuildTime * 1000.0);
+         GetOutcomeMatrix(MilSystem, MilRegistrationResult, Outcome, Matrix);
+         PrintPoseDifference(Matrix, ReferenceMatrix);
+         }
+      }
+   MosPrintf(MIL_TEXT("\n"));
+
+   M3dregFree(MilRegistrationContext);
+   M3dregFree(MilRegistrationResult);
+   }
+
+//--------------------------------------------------------------------------
+// Registers the example pair with each error minimization metric, with the
+// MIL engine and then with the native engine and the selected nearest-neighbor
+// search. The MIL engine has no plane-to-plane or generalized metric. Each
+// run starts from the identity. Prints the times, the number of iterations,
+// the RMS errors and the difference of the poses with the reference pose.
+//--------------------------------------------------------------------------
+void RunMetricBenchmark(MIL_ID MilSystem)
+   {
+   MosPrintf(MIL_TEXT("Benchmark of the error minimization metrics of the registration.\n")
+             MIL_TEXT("A low RMS error does not ensure the right pose: with the relative RMS threshold,\n")
+             MIL_TEXT("the point-to-point metric can stop before it.\n\n"));
+
+   SCloudLoadOptions LoadOptions = GetLoadOptions();
+   SLoadedCloud LoadedCloud[NB_POINT_CLOUD];
+   RestorePointClouds(MilSystem, FILE_SOURCE_POINT_CLOUD, NB_POINT_CLOUD, LoadOptions, LoadedCloud);
+   SCloudPair Pair;
+   PreparePointClouds(MilSystem, FILE_SOURCE_POINT_CLOUD, LoadOptions, LoadedCloud, &Pair);
+
+   MIL_ID MilRegistrationContext = M3dregAlloc(MilSystem, M_PAIRWISE_REGISTRATION_CONTEXT, M_DEFAULT, M_NULL);
+   MIL_ID MilRegistrationResult  = M3dregAllocResult(MilSystem, M_PAIRWISE_REGISTRATION_RESULT, M_DEFAULT, M_NULL);
+
+   // The index of the source is shared by the metrics and built before the timings.
+   CReferenceIndexCache IndexCache;
+   SRegistrationOutcome Outcome;
+   MosPrintf(MIL_TEXT("Native engine, building the index of the source"));
+   RegisterPointCloudsNative(MilSystem, NEIGHBOR_SEARCH, eMetricPointToPoint, &IndexCache, &Pair, &Outcome);
+   MosPrintf(MIL_TEXT("\n\n"));
+
+   // The reference pose is found by the MIL engine with the point-to-plane metric.
+   MIL_DOUBLE ReferenceMatrix[16];
+   MIL_DOUBLE Matrix[16];
+   MosPrintf(MIL_TEXT("MIL engine, %s, reference pose"), METRIC_NAMES[eMetricPointToPlane]);
+   SetRegistrationControls(MilRegistrationContext, eMetricPointToPlane);
+   RegisterPointCloudsMil(MilSystem, MilRegistrationContext, MilRegistrationResult, &Pair, &Outcome);
+   GetOutcomeMatrix(MilSystem, MilRegistrationResult, Outcome, ReferenceMatrix);
+   MosPrintf(MIL_TEXT("\n\n"));
+
+   for(MIL_INT Metric = eMetricPointToPoint; Metric <= eMetricGeneralized; Metric++)
+      {
+      if(Metric <= eMetricPointToPlane)
+         {
+         SetRegistrationControls(MilRegistrationContext, Metric);
+         MosPrintf(MIL_TEXT("MIL engine, %s"), METRIC_NAMES[Metric]);
+         RegisterPointCloudsMil(MilSystem, MilRegistrationContext, MilRegistrationResult, &Pair, &Outcome);
+         MosPrintf(MIL_TEXT("\n   registration %8.2f ms, %3d iterations, RMS error %f mm\n"),
+                   Outcome.ComputationTime * 1000.0, (int)Outcome.NbIterations, Outcome.RmsError);
+         GetOutcomeMatrix(MilSystem, MilRegistrationResult, Outcome, Matrix);
+         PrintPoseDifference(Matrix, ReferenceMatrix);
+         }
+
+      MosPrintf(MIL_TEXT("Native engine, %s"), METRIC_NAMES[Metric]);
+      RegisterPointCloudsNative(MilSystem, NEIGHBOR_SEARCH, Metric, &IndexCache, &Pair, &Outcome);
+      MosPrintf(MIL_TEXT("\n   registration %8.2f ms, %3d iterations (%d approximate), RMS error %f mm"),
+                (Outcome.ComputationTime - Outcome.IndexBuildTime) * 1000.0, (int)Outcome.NbIterations,
+                (int)Outcome.NbApproximateIterations, Outcome.RmsError);
+      if(Outcome.Metric != Metric)
+         MosPrintf(MIL_TEXT(", %s without the normals\n"), METRIC_NAMES[Outcome.Metric]);
+      else
+         MosPrintf(MIL_TEXT("\n"));
+      GetOutcomeMatrix(MilSystem, MilRegistrationResult, Outcome, Matrix);
+      PrintPoseDifference(Matrix, ReferenceMatrix);
+      }
+   MosPrintf(MIL_TEXT("\n"));
+
+   M3dregFree(MilRegistrationContext);
+   M3dregFree(MilRegistrationResult);
+   }
+
+//--------------------------------------------------------------------------
+// Gets the transformation of the target onto the source found by either
+// registration engine, in row-major order.
+//--------------------------------------------------------------------------
+void GetOutcomeMatrix(MIL_ID MilSystem, MIL_ID MilRegistrationResult,
+                      const SRegistrationOutcome& Outcome, MIL_DOUBLE Matrix[16])
+   {
+   if(Outcome.MilMatrix != M_NULL)
+      {
+      M3dgeoMatrixGet(Outcome.MilMatrix, M_DEFAULT, Matrix);
+      return;
+      }
+   MIL_UNIQUE_3DGEO_ID MilMatrix = M3dgeoAlloc(MilSystem, M_TRANSFORMATION_MATRIX, M_DEFAULT, M_UNIQUE_ID);
+   M3dregCopyResult(MilRegistrationResult, eTarget, eSource, MilMatrix, M_REGISTRATION_MATRIX, M_DEFAULT);
+   M3dgeoMatrixGet(MilMatrix, M_DEFAULT, Matrix);
+   }
+
+//--------------------------------------------------------------------------
+// Prints the rotation angle and the translation between a pose and the
+// reference pose.
+//--------------------------------------------------------------------------
+void PrintPoseDifference(const MIL_DOUBLE Matrix[16], const MIL_DOUBLE ReferenceMatrix[16])
+   {
+   // The trace of the relative rotation is the sum of the products of the rotation terms.
+   MIL_DOUBLE Trace = 0.0;
+   MIL_DOUBLE SquaredTranslation = 0.0;
+   for(MIL_INT r = 0; r < 3; r++)
+      {
+      for(MIL_INT c = 0; c < 3; c++)
+         Trace += Matrix[4 * r + c] * ReferenceMatrix[4 * r + c];
+      const MIL_DOUBLE Delta = Matrix[4 * r + 3] - ReferenceMatrix[4 * r + 3];
+      SquaredTranslation += Delta * Delta;
+      }
+   MIL_DOUBLE Cosine = 0.5 * (Trace - 1.0);
+   if(Cosine > 1.0)
+      Cosine = 1.0;
+   else if(Cosine < -1.0)
+      Cosine = -1.0;
+   const MIL_DOUBLE RADIANS_TO_DEGREES = 180.0 / 3.14159265358979323846;
+   MosPrintf(MIL_TEXT("   pose off the reference by %.2f deg and %.2f mm\n"),
+             acos(Cosine) * RADIANS_TO_DEGREES, sqrt(SquaredTranslation));
+   }
+
+//--------------------------------------------------------------------------
+// Returns the options used to restore the point clouds of a pair.
+//--------------------------------------------------------------------------
+SCloudLoadOptions GetLoadOptions()
+   {
+   SCloudLoadOptions LoadOptions;
+   LoadOptions.UseCache = USE_CLOUD_CACHE;
+   LoadOptions.MortonOrder = MORTON_ORDER_AT_LOAD;
+   LoadOptions.NormalNeighbors = NORMAL_NEIGHBORS;
+   if(NORMAL_NEIGHBORS == 0 && (ERROR_MINIMIZATION_METRIC != eMetricPointToPoint || BENCHMARK_METRICS))
+      LoadOptions.NormalNeighbors = METRIC_NORMAL_NEIGHBORS;
+   LoadOptions.Components = eComponentRange;   // The reflectance is replaced by a color before the stitching.
+   LoadOptions.CropBoxes.push_back(MakeCenteredBox(EXTRACTION_BOX_SIZE_X, EXTRACTION_BOX_SIZE_Y * BOX_USED_OVERLAP, EXTRACTION_BOX_SIZE_Z));
+   LoadOptions.CropBoxes.push_back(MakeCenteredBox(EXTRACTION_BOX_SIZE_X, EXTRACTION_BOX_SIZE_Y * BOX_OVERLAP, EXTRACTION_BOX_SIZE_Z));
+   return LoadOptions;
+   }
+
+//--------------------------------------------------------------------------
+// Takes the restored point clouds of a pair and their subsets in the crop boxes.
+//--------------------------------------------------------------------------
+void PreparePointClouds(MIL_ID MilSystem, const MIL_CONST_TEXT_PTR* FileNames,
+                        const SCloudLoadOptions& LoadOptions,
+                        SLoadedCloud* pLoadedCloud, SCloudPair* pPair)
+   {
+   // Get the total number of points of the reference point cloud.
+   pPair->SourceTotalNbPoints = pLoadedCloud[eSource].Stats.NbPoints;
+   pPair->SourceFileName      = FileNames[eSource];
+   pPair->OverlapBox          = LoadOptions.CropBoxes[eOverlapBox];
+
+   // Take the clouds and their subsets in the overlap boxes, all extracted in a single
+   // pass over each cloud while it was restored. The clouds whose range layout cannot be
+   // accessed directly are cropped with M3dimCrop.
+   MIL_UNIQUE_3DGEO_ID MilBox = M3dgeoAlloc(MilSystem, M_GEOMETRY, M_DEFAULT, M_UNIQUE_ID);
+   for(MIL_INT i = 0; i < NB_POINT_CLOUD; ++i)
+      {
+      pPair->PointCloud[i] = std::move(pLoadedCloud[i].Container);
+      const bool CroppedAtLoad = !pLoadedCloud[i].Cropped.empty();
+      for(MIL_INT b = 0; b < NB_CROP_BOX; ++b)
+         {
+         if(CroppedAtLoad)
+            {
+            pPair->CroppedPointCloud[b][i] = std::move(pLoadedCloud[i].Cropped[b]);
+            continue;
+            }
+
+         const SCloudBox& Box = LoadOptions.CropBoxes[(size_t)b];
+         M3dgeoBox(MilBox, M_BOTH_CORNERS,
+                   Box.Min[0], Box.Min[1], Box.Min[2],
+                   Box.Max[0], Box.Max[1], Box.Max[2],
+                   M_DEFAULT);
+         pPair->CroppedPointCloud[b][i] = MbufAllocContainer(MilSystem, M_PROC + M_DISP, M_DEFAULT, M_UNIQUE_ID);
+         M3dimCrop(pPair->PointCloud[i], pPair->CroppedPointCloud[b][i], MilBox, M_NULL, M_DEFAULT, M_DEFAULT);
+         }
+
+      if(i != eSource)
+         continue;
+      pPair->SourceOverlapNbPoints = CroppedAtLoad ? pLoadedCloud[i].CroppedNbPoints[eOverlapBox] : -1;
+      }
+
+   // Keep the clouds with 16-bit coordinates quantized in their bounding box to halve
+   // the memory of their range.
+   if(USE_QUANTIZED_STORAGE)
+      {
+      for(MIL_INT i = 0; i < NB_POINT_CLOUD; ++i)
+         {
+         MIL_UNIQUE_BUF_ID MilQuantized = QuantizePointCloud(MilSystem, pPair->PointCloud[i], &pLoadedCloud[i].Stats, QUANTIZATION_MAX_ERROR);
+         if(MilQuantized != M_NULL)
+            pPair->PointCloud[i] = std::move(MilQuantized);
+         }
+      }
+   }
+
+//--------------------------------------------------------------------------
+// Sets the controls of the pairwise registration context.
+//--------------------------------------------------------------------------
+void SetRegistrationControls(MIL_ID MilRegistrationContext, MIL_INT Metric)
+   {
    // Pairwise registration context controls.
    MIL_ID MilSubsampleContext = M_NULL;
    M3dregInquire(MilRegistrationContext, M_DEFAULT, M_SUBSAMPLE_CONTEXT_ID, &MilSubsampleContext);
@@ -208,75 +822,449 @@ int MosMain()
    M3dimControl(MilSubsampleContext, M_STEP_SIZE_X, DECIMATION_STEP);
    M3dimControl(MilSubsampleContext, M_STEP_SIZE_Y, DECIMATION_STEP);
 
-   M3dregControl(MilRegistrationContext, M_DEFAULT, M_SUBSAMPLE, M_ENABLE);
+   // The voxel grid subsampling is applied before the registration.
+   M3dregControl(MilRegistrationContext, M_DEFAULT, M_SUBSAMPLE, SUBSAMPLE_MODE == eSubsampleDecimation ? M_ENABLE : M_DISABLE);
    M3dregControl(MilRegistrationContext, M_DEFAULT, M_MAX_ITERATIONS, MAX_ITERATIONS);
    M3dregControl(MilRegistrationContext, M_DEFAULT, M_RMS_ERROR_RELATIVE_THRESHOLD, RMS_ERROR_RELATIVE_THRESHOLD);
-   M3dregControl(MilRegistrationContext, M_DEFAULT, M_ERROR_MINIMIZATION_METRIC, ERROR_MINIMIZATION_METRIC);
+   M3dregControl(MilRegistrationContext, M_DEFAULT, M_ERROR_MINIMIZATION_METRIC,
+                 Metric == eMetricPointToPoint ? M_POINT_TO_POINT : M_POINT_TO_PLANE);
+   }
 
-   // Registration.
-   MIL_INT  RegistrationStatus = M_NULL;
-   MIL_DOUBLE ComputationTime = 0.0;
+//--------------------------------------------------------------------------
+// Returns the full model overlap of the registration in the overlap box: the
+// overlap scaled by the fraction of the points of the source in the box. The
+// points of the source in the box are counted on the first call when the
+// clouds were not cropped at load.
+//--------------------------------------------------------------------------
+MIL_DOUBLE GetFullModelOverlap(MIL_ID MilSystem, SCloudPair* pPair)
+   {
+   if(pPair->SourceOverlapNbPoints < 0)
+      {
+      MIL_UNIQUE_3DIM_ID MilStatResult = M3dimAllocResult(MilSystem, M_STATISTICS_RESULT, M_DEFAULT, M_UNIQUE_ID);
+      M3dimStat(M_STAT_CONTEXT_NUMBER_OF_POINTS, pPair->CroppedPointCloud[eOverlapBox][eSource], MilStatResult, M_DEFAULT);
+      M3dimGetResult(MilStatResult, M_NUMBER_OF_POINTS_VALID, &pPair->SourceOverlapNbPoints);
+      }
+   return ((MIL_DOUBLE)pPair->SourceOverlapNbPoints / pPair->SourceTotalNbPoints) * OVERLAP;
+   }
 
-   // Set the box to the expected overlap region.
+//--------------------------------------------------------------------------
+// Registers the target point cloud of a pair on its source point cloud, first
+// in the used overlap box and then in the expected overlap box, with the
+// selected registration engine.
+//--------------------------------------------------------------------------
+void RegisterPointClouds(MIL_ID MilSystem, MIL_ID MilRegistrationContext,
+                         MIL_ID MilRegistrationResult, CReferenceIndexCache* pIndexCache,
+                         SCloudPair* pPair, SRegistrationOutcome* pOutcome)
+   {
+   pOutcome->IndexBuildTime = 0.0;
+   pOutcome->IndexReused    = false;
+   pOutcome->MilMatrix.reset();
+   if(REGISTRATION_ENGINE == eEngineNative)
+      RegisterPointCloudsNative(MilSystem, NEIGHBOR_SEARCH, ERROR_MINIMIZATION_METRIC, pIndexCache, pPair, pOutcome);
+   else
+      RegisterPointCloudsMil(MilSystem, MilRegistrationContext, MilRegistrationResult, pPair, pOutcome);
+   }
+
+//--------------------------------------------------------------------------
+// Finds the transformation of the whole target point cloud of a pair onto
+// its whole source point cloud from their geometric features. The quantized
+// clouds are registered on a float copy. Returns false if the clouds cannot
+// be accessed or no transformation is found.
+//--------------------------------------------------------------------------
+bool FindGlobalPreregistration(MIL_ID MilSystem, const SCloudPair& Pair, MIL_DOUBLE Matrix[16])
+   {
+   SCloudView        View[NB_POINT_CLOUD];
+   MIL_UNIQUE_BUF_ID MilDequantized[NB_POINT_CLOUD];
    for(MIL_INT p = 0; p < NB_POINT_CLOUD; p++)
       {
-      M3dimCrop(MilPointCloud[p], MilCroppedPointCloud[p], MilBox, M_NULL, M_DEFAULT, M_DEFAULT);
-      MosPrintf(MIL_TEXT("."));
+      if(GetCloudView(Pair.PointCloud[p], &View[p]))
+         continue;
+      MilDequantized[p] = DequantizePointCloud(MilSystem, Pair.PointCloud[p], &View[p]);
+      if(MilDequantized[p] == M_NULL)
+         {
+         MosPrintf(MIL_TEXT("The global pre-registration cannot access the range of the point clouds.\n"));
+         return false;
+         }
       }
 
-   MappTimer(M_TIMER_RESET, M_NULL);
+   SGlobalRegistrationSettings Settings;
+   Settings.VoxelSize            = GLOBAL_VOXEL_SIZE;
+   Settings.NormalNeighbors      = GLOBAL_NORMAL_NEIGHBORS;
+   Settings.NormalOrientation[0] = 0.0;
+   Settings.NormalOrientation[1] = 0.0;
+   Settings.NormalOrientation[2] = -1.0;
+   Settings.FeatureRadius        = GLOBAL_FEATURE_RADIUS;
+   Settings.MaxFeatureNeighbors  = GLOBAL_MAX_FEATURE_NEIGHBORS;
+   Settings.NbHypotheses         = GLOBAL_NB_HYPOTHESES;
+   Settings.InlierDistance       = GLOBAL_INLIER_DISTANCE;
+   Settings.Seed                 = GLOBAL_SEED;
+   SGlobalRegistrationResult Result;
+   RegisterGlobal(MilSystem, View[eSource], View[eTarget], Settings, &Result);
+   for(MIL_INT i = 0; i < 16; i++)
+      Matrix[i] = Result.Matrix[i];
+   return Result.Found;
+   }
 
-   // Pre-registration with a given overlap.
-   M3dregControl(MilRegistrationContext, M_ALL, M_OVERLAP, OVERLAP);
-   M3dregCalculate(MilRegistrationContext, MilCroppedPointCloud, NB_POINT_CLOUD,
-                   MilRegistrationResult, M_DEFAULT);
-   MosPrintf(MIL_TEXT("."));
-  
-   MIL_ID MilPreregistration = MilRegistrationResult;
+//--------------------------------------------------------------------------
+// Registers the target point cloud of a pair on its source point cloud with
+// the MIL pairwise registration, in two passes or through the pyramid of the
+// subsets in the overlap box. The global pre-registration, when it is found,
+// replaces the first pass or starts the pyramid.
+//--------------------------------------------------------------------------
+void RegisterPointCloudsMil(MIL_ID MilSystem, MIL_ID MilRegistrationContext,
+                            MIL_ID MilRegistrationResult,
+                            SCloudPair* pPair, SRegistrationOutcome* pOutcome)
+   {
+   MIL_DOUBLE StartTime = 0.0;
+   MappTimer(M_TIMER_READ, &StartTime);
+
+   // Subsample the subsets on the voxel grid. The subsets whose range cannot be accessed
+   // directly are registered as is.
+   MIL_UNIQUE_BUF_ID MilSubsampledPointCloud[NB_CROP_BOX][NB_POINT_CLOUD];
+   MIL_ID            MilRegisteredPointCloud[NB_CROP_BOX][NB_POINT_CLOUD];
+   for(MIL_INT b = 0; b < NB_CROP_BOX; b++)
+      {
+      for(MIL_INT p = 0; p < NB_POINT_CLOUD; p++)
+         {
+         MilRegisteredPointCloud[b][p] = pPair->CroppedPointCloud[b][p];
+         SCloudView View;
+         if(SUBSAMPLE_MODE == eSubsampleVoxelGrid && GetCloudView(pPair->CroppedPointCloud[b][p], &View))
+            {
+            MilSubsampledPointCloud[b][p] = VoxelGridSubsample(MilSystem, View, GRID_SIZE, eVoxelCentroid);
+            if(MilSubsampledPointCloud[b][p] != M_NULL)
+               MilRegisteredPointCloud[b][p] = MilSubsampledPointCloud[b][p];
+            }
+         }
+      }
 
-   M3dgeoBox(MilBox,
-             M_CENTER_AND_DIMENSION,
-             0.0, 0.0, 0.0,
-             EXTRACTION_BOX_SIZE_X, EXTRACTION_BOX_SIZE_Y * BOX_OVERLAP, EXTRACTION_BOX_SIZE_Z,
-             M_DEFAULT);
+   // Register the levels of the pyramid of the subsets in the overlap box from the coarsest,
+   // each level from the location found on the coarser one, with the full model overlap.
+   // The context is shared by the pairs, so the first calculation starts from the identity.
+   // The subsets whose range cannot be accessed directly are registered in two passes.
+   std::vector<MIL_UNIQUE_BUF_ID> MilLevels[NB_POINT_CLOUD];
+   bool HasPyramids = SUBSAMPLE_MODE == eSubsamplePyramid;
+   for(MIL_INT p = 0; HasPyramids && p < NB_POINT_CLOUD; p++)
+      {
+      SCloudView View;
+      HasPyramids = GetCloudView(pPair->CroppedPointCloud[eOverlapBox][p], &View) &&
+                    BuildVoxelPyramid(MilSystem, View, GRID_SIZE, PYRAMID_NB_LEVELS, eVoxelCentroid, &MilLevels[p]);
+      }
 
-   // Get the number of points of the source point cloud in the expected overlap region.
-   MIL_INT SourceOverlapNbOfPoints;
-   MIL_UNIQUE_3DMET_ID MilStatResult = M3dmetAllocResult(MilSystem, M_STATISTICS_RESULT, M_DEFAULT, M_UNIQUE_ID);
-   M3dmetStat(M_STAT_CONTEXT_NUMBER, MilPointCloud[eSource], MilBox, MilStatResult, M_SIGNED_DISTANCE_TO_SURFACE, M_LESS_OR_EQUAL, 0, M_NULL, M_DEFAULT);
-   M3dmetGetResult(MilStatResult, M_STAT_NUMBER, &SourceOverlapNbOfPoints);
+   // The global pre-registration replaces the first pass, or starts the coarsest level.
+   MIL_UNIQUE_3DGEO_ID MilGlobalMatrix;
+   MIL_DOUBLE          GlobalMatrix[16];
+   if(PREREGISTRATION_MODE == ePreregistrationGlobal && FindGlobalPreregistration(MilSystem, *pPair, GlobalMatrix))
+      {
+      MilGlobalMatrix = M3dgeoAlloc(MilSystem, M_TRANSFORMATION_MATRIX, M_DEFAULT, M_UNIQUE_ID);
+      M3dgeoMatrixPut(MilGlobalMatrix, M_DEFAULT, GlobalMatrix);
+      MosPrintf(MIL_TEXT("."));
+      }
 
-   // Set the box to the expected overlap region.
-   for(MIL_INT p = 0; p < NB_POINT_CLOUD; p++)
+   MIL_INT NbPyramidIterations = 0;
+   if(HasPyramids)
       {
-      M3dimCrop(MilPointCloud[p], MilCroppedPointCloud[p],
-                MilBox, M_NULL, M_DEFAULT, M_DEFAULT);
+      MIL_DOUBLE FullModelOverlap = GetFullModelOverlap(MilSystem, pPair);
+      M3dregControl(MilRegistrationContext, M_ALL, M_OVERLAP, FullModelOverlap);
+      M3dregControl(MilRegistrationContext, M_DEFAULT, M_SUBSAMPLE, M_DISABLE);
+      for(MIL_INT l = PYRAMID_NB_LEVELS - 1; l >= 0; l--)
+         {
+         if(l < PYRAMID_NB_LEVELS - 1)
+            M3dregSetLocation(MilRegistrationContext, eTarget, eSource, MilRegistrationResult, M_DEFAULT, M_DEFAULT, M_DEFAULT);
+         else if(MilGlobalMatrix != M_NULL)
+            M3dregSetLocation(MilRegistrationContext, eTarget, eSource, MilGlobalMatrix, M_DEFAULT, M_DEFAULT, M_DEFAULT);
+         else
+            M3dregSetLocation(MilRegistrationContext, eTarget, eSource, M_IDENTITY_MATRIX, M_DEFAULT, M_DEFAULT, M_DEFAULT);
+         MIL_ID MilLevelPointCloud[NB_POINT_CLOUD] = { MilLevels[eSource][(size_t)l], MilLevels[eTarget][(size_t)l] };
+         M3dregCalculate(MilRegistrationContext, MilLevelPointCloud, NB_POINT_CLOUD, MilRegistrationResult, M_DEFAULT);
+         MosPrintf(MIL_TEXT("."));
+
+         MIL_INT NbLevelIterations = 0;
+         M3dregGetResult(MilRegistrationResult, eTarget, M_NB_ITERATIONS, &NbLevelIterations);
+         NbPyramidIterations += NbLevelIterations;
+         }
+      }
+   else
+      {
+      // The subsets that have no pyramid are decimated.
+      if(SUBSAMPLE_MODE == eSubsamplePyramid)
+         M3dregControl(MilRegistrationContext, M_DEFAULT, M_SUBSAMPLE, M_ENABLE);
+
+      // Pre-registration with a given overlap, unless the global pre-registration was found.
+      MIL_ID MilPreregistration = MilGlobalMatrix;
+      if(MilPreregistration == M_NULL)
+         {
+         M3dregSetLocation(MilRegistrationContext, eTarget, eSource, M_IDENTITY_MATRIX, M_DEFAULT, M_DEFAULT, M_DEFAULT);
+         M3dregControl(MilRegistrationContext, M_ALL, M_OVERLAP, OVERLAP);
+         M3dregCalculate(MilRegistrationContext, MilRegisteredPointCloud[eUsedOverlapBox], NB_POINT_CLOUD,
+                         MilRegistrationResult, M_DEFAULT);
+         MosPrintf(MIL_TEXT("."));
+         MilPreregistration = MilRegistrationResult;
+         }
+
+      // Set the full model overlap based on the expected overlap between the two point clouds.
+      MIL_DOUBLE FullModelOverlap = GetFullModelOverlap(MilSystem, pPair);
+      M3dregControl(MilRegistrationContext, M_ALL, M_OVERLAP, FullModelOverlap);
+
+      // Set the pre-registration matrix.
+      M3dregSetLocation(MilRegistrationContext, eTarget, eSource, MilPreregistration, M_DEFAULT, M_DEFAULT, M_DEFAULT);
+
+      // Use the full point clouds.
+      MosPrintf(MIL_TEXT("."));
+      M3dregCalculate(MilRegistrationContext, MilRegisteredPointCloud[eOverlapBox], NB_POINT_CLOUD,
+                      MilRegistrationResult, M_DEFAULT);
       MosPrintf(MIL_TEXT("."));
       }
 
-   // Set the full model overlap based on the expected overlap between the two point clouds.
-   MIL_DOUBLE FullModelOverlap = ((MIL_DOUBLE)SourceOverlapNbOfPoints / SourceTotalNbPoints) * OVERLAP;
-   M3dregControl(MilRegistrationContext, M_ALL, M_OVERLAP, FullModelOverlap);
+   MIL_DOUBLE EndTime = 0.0;
+   MappTimer(M_TIMER_READ, &EndTime);
+   pOutcome->ComputationTime = EndTime - StartTime;
 
-   // Set the pre-registration matrix.
-   M3dregSetLocation(MilRegistrationContext, eTarget, eSource, MilPreregistration, M_DEFAULT, M_DEFAULT, M_DEFAULT);
+   M3dregGetResult(MilRegistrationResult, eTarget, M_STATUS_REGISTRATION_ELEMENT, &pOutcome->Status);
+   M3dregGetResult(MilRegistrationResult, eTarget, M_RMS_ERROR, &pOutcome->RmsError);
+   M3dregGetResult(MilRegistrationResult, eTarget, M_NB_ITERATIONS, &pOutcome->NbIterations);
+   if(HasPyramids)
+      pOutcome->NbIterations = NbPyramidIterations;
 
-   // Use the full point clouds.
-   MosPrintf(MIL_TEXT("."));
-   M3dregCalculate(MilRegistrationContext, MilCroppedPointCloud, NB_POINT_CLOUD,
-                   MilRegistrationResult, M_DEFAULT);
-   MosPrintf(MIL_TEXT("."));
+   MIL_INT Metric = M_POINT_TO_POINT;
+   M3dregInquire(MilRegistrationContext, M_DEFAULT, M_ERROR_MINIMIZATION_METRIC, &Metric);
+   pOutcome->Metric          = Metric == M_POINT_TO_PLANE ? eMetricPointToPlane : eMetricPointToPoint;
+   pOutcome->RequestedMetric = pOutcome->Metric;
+   }
 
-   MappTimer(M_TIMER_READ, &ComputationTime);
-   MosPrintf(MIL_TEXT("done\n\n"));
+//--------------------------------------------------------------------------
+// Returns the spatial index of the source of a pair in the overlap box,
+// subsampled on a voxel grid with cells of GridSize mm, or taken with Step
+// when GridSize is 0. The index is taken from the cache when the source file
+// was already indexed the same way, and pReused is set. Otherwise it is built
+// with the normals of the source, added to the cache, and its build time is
+// added to the outcome.
+//--------------------------------------------------------------------------
+std::shared_ptr<const CNearestNeighborIndex> GetSourceIndex(MIL_ID MilSystem, MIL_INT NeighborSearch,
+                                                            const SCloudView& SourceView, MIL_DOUBLE GridSize,
+                                                            MIL_INT Step, CReferenceIndexCache* pIndexCache,
+                                                            const SCloudPair& Pair, bool* pReused,
+                                                            SRegistrationOutcome* pOutcome)
+   {
+   MIL_TEXT_CHAR IndexDescription[128];
+   MosSprintf(IndexDescription, 128, MIL_TEXT("%s %g, %s %g"),
+              GridSize > 0.0 ? MIL_TEXT("grid") : MIL_TEXT("step"),
+              GridSize > 0.0 ? GridSize : (MIL_DOUBLE)Step,
+              NEIGHBOR_SEARCH_NAMES[NeighborSearch],
+              NeighborSearch == eSearchHashGrid ? HASH_GRID_CELL_SIZE : 0.0);
+   const MIL_STRING IndexKey = MakeReferenceIndexKey(Pair.SourceFileName.c_str(), Pair.OverlapBox, IndexDescription);
+
+   std::shared_ptr<const CNearestNeighborIndex> Index = pIndexCache->Find(IndexKey);
+   *pReused = false;
+   if(Index)
+      {
+      *pReused = true;
+      return Index;
+      }
 
-   MosPrintf(MIL_TEXT("The 3D stitching between the two partial point clouds has been performed with \n")
-             MIL_TEXT("the help of the points within the expected common overlap regions.\n\n"));
+   MIL_DOUBLE IndexStartTime = 0.0;
+   MIL_DOUBLE IndexEndTime = 0.0;
+   MappTimer(M_TIMER_READ, &IndexStartTime);
+   MIL_UNIQUE_BUF_ID MilSubsampledSource;
+   SCloudView        IndexedView = SourceView;
+   if(GridSize > 0.0)
+      {
+      MilSubsampledSource = VoxelGridSubsample(MilSystem, SourceView, GridSize, eVoxelCentroid);
+      if(MilSubsampledSource != M_NULL)
+         GetCloudView(MilSubsampledSource, &IndexedView);
+      }
 
-   M3dregGetResult(MilRegistrationResult, eTarget, M_STATUS_REGISTRATION_ELEMENT, &RegistrationStatus);
+   // The hash grid is replaced by a kd-tree if the source is too large for its cells.
+   std::shared_ptr<CNearestNeighborIndex> NewIndex;
+   if(NeighborSearch == eSearchHashGrid)
+      {
+      std::shared_ptr<CHashGrid> HashGrid = std::make_shared<CHashGrid>();
+      if(HashGrid->Build(IndexedView, Step, HASH_GRID_CELL_SIZE))
+         NewIndex = HashGrid;
+      }
+   else if(NeighborSearch == eSearchOctree)
+      {
+      std::shared_ptr<COctree> Octree = std::make_shared<COctree>();
+      Octree->Build(IndexedView, Step);
+      NewIndex = Octree;
+      }
+   if(!NewIndex)
+      {
+      std::shared_ptr<CKdTree> KdTree = std::make_shared<CKdTree>();
+      KdTree->Build(IndexedView, Step);
+      NewIndex = KdTree;
+      }
+   NewIndex->AttachNormals(IndexedView);
+   Index = NewIndex;
+   pIndexCache->Add(IndexKey, Index);
+   MappTimer(M_TIMER_READ, &IndexEndTime);
+   pOutcome->IndexBuildTime += IndexEndTime - IndexStartTime;
+   return Index;
+   }
+
+//--------------------------------------------------------------------------
+// Registers the target point cloud of a pair on its source point cloud with
+// the native ICP. Both passes search the pairs in the spatial index of the
+// source in the overlap box, which is taken from the cache when the source
+// file was already indexed. The index holds the normals of the source for
+// the plane metrics. In the pyramid mode, the target in the overlap box is
+// registered through its pyramid instead, each level on the index of the
+// source subsampled on the same grid. The global pre-registration, when it is
+// found, replaces the first pass or starts the pyramid.
+//--------------------------------------------------------------------------
+void RegisterPointCloudsNative(MIL_ID MilSystem, MIL_INT NeighborSearch, MIL_INT Metric,
+                               CReferenceIndexCache* pIndexCache,
+                               SCloudPair* pPair, SRegistrationOutcome* pOutcome)
+   {
+   MIL_DOUBLE StartTime = 0.0;
+   MappTimer(M_TIMER_READ, &StartTime);
+   pOutcome->Status                  = M_NOT_INITIALIZED;
+   pOutcome->RmsError                = 0.0;
+   pOutcome->NbIterations            = 0;
+   pOutcome->NbApproximateIterations = 0;
+   pOutcome->Overlap                 = 0.0;
+   pOutcome->RequestedMetric         = Metric;
+   pOutcome->Metric                  = Metric;
+   pOutcome->IndexBuildTime          = 0.0;
+   pOutcome->IndexReused             = false;
+
+   SCloudView SourceView;
+   SCloudView TargetView[NB_CROP_BOX];
+   bool HasViews = GetCloudView(pPair->CroppedPointCloud[eOverlapBox][eSource], &SourceView);
+   for(MIL_INT b = 0; b < NB_CROP_BOX; b++)
+      HasViews = HasViews && GetCloudView(pPair->CroppedPointCloud[b][eTarget], &TargetView[b]);
+
+   // Subsample the target subsets like the source.
+   MIL_INT                        Step = DECIMATION_STEP;
+   MIL_UNIQUE_BUF_ID              MilSubsampledTarget[NB_CROP_BOX];
+   std::vector<MIL_UNIQUE_BUF_ID> MilTargetLevels;
+   std::vector<SCloudView>        TargetLevelViews((size_t)PYRAMID_NB_LEVELS);
+   if(HasViews && SUBSAMPLE_MODE == eSubsampleVoxelGrid)
+      {
+      Step = 1;
+      for(MIL_INT b = 0; b < NB_CROP_BOX; b++)
+         {
+         MilSubsampledTarget[b] = VoxelGridSubsample(MilSystem, TargetView[b], GRID_SIZE, eVoxelCentroid);
+         HasViews = HasViews && MilSubsampledTarget[b] != M_NULL && GetCloudView(MilSubsampledTarget[b], &TargetView[b]);
+         }
+      }
+   else if(HasViews && SUBSAMPLE_MODE == eSubsamplePyramid)
+      {
+      Step = 1;
+      HasViews = BuildVoxelPyramid(MilSystem, TargetView[eOverlapBox], GRID_SIZE, PYRAMID_NB_LEVELS, eVoxelCentroid,
+                                   &MilTargetLevels);
+      for(MIL_INT l = 0; HasViews && l < PYRAMID_NB_LEVELS; l++)
+         GetCloudView(MilTargetLevels[(size_t)l], &TargetLevelViews[(size_t)l]);
+      }
+
+   if(HasViews)
+      {
+      SIcpSettings Settings;
+      Settings.MaxIterations             = MAX_ITERATIONS;
+      Settings.RmsErrorRelativeThreshold = RMS_ERROR_RELATIVE_THRESHOLD;
+      Settings.Overlap                   = ESTIMATE_OVERLAP ? 0.0 : OVERLAP;
+      Settings.MinOverlap                = MIN_OVERLAP;
+      Settings.MaxPairDistance           = MAX_PAIR_DISTANCE;
+      Settings.DecimationStep            = Step;
+      Settings.NeighborError             = NEIGHBOR_SEARCH_ERROR;
+      Settings.Metric                    = Metric == eMetricGeneralized  ? eIcpGeneralized  :
+                                           Metric == eMetricPlaneToPlane ? eIcpPlaneToPlane :
+                                           Metric == eMetricPointToPlane ? eIcpPointToPlane : eIcpPointToPoint;
+      const MIL_DOUBLE FullModelOverlap = ESTIMATE_OVERLAP ? 0.0 : GetFullModelOverlap(MilSystem, pPair);
+      MIL_DOUBLE InitialMatrix[16] = { 1.0, 0.0, 0.0, 0.0,
+                                       0.0, 1.0, 0.0, 0.0,
+                                       0.0, 0.0, 1.0, 0.0,
+                                       0.0, 0.0, 0.0, 1.0 };
+      const bool HasGlobalPreregistration = PREREGISTRATION_MODE == ePreregistrationGlobal &&
+                                            FindGlobalPreregistration(MilSystem, *pPair, InitialMatrix);
+      SIcpResult Registration;
+      if(SUBSAMPLE_MODE == eSubsamplePyramid)
+         {
+         // Register the levels of the target in the overlap box from the coarsest, with
+         // the full model overlap.
+         std::vector< std::shared_ptr<const CNearestNeighborIndex> > LevelIndexes;
+         std::vector<const CNearestNeighborIndex*>                   References;
+         MIL_DOUBLE GridSize = GRID_SIZE;
+         pOutcome->IndexReused = true;
+         for(MIL_INT l = 0; l < PYRAMID_NB_LEVELS; l++, GridSize *= 2.0)
+            {
+            bool LevelReused = false;
+            LevelIndexes.push_back(GetSourceIndex(MilSystem, NeighborSearch, SourceView, GridSize, Step,
+                                                  pIndexCache, *pPair, &LevelReused, pOutcome));
+            References.push_back(LevelIndexes.back().get());
+            pOutcome->IndexReused = pOutcome->IndexReused && LevelReused;
+            }
+
+         std::vector<SIcpResult> LevelResults((size_t)PYRAMID_NB_LEVELS);
+         Settings.Overlap = FullModelOverlap;
+         RegisterIcpPyramid(&References[0], &TargetLevelViews[0], PYRAMID_NB_LEVELS, Settings, InitialMatrix, &LevelResults[0]);
+         MosPrintf(MIL_TEXT("..."));
+
+         Registration = LevelResults[0];
+         for(MIL_INT l = 0; l < PYRAMID_NB_LEVELS; l++)
+            {
+            pOutcome->NbIterations            += LevelResults[(size_t)l].NbIterations;
+            pOutcome->NbApproximateIterations += LevelResults[(size_t)l].NbApproximateIterations;
+            }
+         }
+      else if(HasGlobalPreregistration)
+         {
+         // Registration of the target in the overlap box from the global pre-registration,
+         // with the full model overlap.
+         std::shared_ptr<const CNearestNeighborIndex> Index =
+            GetSourceIndex(MilSystem, NeighborSearch, SourceView, SUBSAMPLE_MODE == eSubsampleVoxelGrid ? GRID_SIZE : 0.0,
+                           Step, pIndexCache, *pPair, &pOutcome->IndexReused, pOutcome);
+         Settings.Overlap = FullModelOverlap;
+         RegisterIcp(*Index, TargetView[eOverlapBox], Settings, InitialMatrix, &Registration);
+         MosPrintf(MIL_TEXT("..."));
+
+         pOutcome->NbIterations            = Registration.NbIterations;
+         pOutcome->NbApproximateIterations = Registration.NbApproximateIterations;
+         }
+      else
+         {
+         // Pre-registration with a given overlap, then registration of the target in the
+         // overlap box from the pre-registration, with the full model overlap.
+         std::shared_ptr<const CNearestNeighborIndex> Index =
+            GetSourceIndex(MilSystem, NeighborSearch, SourceView, SUBSAMPLE_MODE == eSubsampleVoxelGrid ? GRID_SIZE : 0.0,
+                           Step, pIndexCache, *pPair, &pOutcome->IndexReused, pOutcome);
+         SIcpResult Preregistration;
+         RegisterIcpTwoStages(*Index, TargetView[eUsedOverlapBox], TargetView[eOverlapBox], Settings, FullModelOverlap,
+                              InitialMatrix, &Preregistration, &Registration);
+         MosPrintf(MIL_TEXT("..."));
+
+         pOutcome->NbIterations = Preregistration.NbIterations +
+                                  (Preregistration.Status != eIcpNotEnoughPairs ? Registration.NbIterations : 0);
+         pOutcome->NbApproximateIterations = Preregistration.NbApproximateIterations +
+                                             (Preregistration.Status != eIcpNotEnoughPairs ? Registration.NbApproximateIterations : 0);
+         }
+
+      switch(Registration.Status)
+         {
+         case eIcpNotEnoughPairs:                   pOutcome->Status = M_NOT_ENOUGH_POINT_PAIRS; break;
+         case eIcpMaxIterationsReached:             pOutcome->Status = M_MAX_ITERATIONS_REACHED; break;
+         case eIcpRmsErrorRelativeThresholdReached: pOutcome->Status = M_RMS_ERROR_RELATIVE_THRESHOLD_REACHED; break;
+         }
+      pOutcome->RmsError  = Registration.RmsError;
+      pOutcome->Overlap   = Registration.Overlap;
+      pOutcome->Metric    = Registration.Metric == eIcpGeneralized  ? eMetricGeneralized  :
+                            Registration.Metric == eIcpPlaneToPlane ? eMetricPlaneToPlane :
+                            Registration.Metric == eIcpPointToPlane ? eMetricPointToPlane : eMetricPointToPoint;
+      pOutcome->MilMatrix = M3dgeoAlloc(MilSystem, M_TRANSFORMATION_MATRIX, M_DEFAULT, M_UNIQUE_ID);
+      M3dgeoMatrixPut(pOutcome->MilMatrix, M_DEFAULT, Registration.Matrix);
+      }
+
+   MIL_DOUBLE EndTime = 0.0;
+   MappTimer(M_TIMER_READ, &EndTime);
+   pOutcome->ComputationTime = EndTime - StartTime;
+   }
 
+//--------------------------------------------------------------------------
+// Prints the status of the registration.
+//--------------------------------------------------------------------------
+void PrintRegistrationStatus(const SRegistrationOutcome& Outcome)
+   {
    // Interpret the result status.
-   switch(RegistrationStatus)
+   switch(Outcome.Status)
       {
       case M_NOT_INITIALIZED:
          MosPrintf(MIL_TEXT("Registration failed: the registration result is not initialized.\n\n"));
@@ -289,71 +1277,91 @@ int MosMain()
       case M_MAX_ITERATIONS_REACHED:
          MosPrintf(MIL_TEXT("Registration reached the maximum number of iterations allowed (%d)\n")
                    MIL_TEXT("in %.2f ms. Resulting fixture may or may not be valid.\n\n"),
-                   MAX_ITERATIONS, ComputationTime * 1000);
+                   MAX_ITERATIONS, Outcome.ComputationTime * 1000);
          break;
 
       case M_RMS_ERROR_THRESHOLD_REACHED:
       case M_RMS_ERROR_RELATIVE_THRESHOLD_REACHED:
-         MIL_DOUBLE RegistrationRmsError;
-         M3dregGetResult(MilRegistrationResult, eTarget, M_RMS_ERROR , &RegistrationRmsError);
          MosPrintf(MIL_TEXT("The registration of the two partial point clouds\n")
                    MIL_TEXT("succeeded in %.2f ms with a final RMS error of %f mm.\n\n"),
-                   ComputationTime * 1000.0, RegistrationRmsError);
+                   Outcome.ComputationTime * 1000.0, Outcome.RmsError);
          break;
 
       default:
          MosPrintf(MIL_TEXT("Unknown registration status.\n\n"));
       }
 
-   //--------------------------------------------------------------------------
-   // Stitching
+   if(Outcome.Metric != Outcome.RequestedMetric)
+      MosPrintf(MIL_TEXT("The %s metric was used instead of the %s metric, for lack of normals.\n\n"),
+                METRIC_NAMES[Outcome.Metric], METRIC_NAMES[Outcome.RequestedMetric]);
+   else
+      MosPrintf(MIL_TEXT("The %s metric was used.\n\n"), METRIC_NAMES[Outcome.Metric]);
+
+   if(REGISTRATION_ENGINE == eEngineNative && Outcome.MilMatrix != M_NULL)
+      {
+      if(ESTIMATE_OVERLAP)
+         MosPrintf(MIL_TEXT("The estimated overlap kept %.1f %% of the target points.\n\n"), Outcome.Overlap);
+      if(Outcome.IndexReused)
+         MosPrintf(MIL_TEXT("The index of the reference was reused from a previous registration.\n\n"));
+      else
+         MosPrintf(MIL_TEXT("The index of the reference was built in %.2f ms.\n\n"), Outcome.IndexBuildTime * 1000.0);
+      }
+   }
+
+//--------------------------------------------------------------------------
+// Colors the two point clouds of a pair and merges them with the registration
+// result, or with the transformation of the native engine. Returns the
+// stitched point cloud.
+//--------------------------------------------------------------------------
+MIL_UNIQUE_BUF_ID StitchPointClouds(MIL_ID MilSystem, MIL_ID MilRegistrationResult,
+                                    const SRegistrationOutcome& Outcome, SCloudPair* pPair)
+   {
+   // Move and merge float copies of the quantized clouds; the transformed points
+   // could fall outside the quantized box of the target.
+   if(USE_QUANTIZED_STORAGE)
+      {
+      for(MIL_INT i = 0; i < NB_POINT_CLOUD; ++i)
+         {
+         SCloudView View;
+         if(GetCloudView(pPair->PointCloud[i], &View))
+            continue;
+         MIL_UNIQUE_BUF_ID MilDequantized = DequantizePointCloud(MilSystem, pPair->PointCloud[i], &View);
+         if(MilDequantized != M_NULL)
+            pPair->PointCloud[i] = std::move(MilDequantized);
+         }
+      }
 
    // Add color to the two clouds.
    for(MIL_INT i = 0; i < NB_POINT_CLOUD; ++i)
       {
-      M3ddispControl(MilDisplay[i], M_UPDATE, M_DISABLE);
-      MbufFreeComponent(MilPointCloud[i], M_COMPONENT_REFLECTANCE, M_DEFAULT);
-      MIL_INT SizeX = MbufInquireContainer(MilPointCloud[i], M_COMPONENT_RANGE, M_SIZE_X, M_NULL);
-      MIL_INT SizeY = MbufInquireContainer(MilPointCloud[i], M_COMPONENT_RANGE, M_SIZE_Y, M_NULL);
-      MIL_ID MilReflectance = MbufAllocComponent(MilPointCloud[i], 3, SizeX, SizeY, M_UNSIGNED + 8, M_IMAGE + M_PROC + M_DISP, M_COMPONENT_REFLECTANCE, M_NULL);//Colored reflectance
+      MIL_ID MilPointCloud = pPair->PointCloud[i];
+      if(MbufInquireContainer(MilPointCloud, M_COMPONENT_REFLECTANCE, M_COMPONENT_ID, M_NULL) != M_NULL)
+         MbufFreeComponent(MilPointCloud, M_COMPONENT_REFLECTANCE, M_DEFAULT);
+      MIL_INT SizeX = MbufInquireContainer(MilPointCloud, M_COMPONENT_RANGE, M_SIZE_X, M_NULL);
+      MIL_INT SizeY = MbufInquireContainer(MilPointCloud, M_COMPONENT_RANGE, M_SIZE_Y, M_NULL);
+      MIL_ID MilReflectance = MbufAllocComponent(MilPointCloud, 3, SizeX, SizeY, M_UNSIGNED + 8, M_IMAGE + M_PROC + M_DISP, M_COMPONENT_REFLECTANCE, M_NULL);//Colored reflectance
 
       MbufClear(MilReflectance, (i == 0) ? M_RGB888(135, 165, 235) : M_RGB888(75, 125, 215));
-      M3ddispControl(MilDisplay[i], M_UPDATE, M_ENABLE);
       }
 
-   M3dregMerge(MilRegistrationResult, MilPointCloud, 2, MilPointCloud[eStitched], M_NULL, M_DEFAULT);
-
-   // Display stitched point cloud.
-   M3ddispSelect(MilDisplay[eStitched], MilPointCloud[eStitched], M_SELECT, M_DEFAULT);
-
-   // Draw a 3D box in the stitched point cloud to show the original overlap regions.
-   M3ddispInquire(MilDisplay[eStitched], M_3D_GRAPHIC_LIST_ID, &MilGraphicList);
-   MIL_INT64 MilBoxGraphics =
-      M3dgraBox(MilGraphicList,
-                M_ROOT_NODE, M_BOTH_CORNERS,
-                -0.5 * EXTRACTION_BOX_SIZE_X, -0.5 * EXTRACTION_BOX_SIZE_Y * BOX_USED_OVERLAP,  0.5 * EXTRACTION_BOX_SIZE_Z,
-                 0.5* EXTRACTION_BOX_SIZE_X ,  0.5 * EXTRACTION_BOX_SIZE_Y * BOX_USED_OVERLAP, -0.5 * EXTRACTION_BOX_SIZE_Z,
-               M_DEFAULT, M_DEFAULT);
-   M3dgraControl(MilGraphicList, MilBoxGraphics, M_COLOR, M_COLOR_WHITE);
-   M3dgraControl(MilGraphicList, MilBoxGraphics, M_APPEARANCE, M_WIREFRAME);
-
-   MosPrintf(MIL_TEXT("The two point clouds have been stitched into a single point cloud.\n")
-             MIL_TEXT("The resulting stitched point cloud is displayed.\n")
-             MIL_TEXT("A white rectangular box show the transformed overlap region.\n\n"));
-   MosPrintf(MIL_TEXT("Press <Enter> to end.\n"));
-   MosGetch();
-
-   //--------------------------------------------------------------------------
-   // Free MIL objects.
-   M3dregFree(MilRegistrationContext);
-   M3dregFree(MilRegistrationResult);
+   MIL_UNIQUE_BUF_ID MilStitchedPointCloud = MbufAllocContainer(MilSystem, M_PROC+M_DISP, M_DEFAULT, M_UNIQUE_ID);
+   if(Outcome.MilMatrix != M_NULL)
+      {
+      M3dimMatrixTransform(pPair->PointCloud[eTarget], pPair->PointCloud[eTarget], Outcome.MilMatrix, M_DEFAULT);
+      MIL_ID MilPointClouds[NB_POINT_CLOUD] = { pPair->PointCloud[eSource], pPair->PointCloud[eTarget] };
+      M3dimMerge(MilPointClouds, MilStitchedPointCloud, NB_POINT_CLOUD, M_NULL, M_DEFAULT);
+      }
+   else if(MilRegistrationResult != M_NULL)
+      M3dregMerge(MilRegistrationResult, pPair->PointCloud, NB_POINT_CLOUD, MilStitchedPointCloud, M_NULL, M_DEFAULT);
 
-   for(MIL_INT d = 0; d < NB_DISPLAY; d++)
+   // Keep the stitched point cloud with quantized coordinates.
+   if(USE_QUANTIZED_STORAGE)
       {
-      if(MilDisplay[d])
-         { M3ddispFree(MilDisplay[d]); }
+      MIL_UNIQUE_BUF_ID MilQuantized = QuantizePointCloud(MilSystem, MilStitchedPointCloud, M_NULL, QUANTIZATION_MAX_ERROR);
+      if(MilQuantized != M_NULL)
+         MilStitchedPointCloud = std::move(MilQuantized);
       }
-   return 0;
+   return MilStitchedPointCloud;
    }
 
 //--------------------------------------------------------------------------
@@ -395,3 +1403,46 @@ MIL_ID Alloc3dDisplayId(MIL_ID MilSystem)
 
    return MilDisplay3D;
    }
+
+//--------------------------------------------------------------------------
+// Saves the stitched point cloud as a binary PLY file, a cloud cache and a
+// cloud archive named after the base name.
+//--------------------------------------------------------------------------
+void SaveStitchedPointCloud(MIL_ID MilPointCloud, MIL_CONST_TEXT_PTR BaseName)
+   {
+   MIL_DOUBLE StartTime = 0.0;
+   MIL_DOUBLE EndTime = 0.0;
+   MappTimer(M_TIMER_READ, &StartTime);
+
+   const MIL_STRING PlyFileName     = MIL_STRING(BaseName) + MIL_TEXT(".ply");
+   const MIL_STRING CacheFileName   = GetCloudCacheFileName(PlyFileName.c_str());
+   const MIL_STRING ArchiveFileName = MIL_STRING(BaseName) + MIL_TEXT(".s3dz");
+   bool Saved = SavePlyPointCloud(PlyFileName.c_str(), MilPointCloud);
+
+   // The cache and the archive are written from float coordinates; they are not
+   // written for a quantized cloud. The cache holds the signature of the PLY file
+   // so that it is restored in place of it.
+   bool        CopiesSaved = false;
+   SCloudView  View;
+   SCloudStats Stats;
+   MIL_INT64   PlySize = 0;
+   MIL_INT64   PlyTime = 0;
+   if(Saved && GetCloudView(MilPointCloud, &View) && GetFileSignature(PlyFileName.c_str(), &PlySize, &PlyTime))
+      {
+      ComputeCloudStats(View, &Stats);
+      const MIL_UINT32 Flags = (View.Intensity ? eCacheIntensity : 0) | (View.NormalX ? eCacheNormals : 0);
+      CopiesSaved = SaveCloudCache(CacheFileName.c_str(), View, Stats, Flags, 0, M_NULL, PlySize, PlyTime) &&
+                    SaveCloudArchive(ArchiveFileName.c_str(), View, Stats, ARCHIVE_DEFAULT_PRECISION);
+      }
+
+   MappTimer(M_TIMER_READ, &EndTime);
+   if(Saved && CopiesSaved)
+      MosPrintf(MIL_TEXT("The stitched point cloud has been saved in %s, %s and %s in %.2f ms.\n\n"),
+                PlyFileName.c_str(), CacheFileName.c_str(), ArchiveFileName.c_str(),
+                (EndTime - StartTime) * 1000.0);
+   else if(Saved)
+      MosPrintf(MIL_TEXT("The stitched point cloud has been saved in %s in %.2f ms.\n\n"),
+                PlyFileName.c_str(), (EndTime - StartTime) * 1000.0);
+   else
+      MosPrintf(MIL_TEXT("The stitched point cloud could not be saved.\n\n"));
+   }